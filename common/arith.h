@@ -0,0 +1,57 @@
+#ifndef LUMA_ARITH_H
+#define LUMA_ARITH_H
+
+#include <stdint.h>
+
+/*
+ * Integer semantics of the VM, shared with the compiler's constant folder so
+ * folded expressions give exactly the runtime result. Arithmetic wraps around
+ * (two's complement), INT32_MIN / -1 wraps to INT32_MIN and its remainder is 0.
+ * Division by zero is handled by the caller. Shift counts are taken mod 32.
+ */
+static inline int32_t arith_add(int32_t a, int32_t b) { return (int32_t) ((uint32_t) a + (uint32_t) b); }
+static inline int32_t arith_sub(int32_t a, int32_t b) { return (int32_t) ((uint32_t) a - (uint32_t) b); }
+static inline int32_t arith_mul(int32_t a, int32_t b) { return (int32_t) ((uint32_t) a * (uint32_t) b); }
+
+static inline int32_t arith_div(int32_t a, int32_t b)
+{
+    if (b == -1) return arith_sub(0, a);
+    return a / b;
+}
+
+static inline int32_t arith_mod(int32_t a, int32_t b)
+{
+    if (b == -1) return 0;
+    return a % b;
+}
+
+static inline int32_t arith_shl(int32_t a, int32_t n) { return (int32_t) ((uint32_t) a << (n & 31)); }
+static inline int32_t arith_shr(int32_t a, int32_t n) { return (int32_t) ((uint32_t) a >> (n & 31)); }
+
+// rounds toward minus infinity, unlike DIV by a power of two
+static inline int32_t arith_sar(int32_t a, int32_t n)
+{
+    n &= 31;
+    return a < 0 ? ~(int32_t) ((uint32_t) ~a >> n) : (int32_t) ((uint32_t) a >> n);
+}
+
+/*
+ * Q16.16 fixed point: a word holds x * 65536. The product and the shifted
+ * dividend are taken in 64 bits so they don't overflow before the result
+ * is scaled back, which then wraps like the integer operations. MULQ
+ * rounds toward minus infinity, DIVQ toward zero like DIV.
+ */
+#define ARITH_Q_ONE 65536
+
+static inline int32_t arith_mulq(int32_t a, int32_t b)
+{
+    uint64_t p = (uint64_t) ((int64_t) a * b);
+    return (int32_t) (uint32_t) (p >> 16);
+}
+
+static inline int32_t arith_divq(int32_t a, int32_t b)
+{
+    return (int32_t) (uint32_t) (uint64_t) ((int64_t) a * ARITH_Q_ONE / b);
+}
+
+#endif
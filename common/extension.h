@@ -0,0 +1,88 @@
+#ifndef LUMA_EXTENSION_DESC_H
+#define LUMA_EXTENSION_DESC_H
+
+#include <stdint.h>
+
+/*
+ * Extension descriptors shared by the compiler, the assembler and the VM,
+ * generated from extensions.def.
+ * Arguments are passed in R0..R3 (further arguments on the stack),
+ * a return value is passed back in R0.
+ */
+
+/* ------------ IDs and subops ------------ */
+// EXT_ID_NEOPIXEL, plus EXT_ID_OF_neopixel for use from other X-macros
+enum
+{
+#define EXT(NAME, name, id) EXT_ID_##NAME = id, EXT_ID_OF_##name = id,
+#include "extensions.def"
+};
+
+// EXT_FN_neopixel_show = 0x02, ...
+enum
+{
+#define EXT_FN(name, fn, subop, argc, ret, effect) EXT_FN_##name##_##fn = subop,
+#include "extensions.def"
+};
+
+// position of every function in EXT_FUNCS, EXT_FIRST_x / EXT_LAST_x delimit an extension
+enum
+{
+#define EXT(NAME, name, id) EXT_FIRST_##name, EXT_FIRST_PREV_##name = EXT_FIRST_##name - 1,
+#define EXT_FN(name, fn, subop, argc, ret, effect) EXT_IDX_##name##_##fn,
+#define EXT_END(name) EXT_LAST_##name, EXT_LAST_PREV_##name = EXT_LAST_##name - 1,
+#include "extensions.def"
+    EXT_FUNC_TOTAL
+};
+
+// what a call may do besides returning a value, see extensions.def
+typedef enum
+{
+    EXT_EFFECT_PURE,
+    EXT_EFFECT_READS_SENSOR,
+    EXT_EFFECT_WRITES_FRAMEBUFFER,
+} ExtEffect;
+
+/* ------------ Descriptor types ------------ */
+typedef struct
+{
+    const char *name;   // function name as used in LumaLang (ext.name(...))
+    uint8_t ext_id;
+    uint8_t subop;
+    uint8_t arg_count;
+    uint8_t has_ret;
+    uint8_t effect;     // ExtEffect
+} ExtFuncDesc;
+
+typedef struct
+{
+    const char *name;   // name used in "require <name>;"
+    uint8_t id;
+    uint8_t func_count;
+    const ExtFuncDesc *funcs;
+} ExtDesc;
+
+/* ------------ Standard extensions ------------ */
+static const ExtFuncDesc EXT_FUNCS[] = {
+#define EXT_FN(name, fn, subop, argc, ret, effect) {#fn, EXT_ID_OF_##name, subop, argc, ret, EXT_EFFECT_##effect},
+#include "extensions.def"
+};
+
+static const ExtDesc EXT_DESCS[] = {
+#define EXT(NAME, name, id) {#name, id, EXT_LAST_##name - EXT_FIRST_##name, EXT_FUNCS + EXT_FIRST_##name},
+#include "extensions.def"
+};
+
+#define EXT_DESC_COUNT (sizeof(EXT_DESCS) / sizeof(EXT_DESCS[0]))
+
+static inline const ExtDesc *ext_desc_find(uint8_t id)
+{
+    for (unsigned i = 0; i < EXT_DESC_COUNT; i++)
+    {
+        if (EXT_DESCS[i].id == id)
+            return &EXT_DESCS[i];
+    }
+    return 0;
+}
+
+#endif
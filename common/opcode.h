@@ -11,6 +11,7 @@ enum OpCode
     OP_PUSH = 0x05,
     OP_POP = 0x06,
     OP_LDC = 0x07,
+    OP_LDCX = 0x08,
 
     OP_ADD = 0x10,
     OP_SUB = 0x11,
@@ -24,6 +25,9 @@ enum OpCode
     OP_OR = 0x19,
     OP_XOR = 0x1A,
     OP_NOT = 0x1B,
+    OP_SHL = 0x1C,
+    OP_SHR = 0x1D,
+    OP_SAR = 0x1E,
 
     OP_EQ = 0x20,
     OP_NEQ = 0x21,
@@ -41,14 +45,20 @@ enum OpCode
     OP_CALLA = 0x36,
     OP_CALLR = 0x37,
     OP_RET = 0x38,
+    OP_JEQA = 0x39,
+    OP_JNEA = 0x3A,
+    OP_JLTA = 0x3B,
+    OP_JGEA = 0x3C,
+    OP_DJNZ = 0x3D,
+
+    OP_MULQ = 0x40,
+    OP_DIVQ = 0x41,
 
     OP_EXT = 0xE0,
 
-    OP_D_SRGB = 0xD0,
-    OP_D_FRGB = 0xD1,
-    OP_D_SHOW = 0xD2,
-    OP_D_CLR = 0xD3,
-    OP_D_NLED = 0xD4,
+    // OP_D_SRGB, OP_D_FRGB, ... one byte shortcuts for hot extension functions
+#define EXT_SHORTCUT(name, fn, opcode, MNEMONIC) OP_D_##MNEMONIC = opcode,
+#include "extensions.def"
 
     OP_DELAY = 0xFD,
     OP_HALT = 0xFF,
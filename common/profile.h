@@ -0,0 +1,31 @@
+#ifndef LUMA_PROFILE_H
+#define LUMA_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Profiles of LumaRun --profile, read by LumaC --profile-use. A text file,
+ * the first line names the program by the hash of its whole .lbc file, then
+ * one line per conditional jump or call that ran, by code offset:
+ *
+ *   lumaprof 1 <hash, 16 hex digits>
+ *   <offset> <taken> <not taken>
+ *
+ * A call only counts as taken.
+ */
+#define LUMA_PROFILE_MAGIC "lumaprof"
+#define LUMA_PROFILE_VERSION 1
+
+// FNV-1a, 64 bit
+static inline uint64_t luma_program_hash(const uint8_t *data, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ws281x.h"
+
+#define BENCH_LEDS 1000
+#define BENCH_FRAMES 2000
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// per-bit reference encoder, used to check the tables and as the baseline
+static size_t naive_encode(const WsEncoder *enc, uint8_t *out, const uint8_t *rgb, uint16_t count)
+{
+    size_t bit = 0;
+    const unsigned symbol = (unsigned) enc->symbol;
+    memset(out, 0, enc->cap);
+    for (uint16_t i = 0; i < count; i++, rgb += 3) {
+        uint8_t c[4] = {rgb[enc->map[0]], rgb[enc->map[1]], rgb[enc->map[2]], 0};
+        if (enc->channels == 4) {
+            uint8_t w = c[0] < c[1] ? c[0] : c[1];
+            if (c[2] < w) w = c[2];
+            c[0] -= w; c[1] -= w; c[2] -= w; c[3] = w;
+        }
+        for (uint8_t ch = 0; ch < enc->channels; ch++) {
+            for (int b = 7; b >= 0; b--) {
+                unsigned one = (c[ch] >> b) & 1;
+                for (unsigned s = 0; s < symbol; s++) {
+                    unsigned high = s == 0 || (one && s + 1 < symbol);
+                    if (high) out[bit / 8] |= (uint8_t) (0x80 >> (bit % 8));
+                    bit++;
+                }
+            }
+        }
+    }
+    return bit / 8 + enc->reset_bytes;
+}
+
+static int run(const char *name, WsOrder order, WsSymbol symbol, const uint8_t *frame)
+{
+    WsEncoder enc;
+    if (!ws_init(&enc, order, symbol, symbol == WS_SYMBOL_3BIT ? 2400000 : 3200000, 300, BENCH_LEDS)) {
+        fprintf(stderr, "ws_init failed\n");
+        return 1;
+    }
+    uint8_t *ref = malloc(enc.cap);
+    size_t refLen = naive_encode(&enc, ref, frame, BENCH_LEDS);
+    size_t len = ws_encode(&enc, frame, BENCH_LEDS);
+    if (len != refLen || memcmp(ref, enc.buf, len) != 0) {
+        fprintf(stderr, "%s: table encoder differs from reference\n", name);
+        return 1;
+    }
+
+    double t0 = now_s();
+    for (int f = 0; f < BENCH_FRAMES / 10; f++)
+        naive_encode(&enc, ref, frame, BENCH_LEDS);
+    double naive = (BENCH_FRAMES / 10) * (double) BENCH_LEDS / (now_s() - t0);
+
+    volatile uint8_t sink = 0;
+    t0 = now_s();
+    for (int f = 0; f < BENCH_FRAMES; f++) {
+        ws_encode(&enc, frame, BENCH_LEDS);
+        sink ^= enc.buf[f % len];
+    }
+    double table = BENCH_FRAMES * (double) BENCH_LEDS / (now_s() - t0);
+
+    printf("%-10s %8zu bytes/frame  table %8.2f MLED/s  per-bit %7.2f MLED/s  (x%.1f)\n",
+           name, len, table / 1e6, naive / 1e6, table / naive);
+    free(ref);
+    ws_free(&enc);
+    return 0;
+}
+
+int main(void)
+{
+    uint8_t frame[BENCH_LEDS * 3];
+    srand(1);
+    for (size_t i = 0; i < sizeof(frame); i++)
+        frame[i] = (uint8_t) rand();
+
+    int err = 0;
+    err |= run("GRB/3bit", WS_ORDER_GRB, WS_SYMBOL_3BIT, frame);
+    err |= run("GRB/4bit", WS_ORDER_GRB, WS_SYMBOL_4BIT, frame);
+    err |= run("GRBW/3bit", WS_ORDER_GRBW, WS_SYMBOL_3BIT, frame);
+    err |= run("RGBW/4bit", WS_ORDER_RGBW, WS_SYMBOL_4BIT, frame);
+    return err;
+}
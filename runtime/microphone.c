@@ -0,0 +1,395 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "microphone.h"
+#include "spsc_ring.h"
+#include "vm.h"
+#include "../common/extension.h"
+
+#define MIC_CHUNK_FRAMES 256
+#define MIC_PIPE_POLL_MS 100    // longest the capture thread waits for a pipe before checking `running`
+#define MIC_PI 3.14159265358979323846f
+
+/* ------------ Capture state (capture thread writes, VM reads) ------------ */
+static SpscRing ring;
+static int16_t ring_buf[MIC_RING_SAMPLES];
+static _Atomic uint32_t dropped;
+
+static FILE *src;
+static bool src_is_wav;
+static long wav_data_start;
+static uint16_t wav_channels;
+static uint32_t sample_rate;
+static int pipe_odd_byte = -1;     // first half of a sample split across two reads, -1 if none
+static pthread_t capture_thread;
+static _Atomic bool running;
+
+/* ------------ Analysis state (VM side only) ------------ */
+static int16_t window[MIC_FFT_SIZE];        // last MIC_FFT_SIZE samples, oldest first
+static float hann[MIC_FFT_SIZE];
+static float tw_re[MIC_FFT_SIZE / 2], tw_im[MIC_FFT_SIZE / 2];
+static uint16_t bitrev[MIC_FFT_SIZE];
+static uint16_t band_edge[MIC_BANDS + 1];   // first FFT bin of each band
+static bool tables_ready;
+
+static uint32_t analysed_frame = UINT32_MAX;
+static word_t level, peak;
+static word_t bands[MIC_BANDS];
+
+static uint32_t read_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint16_t read_le16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+static void mic_init_tables(void)
+{
+    if (tables_ready)
+        return;
+    unsigned bits = 0;
+    while ((1u << bits) < MIC_FFT_SIZE)
+        bits++;
+    for (unsigned i = 0; i < MIC_FFT_SIZE; i++) {
+        unsigned r = 0;
+        for (unsigned b = 0; b < bits; b++)
+            if (i & (1u << b)) r |= 1u << (bits - 1 - b);
+        bitrev[i] = (uint16_t) r;
+        hann[i] = 0.5f - 0.5f * cosf(2.0f * MIC_PI * i / (MIC_FFT_SIZE - 1));
+    }
+    for (unsigned i = 0; i < MIC_FFT_SIZE / 2; i++) {
+        tw_re[i] = cosf(2.0f * MIC_PI * i / MIC_FFT_SIZE);
+        tw_im[i] = -sinf(2.0f * MIC_PI * i / MIC_FFT_SIZE);
+    }
+    // log-spaced band edges over bins 1..N/2, each band at least one bin wide
+    const float top = MIC_FFT_SIZE / 2;
+    band_edge[0] = 1;
+    for (unsigned b = 1; b <= MIC_BANDS; b++) {
+        uint16_t e = (uint16_t) lroundf(powf(top, (float) b / MIC_BANDS));
+        if (e <= band_edge[b - 1]) e = band_edge[b - 1] + 1;
+        band_edge[b] = e;
+    }
+    band_edge[MIC_BANDS] = MIC_FFT_SIZE / 2 + 1;
+    tables_ready = true;
+}
+
+/* ------------ Capture thread ------------ */
+static bool wav_parse_header(void)
+{
+    uint8_t hdr[12];
+    if (fread(hdr, 1, 12, src) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4))
+        return false;
+
+    bool have_fmt = false;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, 8, src) == 8) {
+        uint32_t len = read_le32(chunk + 4);
+        if (!memcmp(chunk, "fmt ", 4)) {
+            uint8_t fmt[16];
+            if (len < 16 || fread(fmt, 1, 16, src) != 16)
+                return false;
+            if (read_le16(fmt) != 1 || read_le16(fmt + 14) != 16)
+                return false;   // 16-bit PCM only
+            wav_channels = read_le16(fmt + 2);
+            sample_rate = read_le32(fmt + 4);
+            have_fmt = wav_channels > 0;
+            fseek(src, (long) (len - 16 + (len & 1)), SEEK_CUR);
+        } else if (!memcmp(chunk, "data", 4)) {
+            wav_data_start = ftell(src);
+            return have_fmt;
+        } else {
+            fseek(src, (long) (len + (len & 1)), SEEK_CUR);
+        }
+    }
+    return false;
+}
+
+static void capture_push(const int16_t *samples, uint32_t n)
+{
+    uint32_t avail = spsc_write_avail(&ring);
+    if (n > avail) {
+        atomic_fetch_add_explicit(&dropped, n - avail, memory_order_relaxed);
+        n = avail;
+    }
+    uint32_t idx = spsc_write_index(&ring);
+    uint32_t first = MIC_RING_SAMPLES - idx;
+    if (first > n) first = n;
+    memcpy(&ring_buf[idx], samples, first * sizeof(int16_t));
+    memcpy(&ring_buf[0], samples + first, (n - first) * sizeof(int16_t));
+    spsc_publish(&ring, n);
+}
+
+// Up to `max` samples from the pipe. Waits at most MIC_PIPE_POLL_MS for data, so
+// the thread notices mic_close() even when the writer goes quiet; read(2) on the
+// descriptor instead of fread keeps stdio's buffer from hiding data from poll.
+static size_t pipe_read(int16_t *out, size_t max, bool *closed)
+{
+    struct pollfd pfd = { .fd = fileno(src), .events = POLLIN };
+    int ready = poll(&pfd, 1, MIC_PIPE_POLL_MS);
+    if (ready <= 0) {
+        *closed = ready < 0 && errno != EINTR;
+        return 0;
+    }
+
+    uint8_t *bytes = (uint8_t *) out;
+    size_t have = 0;
+    if (pipe_odd_byte >= 0)
+        bytes[have++] = (uint8_t) pipe_odd_byte;
+    ssize_t n = read(pfd.fd, bytes + have, max * sizeof(int16_t) - have);
+    if (n <= 0) {
+        *closed = n == 0 || (errno != EINTR && errno != EAGAIN);
+        return 0;
+    }
+    have += (size_t) n;
+    pipe_odd_byte = (have & 1) ? bytes[have - 1] : -1;
+    return have / sizeof(int16_t);
+}
+
+static void *capture_main(void *arg)
+{
+    (void)arg;
+    int16_t raw[MIC_CHUNK_FRAMES * 8];
+    int16_t mono[MIC_CHUNK_FRAMES];
+    uint16_t channels = src_is_wav ? wav_channels : 1;
+    if (channels > 8) channels = 8;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    const long chunk_ns = (long) (1000000000.0 * MIC_CHUNK_FRAMES / sample_rate);
+
+    while (atomic_load_explicit(&running, memory_order_relaxed)) {
+        size_t got;
+        if (!src_is_wav) {
+            bool closed = false;
+            got = pipe_read(raw, MIC_CHUNK_FRAMES, &closed);
+            if (closed)
+                break;
+            if (got == 0)
+                continue;   // nothing yet
+        } else {
+            got = fread(raw, sizeof(int16_t) * channels, MIC_CHUNK_FRAMES, src);
+            if (got == 0) {
+                if (fseek(src, wav_data_start, SEEK_SET) != 0)
+                    break;
+                continue;   // loop the file
+            }
+        }
+        for (size_t i = 0; i < got; i++) {
+            int32_t sum = 0;
+            for (uint16_t c = 0; c < channels; c++)
+                sum += raw[i * channels + c];
+            mono[i] = (int16_t) (sum / channels);
+        }
+        capture_push(mono, (uint32_t) got);
+
+        if (src_is_wav) {
+            // play the file back in real time
+            next.tv_nsec += chunk_ns;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void mic_release_src(void)
+{
+    if (src != stdin)
+        fclose(src);
+    src = NULL;
+}
+
+static bool mic_start(void)
+{
+    mic_init_tables();
+    spsc_init(&ring, MIC_RING_SAMPLES);
+    atomic_store(&dropped, 0);
+    atomic_store(&running, true);
+    if (pthread_create(&capture_thread, NULL, capture_main, NULL) != 0) {
+        atomic_store(&running, false);
+        mic_release_src();
+        return false;
+    }
+    return true;
+}
+
+bool mic_open_wav(const char *path)
+{
+    mic_close();
+    src = fopen(path, "rb");
+    if (!src)
+        return false;
+    src_is_wav = true;
+    if (!wav_parse_header() || sample_rate == 0) {
+        mic_release_src();
+        return false;
+    }
+    return mic_start();
+}
+
+bool mic_open_pipe(const char *path, uint32_t rate)
+{
+    mic_close();
+    if (rate == 0)
+        return false;
+    src = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!src)
+        return false;
+    src_is_wav = false;
+    sample_rate = rate;
+    pipe_odd_byte = -1;
+    return mic_start();
+}
+
+void mic_close(void)
+{
+    if (!src)
+        return;
+    atomic_store(&running, false);
+    // the pipe reader polls with a timeout, this returns within MIC_PIPE_POLL_MS
+    pthread_join(capture_thread, NULL);
+    mic_release_src();
+}
+
+/* ------------ Per-frame analysis ------------ */
+static void fft(float *re, float *im)
+{
+    for (unsigned i = 0; i < MIC_FFT_SIZE; i++) {
+        unsigned j = bitrev[i];
+        if (j > i) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (unsigned len = 2; len <= MIC_FFT_SIZE; len <<= 1) {
+        unsigned half = len >> 1, step = MIC_FFT_SIZE / len;
+        for (unsigned i = 0; i < MIC_FFT_SIZE; i += len) {
+            for (unsigned k = 0; k < half; k++) {
+                float wr = tw_re[k * step], wi = tw_im[k * step];
+                float xr = re[i + k + half] * wr - im[i + k + half] * wi;
+                float xi = re[i + k + half] * wi + im[i + k + half] * wr;
+                re[i + k + half] = re[i + k] - xr;
+                im[i + k + half] = im[i + k] - xi;
+                re[i + k] += xr;
+                im[i + k] += xi;
+            }
+        }
+    }
+}
+
+static word_t to_byte(float v)
+{
+    if (v <= 0.0f) return 0;
+    if (v >= 255.0f) return 255;
+    return (word_t) v;
+}
+
+static void mic_analyse(void)
+{
+    // slide the newest samples into the window
+    uint32_t n = spsc_read_avail(&ring);
+    if (n > MIC_FFT_SIZE) {
+        spsc_consume(&ring, n - MIC_FFT_SIZE);
+        n = MIC_FFT_SIZE;
+    }
+    if (n > 0) {
+        memmove(window, window + n, (MIC_FFT_SIZE - n) * sizeof(int16_t));
+        uint32_t idx = spsc_read_index(&ring);
+        for (uint32_t i = 0; i < n; i++)
+            window[MIC_FFT_SIZE - n + i] = ring_buf[(idx + i) & (MIC_RING_SAMPLES - 1)];
+        spsc_consume(&ring, n);
+    }
+
+    float re[MIC_FFT_SIZE], im[MIC_FFT_SIZE];
+    float sq = 0.0f;
+    int32_t pk = 0;
+    for (unsigned i = 0; i < MIC_FFT_SIZE; i++) {
+        int32_t s = window[i];
+        sq += (float) s * s;
+        if (s < 0) s = -s;
+        if (s > pk) pk = s;
+        re[i] = window[i] * hann[i] / 32768.0f;
+        im[i] = 0.0f;
+    }
+    level = to_byte(sqrtf(sq / MIC_FFT_SIZE) / 32768.0f * 255.0f);
+    peak = to_byte(pk / 32768.0f * 255.0f);
+
+    fft(re, im);
+    // a full-scale sine peaks at |X| = N/4 with the Hann window
+    const float ref = (MIC_FFT_SIZE / 4.0f) * (MIC_FFT_SIZE / 4.0f);
+    for (unsigned b = 0; b < MIC_BANDS; b++) {
+        float p = 0.0f;
+        for (unsigned k = band_edge[b]; k < band_edge[b + 1]; k++)
+            p += re[k] * re[k] + im[k] * im[k];
+        float db = p > 0.0f ? 10.0f * log10f(p / ref) : -MIC_BAND_RANGE_DB;
+        bands[b] = to_byte((db + MIC_BAND_RANGE_DB) * 255.0f / MIC_BAND_RANGE_DB);
+    }
+}
+
+// analysis runs at most once per frame, every further read is a cached load
+static inline void mic_update(VM *vm)
+{
+    if (analysed_frame != vm->frame) {
+        analysed_frame = vm->frame;
+        mic_analyse();
+    }
+}
+
+// ExtConfigFn, runs before every load of a program that requires the mic. The
+// new program's frames count from 0 again, so the last analysis is dropped
+static bool mic_config(const uint8_t *data, uint8_t len)
+{
+    (void)data;
+    analysed_frame = UINT32_MAX;
+    return len == 0;
+}
+
+/* ------------ Natives ------------ */
+static word_t mic_read(VM *vm, const word_t *args)
+{
+    (void)args;
+    mic_update(vm);
+    return level;
+}
+
+static word_t mic_peak(VM *vm, const word_t *args)
+{
+    (void)args;
+    mic_update(vm);
+    return peak;
+}
+
+static word_t mic_band(VM *vm, const word_t *args)
+{
+    mic_update(vm);
+    if (args[0] < 0 || args[0] >= MIC_BANDS)
+        return 0;
+    return bands[args[0]];
+}
+
+static word_t mic_band_count(VM *vm, const word_t *args)
+{
+    (void)vm;
+    (void)args;
+    return MIC_BANDS;
+}
+
+static const ExtNativeFn mic_natives[] = {
+    [EXT_FN_microphone_read] = mic_read,    // RMS level, same as level
+    [EXT_FN_microphone_level] = mic_read,
+    [EXT_FN_microphone_peak] = mic_peak,
+    [EXT_FN_microphone_band] = mic_band,
+    [EXT_FN_microphone_band_count] = mic_band_count,
+};
+
+bool mic_register(void)
+{
+    mic_init_tables();
+    return vm_register_ext(EXT_ID_MIC, mic_natives, sizeof(mic_natives) / sizeof(mic_natives[0]), mic_config);
+}
@@ -0,0 +1,35 @@
+#ifndef LUMA_MICROPHONE_H
+#define LUMA_MICROPHONE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ------------ Configuration ------------ */
+#define MIC_RING_SAMPLES 8192   // capture ring size (power of two)
+#define MIC_FFT_SIZE 256        // analysis window (power of two)
+#define MIC_BANDS 8             // log-spaced FFT bands
+#define MIC_BAND_RANGE_DB 60    // dynamic range mapped onto 0..255
+
+/*
+ * Capture sources. The capture thread writes mono 16-bit samples into a
+ * lock-free SPSC ring, the VM side analyses them once per frame (SHOW).
+ * Live audio comes in through mic_open_pipe: a platform's ADC or I2S driver
+ * (or `arecord -f S16_LE -c 1`) writes raw samples to a pipe or FIFO, which
+ * is the supported interface for injecting samples.
+ */
+bool mic_open_wav(const char *path);                        // 16-bit PCM WAV, looped
+bool mic_open_pipe(const char *path, uint32_t sample_rate); // raw s16le mono, "-" = stdin
+void mic_close(void);
+
+/* Registers the microphone natives with the VM (extension 0x02) */
+bool mic_register(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,286 @@
+#include <math.h>
+#include <string.h>
+
+#include "neopixel.h"
+#include "output_stage.h"
+#include "vm.h"
+#include "../common/extension.h"
+
+static uint8_t back[NEO_MAX_LEDS * 3];
+static uint16_t num_leds = NEO_DEFAULT_LEDS;
+static uint16_t strip_base[NEO_MAX_STRIPS + 1];
+
+/* ------------ Mapping tables, computed at load ------------ */
+static uint16_t phys[NEO_MAX_LEDS];         // logical LED -> physical LED
+static uint16_t xy_phys[NEO_MAX_LEDS];      // y * width + x -> physical LED
+static uint16_t xy_led[NEO_MAX_LEDS];       // y * width + x -> logical LED
+static uint16_t led_x[NEO_MAX_LEDS], led_y[NEO_MAX_LEDS];
+static uint8_t led_angle[NEO_MAX_LEDS], led_radius[NEO_MAX_LEDS];
+static uint16_t width, height;
+static bool configured;
+
+static uint8_t clamp_u8(word_t v)
+{
+    if (v < 0) return 0;
+    if (v > 255) return 255;
+    return (uint8_t) v;
+}
+
+// logical LED index of matrix cell (x, y) for the given wiring
+static uint16_t matrix_index(uint16_t x, uint16_t y, uint8_t layout)
+{
+    if (layout & NEO_MTX_FLIP_X) x = (uint16_t) (width - 1 - x);
+    if (layout & NEO_MTX_FLIP_Y) y = (uint16_t) (height - 1 - y);
+    if (layout & NEO_MTX_COLUMNS) {
+        if ((layout & NEO_MTX_SERPENTINE) && (x & 1)) y = (uint16_t) (height - 1 - y);
+        return (uint16_t) (x * height + y);
+    }
+    if ((layout & NEO_MTX_SERPENTINE) && (y & 1)) x = (uint16_t) (width - 1 - x);
+    return (uint16_t) (y * width + x);
+}
+
+bool neo_configure_layout(const NeoSegment *segs, uint8_t seg_count,
+                          uint8_t w, uint8_t h, uint8_t layout)
+{
+    if (seg_count == 0 || seg_count > NEO_MAX_SEGMENTS)
+        return false;
+
+    uint16_t strip_len[NEO_MAX_STRIPS] = {0};
+    uint32_t total = 0;
+    for (uint8_t s = 0; s < seg_count; s++) {
+        if (segs[s].strip >= NEO_MAX_STRIPS)
+            return false;
+        strip_len[segs[s].strip] += segs[s].count;
+        total += segs[s].count;
+    }
+    if (total == 0 || total > NEO_MAX_LEDS || (uint32_t) w * h > total)
+        return false;
+
+    strip_base[0] = 0;
+    for (uint8_t s = 0; s < NEO_MAX_STRIPS; s++)
+        strip_base[s + 1] = (uint16_t) (strip_base[s] + strip_len[s]);
+
+    // logical index -> physical index, segments fill their strips in order
+    uint16_t fill[NEO_MAX_STRIPS] = {0};
+    uint16_t logical = 0;
+    for (uint8_t s = 0; s < seg_count; s++) {
+        uint16_t first = (uint16_t) (strip_base[segs[s].strip] + fill[segs[s].strip]);
+        for (uint16_t i = 0; i < segs[s].count; i++) {
+            uint16_t off = (segs[s].flags & NEO_SEG_REVERSED) ? (uint16_t) (segs[s].count - 1 - i) : i;
+            phys[logical++] = (uint16_t) (first + off);
+        }
+        fill[segs[s].strip] = (uint16_t) (fill[segs[s].strip] + segs[s].count);
+    }
+    num_leds = (uint16_t) total;
+
+    // without a matrix the strip is a single row
+    if (w == 0 || h == 0) {
+        width = (uint16_t) total;
+        height = 1;
+        layout = 0;
+    } else {
+        width = w;
+        height = h;
+    }
+
+    memset(led_x, 0, sizeof(led_x));
+    memset(led_y, 0, sizeof(led_y));
+    memset(led_angle, 0, sizeof(led_angle));
+    memset(led_radius, 0, sizeof(led_radius));
+    const float cx = (width - 1) / 2.0f, cy = (height - 1) / 2.0f;
+    const float rmax = sqrtf(cx * cx + cy * cy);
+    for (uint16_t y = 0; y < height; y++) {
+        for (uint16_t x = 0; x < width; x++) {
+            uint16_t idx = matrix_index(x, y, layout);
+            xy_phys[y * width + x] = phys[idx];
+            xy_led[y * width + x] = idx;
+            led_x[idx] = x;
+            led_y[idx] = y;
+            float dx = x - cx, dy = y - cy;
+            float a = atan2f(dy, dx);
+            if (a < 0) a += 2.0f * 3.14159265f;
+            // rounding can give 256 for angles just below 2 pi, that is 0 again
+            led_angle[idx] = (uint8_t) ((int) (a * 256.0f / (2.0f * 3.14159265f)) & 0xFF);
+            led_radius[idx] = rmax > 0 ? (uint8_t) lroundf(sqrtf(dx * dx + dy * dy) * 255.0f / rmax) : 0;
+        }
+    }
+
+    memset(back, 0, sizeof(back));
+    configured = true;
+    return true;
+}
+
+void neo_configure(uint16_t count)
+{
+    NeoSegment seg = {0, count > NEO_MAX_LEDS ? NEO_MAX_LEDS : count, 0};
+    neo_configure_layout(&seg, 1, 0, 0, 0);
+}
+
+bool neo_load_config(const uint8_t *data, uint8_t len)
+{
+    if (len == 0) {
+        neo_configure(NEO_DEFAULT_LEDS);
+        return true;
+    }
+    uint8_t count = data[0];
+    size_t pos = 1;
+    if (count > NEO_MAX_SEGMENTS || pos + (size_t) count * 4 > len)
+        return false;
+
+    NeoSegment segs[NEO_MAX_SEGMENTS];
+    for (uint8_t s = 0; s < count; s++, pos += 4) {
+        segs[s].strip = data[pos];
+        segs[s].count = (uint16_t) (data[pos + 1] | (data[pos + 2] << 8));
+        segs[s].flags = data[pos + 3];
+    }
+    uint8_t w = 0, h = 0, layout = 0;
+    if (pos + 3 <= len) {
+        w = data[pos];
+        h = data[pos + 1];
+        layout = data[pos + 2];
+    }
+    return neo_configure_layout(segs, count, w, h, layout);
+}
+
+uint16_t neo_num_leds(void)
+{
+    return num_leds;
+}
+
+const uint8_t *neo_buffer(void)
+{
+    return back;
+}
+
+uint16_t neo_strip_offset(uint8_t strip)
+{
+    return strip < NEO_MAX_STRIPS ? strip_base[strip] : num_leds;
+}
+
+uint16_t neo_strip_len(uint8_t strip)
+{
+    return strip < NEO_MAX_STRIPS ? (uint16_t) (strip_base[strip + 1] - strip_base[strip]) : 0;
+}
+
+/* ------------ Natives ------------ */
+static inline void put_rgb(uint16_t p, const word_t *rgb)
+{
+    uint8_t *px = &back[p * 3];
+    px[0] = clamp_u8(rgb[0]);
+    px[1] = clamp_u8(rgb[1]);
+    px[2] = clamp_u8(rgb[2]);
+}
+
+static word_t neo_set_rgb(VM *vm, const word_t *args)
+{
+    (void)vm;
+    if (args[0] < 0 || args[0] >= num_leds)
+        return 0;
+    put_rgb(phys[args[0]], &args[1]);
+    return 0;
+}
+
+static word_t neo_fill_rgb(VM *vm, const word_t *args)
+{
+    (void)vm;
+    uint8_t r = clamp_u8(args[0]), g = clamp_u8(args[1]), b = clamp_u8(args[2]);
+    for (uint16_t i = 0; i < num_leds; i++) {
+        back[i * 3] = r;
+        back[i * 3 + 1] = g;
+        back[i * 3 + 2] = b;
+    }
+    return 0;
+}
+
+static word_t neo_show(VM *vm, const word_t *args)
+{
+    (void)args;
+    // the output thread encodes and transmits, the VM continues with the next frame
+    out_publish(back, (uint16_t) (num_leds * 3));
+    vm->frame++;
+    return 0;
+}
+
+static word_t neo_clear(VM *vm, const word_t *args)
+{
+    (void)vm;
+    (void)args;
+    memset(back, 0, (size_t) num_leds * 3);
+    return 0;
+}
+
+static word_t neo_get_num_leds(VM *vm, const word_t *args)
+{
+    (void)vm;
+    (void)args;
+    return num_leds;
+}
+
+static word_t neo_set_xy(VM *vm, const word_t *args)
+{
+    (void)vm;
+    if (args[0] < 0 || args[0] >= width || args[1] < 0 || args[1] >= height)
+        return 0;
+    put_rgb(xy_phys[args[1] * width + args[0]], &args[2]);
+    return 0;
+}
+
+static word_t neo_xy_index(VM *vm, const word_t *args)
+{
+    (void)vm;
+    if (args[0] < 0 || args[0] >= width || args[1] < 0 || args[1] >= height)
+        return -1;
+    return xy_led[args[1] * width + args[0]];
+}
+
+#define NEO_LED_TABLE_FN(name, table) \
+    static word_t name(VM *vm, const word_t *args) \
+    { \
+        (void)vm; \
+        if (args[0] < 0 || args[0] >= num_leds) \
+            return 0; \
+        return table[args[0]]; \
+    }
+
+NEO_LED_TABLE_FN(neo_led_x, led_x)
+NEO_LED_TABLE_FN(neo_led_y, led_y)
+NEO_LED_TABLE_FN(neo_led_angle, led_angle)
+NEO_LED_TABLE_FN(neo_led_radius, led_radius)
+
+static word_t neo_width(VM *vm, const word_t *args)
+{
+    (void)vm;
+    (void)args;
+    return width;
+}
+
+static word_t neo_height(VM *vm, const word_t *args)
+{
+    (void)vm;
+    (void)args;
+    return height;
+}
+
+static const ExtNativeFn neo_natives[] = {
+    [EXT_FN_neopixel_set_rgb] = neo_set_rgb,
+    [EXT_FN_neopixel_fill_rgb] = neo_fill_rgb,
+    [EXT_FN_neopixel_show] = neo_show,
+    [EXT_FN_neopixel_clear] = neo_clear,
+    [EXT_FN_neopixel_num_leds] = neo_get_num_leds,
+    [EXT_FN_neopixel_set_xy] = neo_set_xy,
+    [EXT_FN_neopixel_xy_index] = neo_xy_index,
+    [EXT_FN_neopixel_led_x] = neo_led_x,
+    [EXT_FN_neopixel_led_y] = neo_led_y,
+    [EXT_FN_neopixel_led_angle] = neo_led_angle,
+    [EXT_FN_neopixel_led_radius] = neo_led_radius,
+    [EXT_FN_neopixel_width] = neo_width,
+    [EXT_FN_neopixel_height] = neo_height,
+};
+
+bool neo_register(void)
+{
+    if (!configured)
+        neo_configure(NEO_DEFAULT_LEDS);
+    return vm_register_ext(EXT_ID_NEOPIXEL, neo_natives, sizeof(neo_natives) / sizeof(neo_natives[0]),
+                           neo_load_config);
+}
@@ -0,0 +1,62 @@
+#ifndef LUMA_NEOPIXEL_H
+#define LUMA_NEOPIXEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ------------ Configuration ------------ */
+#define NEO_MAX_LEDS 512
+#define NEO_MAX_STRIPS 8
+#define NEO_MAX_SEGMENTS 16
+#define NEO_DEFAULT_LEDS 60
+
+/* Segment flags */
+#define NEO_SEG_REVERSED 0x01
+
+/* Matrix layout flags */
+#define NEO_MTX_SERPENTINE 0x01     // every other row (column) runs backwards
+#define NEO_MTX_COLUMNS 0x02        // wired column by column
+#define NEO_MTX_FLIP_X 0x04
+#define NEO_MTX_FLIP_Y 0x08
+
+typedef struct
+{
+    uint8_t strip;      // physical output
+    uint16_t count;
+    uint8_t flags;
+} NeoSegment;
+
+/* Single strip with num_leds LEDs (clamped to NEO_MAX_LEDS), no matrix */
+void neo_configure(uint16_t num_leds);
+
+/*
+ * Several segments (concatenated into the logical LED index space) and an
+ * optional width x height matrix laid over the first width*height LEDs.
+ * All index, coordinate and polar tables are computed here.
+ */
+bool neo_configure_layout(const NeoSegment *segs, uint8_t seg_count,
+                          uint8_t width, uint8_t height, uint8_t layout);
+
+/* Parses an extension table ConfigData record (see LBC_FileFormat_Specs.md) */
+bool neo_load_config(const uint8_t *data, uint8_t len);
+
+uint16_t neo_num_leds(void);
+
+/* Physical buffer, 3 bytes (R, G, B) per LED, strips back to back in strip order */
+const uint8_t *neo_buffer(void);
+uint16_t neo_strip_offset(uint8_t strip);   // first LED of a strip in the buffer
+uint16_t neo_strip_len(uint8_t strip);
+
+/* Registers the neopixel natives with the VM (extension 0x01).
+ * SHOW hands the back buffer to the output stage if it is running. */
+bool neo_register(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
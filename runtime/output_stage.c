@@ -0,0 +1,205 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "output_stage.h"
+
+#define OUT_CACHE_LINE 64
+
+typedef struct
+{
+    _Atomic uint32_t seq;   // odd while the producer writes the slot
+    uint64_t publish_ns;
+    uint16_t len;
+    uint8_t data[OUT_FRAME_BYTES];
+} OutFrame;
+
+/*
+ * The VM thread produces, the output thread consumes. Unlike an SpscRing both
+ * sides move tail: the consumer to send a frame, the producer to drop the
+ * oldest one on a full queue, each with a CAS. A dropped slot can be rewritten
+ * while the consumer is still copying it, so every slot is a seqlock: the
+ * copy only counts if the slot's sequence didn't change and the consumer then
+ * wins the CAS for the frame.
+ */
+static _Alignas(OUT_CACHE_LINE) _Atomic uint32_t head;  // next slot to write, producer only
+static _Alignas(OUT_CACHE_LINE) _Atomic uint32_t tail;  // next frame to send
+static OutFrame slots[OUT_QUEUE_FRAMES];
+static OutFrame current;    // consumer-owned copy of the frame being sent
+
+static OutPolicy policy;
+static OutSink sink;
+static void *sink_user;
+static pthread_t thread;
+static sem_t wakeup;
+static _Atomic bool running;
+
+static _Atomic uint32_t st_published, st_sent, st_dropped, st_coalesced, st_max_depth;
+static _Atomic uint64_t st_latency_sum, st_latency_max;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t queued(void)
+{
+    uint32_t t = atomic_load_explicit(&tail, memory_order_acquire);
+    return atomic_load_explicit(&head, memory_order_acquire) - t;
+}
+
+static bool claim(uint32_t t)
+{
+    return atomic_compare_exchange_strong_explicit(&tail, &t, t + 1,
+                                                   memory_order_acq_rel, memory_order_relaxed);
+}
+
+/* ------------ Output thread ------------ */
+static void record_sent(void)
+{
+    uint64_t lat = now_ns() - current.publish_ns;
+    atomic_fetch_add_explicit(&st_sent, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&st_latency_sum, lat, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&st_latency_max, memory_order_relaxed);
+    while (lat > max && !atomic_compare_exchange_weak_explicit(&st_latency_max, &max, lat,
+                                                              memory_order_relaxed, memory_order_relaxed));
+}
+
+static void *output_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        uint32_t avail = queued();
+        if (avail == 0) {
+            if (!atomic_load_explicit(&running, memory_order_acquire))
+                break;
+            sem_wait(&wakeup);
+            continue;
+        }
+
+        uint32_t t = atomic_load_explicit(&tail, memory_order_acquire);
+        if (policy == OUT_COALESCE && avail > 1) {
+            // skip straight to the newest frame
+            if (!atomic_compare_exchange_strong_explicit(&tail, &t, t + avail - 1,
+                                                         memory_order_acq_rel, memory_order_relaxed))
+                continue;
+            atomic_fetch_add_explicit(&st_coalesced, avail - 1, memory_order_relaxed);
+            t += avail - 1;
+        }
+
+        const OutFrame *slot = &slots[t % OUT_QUEUE_FRAMES];
+        uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;   // dropped and being rewritten
+        current.publish_ns = slot->publish_ns;
+        current.len = slot->len < OUT_FRAME_BYTES ? slot->len : OUT_FRAME_BYTES;
+        memcpy(current.data, slot->data, current.len);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq || !claim(t))
+            continue;   // dropped by the producer while copying
+
+        if (sink)
+            sink(current.data, current.len, sink_user);
+        record_sent();
+    }
+    return NULL;
+}
+
+/* ------------ VM side ------------ */
+bool out_start(OutPolicy p, OutSink s, void *user)
+{
+    if (out_running())
+        return false;
+    atomic_store(&head, 0);
+    atomic_store(&tail, 0);
+    for (uint32_t i = 0; i < OUT_QUEUE_FRAMES; i++)
+        atomic_store(&slots[i].seq, 0);
+    policy = p;
+    sink = s;
+    sink_user = user;
+    atomic_store(&st_published, 0);
+    atomic_store(&st_sent, 0);
+    atomic_store(&st_dropped, 0);
+    atomic_store(&st_coalesced, 0);
+    atomic_store(&st_max_depth, 0);
+    atomic_store(&st_latency_sum, 0);
+    atomic_store(&st_latency_max, 0);
+    if (sem_init(&wakeup, 0, 0) != 0)
+        return false;
+    atomic_store(&running, true);
+    if (pthread_create(&thread, NULL, output_main, NULL) != 0) {
+        atomic_store(&running, false);
+        sem_destroy(&wakeup);
+        return false;
+    }
+    return true;
+}
+
+void out_stop(void)
+{
+    if (!out_running())
+        return;
+    atomic_store_explicit(&running, false, memory_order_release);
+    sem_post(&wakeup);
+    pthread_join(thread, NULL);
+    sem_destroy(&wakeup);
+}
+
+bool out_running(void)
+{
+    return atomic_load_explicit(&running, memory_order_acquire);
+}
+
+bool out_publish(const uint8_t *data, uint16_t len)
+{
+    if (!out_running() || len > OUT_FRAME_BYTES)
+        return false;
+
+    while (queued() >= OUT_QUEUE_FRAMES) {
+        if (policy == OUT_BLOCK) {
+            struct timespec ts = {0, 50000};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        uint32_t t = atomic_load_explicit(&tail, memory_order_acquire);
+        if (claim(t))
+            atomic_fetch_add_explicit(&st_dropped, 1, memory_order_relaxed);
+    }
+
+    uint32_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    OutFrame *slot = &slots[h % OUT_QUEUE_FRAMES];
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->publish_ns = now_ns();
+    slot->len = len;
+    memcpy(slot->data, data, len);
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&head, h + 1, memory_order_release);
+    sem_post(&wakeup);
+
+    atomic_fetch_add_explicit(&st_published, 1, memory_order_relaxed);
+    uint32_t depth = queued();
+    if (depth > atomic_load_explicit(&st_max_depth, memory_order_relaxed))
+        atomic_store_explicit(&st_max_depth, depth, memory_order_relaxed);
+    return true;
+}
+
+void out_get_stats(OutStats *stats)
+{
+    stats->published = atomic_load(&st_published);
+    stats->sent = atomic_load(&st_sent);
+    stats->dropped = atomic_load(&st_dropped);
+    stats->coalesced = atomic_load(&st_coalesced);
+    stats->depth = queued();
+    stats->max_depth = atomic_load(&st_max_depth);
+    stats->latency_avg_ns = stats->sent ? atomic_load(&st_latency_sum) / stats->sent : 0;
+    stats->latency_max_ns = atomic_load(&st_latency_max);
+}
@@ -0,0 +1,51 @@
+#ifndef LUMA_OUTPUT_STAGE_H
+#define LUMA_OUTPUT_STAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ------------ Configuration ------------ */
+#define OUT_QUEUE_FRAMES 4      // frame queue depth (power of two)
+#define OUT_FRAME_BYTES 2048    // max bytes per frame
+
+/* What SHOW does when the output thread is behind and the queue is full */
+typedef enum
+{
+    OUT_DROP_OLDEST = 0,    // discard the oldest queued frame, every other frame is sent
+    OUT_BLOCK = 1,          // wait until the output thread frees a slot
+    OUT_COALESCE = 2,       // like DROP_OLDEST, and the output thread only sends the newest frame
+} OutPolicy;
+
+/* Encodes and transmits one frame, runs on the output thread */
+typedef void (*OutSink)(const uint8_t *data, uint16_t len, void *user);
+
+typedef struct
+{
+    uint32_t published;     // frames handed over by SHOW
+    uint32_t sent;          // frames passed to the sink
+    uint32_t dropped;       // frames discarded because the queue was full
+    uint32_t coalesced;     // frames skipped in favour of a newer one
+    uint32_t depth;         // frames currently queued
+    uint32_t max_depth;
+    uint64_t latency_avg_ns;    // SHOW -> sink finished
+    uint64_t latency_max_ns;
+} OutStats;
+
+bool out_start(OutPolicy policy, OutSink sink, void *user);
+void out_stop(void);    // drains the queue, then joins the output thread
+
+/* Copies a frame into the queue, called by SHOW on the VM thread */
+bool out_publish(const uint8_t *data, uint16_t len);
+bool out_running(void);
+
+void out_get_stats(OutStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef LUMA_SPSC_RING_H
+#define LUMA_SPSC_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring indices.
+ * The element storage belongs to the user; capacity must be a power of two.
+ * head is only written by the producer, tail only by the consumer.
+ */
+#define SPSC_CACHE_LINE 64
+
+typedef struct
+{
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t head;    // next slot to write
+    _Alignas(SPSC_CACHE_LINE) _Atomic uint32_t tail;    // next slot to read
+    uint32_t mask;                                      // capacity - 1
+} SpscRing;
+
+static inline bool spsc_init(SpscRing *r, uint32_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        return false;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->mask = capacity - 1;
+    return true;
+}
+
+/* ------------ Producer side ------------ */
+static inline uint32_t spsc_write_avail(const SpscRing *r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    return (r->mask + 1) - (head - tail);
+}
+
+static inline uint32_t spsc_write_index(const SpscRing *r)
+{
+    return atomic_load_explicit(&r->head, memory_order_relaxed) & r->mask;
+}
+
+static inline void spsc_publish(SpscRing *r, uint32_t n)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+}
+
+/* ------------ Consumer side ------------ */
+static inline uint32_t spsc_read_avail(const SpscRing *r)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    return head - tail;
+}
+
+static inline uint32_t spsc_read_index(const SpscRing *r)
+{
+    return atomic_load_explicit(&r->tail, memory_order_relaxed) & r->mask;
+}
+
+static inline void spsc_consume(SpscRing *r, uint32_t n)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+#endif
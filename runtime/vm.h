@@ -4,10 +4,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* ------------ Configuration ------------ */
 #define STACK_WORDS 256
 #define MEM_WORDS 256
 #define REG_COUNT 8
+#define EXT_MAX_ID 4            // extension IDs 0..EXT_MAX_ID-1 get dispatch slots
+#define EXT_MAX_SUBOPS 16       // subops per extension
+#define EXT_MAX_ARGS 8          // R0..R3 + up to 4 stack arguments
 
 #define VM_TRUE 1
 #define VM_FALSE 0
@@ -16,7 +23,38 @@
 typedef int32_t word_t;
 
 typedef struct VM VM;
-typedef void (*ExtHandler)(VM *vm, uint8_t subop);
+
+/*
+ * Native extension ABI: args[0..3] alias R0..R3, further arguments are popped
+ * from the stack. If the function has a return value it is written to R0
+ * (or Rdst for the built-in opcodes) by the VM.
+ */
+typedef word_t (*ExtNativeFn)(VM *vm, const word_t *args);
+
+/* Applies the ConfigData of an extension table record, see LBC_FileFormat_Specs.md */
+typedef bool (*ExtConfigFn)(const uint8_t *data, uint8_t len);
+
+typedef struct
+{
+    ExtNativeFn fn;
+    uint8_t arg_count;
+    uint8_t has_ret;
+} ExtSlot;
+
+#define EXT_SLOT(id, subop) ((uint16_t) (id) * EXT_MAX_SUBOPS + (subop))
+#define EXT_SLOT_COUNT (EXT_MAX_ID * EXT_MAX_SUBOPS)
+
+/*
+ * Instrumentation, see LumaRun --profile: counts by the code offset of the
+ * instruction. A conditional jump counts into taken or not_taken, CALLA and
+ * CALLR into taken. The arrays belong to the caller and hold code_len
+ * entries each, counts stop at UINT32_MAX.
+ */
+typedef struct
+{
+    uint32_t *taken;
+    uint32_t *not_taken;
+} VmProfile;
 
 struct VM
 {
@@ -27,7 +65,7 @@ struct VM
     const uint8_t *code;        // pointer into loaded code section
     uint16_t code_len;          // length of code section
     const uint32_t *consts;     // constant pool pointer
-    uint8_t const_count;        // number of constants in pool
+    uint16_t const_count;       // number of constants in pool
     uint16_t pc;                // program counter
     uint8_t flags;              // bitflags defined in file header
     bool halted;
@@ -35,7 +73,9 @@ struct VM
     bool delaying;
     word_t delayAmount;
     uint64_t delayStart;
-    ExtHandler ext_table[256];  // registered extension handlers
+    uint32_t frame;             // number of SHOWs since load, used for per-frame caching
+    VmProfile *profile;         // jump and call counts when not NULL, kept across loads
+    ExtSlot ext_slots[EXT_SLOT_COUNT]; // flat (ExtID, SubOp) dispatch table, resolved at load
     int err;                    // Error code (defined below)
 };
 
@@ -52,10 +92,20 @@ enum
 };
 
 bool vm_load_program(VM *vm, const uint8_t *code, uint16_t code_len,
-                            const uint32_t *consts, uint8_t const_count,
-                            bool signed_rel);
+                            const uint32_t *consts, uint16_t const_count);
+
+/* Register native functions for an extension, indexed by subop. Arity comes from
+ * the shared descriptor in common/extension.h. Takes effect on the next load. */
+bool vm_register_ext(uint8_t id, const ExtNativeFn *fns, uint8_t fn_count, ExtConfigFn config);
+
+/* Passes an extension record's ConfigData to the registered extension */
+bool vm_configure_ext(uint8_t id, const uint8_t *data, uint8_t len);
 
 void vm_step(VM *vm);   // executes one instruction
 void vm_run(VM *vm);    // runs until halted
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
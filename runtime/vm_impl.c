@@ -4,9 +4,14 @@
 
 #include "vm.h"
 #include "../common/opcode.h"
+#include "../common/extension.h"
+#include "../common/arith.h"
 
 #define CLOCKS_PER_MSEC (CLOCKS_PER_SEC * 1000)
 
+// LOAD and STORE take 8-bit addresses without a range check
+_Static_assert(MEM_WORDS == 256, "an 8-bit address has to reach exactly the mem words");
+
 /* ------------ Helper fetch functions ------------ */
 static bool vm_fetch_u8(VM* vm, uint8_t* out) {
     if (vm->pc >= vm->code_len) return false;
@@ -87,26 +92,113 @@ void op_jmpr(VM* vm) {
     }
 }
 
+/* ------------ Profile Helper ------------ */
+static void vm_count(VM* vm, uint16_t at, bool taken) {
+    if (!vm->profile) return;
+    uint32_t *count = taken ? &vm->profile->taken[at] : &vm->profile->not_taken[at];
+    if (*count != UINT32_MAX) (*count)++;
+}
+
 /* ------------ Extension Helper ------------ */
+// native functions per extension ID, indexed by subop
+static const ExtNativeFn *ext_natives[EXT_MAX_ID];
+static uint8_t ext_native_counts[EXT_MAX_ID];
+static ExtConfigFn ext_configs[EXT_MAX_ID];
+
+bool vm_register_ext(uint8_t id, const ExtNativeFn *fns, uint8_t fn_count, ExtConfigFn config)
+{
+    if (id >= EXT_MAX_ID || fn_count > EXT_MAX_SUBOPS)
+        return false;
+    ext_natives[id] = fns;
+    ext_native_counts[id] = fn_count;
+    ext_configs[id] = config;
+    return true;
+}
+
+bool vm_configure_ext(uint8_t id, const uint8_t *data, uint8_t len)
+{
+    if (id >= EXT_MAX_ID || !ext_natives[id])
+        return false;
+    if (!ext_configs[id])
+        return len == 0;
+    return ext_configs[id](data, len);
+}
+
+// arity of every (ExtID, SubOp) slot, generated from extensions.def
+static const ExtSlot ext_slot_info[EXT_SLOT_COUNT] = {
+#define EXT_FN(name, fn, subop, argc, ret, effect) [EXT_SLOT(EXT_ID_OF_##name, subop)] = {NULL, argc, ret},
+#include "../common/extensions.def"
+};
+
+// fills the flat dispatch table with the registered natives
+static void ext_resolve(VM *vm)
+{
+    memcpy(vm->ext_slots, ext_slot_info, sizeof(vm->ext_slots));
+    for (uint8_t id = 0; id < EXT_MAX_ID; id++) {
+        if (!ext_natives[id])
+            continue;
+        for (uint8_t sub = 0; sub < ext_native_counts[id]; sub++)
+            vm->ext_slots[EXT_SLOT(id, sub)].fn = ext_natives[id][sub];
+    }
+}
+
+// calls a resolved slot, returns false if the VM halted
+static bool ext_call(VM *vm, const ExtSlot *slot, word_t *ret)
+{
+    if (!slot->fn) {
+        vm->err = ERR_UNKNOWN_EXTENSION;
+        vm->halted = true;
+        return false;
+    }
+    if (slot->arg_count <= 4) {
+        *ret = slot->fn(vm, vm->regs);
+        return true;
+    }
+
+    word_t args[EXT_MAX_ARGS];
+    memcpy(args, vm->regs, 4 * sizeof(word_t));
+    for (uint8_t i = 4; i < slot->arg_count && i < EXT_MAX_ARGS; i++) {
+        vm->err = vm_pop(vm, &args[i]);
+        if (vm->err) {
+            vm->halted = true;
+            return false;
+        }
+    }
+    *ret = slot->fn(vm, args);
+    return true;
+}
+
 static void ext_dispatch(VM* vm, uint8_t extID, uint8_t subop) {
-    ExtHandler h = vm->ext_table[extID];
-    if (!h) {
+    if (extID >= EXT_MAX_ID || subop >= EXT_MAX_SUBOPS) {
         vm->err = ERR_UNKNOWN_EXTENSION;
         vm->halted = true;
         return;
     }
-    h(vm, subop);
+    const ExtSlot *slot = &vm->ext_slots[EXT_SLOT(extID, subop)];
+    word_t ret;
+    if (ext_call(vm, slot, &ret) && slot->has_ret)
+        vm->regs[0] = ret;
 }
 
-static void neopixel_ext(VM *vm, uint8_t subop)
+// one byte shortcut opcode, a function with a return value takes an Rdst operand
+static void ext_shortcut(VM *vm, uint8_t extID, uint8_t subop)
 {
-    printf("neopixel_ext called subop=%02X R0=%ld R1=%ld R2=%ld R3=%ld\n",
-           subop, (long)vm->regs[0], (long)vm->regs[1], (long)vm->regs[2], (long)vm->regs[3]);
+    const ExtSlot *slot = &vm->ext_slots[EXT_SLOT(extID, subop)];
+    uint8_t dst = 0;
+    word_t ret;
+    if (slot->has_ret) {
+        if (!vm_fetch_u8(vm, &dst) || dst >= REG_COUNT) {
+            vm->err = ERR_BAD_OPCODE;
+            vm->halted = true;
+            return;
+        }
+    }
+    if (ext_call(vm, slot, &ret) && slot->has_ret)
+        vm->regs[dst] = ret;
 }
 
-static bool vm_load_program(VM *vm, const uint8_t *code, uint16_t code_len,
-                            const uint32_t *consts, uint8_t const_count,
-                            bool signed_rel)
+bool vm_load_program(VM *vm, const uint8_t *code, uint16_t code_len,
+                     const uint32_t *consts, uint16_t const_count)
 {
     if (!vm)
         return false;
@@ -121,26 +213,32 @@ static bool vm_load_program(VM *vm, const uint8_t *code, uint16_t code_len,
     vm->delaying = false;
     vm->delayAmount = 0;
     vm->delayStart = 0;
+    vm->frame = 0;
     vm->err = ERR_OK;
     // zero regs/mem
     memset(vm->regs, 0, sizeof(vm->regs));
     memset(vm->mem, 0, sizeof(vm->mem));
-    for (int i = 0; i < 256; i++)
-        vm->ext_table[i] = NULL;
-    vm->ext_table[0x01] = neopixel_ext;
+    ext_resolve(vm);
     return true;
 }
 
+void vm_run(VM* vm) {
+    while (!vm->halted) {
+        vm_step(vm);
+    }
+}
+
 void vm_step(VM* vm) {
     if (vm->halted) return;
     // TODO: implement for your platform
     if (vm->delaying) {
-        if ((clock() / CLOCKS_PER_MSEC) < vm->delayStart + vm->delayAmount) {
+        if ((uint64_t) (clock() / CLOCKS_PER_MSEC) < vm->delayStart + vm->delayAmount) {
             return;
         }
         vm->delaying = false;
     }
 
+    uint16_t at = vm->pc;       // where the instruction starts, for the profile
     uint8_t op;
     if (!vm_fetch_u8(vm, &op)) {
         vm->err = ERR_BAD_OPCODE;
@@ -191,22 +289,22 @@ void vm_step(VM* vm) {
                 vm->halted = true;
                 break;
             }
-            if (dst < REG_COUNT && addr < MEM_WORDS) {
+            if (dst < REG_COUNT) {
                 vm->regs[dst] = vm->mem[addr];
             } else {
                 vm->err = ERR_BAD_OPCODE;
-                vm->halted;
+                vm->halted = true;
             }
             break;
         }
         case OP_STORE: {
             uint8_t addr, src;
-            if (!vm_fetch_u8(vm, &addr) || vm_fetch_u8(vm, &src)) {
+            if (!vm_fetch_u8(vm, &addr) || !vm_fetch_u8(vm, &src)) {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
                 break;
             }
-            if (addr < MEM_WORDS && src < REG_COUNT) {
+            if (src < REG_COUNT) {
                 vm->mem[addr] = vm->regs[src];
             } else {
                 vm->err = ERR_BAD_OPCODE;
@@ -248,7 +346,7 @@ void vm_step(VM* vm) {
         }
         case OP_LDC: {
             uint8_t dst, idx;
-            if (!vm_fetch_u8(vm, &dst) || vm_fetch_u8(vm, &idx)) {
+            if (!vm_fetch_u8(vm, &dst) || !vm_fetch_u8(vm, &idx)) {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
                 break;
@@ -261,6 +359,26 @@ void vm_step(VM* vm) {
             }
             break;
         }
+        case OP_LDCX: {
+            uint8_t dstidx;
+            uint16_t base, len;
+            if (!vm_fetch_u8(vm, &dstidx) || !vm_fetch_u16(vm, &base) || !vm_fetch_u16(vm, &len)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t dst = op_dst(dstidx);
+            uint8_t idx = op_src(dstidx);
+            // an index outside the table halts, it would read the neighbouring one
+            if (dst < REG_COUNT && idx < REG_COUNT && (uint32_t) vm->regs[idx] < len
+                && (uint32_t) base + (uint32_t) vm->regs[idx] < vm->const_count) {
+                vm->regs[dst] = vm->consts[base + vm->regs[idx]];
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
         // Arithmetic
         case OP_ADD: {
             uint8_t dstsrc;
@@ -272,7 +390,7 @@ void vm_step(VM* vm) {
             uint8_t dst = op_dst(dstsrc);
             uint8_t src = op_src(dstsrc);
             if (dst < REG_COUNT && src < REG_COUNT) {
-                vm->regs[dst] += vm->regs[src];
+                vm->regs[dst] = arith_add(vm->regs[dst], vm->regs[src]);
             } else {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
@@ -289,7 +407,7 @@ void vm_step(VM* vm) {
             uint8_t dst = op_dst(dstsrc);
             uint8_t src = op_src(dstsrc);
             if (dst < REG_COUNT && src < REG_COUNT) {
-                vm->regs[dst] -= vm->regs[src];
+                vm->regs[dst] = arith_sub(vm->regs[dst], vm->regs[src]);
             } else {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
@@ -306,7 +424,7 @@ void vm_step(VM* vm) {
             uint8_t dst = op_dst(dstsrc);
             uint8_t src = op_src(dstsrc);
             if (dst < REG_COUNT && src < REG_COUNT) {
-                vm->regs[dst] *= vm->regs[src];
+                vm->regs[dst] = arith_mul(vm->regs[dst], vm->regs[src]);
             } else {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
@@ -327,7 +445,7 @@ void vm_step(VM* vm) {
                     vm->err = ERR_DIV_BY_ZERO;
                     vm->halted = true;
                 } else{
-                    vm->regs[dst] /= vm->regs[src];
+                    vm->regs[dst] = arith_div(vm->regs[dst], vm->regs[src]);
                 }
             } else {
                 vm->err = ERR_BAD_OPCODE;
@@ -349,7 +467,7 @@ void vm_step(VM* vm) {
                     vm->err = ERR_DIV_BY_ZERO;
                     vm->halted = true;
                 } else{
-                    vm->regs[dst] %= vm->regs[src];
+                    vm->regs[dst] = arith_mod(vm->regs[dst], vm->regs[src]);
                 }
             } else {
                 vm->err = ERR_BAD_OPCODE;
@@ -366,8 +484,9 @@ void vm_step(VM* vm) {
             }
             if (dst < REG_COUNT) {
                 word_t v = vm->regs[dst];
-                vm->regs[dst] = v < 0 ? -v : v;
+                vm->regs[dst] = v < 0 ? arith_sub(0, v) : v;
             }
+            break;
         }
         case OP_MAX: {
             uint8_t dstsrc;
@@ -465,6 +584,98 @@ void vm_step(VM* vm) {
                 word_t v = vm->regs[dst];
                 vm->regs[dst] = ~v;
             }
+            break;
+        }
+        case OP_SHL: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t dst = op_dst(dstsrc);
+            uint8_t src = op_src(dstsrc);
+            if (dst < REG_COUNT && src < REG_COUNT) {
+                vm->regs[dst] = arith_shl(vm->regs[dst], vm->regs[src]);
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        case OP_SHR: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t dst = op_dst(dstsrc);
+            uint8_t src = op_src(dstsrc);
+            if (dst < REG_COUNT && src < REG_COUNT) {
+                vm->regs[dst] = arith_shr(vm->regs[dst], vm->regs[src]);
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        case OP_SAR: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t dst = op_dst(dstsrc);
+            uint8_t src = op_src(dstsrc);
+            if (dst < REG_COUNT && src < REG_COUNT) {
+                vm->regs[dst] = arith_sar(vm->regs[dst], vm->regs[src]);
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        // Fixed point
+        case OP_MULQ: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t dst = op_dst(dstsrc);
+            uint8_t src = op_src(dstsrc);
+            if (dst < REG_COUNT && src < REG_COUNT) {
+                vm->regs[dst] = arith_mulq(vm->regs[dst], vm->regs[src]);
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        case OP_DIVQ: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t dst = op_dst(dstsrc);
+            uint8_t src = op_src(dstsrc);
+            if (dst < REG_COUNT && src < REG_COUNT) {
+                if (vm->regs[src] == 0) {
+                    vm->err = ERR_DIV_BY_ZERO;
+                    vm->halted = true;
+                } else {
+                    vm->regs[dst] = arith_divq(vm->regs[dst], vm->regs[src]);
+                }
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
         }
         // Comparisons
         case OP_EQ: {
@@ -574,7 +785,10 @@ void vm_step(VM* vm) {
                 break;
             }
             if (cond < REG_COUNT) {
-                if (vm->regs[cond] == 0) op_jmpa(vm);
+                bool taken = vm->regs[cond] == 0;
+                vm_count(vm, at, taken);
+                if (taken) op_jmpa(vm);
+                else vm->pc += 2;      // step over the untaken target
             } else {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
@@ -589,7 +803,10 @@ void vm_step(VM* vm) {
                 break;
             }
             if (cond < REG_COUNT) {
-                if (vm->regs[cond] == 0) op_jmpr(vm);
+                bool taken = vm->regs[cond] == 0;
+                vm_count(vm, at, taken);
+                if (taken) op_jmpr(vm);
+                else vm->pc += 1;      // step over the untaken target
             } else {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
@@ -604,7 +821,10 @@ void vm_step(VM* vm) {
                 break;
             }
             if (cond < REG_COUNT) {
-                if (vm->regs[cond] != 0) op_jmpa(vm);
+                bool taken = vm->regs[cond] != 0;
+                vm_count(vm, at, taken);
+                if (taken) op_jmpa(vm);
+                else vm->pc += 2;      // step over the untaken target
             } else {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
@@ -619,7 +839,109 @@ void vm_step(VM* vm) {
                 break;
             }
             if (cond < REG_COUNT) {
-                if (vm->regs[cond] != 0) op_jmpr(vm);
+                bool taken = vm->regs[cond] != 0;
+                vm_count(vm, at, taken);
+                if (taken) op_jmpr(vm);
+                else vm->pc += 1;      // step over the untaken target
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        case OP_JEQA: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t a = op_dst(dstsrc);
+            uint8_t b = op_src(dstsrc);
+            if (a < REG_COUNT && b < REG_COUNT) {
+                bool taken = vm->regs[a] == vm->regs[b];
+                vm_count(vm, at, taken);
+                if (taken) op_jmpa(vm);
+                else vm->pc += 2;      // step over the untaken target
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        case OP_JNEA: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t a = op_dst(dstsrc);
+            uint8_t b = op_src(dstsrc);
+            if (a < REG_COUNT && b < REG_COUNT) {
+                bool taken = vm->regs[a] != vm->regs[b];
+                vm_count(vm, at, taken);
+                if (taken) op_jmpa(vm);
+                else vm->pc += 2;      // step over the untaken target
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        case OP_JLTA: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t a = op_dst(dstsrc);
+            uint8_t b = op_src(dstsrc);
+            if (a < REG_COUNT && b < REG_COUNT) {
+                bool taken = vm->regs[a] < vm->regs[b];
+                vm_count(vm, at, taken);
+                if (taken) op_jmpa(vm);
+                else vm->pc += 2;      // step over the untaken target
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        case OP_JGEA: {
+            uint8_t dstsrc;
+            if (!vm_fetch_u8(vm, &dstsrc)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            uint8_t a = op_dst(dstsrc);
+            uint8_t b = op_src(dstsrc);
+            if (a < REG_COUNT && b < REG_COUNT) {
+                bool taken = vm->regs[a] >= vm->regs[b];
+                vm_count(vm, at, taken);
+                if (taken) op_jmpa(vm);
+                else vm->pc += 2;      // step over the untaken target
+            } else {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+            }
+            break;
+        }
+        case OP_DJNZ: {
+            uint8_t counter;
+            if (!vm_fetch_u8(vm, &counter)) {
+                vm->err = ERR_BAD_OPCODE;
+                vm->halted = true;
+                break;
+            }
+            if (counter < REG_COUNT) {
+                vm->regs[counter] = arith_sub(vm->regs[counter], 1);
+                bool taken = vm->regs[counter] != 0;
+                vm_count(vm, at, taken);
+                if (taken) op_jmpa(vm);
+                else vm->pc += 2;      // step over the untaken target
             } else {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
@@ -633,6 +955,7 @@ void vm_step(VM* vm) {
                 vm->halted = true;
                 break;
             }
+            vm_count(vm, at, true);
             vm->err = vm_push(vm, vm->pc);
             if (vm->err) {
                 vm->halted = true;
@@ -653,6 +976,7 @@ void vm_step(VM* vm) {
                 vm->halted = true;
                 break;
             }
+            vm_count(vm, at, true);
             vm->err = vm_push(vm, vm->pc);
             if (vm->err) {
                 vm->halted = true;
@@ -669,14 +993,14 @@ void vm_step(VM* vm) {
             break;
         }
         case OP_RET: {
-            uint16_t addr;
+            word_t addr;
             vm->err = vm_pop(vm, &addr);
             if (vm->err) {
                 vm->halted = true;
                 break;
             }
-            if (addr < vm->code_len) {
-                vm->pc = addr;
+            if (addr >= 0 && addr < vm->code_len) {
+                vm->pc = (uint16_t) addr;
             } else {
                 vm->err = ERR_BAD_OPCODE;
                 vm->halted = true;
@@ -684,26 +1008,11 @@ void vm_step(VM* vm) {
             break;
         }
         // Extensions
-        case OP_D_SRGB: {
-            ext_dispatch(vm, 0x01, 0x00);
-            break;
-        }
-        case OP_D_FRGB: {
-            ext_dispatch(vm, 0x01, 0x01);
-            break;
-        }
-        case OP_D_SHOW: {
-            ext_dispatch(vm, 0x01, 0x02);
-            break;
-        }
-        case OP_D_CLR: {
-            ext_dispatch(vm, 0x01, 0x03);
+#define EXT_SHORTCUT(name, fn, opcode, MNEMONIC) \
+        case OP_D_##MNEMONIC: \
+            ext_shortcut(vm, EXT_ID_OF_##name, EXT_FN_##name##_##fn); \
             break;
-        }
-        case OP_D_NLED: {
-            ext_dispatch(vm, 0x01, 0x04);
-            break;
-        }
+#include "../common/extensions.def"
         case OP_EXT: {
             uint8_t extID, subOp;
             if (!vm_fetch_u8(vm, &extID) || !vm_fetch_u8(vm, &subOp)) {
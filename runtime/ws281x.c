@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws281x.h"
+
+/* ------------ Symbol tables (MSB first) ------------ */
+// 3-bit symbols: one byte -> 24 bits
+#define S3(b, bit) ((((b) >> (bit)) & 1u) ? 6u : 4u)
+#define W3(b) (S3(b, 7) << 21 | S3(b, 6) << 18 | S3(b, 5) << 15 | S3(b, 4) << 12 | \
+               S3(b, 3) << 9 | S3(b, 2) << 6 | S3(b, 1) << 3 | S3(b, 0))
+#define W3_4(n) W3(n), W3(n + 1), W3(n + 2), W3(n + 3)
+#define W3_16(n) W3_4(n), W3_4(n + 4), W3_4(n + 8), W3_4(n + 12)
+#define W3_64(n) W3_16(n), W3_16(n + 16), W3_16(n + 32), W3_16(n + 48)
+
+static const uint32_t sym3[256] = {
+    W3_64(0), W3_64(64), W3_64(128), W3_64(192),
+};
+
+// 4-bit symbols: one nibble -> 16 bits
+#define S4(n, bit) ((((n) >> (bit)) & 1u) ? 0xEu : 0x8u)
+#define W4(n) (uint16_t) (S4(n, 3) << 12 | S4(n, 2) << 8 | S4(n, 1) << 4 | S4(n, 0))
+
+static const uint16_t sym4[16] = {
+    W4(0), W4(1), W4(2), W4(3), W4(4), W4(5), W4(6), W4(7),
+    W4(8), W4(9), W4(10), W4(11), W4(12), W4(13), W4(14), W4(15),
+};
+
+bool ws_init(WsEncoder *enc, WsOrder order, WsSymbol symbol,
+             uint32_t spi_hz, uint16_t reset_us, uint16_t max_leds)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->order = order;
+    enc->symbol = symbol;
+    enc->max_leds = max_leds;
+    enc->channels = (order == WS_ORDER_GRBW || order == WS_ORDER_RGBW) ? 4 : 3;
+
+    switch (order) {
+        case WS_ORDER_GRB:
+        case WS_ORDER_GRBW: enc->map[0] = 1; enc->map[1] = 0; enc->map[2] = 2; break;
+        case WS_ORDER_RGB:
+        case WS_ORDER_RGBW: enc->map[0] = 0; enc->map[1] = 1; enc->map[2] = 2; break;
+        case WS_ORDER_BRG: enc->map[0] = 2; enc->map[1] = 0; enc->map[2] = 1; break;
+        default: return false;
+    }
+    if (symbol != WS_SYMBOL_3BIT && symbol != WS_SYMBOL_4BIT)
+        return false;
+
+    enc->reset_bytes = ((uint64_t) spi_hz * reset_us + 7999999) / 8000000;
+    size_t bytes = (size_t) max_leds * enc->channels * symbol + enc->reset_bytes;
+    enc->cap = (bytes + WS_BUF_ALIGN - 1) / WS_BUF_ALIGN * WS_BUF_ALIGN;
+    enc->buf = aligned_alloc(WS_BUF_ALIGN, enc->cap);
+    if (!enc->buf)
+        return false;
+    memset(enc->buf, 0, enc->cap);
+    return true;
+}
+
+void ws_free(WsEncoder *enc)
+{
+    free(enc->buf);
+    enc->buf = NULL;
+    enc->cap = 0;
+}
+
+static inline uint8_t *put3(uint8_t *out, uint8_t v)
+{
+    uint32_t s = sym3[v];
+    out[0] = (uint8_t) (s >> 16);
+    out[1] = (uint8_t) (s >> 8);
+    out[2] = (uint8_t) s;
+    return out + 3;
+}
+
+static inline uint8_t *put4(uint8_t *out, uint8_t v)
+{
+    uint16_t hi = sym4[v >> 4], lo = sym4[v & 0x0F];
+    out[0] = (uint8_t) (hi >> 8);
+    out[1] = (uint8_t) hi;
+    out[2] = (uint8_t) (lo >> 8);
+    out[3] = (uint8_t) lo;
+    return out + 4;
+}
+
+size_t ws_encode(WsEncoder *enc, const uint8_t *rgb, uint16_t count)
+{
+    if (count > enc->max_leds)
+        count = enc->max_leds;
+
+    uint8_t *out = enc->buf;
+    const uint8_t m0 = enc->map[0], m1 = enc->map[1], m2 = enc->map[2];
+    const bool white = enc->channels == 4;
+
+    for (uint16_t i = 0; i < count; i++, rgb += 3) {
+        uint8_t c0 = rgb[m0], c1 = rgb[m1], c2 = rgb[m2], w = 0;
+        if (white) {
+            w = c0 < c1 ? c0 : c1;
+            if (c2 < w) w = c2;
+            c0 -= w; c1 -= w; c2 -= w;
+        }
+        if (enc->symbol == WS_SYMBOL_3BIT) {
+            out = put3(put3(put3(out, c0), c1), c2);
+            if (white) out = put3(out, w);
+        } else {
+            out = put4(put4(put4(out, c0), c1), c2);
+            if (white) out = put4(out, w);
+        }
+    }
+
+    memset(out, 0, enc->reset_bytes);
+    out += enc->reset_bytes;
+    return (size_t) (out - enc->buf);
+}
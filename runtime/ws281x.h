@@ -0,0 +1,56 @@
+#ifndef LUMA_WS281X_H
+#define LUMA_WS281X_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * WS281x over SPI: every color bit becomes a 3-bit (100 / 110, ~2.4 MHz) or
+ * 4-bit (1000 / 1110, ~3.2 MHz) symbol, followed by a low reset gap.
+ */
+#define WS_BUF_ALIGN 64
+
+typedef enum
+{
+    WS_ORDER_GRB = 0,
+    WS_ORDER_RGB,
+    WS_ORDER_BRG,
+    WS_ORDER_GRBW,      // white = min(R, G, B), subtracted from the colors
+    WS_ORDER_RGBW,
+} WsOrder;
+
+typedef enum
+{
+    WS_SYMBOL_3BIT = 3,
+    WS_SYMBOL_4BIT = 4,
+} WsSymbol;
+
+typedef struct
+{
+    WsOrder order;
+    WsSymbol symbol;
+    uint8_t channels;       // 3 or 4 bytes per LED on the wire
+    uint8_t map[3];         // wire position -> RGB input offset
+    uint16_t max_leds;
+    size_t reset_bytes;     // zero bytes appended for the reset gap
+    uint8_t *buf;           // WS_BUF_ALIGN aligned, reused for every frame
+    size_t cap;
+} WsEncoder;
+
+bool ws_init(WsEncoder *enc, WsOrder order, WsSymbol symbol,
+             uint32_t spi_hz, uint16_t reset_us, uint16_t max_leds);
+void ws_free(WsEncoder *enc);
+
+/* Encodes count RGB LEDs into enc->buf, returns the number of bytes to send */
+size_t ws_encode(WsEncoder *enc, const uint8_t *rgb, uint16_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
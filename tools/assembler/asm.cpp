@@ -4,10 +4,51 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <cmath>
 #include <cstdint>
 #include <iomanip>
+#include <cstring>
+#include <initializer_list>
 
 #include "../../common/opcode.h"
+#include "../../common/extension.h"
+#include <Peephole.h>
+
+// one byte extension shortcuts, generated from extensions.def
+struct ExtShortcut {
+    const char* mnemonic;
+    uint8_t opcode;
+    const ExtFuncDesc* fn;
+};
+
+static const ExtShortcut EXT_SHORTCUTS[] = {
+#define EXT_SHORTCUT(name, fn, opcode, MNEMONIC) {#MNEMONIC, OP_D_##MNEMONIC, &EXT_FUNCS[EXT_IDX_##name##_##fn]},
+#include "../../common/extensions.def"
+};
+
+static const ExtShortcut* findShortcut(const std::string& op) {
+    for (const auto& sc : EXT_SHORTCUTS) {
+        if (op == sc.mnemonic) return &sc;
+    }
+    return nullptr;
+}
+
+static const ExtDesc* findExtension(const std::string& name) {
+    for (const auto& desc : EXT_DESCS) {
+        if (name == desc.name) return &desc;
+    }
+    return nullptr;
+}
+
+static std::string lower(std::string s) {
+    for (auto& c : s) c = tolower(c);
+    return s;
+}
+
+struct ExtRecord {
+    uint8_t id;
+    std::vector<uint8_t> config;
+};
 
 struct Label {
     std::string name;
@@ -18,11 +59,12 @@ struct Label {
 class ByteWriter {
 public:
     std::vector<uint8_t> data;
-    std::vector<uint8_t> extensions;
+    std::vector<ExtRecord> extensions;
     std::vector<Label> labels;
+    std::vector<uint32_t> consts;
 
-    void require(uint8_t id) {
-        extensions.push_back(id);
+    void require(uint8_t id, const std::vector<uint8_t>& config) {
+        extensions.push_back(ExtRecord{id, config});
     }
 
     void emit(uint8_t byte) { data.push_back(byte); }
@@ -41,7 +83,8 @@ public:
         labels.push_back(Label{name, (uint16_t) data.size()});
     }
 
-    void jump(const std::string& name, uint8_t op) {
+    // operands are the bytes between the opcode and the target, a condition register or dstsrc
+    void jump(const std::string& name, uint8_t op, std::initializer_list<uint8_t> operands = {}) {
         Label* label = nullptr;
         for (int i = 0; i < labels.size(); i++) {
             if (labels[i].name == name) {
@@ -53,6 +96,7 @@ public:
             throw std::runtime_error("Unknown label: " + name);
         }
         emit(op);
+        for (uint8_t b : operands) emit(b);
         emit16(label->addr);
     }
 
@@ -62,33 +106,53 @@ public:
             head[i] = 0;
         }
         std::vector<uint8_t> extTable;
-        std::cout << extensions.size() << ": " << extensions.size() * 3 << std::endl;
         // Header
         head[0] = 'L'; head[1] = 'V'; head[2] = 'M'; head[3] = '1';     // Magic Number
         head[4] = 0x01;                                                 // Version
         head[6] = (uint8_t) extensions.size();                          // ExtCount
-
-        uint16_t codeOffset = (uint16_t) (16 + extensions.size() * 3);
-        head[8] = (uint8_t) (codeOffset & 0xFF);
-        head[9] = (uint8_t) ((codeOffset >> 8) & 0xFF);                 // code offset
+        // more than 255 constants: Flags bit 0, the count goes in front of the pool
+        bool wide = consts.size() > 0xFF;
+        head[5] = wide ? 0x01 : 0;                                      // Flags
+        head[7] = wide ? 0 : (uint8_t) consts.size();                   // ConstCount
 
         // Extension table
-        for (uint8_t id : extensions) {
-            extTable.push_back(id);
-            extTable.push_back(0);
+        for (const auto& ext : extensions) {
+            extTable.push_back(ext.id);
             extTable.push_back(0);
+            extTable.push_back((uint8_t) ext.config.size());
+            extTable.insert(extTable.end(), ext.config.begin(), ext.config.end());
+        }
+
+        // Constant pool
+        std::vector<uint8_t> pool;
+        if (wide) {
+            pool.push_back((uint8_t) (consts.size() & 0xFF));
+            pool.push_back((uint8_t) ((consts.size() >> 8) & 0xFF));
+        }
+        for (uint32_t val : consts) {
+            for (int i = 0; i < 4; i++)
+                pool.push_back((uint8_t) ((val >> (i * 8)) & 0xFF));
         }
 
+        uint16_t codeOffset = (uint16_t) (16 + extTable.size() + pool.size());
+        head[8] = (uint8_t) (codeOffset & 0xFF);
+        head[9] = (uint8_t) ((codeOffset >> 8) & 0xFF);                 // code offset
+        for (int i = 0; i < 4; i++)
+            head[12 + i] = (uint8_t) ((data.size() >> (i * 8)) & 0xFF);  // code size
+
         std::ofstream out(filename, std::ios::binary);
         out.write(reinterpret_cast<const char*>(head), 16);
 
         if (extTable.size() > 0) {
             out.write(reinterpret_cast<const char*>(extTable.data()), extTable.size());
         }
+        if (pool.size() > 0) {
+            out.write(reinterpret_cast<const char*>(pool.data()), pool.size());
+        }
 
         out.write(reinterpret_cast<const char*>(data.data()), data.size());
 
-        return 16 + data.size() + extTable.size();
+        return 16 + data.size() + extTable.size() + pool.size();
     }
 };
 
@@ -110,6 +174,15 @@ int parseRegister(const std::string& token) {
     return r;
 }
 
+// an integer, or a number with a fraction like 0.25 as Q16.16
+uint32_t parseImmediate(const std::string& token, int base) {
+    if (token.find('.') == std::string::npos) return (uint32_t) std::stoll(token, nullptr, base);
+    long long q = std::llround(std::stod(token) * 65536.0);
+    if (q < INT32_MIN || q > INT32_MAX)
+        throw std::runtime_error("Fixed-point number out of range: " + token);
+    return (uint32_t) (int32_t) q;
+}
+
 ByteWriter w;
 
 // Main assembly function
@@ -129,10 +202,26 @@ std::vector<uint8_t> assemble(std::istream& in) {
         for (auto& c : op) c = toupper(c);
 
         if (op == "REQ") {
-            std::string idStr;
+            // REQ <id|name> [config bytes...]
+            std::string idStr, byteStr;
             iss >> idStr;
-            uint8_t id = (uint8_t) std::stoul(idStr);
-            w.require(id);
+            const ExtDesc* desc = findExtension(lower(idStr));
+            uint8_t id = desc ? desc->id : (uint8_t) std::stoul(idStr, nullptr, 0);
+            std::vector<uint8_t> config;
+            while (iss >> byteStr) {
+                config.push_back((uint8_t) std::stoul(byteStr, nullptr, 0));
+            }
+            if (config.size() > 255) throw std::runtime_error("Extension config too long on line " + std::to_string(lineNum));
+            w.require(id, config);
+        }
+        else if (op == "CONST") {
+            // CONST <value> [values...] appends to the constant pool, LDC and LDCX index it
+            std::string valStr;
+            while (iss >> valStr) {
+                if (valStr.back() == ',') valStr.pop_back();
+                w.consts.push_back(parseImmediate(valStr, 0));
+            }
+            if (w.consts.size() > 0xFFFF) throw std::runtime_error("Constant pool full on line " + std::to_string(lineNum));
         }
         else if (op == "MOVI") {
             std::string rd, immStr;
@@ -141,7 +230,7 @@ std::vector<uint8_t> assemble(std::istream& in) {
             iss >> immStr;
 
             int reg = parseRegister(rd);
-            uint32_t imm = std::stoul(immStr);
+            uint32_t imm = parseImmediate(immStr, 10);
 
             w.emit(OP_MOVI);
             w.emit(reg);
@@ -212,6 +301,26 @@ std::vector<uint8_t> assemble(std::istream& in) {
             w.emit(reg);
             w.emit(idx);
         }
+        else if (op == "LDCX") {
+            // LDCX Rd, Ri, base, len loads constant base + Ri, halts unless 0 <= Ri < len
+            std::string rd, ri, baseStr, lenStr;
+            iss >> rd;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> ri;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> baseStr;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> lenStr;
+            if (!rd.empty() && rd.back() == ',') rd.pop_back();
+            if (!ri.empty() && ri.back() == ',') ri.pop_back();
+            if (!baseStr.empty() && baseStr.back() == ',') baseStr.pop_back();
+
+            uint8_t dstidx = (uint8_t) ((parseRegister(rd) << 4) | (parseRegister(ri) & 0xF));
+            w.emit(OP_LDCX);
+            w.emit(dstidx);
+            w.emit16((uint16_t) std::stoul(baseStr, nullptr, 0));
+            w.emit16((uint16_t) std::stoul(lenStr, nullptr, 0));
+        }
         else if (op == "ADD") {
             std::string rd, rs;
             iss >> rd;
@@ -360,6 +469,71 @@ std::vector<uint8_t> assemble(std::istream& in) {
             w.emit(OP_NOT);
             w.emit(reg);
         }
+        else if (op == "SHL") {
+            std::string rd, rs;
+            iss >> rd;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> rs;
+
+            int dst = parseRegister(rd);
+            int src = parseRegister(rs);
+            uint8_t dstsrc = (dst << 4) | (src & 0xF);
+
+            w.emit(OP_SHL);
+            w.emit(dstsrc);
+        }
+        else if (op == "SHR") {
+            std::string rd, rs;
+            iss >> rd;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> rs;
+
+            int dst = parseRegister(rd);
+            int src = parseRegister(rs);
+            uint8_t dstsrc = (dst << 4) | (src & 0xF);
+
+            w.emit(OP_SHR);
+            w.emit(dstsrc);
+        }
+        else if (op == "SAR") {
+            std::string rd, rs;
+            iss >> rd;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> rs;
+
+            int dst = parseRegister(rd);
+            int src = parseRegister(rs);
+            uint8_t dstsrc = (dst << 4) | (src & 0xF);
+
+            w.emit(OP_SAR);
+            w.emit(dstsrc);
+        }
+        else if (op == "MULQ") {
+            std::string rd, rs;
+            iss >> rd;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> rs;
+
+            int dst = parseRegister(rd);
+            int src = parseRegister(rs);
+            uint8_t dstsrc = (dst << 4) | (src & 0xF);
+
+            w.emit(OP_MULQ);
+            w.emit(dstsrc);
+        }
+        else if (op == "DIVQ") {
+            std::string rd, rs;
+            iss >> rd;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> rs;
+
+            int dst = parseRegister(rd);
+            int src = parseRegister(rs);
+            uint8_t dstsrc = (dst << 4) | (src & 0xF);
+
+            w.emit(OP_DIVQ);
+            w.emit(dstsrc);
+        }
         else if (op == "EQ") {
             std::string rd, rs;
             iss >> rd;
@@ -444,17 +618,38 @@ std::vector<uint8_t> assemble(std::istream& in) {
             for (auto& c : name) c = toupper(c);
             w.jump(name, OP_JMPA);
         }
-        else if (op == "JZ") {
-            std::string name;
+        else if (op == "JZ" || op == "JNZ") {
+            // JZ Rcond, label
+            std::string rc, name;
+            iss >> rc;
+            if (!rc.empty() && rc.back() == ',') rc.pop_back();
             iss >> name;
             for (auto& c : name) c = toupper(c);
-            w.jump(name, OP_JZA);
+            uint8_t cond = (uint8_t) parseRegister(rc);
+            w.jump(name, op == "JZ" ? OP_JZA : OP_JNZA, {cond});
+        }
+        else if (op == "DJNZ") {
+            // DJNZ Rc, label decrements Rc and jumps unless it reached 0
+            std::string rc, name;
+            iss >> rc;
+            if (!rc.empty() && rc.back() == ',') rc.pop_back();
+            iss >> name;
+            for (auto& c : name) c = toupper(c);
+            w.jump(name, OP_DJNZ, {(uint8_t) parseRegister(rc)});
         }
-        else if (op == "JNZ") {
-            std::string name;
+        else if (op == "JEQ" || op == "JNE" || op == "JLT" || op == "JGE") {
+            // JLT Ra, Rb, label jumps if Ra < Rb
+            std::string ra, rb, name;
+            iss >> ra;
+            if (iss.peek() == ',') iss.ignore();
+            iss >> rb;
+            if (!ra.empty() && ra.back() == ',') ra.pop_back();
+            if (!rb.empty() && rb.back() == ',') rb.pop_back();
             iss >> name;
             for (auto& c : name) c = toupper(c);
-            w.jump(name, OP_JNZA);
+            uint8_t ab = (uint8_t) ((parseRegister(ra) << 4) | (parseRegister(rb) & 0xF));
+            uint8_t opcode = op == "JEQ" ? OP_JEQA : op == "JNE" ? OP_JNEA : op == "JLT" ? OP_JLTA : OP_JGEA;
+            w.jump(name, opcode, {ab});
         }
         else if (op == "CALL") {
             std::string name;
@@ -465,11 +660,30 @@ std::vector<uint8_t> assemble(std::istream& in) {
         else if (op == "RET") {
             w.emit(OP_RET);
         }
-        else if (op == "FRGB") {
-            w.emit(OP_D_FRGB);
-        }
-        else if (op == "SHOW") {
-            w.emit(OP_D_SHOW);
+        else if (op == "EXT") {
+            // EXT ext.fn
+            std::string target;
+            iss >> target;
+            target = lower(target);
+            size_t dot = target.find('.');
+            const ExtDesc* desc = dot != std::string::npos ? findExtension(target.substr(0, dot)) : nullptr;
+            const ExtFuncDesc* fn = nullptr;
+            for (uint8_t i = 0; desc && i < desc->func_count; i++) {
+                if (target.compare(dot + 1, std::string::npos, desc->funcs[i].name) == 0) fn = &desc->funcs[i];
+            }
+            if (fn == nullptr) throw std::runtime_error("Unknown extension function '" + target + "' on line " + std::to_string(lineNum));
+            w.emit(OP_EXT);
+            w.emit(desc->id);
+            w.emit(fn->subop);
+        }
+        else if (const ExtShortcut* sc = findShortcut(op)) {
+            // shortcuts of functions with a return value take the destination register
+            w.emit(sc->opcode);
+            if (sc->fn->has_ret) {
+                std::string rd;
+                iss >> rd;
+                w.emit(parseRegister(rd));
+            }
         }
         else if (op == "DELAY") {
             std::string rd;
@@ -495,10 +709,26 @@ std::vector<uint8_t> assemble(std::istream& in) {
 
 int main(int argc, char** argv) {
     if (argc < 3) {
-        std::cerr << "Usage: assembler <input.asm> <output.lbc>\n";
+        std::cerr << "Usage: assembler <input.asm> <output.lbc> [-O] [--window <n>] [--stats]\n"
+                  << "  -O runs the peephole pass over the assembled code\n";
         return 1;
     }
 
+    bool optimize = false, stats = false;
+    unsigned window = Peephole::DEFAULT_WINDOW;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-O") == 0) {
+            optimize = true;
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            window = (unsigned) std::stoul(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else {
+            std::cerr << "Unknown option: " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
     std::ifstream in(argv[1]);
     if (!in) {
         std::cerr << "Failed to open input file: " << argv[1] << "\n";
@@ -507,6 +737,14 @@ int main(int argc, char** argv) {
 
     try {
         auto code = assemble(in);
+        if (optimize) {
+            Peephole peephole(window);
+            if (!peephole.run(w.data)) {
+                std::cerr << "Peephole pass skipped, the code can't be decoded\n";
+            } else if (stats) {
+                peephole.printStats(std::cout);
+            }
+        }
 
         size_t codeSize = w.writeToFile(argv[2]);
         std::cout << "Assembled " << codeSize << " bytes -> " << argv[2] << "\n";
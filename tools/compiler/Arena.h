@@ -0,0 +1,93 @@
+#ifndef LUMA_ARENA_H
+#define LUMA_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Bump allocator, everything allocated from it is released at once when the arena dies.
+// Destructors of allocated objects are never run.
+class Arena {
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    struct Chunk {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    std::byte* cur = nullptr;
+    size_t left = 0;
+    size_t used = 0;
+
+    public:
+        Arena() = default;
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+            size_t pad = (align - (reinterpret_cast<uintptr_t>(cur) & (align - 1))) & (align - 1);
+            if (pad + size > left) {
+                size_t chunkSize = size + align > CHUNK_SIZE ? size + align : CHUNK_SIZE;
+                chunks.push_back(Chunk{std::make_unique<std::byte[]>(chunkSize), chunkSize});
+                cur = chunks.back().data.get();
+                left = chunkSize;
+                pad = (align - (reinterpret_cast<uintptr_t>(cur) & (align - 1))) & (align - 1);
+            }
+            void* p = cur + pad;
+            cur += pad + size;
+            left -= pad + size;
+            used += size;
+            return p;
+        }
+
+        template<typename T, typename... Args>
+        T* make(Args&&... args) {
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        // copies a string into the arena
+        std::string_view intern(std::string_view s) {
+            if (s.empty()) return {};
+            char* p = static_cast<char*>(allocate(s.size(), 1));
+            std::memcpy(p, s.data(), s.size());
+            return std::string_view(p, s.size());
+        }
+
+        size_t bytesUsed() const { return used; }
+};
+
+// std::allocator replacement for containers living in an Arena
+template<typename T>
+class ArenaAllocator {
+    template<typename U> friend class ArenaAllocator;
+    Arena* arena;
+
+    public:
+        using value_type = T;
+
+        ArenaAllocator(Arena& arena) : arena(&arena) {}
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T*, size_t) {}
+
+        template<typename U>
+        bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+        template<typename U>
+        bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,108 @@
+#include "Batch.h"
+
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "Extension.h"
+#include "CompileCache.h"
+
+std::string defaultOutput(const std::string& input) {
+    size_t slash = input.find_last_of('/');
+    size_t dot = input.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return input + ".lbc";
+    }
+    return input.substr(0, dot) + ".lbc";
+}
+
+std::vector<BatchJob> readManifest(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Can't open manifest: " + path);
+    }
+
+    std::vector<BatchJob> jobs;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.input) || job.input[0] == '#') continue;
+        if (!(fields >> job.output)) job.output = defaultOutput(job.input);
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+static void writeOutput(const BatchJob& job, const std::vector<uint8_t>& code) {
+    std::ofstream out(job.output, std::ios::binary | std::ios::trunc);
+    if (!out.write(reinterpret_cast<const char*>(code.data()), code.size())) {
+        throw std::runtime_error("Can't write output file: " + job.output);
+    }
+}
+
+// Each compile owns its parser, arena and codegen state, only the registry and cache are shared
+static void compileJob(BatchJob& job, const ExtensionRegistry& registry, CompileCache* cache) {
+    std::ifstream in(job.input, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Can't open input file");
+    }
+    std::stringstream buf;
+    buf << in.rdbuf();
+    std::string src = buf.str();
+
+    LumaCompileOptions options;
+    options.registry = &registry;
+
+    std::string key;
+    std::vector<uint8_t> code;
+    if (cache != nullptr) {
+        key = cache->key(src, options);
+        if (cache->lookup(key, src.size(), code, job.diagnostics)) {
+            writeOutput(job, code);
+            job.cached = true;
+            job.ok = true;
+            return;
+        }
+    }
+
+    LumaCompileResult result = luma_compile(src, options);
+    job.diagnostics = std::move(result.diagnostics);
+    if (!result.ok) {
+        return;
+    }
+    code = std::move(result.bytes);
+
+    writeOutput(job, code);
+    job.ok = true;
+    if (cache != nullptr) {
+        cache->store(key, code, job.diagnostics);
+    }
+}
+
+void compileBatch(std::vector<BatchJob>& jobs, const ExtensionRegistry& registry, unsigned threads,
+                  CompileCache* cache) {
+    std::atomic<size_t> nextJob{0};
+    auto worker = [&] {
+        for (size_t i; (i = nextJob.fetch_add(1, std::memory_order_relaxed)) < jobs.size(); ) {
+            BatchJob& job = jobs[i];
+            try {
+                compileJob(job, registry, cache);
+            } catch (const std::exception& e) {
+                job.diagnostics.push_back({LumaDiagnostic::Severity::ERROR, e.what(), 0, 0});
+            }
+        }
+    };
+
+    if (threads > jobs.size()) threads = (unsigned) jobs.size();
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& th : pool) {
+        th.join();
+    }
+}
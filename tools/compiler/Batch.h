@@ -0,0 +1,30 @@
+#ifndef LUMA_BATCH_H
+#define LUMA_BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "Compiler.h"
+
+class ExtensionRegistry;
+class CompileCache;
+
+struct BatchJob {
+    std::string input, output;
+    bool ok = false;
+    bool cached = false;    // output came from the compile cache
+    std::vector<LumaDiagnostic> diagnostics;
+};
+
+// output path for an input compiled without an explicit one: the input with a .lbc extension
+std::string defaultOutput(const std::string& input);
+
+// one job per line: `<input> [output]`, blank lines and lines starting with # are skipped
+std::vector<BatchJob> readManifest(const std::string& path);
+
+// compiles every job on `threads` workers, failures are recorded per job
+// cache may be null, it has to be keyed with the same registry
+void compileBatch(std::vector<BatchJob>& jobs, const ExtensionRegistry& registry, unsigned threads,
+                  CompileCache* cache = nullptr);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef LUMA_BINOP_H
+#define LUMA_BINOP_H
+
+#include <opcode.h>
+#include <stdint.h>
+#include <string>
+
+enum class BinOp : uint8_t {
+    ADD, SUB, MUL, DIV, MOD,
+    MULQ, DIVQ,     // of two Q16.16 numbers, only TypeChecker makes them
+    MAX, MIN,
+    EQUALS, NEQUALS,
+    GREATER, LESS, GEQUALS, LEQUALS,
+    LOR, LAND
+};
+
+inline std::string binOpToString(const BinOp& op) {
+    switch (op) {
+        case BinOp::ADD: return "ADD";
+        case BinOp::SUB: return "SUB";
+        case BinOp::MUL: return "MUL";
+        case BinOp::DIV: return "DIV";
+        case BinOp::MOD: return "MOD";
+        case BinOp::MULQ: return "MULQ";
+        case BinOp::DIVQ: return "DIVQ";
+        case BinOp::MAX: return "MAX";
+        case BinOp::MIN: return "MIN";
+        case BinOp::EQUALS: return "EQUALS";
+        case BinOp::NEQUALS: return "NEQUALS";
+        case BinOp::GREATER: return "GREATER";
+        case BinOp::LESS: return "LESS";
+        case BinOp::GEQUALS: return "GEQUALS";
+        case BinOp::LEQUALS: return "LEQUALS";
+        case BinOp::LOR: return "LOR";
+        case BinOp::LAND: return "LAND";
+        default: return "UNKOWN";
+    }
+}
+
+// the instruction computing op, `and` and `or` have none, they are lowered to jumps
+inline uint8_t binOpOpcode(const BinOp& op) {
+    switch (op) {
+        case BinOp::ADD: return OP_ADD;
+        case BinOp::SUB: return OP_SUB;
+        case BinOp::MUL: return OP_MUL;
+        case BinOp::DIV: return OP_DIV;
+        case BinOp::MOD: return OP_MOD;
+        case BinOp::MULQ: return OP_MULQ;
+        case BinOp::DIVQ: return OP_DIVQ;
+        case BinOp::MAX: return OP_MAX;
+        case BinOp::MIN: return OP_MIN;
+        case BinOp::EQUALS: return OP_EQ;
+        case BinOp::NEQUALS: return OP_NEQ;
+        case BinOp::GREATER: return OP_GT;
+        case BinOp::LESS: return OP_LT;
+        case BinOp::GEQUALS: return OP_GEQ;
+        case BinOp::LEQUALS: return OP_LEQ;
+        default: return OP_NOOP;
+    }
+}
+
+inline bool isComparison(const BinOp& op) {
+    return op >= BinOp::EQUALS && op <= BinOp::LEQUALS;
+}
+
+#endif
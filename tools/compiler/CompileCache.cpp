@@ -0,0 +1,211 @@
+#include "CompileCache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+#include "Extension.h"
+
+namespace fs = std::filesystem;
+
+#ifndef LUMA_COMPILER_VERSION
+#define LUMA_COMPILER_VERSION "unknown"
+#endif
+
+namespace {
+    // FNV-1a, 128-bit
+    using u128 = unsigned __int128;
+    constexpr u128 FNV128_PRIME = ((u128) 0x0000000001000000ull << 64) | 0x000000000000013Bull;
+    constexpr u128 FNV128_OFFSET = ((u128) 0x6C62272E07BB0142ull << 64) | 0x62B821756295C58Dull;
+
+    u128 fnv128(std::string_view data, u128 h = FNV128_OFFSET) {
+        for (unsigned char c : data) {
+            h ^= c;
+            h *= FNV128_PRIME;
+        }
+        return h;
+    }
+
+    std::string toHex(u128 h) {
+        static const char digits[] = "0123456789abcdef";
+        std::string out(32, '0');
+        for (int i = 31; i >= 0; i--, h >>= 4) out[i] = digits[(unsigned) (h & 0xF)];
+        return out;
+    }
+
+    // every option that changes the emitted code, the profile's counts in offset order
+    std::string describeOptions(const LumaCompileOptions& options) {
+        std::ostringstream out;
+        out << "O" << options.optimize << " peephole " << options.peepholeWindow
+            << " profile-generate " << options.profileGenerate << "\n";
+        if (options.profile != nullptr) {
+            std::vector<std::pair<uint32_t, LumaProfile::Count>> counts(options.profile->counts.begin(),
+                                                                         options.profile->counts.end());
+            std::sort(counts.begin(), counts.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            out << "profile " << options.profile->hash << "\n";
+            for (const auto& [at, count] : counts) {
+                out << at << " " << count.taken << " " << count.notTaken << "\n";
+            }
+        }
+        return out.str();
+    }
+
+    // entry file: "LCE1", u32 diagnostic count, per diagnostic severity u8, line u32, col u32,
+    // message length u32 and the message, then the .lbc file. Little endian
+    constexpr char ENTRY_MAGIC[4] = {'L', 'C', 'E', '1'};
+
+    void put32(std::string& out, uint32_t v) {
+        for (int i = 0; i < 4; i++) out.push_back((char) (v >> (8 * i)));
+    }
+
+    bool get32(const std::string& in, size_t& pos, uint32_t& v) {
+        if (pos + 4 > in.size()) return false;
+        v = 0;
+        for (int i = 0; i < 4; i++) v |= (uint32_t) (uint8_t) in[pos + i] << (8 * i);
+        pos += 4;
+        return true;
+    }
+
+    bool parseEntry(const std::string& in, std::vector<uint8_t>& lbc, std::vector<LumaDiagnostic>& diagnostics) {
+        if (in.compare(0, 4, ENTRY_MAGIC, 4) != 0) return false;
+        size_t pos = 4;
+        uint32_t count;
+        if (!get32(in, pos, count)) return false;
+        std::vector<LumaDiagnostic> diags;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t line, col, len;
+            if (pos >= in.size()) return false;
+            auto severity = (LumaDiagnostic::Severity) (uint8_t) in[pos++];
+            if (!get32(in, pos, line) || !get32(in, pos, col) || !get32(in, pos, len) || pos + len > in.size()) {
+                return false;
+            }
+            diags.push_back({severity, in.substr(pos, len), line, col});
+            pos += len;
+        }
+        lbc.assign(in.begin() + pos, in.end());
+        diagnostics = std::move(diags);
+        return true;
+    }
+
+    // the version string alone misses unreleased codegen changes, so the binary itself is hashed too
+    std::string compilerBuildId() {
+        std::string id = LUMA_COMPILER_VERSION;
+        std::ifstream self("/proc/self/exe", std::ios::binary);
+        if (self) {
+            std::stringstream buf;
+            buf << self.rdbuf();
+            id += "+" + toHex(fnv128(buf.str()));
+        }
+        return id;
+    }
+}
+
+CompileCache::CompileCache(fs::path dir, const ExtensionRegistry& registry, uint64_t maxBytes)
+    : dir(std::move(dir)), maxBytes(maxBytes)
+{
+    static const std::string buildId = compilerBuildId();
+    salt = buildId + "\n" + registry.describe() + "\n";
+    fs::create_directories(this->dir);
+}
+
+std::string CompileCache::key(std::string_view source, const LumaCompileOptions& options) const {
+    return toHex(fnv128(source, fnv128(describeOptions(options), fnv128(salt))));
+}
+
+fs::path CompileCache::entryPath(const std::string& key) const {
+    return dir / key.substr(0, 2) / (key.substr(2) + ".entry");
+}
+
+bool CompileCache::lookup(const std::string& key, size_t sourceSize, std::vector<uint8_t>& lbc,
+                          std::vector<LumaDiagnostic>& diagnostics) {
+    fs::path path = entryPath(key);
+    std::ifstream in(path, std::ios::binary);
+    std::string entry;
+    if (in) entry.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    // a damaged entry is compiled again and overwritten
+    if (!in || !parseEntry(entry, lbc, diagnostics)) {
+        misses++;
+        return false;
+    }
+
+    // refresh the entry for LRU eviction, losing a race with trim() is harmless
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+    hits++;
+    bytesSaved += sourceSize;
+    return true;
+}
+
+void CompileCache::store(const std::string& key, const std::vector<uint8_t>& lbc,
+                         const std::vector<LumaDiagnostic>& diagnostics) {
+    std::string entry(ENTRY_MAGIC, 4);
+    put32(entry, (uint32_t) diagnostics.size());
+    for (const LumaDiagnostic& d : diagnostics) {
+        entry.push_back((char) d.severity);
+        put32(entry, (uint32_t) d.line);
+        put32(entry, (uint32_t) d.col);
+        put32(entry, (uint32_t) d.message.size());
+        entry += d.message;
+    }
+    entry.append(lbc.begin(), lbc.end());
+
+    fs::path path = entryPath(key);
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+
+    std::ostringstream tmpName;
+    tmpName << path.string() << ".tmp." << getpid() << "." << std::this_thread::get_id();
+    fs::path tmp = tmpName.str();
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.write(entry.data(), entry.size())) {
+            fs::remove(tmp, ec);
+            return;     // a cache that can't be written just stays cold
+        }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return;
+    }
+    stores++;
+}
+
+void CompileCache::trim() {
+    struct Entry {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type used;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(dir, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file(ec) || it->path().extension() != ".entry") continue;
+        Entry e{it->path(), it->file_size(ec), it->last_write_time(ec)};
+        if (ec) continue;
+        total += e.size;
+        entries.push_back(std::move(e));
+    }
+    if (total <= maxBytes) return;
+
+    // evict down to 90% so the next few stores don't trigger another scan
+    uint64_t target = maxBytes / 10 * 9;
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const Entry& e : entries) {
+        if (total <= target) break;
+        if (fs::remove(e.path, ec)) {
+            total -= e.size;
+            evictions++;
+        }
+    }
+}
+
+CacheStats CompileCache::stats() const {
+    return {hits.load(), misses.load(), stores.load(), evictions.load(), bytesSaved.load()};
+}
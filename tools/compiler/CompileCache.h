@@ -0,0 +1,58 @@
+#ifndef LUMA_COMPILE_CACHE_H
+#define LUMA_COMPILE_CACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Compiler.h"
+
+class ExtensionRegistry;
+
+struct CacheStats {
+    uint64_t hits, misses, stores, evictions;
+    uint64_t bytesSaved;    // source bytes that skipped tokenizer, parser and codegen
+};
+
+/*
+ * On-disk cache of compiled .lbc files, addressed by a 128-bit hash of the
+ * source, the compile options, the compiler build and the extension registry
+ * contents. An entry keeps the warnings of the compile next to the code, a hit
+ * reports them again. Safe to share between threads and between concurrent
+ * LumaC processes: entries are written to a temporary file and renamed into
+ * place.
+ */
+class CompileCache {
+    std::filesystem::path dir;
+    uint64_t maxBytes;
+    std::string salt;       // compiler build + registry, prefixed to every source
+
+    std::atomic<uint64_t> hits{0}, misses{0}, stores{0}, evictions{0}, bytesSaved{0};
+
+    public:
+        static constexpr uint64_t DEFAULT_MAX_BYTES = 256ull << 20;
+
+        CompileCache(std::filesystem::path dir, const ExtensionRegistry& registry,
+                     uint64_t maxBytes = DEFAULT_MAX_BYTES);
+
+        // 32 hex digits. Of the options only what changes the code counts, the dump streams don't
+        std::string key(std::string_view source, const LumaCompileOptions& options) const;
+
+        bool lookup(const std::string& key, size_t sourceSize, std::vector<uint8_t>& lbc,
+                    std::vector<LumaDiagnostic>& diagnostics);
+        void store(const std::string& key, const std::vector<uint8_t>& lbc,
+                   const std::vector<LumaDiagnostic>& diagnostics);
+
+        // drops the least recently used entries until the cache fits in maxBytes
+        void trim();
+
+        CacheStats stats() const;
+
+    private:
+        std::filesystem::path entryPath(const std::string& key) const;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef LUMA_COMPILE_ERROR_H
+#define LUMA_COMPILE_ERROR_H
+
+#include <stdexcept>
+#include <string>
+
+// Error tied to a source position, line and col are 0-based like in Token
+class CompileError : public std::runtime_error {
+    public:
+        size_t line, col;
+
+        CompileError(const std::string& msg, size_t line, size_t col)
+            : std::runtime_error(msg), line(line), col(col) {}
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "Compiler.h"
+
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "CompileError.h"
+#include "Extension.h"
+#include "Parser.h"
+#include "ir/IRBuilder.h"
+#include "ir/Lowering.h"
+#include "ir/Passes.h"
+#include "visitors/CodegenVisitor.h"
+#include "visitors/ConstEvaluator.h"
+#include "visitors/ConstantFolder.h"
+#include "visitors/TypeChecker.h"
+#include "visitors/VarAllocator.h"
+#include <Peephole.h>
+#include <profile.h>
+
+static void dumpHex(std::ostream& os, const std::vector<uint8_t>& bytes) {
+    char line[16 * 3 + 1];
+    for (size_t i = 0; i < bytes.size(); i += 16) {
+        size_t n = bytes.size() - i < 16 ? bytes.size() - i : 16;
+        for (size_t j = 0; j < n; j++) {
+            std::snprintf(line + j * 3, 4, "%02X ", bytes[i + j]);
+        }
+        os.write(line, (std::streamsize) (n * 3));
+        os << '\n';
+    }
+}
+
+/*
+ * The counts of a profile by site. It was taken of the program the way
+ * profileGenerate compiles it, so that build is repeated to find the jump
+ * or call each site became. Empty if that isn't the program that ran.
+ */
+static std::vector<ir::SiteCount> siteCounts(Program* prog, const ExtensionRegistry& registry,
+                                             const std::vector<int32_t>& pool, const LumaCompileOptions& options) {
+    ir::Module module;
+    IRBuilder builder(registry, module);
+    builder.unrolling = false;
+    builder.build(prog);
+    ir::optimize(module, false);
+    Lowering lowering(builder.reqIDs);
+    lowering.setConstants(pool);
+    lowering.run(module);
+    if (options.peepholeWindow > 0) {
+        Peephole peephole(options.peepholeWindow);
+        lowering.runPeephole(peephole);
+    }
+    std::vector<uint8_t> bytes = lowering.getLBC();
+    if (luma_program_hash(bytes.data(), bytes.size()) != options.profile->hash) return {};
+
+    // a call's jump is always taken, calls and branches never share a site
+    std::vector<ir::SiteCount> counts(module.sites);
+    for (const SiteAddress& addr : lowering.sites()) {
+        auto found = options.profile->counts.find((uint32_t) addr.at);
+        if (found == options.profile->counts.end()) continue;
+        const LumaProfile::Count& c = found->second;
+        ir::SiteCount& count = counts[addr.site];
+        count.toTrue += addr.jumpsIfTrue ? c.taken : c.notTaken;
+        count.toFalse += addr.jumpsIfTrue ? c.notTaken : c.taken;
+        count.calls += c.taken;
+    }
+    return counts;
+}
+
+bool luma_parse_profile(std::string_view text, LumaProfile& out) {
+    std::istringstream in{std::string(text)};
+    std::string magic;
+    int version = 0;
+    if (!(in >> magic >> version >> std::hex >> out.hash >> std::dec)) return false;
+    if (magic != LUMA_PROFILE_MAGIC || version != LUMA_PROFILE_VERSION) return false;
+
+    out.counts.clear();
+    uint32_t at;
+    LumaProfile::Count count;
+    while (in >> at >> count.taken >> count.notTaken) {
+        out.counts[at] = count;
+    }
+    return in.eof();
+}
+
+LumaCompileResult luma_compile(std::string_view source, const LumaCompileOptions& options) {
+    LumaCompileResult result;
+
+    const ExtensionRegistry* registry = options.registry;
+    if (registry == nullptr) {
+        registry = &ExtensionRegistry::standard();
+    }
+
+    try {
+        Parser parser(source);
+        std::unique_ptr<Program> prog = parser.parse();
+        // fixed-point operations and conversions are in the tree from here on
+        TypeChecker types;
+        types.run(prog.get());
+        // the tables of const fns, at every level: a call of a tabulated one is always a lookup
+        ConstEvaluator consts;
+        consts.run(prog.get());
+        if (options.optimize > 0) {
+            ConstantFolder folder(consts);
+            folder.run(prog.get());
+        }
+        if (options.astDump != nullptr) {
+            prog->print(*options.astDump);
+            *options.astDump << '\n';
+        }
+
+        Peephole peephole(options.peepholeWindow);
+        bool usePeephole = options.optimize > 0 && options.peepholeWindow > 0;
+        if (options.optimize < 2 && (options.profileGenerate || options.profile != nullptr)) {
+            result.diagnostics.push_back({LumaDiagnostic::Severity::WARNING, "Profiles are only used at -O2", 0, 0});
+        }
+        if (options.optimize >= 2) {
+            ir::Module module;
+            // before building, loops that never ran aren't unrolled
+            if (options.profile != nullptr) {
+                module.profile = siteCounts(prog.get(), *registry, consts.pool, options);
+                if (module.profile.empty()) {
+                    result.diagnostics.push_back({LumaDiagnostic::Severity::WARNING,
+                        "Profile doesn't match the --profile-generate build of this program, ignored", 0, 0});
+                }
+            }
+            IRBuilder builder(*registry, module);
+            builder.unrolling = !options.profileGenerate;
+            builder.build(prog.get());
+            ir::optimize(module, !options.profileGenerate);
+            if (options.irDump != nullptr) {
+                module.print(*options.irDump);
+                *options.irDump << '\n';
+            }
+            Lowering lowering(builder.reqIDs);
+            lowering.setConstants(consts.pool);
+            lowering.run(module);
+            if (usePeephole) lowering.runPeephole(peephole);
+            result.bytes = lowering.getLBC();
+        } else {
+            VarAllocator vars;
+            vars.run(prog.get(), options.optimize > 0);
+            CodegenVisitor cgv(*registry, vars);
+            cgv.setConstants(consts.pool);
+            cgv.visitProgram(prog.get());
+            if (usePeephole) cgv.runPeephole(peephole);
+            result.bytes = cgv.getLBC();
+        }
+        if (usePeephole && options.peepholeStats != nullptr) {
+            peephole.printStats(*options.peepholeStats);
+        }
+        result.ok = true;
+    } catch (const CompileError& e) {
+        result.diagnostics.push_back({LumaDiagnostic::Severity::ERROR, e.what(), e.line + 1, e.col + 1});
+    } catch (const std::exception& e) {
+        result.diagnostics.push_back({LumaDiagnostic::Severity::ERROR, e.what(), 0, 0});
+    }
+
+    if (result.ok && options.hexDump != nullptr) {
+        dumpHex(*options.hexDump, result.bytes);
+    }
+    return result;
+}
+
+std::string luma_format_diagnostic(const LumaDiagnostic& diag, std::string_view name) {
+    std::string out(name);
+    if (diag.line != 0) {
+        out += ":" + std::to_string(diag.line) + ":" + std::to_string(diag.col);
+    }
+    out += diag.severity == LumaDiagnostic::Severity::ERROR ? ": error: " : ": warning: ";
+    return out + diag.message;
+}
@@ -0,0 +1,70 @@
+#ifndef LUMA_COMPILER_H
+#define LUMA_COMPILER_H
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class ExtensionRegistry;
+
+/*
+ * In-process entry point of the compiler: no file I/O, no console output,
+ * errors come back as diagnostics. Safe to call from several threads at once
+ * as long as they share only the registry.
+ */
+struct LumaDiagnostic {
+    enum class Severity { ERROR, WARNING };
+
+    Severity severity;
+    std::string message;
+    size_t line, col;       // 1-based, 0 when the error has no source position
+};
+
+// what LumaRun --profile counted, see common/profile.h
+struct LumaProfile {
+    struct Count {
+        uint64_t taken = 0, notTaken = 0;
+    };
+
+    uint64_t hash = 0;                              // of the .lbc file that ran
+    std::unordered_map<uint32_t, Count> counts;     // by code offset of the jump or call
+};
+
+// false when text isn't a profile of a version this compiler reads
+bool luma_parse_profile(std::string_view text, LumaProfile& out);
+
+struct LumaCompileOptions {
+    const ExtensionRegistry* registry = nullptr;    // defaults to ExtensionRegistry::standard()
+    // 0 skips the optimization passes, 1 folds constants and keeps variables in registers,
+    // 2 also goes through the SSA form (common subexpressions, dead code, copies)
+    unsigned optimize = 2;
+    // instructions a peephole rule looks ahead, the pass runs on the emitted code from -O1 on unless this is 0
+    unsigned peepholeWindow = 4;
+    std::ostream* peepholeStats = nullptr;          // what every peephole rule removed is printed here when set
+    std::ostream* astDump = nullptr;                // AST is printed here when set, after optimization
+    std::ostream* irDump = nullptr;                 // SSA form is printed here when set, at -O2 only
+    std::ostream* hexDump = nullptr;                // LBC bytes are printed here as hex when set
+    // -O2 only: calls aren't inlined and loops aren't unrolled, so LumaRun --profile counts every
+    // branch and call where it's written
+    bool profileGenerate = false;
+    // -O2 only: counts of the profileGenerate build of the same source with the same options, they
+    // decide the layout of branches, which calls are inlined and which loops unrolled. A profile of anything else is
+    // ignored with a warning
+    const LumaProfile* profile = nullptr;
+};
+
+struct LumaCompileResult {
+    bool ok = false;
+    std::vector<uint8_t> bytes;     // the .lbc file, empty when compiling failed
+    std::vector<LumaDiagnostic> diagnostics;
+};
+
+LumaCompileResult luma_compile(std::string_view source, const LumaCompileOptions& options = {});
+
+// `<name>:<line>:<col>: error: <message>`
+std::string luma_format_diagnostic(const LumaDiagnostic& diag, std::string_view name);
+
+#endif
@@ -2,71 +2,155 @@
 #define LUMA_EXTENSION_H
 
 #include <stdint.h>
+#include <array>
+#include <iterator>
 #include <string>
-#include <memory>
-#include <unordered_map>
+#include <string_view>
 
+#include <extension.h>
+
+/*
+ * Compile-time view of common/extensions.def: the tables and their hash
+ * indices are constexpr, so nothing is hashed or allocated at startup and
+ * the compiler can't disagree with the VM about subops or arity.
+ */
 struct ExtFunction {
+    std::string_view ext, name;
+    uint8_t extID;
     uint8_t subOp;
-    size_t argCount;
+    uint8_t argCount;
     bool hasReturnValue;
+    ExtEffect effect;
+
+    // the result only depends on the arguments, so calls can be merged and moved
+    constexpr bool isPure() const { return effect == EXT_EFFECT_PURE; }
 };
 
-class Extension {
-    protected:
-        std::unordered_map<std::string, ExtFunction> functions;
-        uint8_t id;
+namespace ext_table {
+    // FNV-1a
+    constexpr uint32_t hash(std::string_view s, uint32_t h = 2166136261u) {
+        for (char c : s) {
+            h ^= (uint8_t) c;
+            h *= 16777619u;
+        }
+        return h;
+    }
 
-    public:
-        uint8_t getID() {
-            return id;
+    constexpr uint32_t functionKey(std::string_view ext, std::string_view name) {
+        return hash(name, hash(".", hash(ext)));
+    }
+
+    inline constexpr ExtFunction FUNCTIONS[] = {
+#define EXT_FN(name, fn, subop, argc, ret, effect) {#name, #fn, EXT_ID_OF_##name, subop, argc, ret != 0, EXT_EFFECT_##effect},
+#include <extensions.def>
+    };
+
+    constexpr size_t indexSize(size_t n) {
+        size_t size = 1;
+        while (size < n * 2) size <<= 1;
+        return size;
+    }
+
+    // open addressing with linear probing, -1 marks an empty slot
+    template<size_t SIZE, typename Key, size_t N>
+    constexpr std::array<int16_t, SIZE> buildIndex(const Key (&keys)[N]) {
+        std::array<int16_t, SIZE> slots{};
+        for (auto& slot : slots) slot = -1;
+        for (size_t i = 0; i < N; i++) {
+            size_t pos = keys[i] & (SIZE - 1);
+            while (slots[pos] != -1) pos = (pos + 1) & (SIZE - 1);
+            slots[pos] = (int16_t) i;
         }
+        return slots;
+    }
 
-        ExtFunction* getFunction(std::string name) {
-            auto it = functions.find(name);
-            if (it == functions.end()) return nullptr;
-            return &it->second;
+    inline constexpr uint32_t FUNCTION_KEYS[] = {
+#define EXT_FN(name, fn, subop, argc, ret, effect) functionKey(#name, #fn),
+#include <extensions.def>
+    };
+    inline constexpr auto FUNCTION_INDEX = buildIndex<indexSize(EXT_FUNC_TOTAL)>(FUNCTION_KEYS);
+
+    constexpr const ExtFunction* findFunction(std::string_view ext, std::string_view name) {
+        uint32_t key = functionKey(ext, name);
+        constexpr size_t mask = FUNCTION_INDEX.size() - 1;
+        for (size_t pos = key & mask; FUNCTION_INDEX[pos] != -1; pos = (pos + 1) & mask) {
+            const ExtFunction& fn = FUNCTIONS[FUNCTION_INDEX[pos]];
+            if (FUNCTION_KEYS[FUNCTION_INDEX[pos]] == key && fn.ext == ext && fn.name == name) return &fn;
         }
-};
+        return nullptr;
+    }
+}
 
-class Neopixel : public Extension {
+class Extension {
     public:
-        Neopixel() {
-            id = 0x01;
-            
-            functions.insert({"set_rgb", {0x00, 4, false}});
-            functions.insert({"fill_rgb", {0x01, 3, false}});
-            functions.insert({"show", {0x02, 0, false}});
-            functions.insert({"clear", {0x03, 0, false}});
-            functions.insert({"num_leds", {0x04, 0, true}});
+        std::string_view name;
+        uint8_t id;
+        uint16_t first, count;      // range in ext_table::FUNCTIONS
+
+        constexpr uint8_t getID() const {
+            return id;
         }
-};
 
-class Microphone : public Extension {
-    public:
-        Microphone() {
-            id = 0x02;
-            functions.insert({"read", {0x00, 0, true}});
+        constexpr const ExtFunction* getFunction(std::string_view fnName) const {
+            return ext_table::findFunction(name, fnName);
         }
+
+        constexpr const ExtFunction* begin() const { return ext_table::FUNCTIONS + first; }
+        constexpr const ExtFunction* end() const { return ext_table::FUNCTIONS + first + count; }
 };
 
-class ExtensionRegistry {
-    std::unordered_map<std::string, std::unique_ptr<Extension>> exts;
+namespace ext_table {
+    inline constexpr Extension EXTENSIONS[] = {
+#define EXT(NAME, name, id) {#name, id, EXT_FIRST_##name, EXT_LAST_##name - EXT_FIRST_##name},
+#include <extensions.def>
+    };
 
+    inline constexpr uint32_t EXTENSION_KEYS[] = {
+#define EXT(NAME, name, id) hash(#name),
+#include <extensions.def>
+    };
+    inline constexpr auto EXTENSION_INDEX = buildIndex<indexSize(std::size(EXTENSIONS))>(EXTENSION_KEYS);
+}
+
+// Read-only, so one registry can be shared by concurrent compiles
+class ExtensionRegistry {
     public:
-        static ExtensionRegistry& instance() {
-            static ExtensionRegistry inst;
-            return inst;
-        }
+        // registry of all extensions described in common/extensions.def
+        static const ExtensionRegistry& standard();
 
-        void registerExt(const std::string& name, std::unique_ptr<Extension> ext) {
-            exts[name] = std::move(ext);
+        constexpr const Extension* get(std::string_view name) const {
+            using namespace ext_table;
+            uint32_t key = hash(name);
+            constexpr size_t mask = EXTENSION_INDEX.size() - 1;
+            for (size_t pos = key & mask; EXTENSION_INDEX[pos] != -1; pos = (pos + 1) & mask) {
+                const Extension& ext = EXTENSIONS[EXTENSION_INDEX[pos]];
+                if (EXTENSION_KEYS[EXTENSION_INDEX[pos]] == key && ext.name == name) return &ext;
+            }
+            return nullptr;
         }
 
-        Extension* get(const std::string& name) {
-            auto it = exts.find(name);
-            return it != exts.end() ? it->second.get() : nullptr;
+        // changes whenever an extension or one of its functions changes, keys the compile cache
+        std::string describe() const {
+            std::string out;
+            for (const Extension& ext : ext_table::EXTENSIONS) {
+                out += std::string(ext.name) + "=" + std::to_string(ext.id) + "{";
+                for (const ExtFunction& fn : ext) {
+                    out += std::string(fn.name) + ":" + std::to_string(fn.subOp) + "/"
+                        + std::to_string(fn.argCount) + (fn.hasReturnValue ? "r;" : ";");
+                }
+                out += "}\n";
+            }
+            return out;
         }
 };
 
-#endif
\ No newline at end of file
+inline constexpr ExtensionRegistry STANDARD_EXTENSIONS{};
+
+inline const ExtensionRegistry& ExtensionRegistry::standard() {
+    return STANDARD_EXTENSIONS;
+}
+
+static_assert(STANDARD_EXTENSIONS.get("neopixel")->getFunction("show")->subOp == EXT_FN_neopixel_show,
+              "extension tables must be usable at compile time");
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef LUMA_FLAT_AST_H
+#define LUMA_FLAT_AST_H
+
+#include <stdint.h>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Arena.h"
+#include "BinOp.h"
+
+/*
+ * Data-oriented alternative to the Program tree: every node is a 16 byte
+ * record in one array and refers to other nodes by 32-bit index. Nodes are
+ * appended after their children, so a child index is always smaller than its
+ * parent's and bottom-up passes can run as a single loop over `nodes`.
+ */
+using NodeRef = uint32_t;
+constexpr NodeRef NO_NODE = UINT32_MAX;
+
+using NameRef = uint32_t;   // index into FlatAST::names, equal names share one index
+
+enum class NodeKind : uint8_t {
+    NUMBER,     // a: value
+    VAR,        // a: name
+    BINARY,     // op, a: lhs, b: rhs
+    ASSIGN,     // a: name, b: expr
+    CALL,       // a: name, b: namespace name or NO_NODE, c: first arg in lists, count
+    EXPR_STMT,  // a: expr
+    IF_ELSE,    // a: cond, b: if body, c: else body or NO_NODE
+    LOOP,       // a: body
+    BLOCK,      // c: first stmt in lists, count
+    VAR_DECL,   // a: name, b: init expr or NO_NODE
+};
+
+struct FlatNode {
+    NodeKind kind;
+    BinOp op;
+    uint16_t count;
+    uint32_t a, b, c;
+};
+static_assert(sizeof(FlatNode) == 16, "FlatNode should stay 16 bytes");
+
+class FlatAST {
+    std::unique_ptr<Arena> arena = std::make_unique<Arena>();
+    std::unordered_map<std::string_view, NameRef> nameIndex;
+
+    public:
+        std::vector<FlatNode> nodes;
+        std::vector<NodeRef> lists;     // child ranges of CALL and BLOCK nodes
+        std::vector<std::string_view> names;
+
+        std::vector<NodeRef> stmts;     // top level statements
+        std::vector<NameRef> reqs;
+
+        NodeRef add(const FlatNode& node) {
+            nodes.push_back(node);
+            return (NodeRef) (nodes.size() - 1);
+        }
+
+        NameRef name(std::string_view s) {
+            auto it = nameIndex.find(s);
+            if (it != nameIndex.end()) return it->second;
+            std::string_view owned = arena->intern(s);
+            NameRef ref = (NameRef) names.size();
+            names.push_back(owned);
+            nameIndex.emplace(owned, ref);
+            return ref;
+        }
+
+        const FlatNode& operator[](NodeRef ref) const { return nodes[ref]; }
+
+        // child list of a CALL or BLOCK node
+        const NodeRef* begin(const FlatNode& node) const { return lists.data() + node.c; }
+        const NodeRef* end(const FlatNode& node) const { return lists.data() + node.c + node.count; }
+
+        // calls f(child) for each direct child in evaluation order
+        template<typename F>
+        void forEachChild(NodeRef ref, F&& f) const {
+            const FlatNode& n = nodes[ref];
+            switch (n.kind) {
+                case NodeKind::NUMBER:
+                case NodeKind::VAR:
+                    break;
+                case NodeKind::BINARY:
+                    f(n.a);
+                    f(n.b);
+                    break;
+                case NodeKind::ASSIGN:
+                case NodeKind::VAR_DECL:
+                    if (n.b != NO_NODE) f(n.b);
+                    break;
+                case NodeKind::CALL:
+                case NodeKind::BLOCK:
+                    for (const NodeRef* it = begin(n); it != end(n); it++) f(*it);
+                    break;
+                case NodeKind::EXPR_STMT:
+                case NodeKind::LOOP:
+                    f(n.a);
+                    break;
+                case NodeKind::IF_ELSE:
+                    f(n.a);
+                    f(n.b);
+                    if (n.c != NO_NODE) f(n.c);
+                    break;
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,266 @@
+#include "FlatParser.h"
+
+#include <stdexcept>
+#include <string>
+#include <charconv>
+
+#include "CompileError.h"
+
+std::unique_ptr<FlatAST> FlatParser::parse() {
+    auto flat = std::make_unique<FlatAST>();
+    ast = flat.get();
+
+    while (peek().type == TokType::REQUIRE) {
+        next();
+        ast->reqs.push_back(ast->name(expect(TokType::IDENTIFIER).value));
+        expect(TokType::SEMICOLON);
+    }
+
+    while (peek().type != TokType::T_EOF) {
+        ast->stmts.push_back(parseStatement());
+    }
+    ast = nullptr;
+    return flat;
+}
+
+NodeRef FlatParser::binary(BinOp op, NodeRef lhs, NodeRef rhs) {
+    return ast->add({NodeKind::BINARY, op, 0, lhs, rhs, 0});
+}
+
+uint32_t FlatParser::commitList(size_t mark, uint16_t& count) {
+    size_t n = scratch.size() - mark;
+    if (n > UINT16_MAX) {
+        throw std::runtime_error("Too many children in one list: " + std::to_string(n));
+    }
+    uint32_t first = (uint32_t) ast->lists.size();
+    ast->lists.insert(ast->lists.end(), scratch.begin() + mark, scratch.end());
+    scratch.resize(mark);
+    count = (uint16_t) n;
+    return first;
+}
+
+NodeRef FlatParser::parseStatement() {
+    Token tok = peek();
+    switch (tok.type) {
+        case TokType::IF: return parseIfElse();
+        case TokType::LOOP: return parseLoop();
+        case TokType::LET: return parseVarDecl();
+        case TokType::LBRACE: return parseBlock();
+        case TokType::FN: case TokType::CONST: case TokType::FOR: case TokType::RETURN:
+            throw CompileError("Not supported by the flat parser: " + tokenDescription(tok), tok.line, tok.col);
+    }
+
+    NodeRef expr = parseExpression();
+    expect(TokType::SEMICOLON);
+    return ast->add({NodeKind::EXPR_STMT, BinOp::ADD, 0, expr, 0, 0});
+}
+
+NodeRef FlatParser::parseIfElse() {
+    expect(TokType::IF);
+    expect(TokType::LPAREN);
+    NodeRef cond = parseExpression();
+    expect(TokType::RPAREN);
+    NodeRef body = parseStatement();
+    NodeRef elseBody = NO_NODE;
+    if (accept(TokType::ELSE)) {
+        elseBody = parseStatement();
+    }
+    return ast->add({NodeKind::IF_ELSE, BinOp::ADD, 0, cond, body, elseBody});
+}
+
+NodeRef FlatParser::parseLoop() {
+    expect(TokType::LOOP);
+    NodeRef body = parseStatement();
+    return ast->add({NodeKind::LOOP, BinOp::ADD, 0, body, 0, 0});
+}
+
+NodeRef FlatParser::parseBlock() {
+    expect(TokType::LBRACE);
+    size_t mark = scratch.size();
+    while (peek().type != TokType::RBRACE) {
+        NodeRef stmt = parseStatement();
+        scratch.push_back(stmt);
+    }
+    expect(TokType::RBRACE);
+    FlatNode node = {NodeKind::BLOCK, BinOp::ADD, 0, 0, 0, 0};
+    node.c = commitList(mark, node.count);
+    return ast->add(node);
+}
+
+NodeRef FlatParser::parseVarDecl() {
+    expect(TokType::LET);
+    NameRef id = ast->name(expect(TokType::IDENTIFIER).value);
+    NodeRef expr = NO_NODE;
+    if (accept(TokType::ASSIGN)) {
+        expr = parseExpression();
+    }
+    expect(TokType::SEMICOLON);
+    return ast->add({NodeKind::VAR_DECL, BinOp::ADD, 0, id, expr, 0});
+}
+
+
+
+NodeRef FlatParser::parseExpression() {
+    return parseAssignment();
+}
+
+NodeRef FlatParser::parseAssignment() {
+    if (peek().type == TokType::IDENTIFIER && peek(1).type == TokType::ASSIGN) {
+        NameRef id = ast->name(expect(TokType::IDENTIFIER).value);
+        expect(TokType::ASSIGN);
+        NodeRef expr = parseAssignment();
+        return ast->add({NodeKind::ASSIGN, BinOp::ADD, 0, id, expr, 0});
+    }
+    return parseLogicOr();
+}
+
+NodeRef FlatParser::parseLogicOr() {
+    NodeRef node = parseLogicAnd();
+    while (accept(TokType::OR)) {
+        node = binary(BinOp::LOR, node, parseLogicAnd());
+    }
+    return node;
+}
+
+NodeRef FlatParser::parseLogicAnd() {
+    NodeRef node = parseEquality();
+    while (accept(TokType::AND)) {
+        node = binary(BinOp::LAND, node, parseEquality());
+    }
+    return node;
+}
+
+NodeRef FlatParser::parseEquality() {
+    NodeRef node = parseComparison();
+    while (1) {
+        if (accept(TokType::EQUALS)) {
+            node = binary(BinOp::EQUALS, node, parseComparison());
+        } else if (accept(TokType::NEQUALS)) {
+            node = binary(BinOp::NEQUALS, node, parseComparison());
+        } else {
+            break;
+        }
+    }
+    return node;
+}
+
+NodeRef FlatParser::parseComparison() {
+    NodeRef node = parseTerm();
+    while (1) {
+        if (accept(TokType::GREATER)) {
+            node = binary(BinOp::GREATER, node, parseTerm());
+        } else if (accept(TokType::GEQUALS)) {
+            node = binary(BinOp::GEQUALS, node, parseTerm());
+        } else if (accept(TokType::LESS)) {
+            node = binary(BinOp::LESS, node, parseTerm());
+        } else if (accept(TokType::LEQUALS)) {
+            node = binary(BinOp::LEQUALS, node, parseTerm());
+        } else {
+            break;
+        }
+    }
+    return node;
+}
+
+NodeRef FlatParser::parseTerm() {
+    NodeRef node = parseFactor();
+    while (1) {
+        if (accept(TokType::PLUS)) {
+            node = binary(BinOp::ADD, node, parseFactor());
+        } else if (accept(TokType::MINUS)) {
+            node = binary(BinOp::SUB, node, parseFactor());
+        } else {
+            break;
+        }
+    }
+    return node;
+}
+
+NodeRef FlatParser::parseFactor() {
+    NodeRef node = parseUnary();
+    while (1) {
+        if (accept(TokType::MUL)) {
+            node = binary(BinOp::MUL, node, parseUnary());
+        } else if (accept(TokType::DIV)) {
+            node = binary(BinOp::DIV, node, parseUnary());
+        } else if (accept(TokType::MOD)) {
+            node = binary(BinOp::MOD, node, parseUnary());
+        } else {
+            break;
+        }
+    }
+    return node;
+}
+
+NodeRef FlatParser::parseUnary() {
+    if (accept(TokType::MINUS)) {
+        NodeRef zero = ast->add({NodeKind::NUMBER, BinOp::ADD, 0, 0, 0, 0});
+        return binary(BinOp::SUB, zero, parseUnary());
+    }
+    return parseCall();
+}
+
+NodeRef FlatParser::parseCall() {
+    bool plain = peek().type == TokType::IDENTIFIER && peek(1).type == TokType::LPAREN;
+    bool namespaced = peek().type == TokType::IDENTIFIER && peek(1).type == TokType::DOT;
+    if (!plain && !namespaced) {
+        return parsePrimary();
+    }
+
+    NameRef namesp = NO_NODE;
+    if (namespaced) {
+        namesp = ast->name(expect(TokType::IDENTIFIER).value);
+        expect(TokType::DOT);
+    }
+    std::string_view id = expect(TokType::IDENTIFIER).value;
+
+    expect(TokType::LPAREN);
+    size_t mark = scratch.size();
+    if (!accept(TokType::RPAREN)) {
+        do {
+            NodeRef arg = parseExpression();
+            scratch.push_back(arg);
+        } while (accept(TokType::COMMA));
+        expect(TokType::RPAREN);
+    }
+
+    if (plain && (id == "max" || id == "min")) {
+        size_t argc = scratch.size() - mark;
+        if (argc != 2) {
+            throw std::runtime_error(std::string(id == "max" ? "Max" : "Min")
+                + " operation expects 2 arguments but got: " + std::to_string(argc));
+        }
+        NodeRef lhs = scratch[mark], rhs = scratch[mark + 1];
+        scratch.resize(mark);
+        return binary(id == "max" ? BinOp::MAX : BinOp::MIN, lhs, rhs);
+    }
+
+    FlatNode node = {NodeKind::CALL, BinOp::ADD, 0, ast->name(id), namesp, 0};
+    node.c = commitList(mark, node.count);
+    return ast->add(node);
+}
+
+NodeRef FlatParser::parsePrimary() {
+    Token tok = next();
+
+    if (tok.type == TokType::NUMBER) {
+        int32_t val = 0;
+        const char* end = tok.value.data() + tok.value.size();
+        auto res = std::from_chars(tok.value.data(), end, val);
+        if (res.ec == std::errc() && res.ptr != end) {
+            throw CompileError("Not supported by the flat parser: " + tokenDescription(tok), tok.line, tok.col);
+        }
+        if (res.ec != std::errc()) {
+            throw CompileError("Number out of range: " + tokenDescription(tok), tok.line, tok.col);
+        }
+        return ast->add({NodeKind::NUMBER, BinOp::ADD, 0, (uint32_t) val, 0, 0});
+    } else if (tok.type == TokType::IDENTIFIER) {
+        return ast->add({NodeKind::VAR, BinOp::ADD, 0, ast->name(tok.value), 0, 0});
+    } else if (tok.type == TokType::LPAREN) {
+        NodeRef expr = parseExpression();
+        expect(TokType::RPAREN);
+        return expr;
+    } else {
+        throw CompileError("Unexpected token: " + tokenDescription(tok), tok.line, tok.col);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef LUMA_FLAT_PARSER_H
+#define LUMA_FLAT_PARSER_H
+
+#include <vector>
+
+#include "FlatAST.h"
+#include "TokenStream.h"
+
+// Parser's grammar as it was before functions, builds a FlatAST instead of the
+// Program tree. `fn`, `const`, `for`, `return`, types and fixed-point numbers
+// are compile errors, it only exists for the comparison in bench/ast_bench.
+class FlatParser : public TokenStream {
+    FlatAST* ast = nullptr;
+    std::vector<NodeRef> scratch;   // children of the lists still being parsed
+
+    public:
+        using TokenStream::TokenStream;
+
+        std::unique_ptr<FlatAST> parse();
+
+    private:
+        NodeRef parseStatement();
+        NodeRef parseIfElse();
+        NodeRef parseLoop();
+        NodeRef parseBlock();
+        NodeRef parseVarDecl();
+
+        NodeRef parseExpression();
+        NodeRef parseAssignment();
+        NodeRef parseLogicOr();
+        NodeRef parseLogicAnd();
+        NodeRef parseEquality();
+        NodeRef parseComparison();
+        NodeRef parseTerm();
+        NodeRef parseFactor();
+        NodeRef parseUnary();
+        NodeRef parseCall();
+        NodeRef parsePrimary();
+
+        NodeRef binary(BinOp op, NodeRef lhs, NodeRef rhs);
+        // moves scratch[mark..] into ast->lists, returns the first index
+        uint32_t commitList(size_t mark, uint16_t& count);
+};
+
+#endif
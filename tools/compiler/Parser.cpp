@@ -1,52 +1,20 @@
 #include "Parser.h"
 
 #include <stdexcept>
+#include <charconv>
 
-#include "Tokenizer.h"
+#include "CompileError.h"
 
-Parser::Parser(std::vector<Token> toks) : toks(toks)
-{}
+std::unique_ptr<Program> Parser::parse() {
+    auto programArena = std::make_unique<Arena>();
+    arena = programArena.get();
 
-Parser::Parser(const std::string& src) {
-    auto tokenizer = Tokenizer(src);
-    toks = tokenizer.tokenizeAll();
-}
-
-Token Parser::peek(size_t amount) {
-    return toks[index + amount];
-}
-
-Token Parser::next() {
-    if (index >= toks.size()) {
-        throw std::runtime_error("Index out of bounds");
-    }
-    return toks[index++];
-}
-
-Token Parser::expect(TokType type) {
-    auto tok = next();
-    if (tok.type != type) {
-        throw std::runtime_error(std::string("Expected ") + tokTypeToString(type)
-            + std::string(", got ") + tokenToString(tok));
-    }
-    return tok;
-}
-
-bool Parser::accept(TokType type) {
-    if (peek().type == type) {
-        next();
-        return true;
-    }
-    return false;
-}
-
-Program* Parser::parse() {
-    auto tok = peek();
-    std::vector<Statement*> stmts;
-    std::vector<std::string> reqs;
+    Token tok = peek();
+    ArenaVector<Statement*> stmts(*arena);
+    ArenaVector<std::string_view> reqs(*arena);
     while (tok.type == TokType::REQUIRE) {
         next();
-        reqs.push_back(expect(TokType::IDENTIFIER).value);
+        reqs.push_back(arena->intern(expect(TokType::IDENTIFIER).value));
         expect(TokType::SEMICOLON);
         tok = peek();
     }
@@ -55,21 +23,24 @@ Program* Parser::parse() {
         stmts.push_back(parseStatement());
         tok = peek();
     }
-    return new Program(stmts, reqs);
+    arena = nullptr;
+    return std::make_unique<Program>(std::move(programArena), std::move(stmts), std::move(reqs));
 }
 
 Statement* Parser::parseStatement() {
     switch (peek().type) {
         case TokType::IF: return parseIfElse();
         case TokType::LOOP: return parseLoop();
+        case TokType::FOR: return parseFor();
         case TokType::LET: return parseVarDecl();
-        case TokType::FN: throw std::runtime_error("Functions not implemented yet!");
+        case TokType::FN: case TokType::CONST: return parseFnDecl();
+        case TokType::RETURN: return parseReturn();
         case TokType::LBRACE: return parseBlock();
     }
 
     Expression* expr = parseExpression();
     expect(TokType::SEMICOLON);
-    return new ExprStatement(expr);
+    return arena->make<ExprStatement>(expr);
 }
 
 Statement* Parser::parseIfElse() {
@@ -82,48 +53,183 @@ Statement* Parser::parseIfElse() {
     if (accept(TokType::ELSE)) {
         elseBody = parseStatement();
     }
-    return new IfElse(cond, body, elseBody);
+    return arena->make<IfElse>(cond, body, elseBody);
 }
 
 Statement* Parser::parseLoop() {
     expect(TokType::LOOP);
     auto* body = parseStatement();
-    return new LoopStmt(body);
+    return arena->make<LoopStmt>(body);
+}
+
+Statement* Parser::parseFor() {
+    expect(TokType::FOR);
+    std::string_view id = arena->intern(expect(TokType::IDENTIFIER).value);
+    expect(TokType::IN);
+    auto* from = parseExpression();
+    expect(TokType::DOTDOT);
+    auto* to = parseExpression();
+    auto* body = parseStatement();
+    // a space keeps the counter's name apart from every identifier
+    auto* count = arena->make<VarDeclaration>(arena->intern(std::string(id) + " count"));
+    return arena->make<ForStmt>(arena->make<VarDeclaration>(id), count, from, to, body);
 }
 
 Statement* Parser::parseBlock() {
     expect(TokType::LBRACE);
-    std::vector<Statement*> stmts;
+    ArenaVector<Statement*> stmts(*arena);
     while (peek().type != TokType::RBRACE) {
         stmts.push_back(parseStatement());
     }
     expect(TokType::RBRACE);
-    return new BlockStmt(stmts);
+    return arena->make<BlockStmt>(std::move(stmts));
 }
 
 Statement* Parser::parseVarDecl() {
     expect(TokType::LET);
-    std::string id = expect(TokType::IDENTIFIER).value;
+    std::string_view id = arena->intern(expect(TokType::IDENTIFIER).value);
+    bool typed = peek().type == TokType::COLON;
+    ValueType type = typed ? parseType() : ValueType::INT;
     Expression* expr = nullptr;
     if (accept(TokType::ASSIGN)) {
         expr = parseExpression();
     }
     expect(TokType::SEMICOLON);
-    return new VarDeclaration(id, expr);
+    auto* decl = arena->make<VarDeclaration>(id, expr);
+    decl->type = type;
+    decl->typed = typed;
+    return decl;
+}
+
+Statement* Parser::parseFnDecl() {
+    bool isConst = accept(TokType::CONST);
+    expect(TokType::FN);
+    std::string_view id = arena->intern(expect(TokType::IDENTIFIER).value);
+    expect(TokType::LPAREN);
+    ArenaVector<VarDeclaration*> params(*arena);
+    bool tabulated = false;
+    int32_t from = 0, to = 0;
+    if (peek().type != TokType::RPAREN) {
+        do {
+            std::string_view param = arena->intern(expect(TokType::IDENTIFIER).value);
+            params.push_back(arena->make<VarDeclaration>(param));
+            params.back()->typed = true;
+            if (peek().type == TokType::COLON) params.back()->type = parseType();
+            if (peek().type == TokType::IN) {
+                Token in = next();
+                if (!isConst || params.size() != 1 || tabulated) {
+                    throw CompileError("Only a const fn with a single parameter can be tabulated", in.line, in.col);
+                }
+                if (params.back()->type != ValueType::INT) {
+                    throw CompileError("A table is indexed by an int", in.line, in.col);
+                }
+                tabulated = true;
+                from = parseInteger();
+                expect(TokType::DOTDOT);
+                to = parseInteger();
+            }
+        } while (accept(TokType::COMMA));
+    }
+    Token close = expect(TokType::RPAREN);
+    if (tabulated && params.size() != 1) {
+        throw CompileError("Only a const fn with a single parameter can be tabulated", close.line, close.col);
+    }
+    ValueType returns = peek().type == TokType::COLON ? parseType() : ValueType::INT;
+    auto* body = parseStatement();
+    auto* fn = arena->make<FnDecl>(id, std::move(params), body);
+    fn->returns = returns;
+    fn->isConst = isConst;
+    fn->tabulated = tabulated;
+    fn->from = from;
+    fn->to = to;
+    return fn;
+}
+
+// a NUMBER, optionally negative
+int32_t Parser::parseInteger() {
+    bool negative = accept(TokType::MINUS);
+    Token tok = expect(TokType::NUMBER);
+    int64_t val = 0;
+    auto res = std::from_chars(tok.value.data(), tok.value.data() + tok.value.size(), val);
+    if (negative) val = -val;
+    if (res.ptr != tok.value.data() + tok.value.size()) {
+        throw CompileError("Expected an integer: " + tokenDescription(tok), tok.line, tok.col);
+    }
+    if (res.ec != std::errc() || val < INT32_MIN || val > INT32_MAX) {
+        throw CompileError("Number out of range: " + tokenDescription(tok), tok.line, tok.col);
+    }
+    return (int32_t) val;
+}
+
+// `: int` or `: fixed`, the names aren't keywords
+ValueType Parser::parseType() {
+    expect(TokType::COLON);
+    Token tok = expect(TokType::IDENTIFIER);
+    if (tok.value == "int") return ValueType::INT;
+    if (tok.value == "fixed") return ValueType::FIXED;
+    throw CompileError("Unknown type: " + std::string(tok.value), tok.line, tok.col);
+}
+
+/*
+ * A number with a fraction as Q16.16, rounded to the nearest 1/65536.
+ * Digits past the 12th can't change that and are ignored, the integer part
+ * has to be below 32768.
+ */
+static int32_t parseFixed(const Token& tok) {
+    size_t dot = tok.value.find('.');
+    int64_t whole = 0;
+    auto res = std::from_chars(tok.value.data(), tok.value.data() + dot, whole);
+    std::string_view digits = tok.value.substr(dot + 1, 12);
+    uint64_t frac = 0, scale = 1;
+    for (char c : digits) {
+        frac = frac * 10 + (uint64_t) (c - '0');
+        scale *= 10;
+    }
+    int64_t val = whole * 65536 + (int64_t) ((frac * 65536 + scale / 2) / scale);
+    if (res.ec != std::errc() || val > INT32_MAX) {
+        throw CompileError("Fixed-point number out of range: " + tokenDescription(tok), tok.line, tok.col);
+    }
+    return (int32_t) val;
+}
+
+Statement* Parser::parseReturn() {
+    expect(TokType::RETURN);
+    Expression* expr = nullptr;
+    if (peek().type != TokType::SEMICOLON) {
+        expr = parseExpression();
+    }
+    expect(TokType::SEMICOLON);
+    return arena->make<ReturnStmt>(expr);
 }
 
 
 
+// an expression starts at its first token, a binary one where its lhs does
+template<typename T>
+static T* at(T* expr, const Token& first) {
+    expr->line = first.line;
+    expr->col = first.col;
+    return expr;
+}
+
+template<typename T>
+static T* at(T* expr, const Expression* lhs) {
+    expr->line = lhs->line;
+    expr->col = lhs->col;
+    return expr;
+}
+
 Expression* Parser::parseExpression() {
     return parseAssignment();
 }
 
 Expression* Parser::parseAssignment() {
     if (peek().type == TokType::IDENTIFIER && peek(1).type == TokType::ASSIGN) {
-        std::string id = expect(TokType::IDENTIFIER).value;
+        Token tok = expect(TokType::IDENTIFIER);
+        std::string_view id = arena->intern(tok.value);
         expect(TokType::ASSIGN);
         auto* expr = parseAssignment();
-        return new Assignment(id, expr);
+        return at(arena->make<Assignment>(id, expr), tok);
     }
     return parseLogicOr();
 }
@@ -132,7 +238,7 @@ Expression* Parser::parseLogicOr() {
     Expression* node = parseLogicAnd();
     while (accept(TokType::OR)) {
         Expression* rhs = parseLogicAnd();
-        node = new BinaryExpr(BinOp::LOR, node, rhs);
+        node = at(arena->make<BinaryExpr>(BinOp::LOR, node, rhs), node);
     }
     return node;
 }
@@ -141,7 +247,7 @@ Expression* Parser::parseLogicAnd() {
     Expression* node = parseEquality();
     while (accept(TokType::AND)) {
         Expression* rhs = parseEquality();
-        node = new BinaryExpr(BinOp::LAND, node, rhs);
+        node = at(arena->make<BinaryExpr>(BinOp::LAND, node, rhs), node);
     }
     return node;
 }
@@ -151,10 +257,10 @@ Expression* Parser::parseEquality() {
     while (1) {
         if (accept(TokType::EQUALS)) {
             Expression* rhs = parseComparison();
-            node = new BinaryExpr(BinOp::EQUALS, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::EQUALS, node, rhs), node);
         } else if (accept(TokType::NEQUALS)) {
             Expression* rhs = parseComparison();
-            node = new BinaryExpr(BinOp::NEQUALS, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::NEQUALS, node, rhs), node);
         } else {
             break;
         }
@@ -167,16 +273,16 @@ Expression* Parser::parseComparison() {
     while (1) {
         if (accept(TokType::GREATER)) {
             Expression* rhs = parseTerm();
-            node = new BinaryExpr(BinOp::GREATER, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::GREATER, node, rhs), node);
         } else if (accept(TokType::GEQUALS)) {
             Expression* rhs = parseTerm();
-            node = new BinaryExpr(BinOp::GEQUALS, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::GEQUALS, node, rhs), node);
         } else if (accept(TokType::LESS)) {
             Expression* rhs = parseTerm();
-            node = new BinaryExpr(BinOp::LESS, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::LESS, node, rhs), node);
         } else if (accept(TokType::LEQUALS)) {
             Expression* rhs = parseTerm();
-            node = new BinaryExpr(BinOp::LEQUALS, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::LEQUALS, node, rhs), node);
         } else {
             break;
         }
@@ -189,10 +295,10 @@ Expression* Parser::parseTerm() {
     while (1) {
         if (accept(TokType::PLUS)) {
             Expression* rhs = parseFactor();
-            node = new BinaryExpr(BinOp::ADD, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::ADD, node, rhs), node);
         } else if (accept(TokType::MINUS)) {
             Expression* rhs = parseFactor();
-            node = new BinaryExpr(BinOp::SUB, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::SUB, node, rhs), node);
         } else {
             break;
         }
@@ -205,13 +311,13 @@ Expression* Parser::parseFactor() {
     while (1) {
         if (accept(TokType::MUL)) {
             Expression* rhs = parseUnary();
-            node = new BinaryExpr(BinOp::MUL, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::MUL, node, rhs), node);
         } else if (accept(TokType::DIV)) {
             Expression* rhs = parseUnary();
-            node = new BinaryExpr(BinOp::DIV, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::DIV, node, rhs), node);
         } else if (accept(TokType::MOD)) {
             Expression* rhs = parseUnary();
-            node = new BinaryExpr(BinOp::MOD, node, rhs);
+            node = at(arena->make<BinaryExpr>(BinOp::MOD, node, rhs), node);
         } else {
             break;
         }
@@ -220,19 +326,21 @@ Expression* Parser::parseFactor() {
 }
 
 Expression* Parser::parseUnary() {
-    if (accept(TokType::MINUS)) {
+    if (peek().type == TokType::MINUS) {
+        Token tok = next();
         Expression* rhs = parseUnary();
-        return new BinaryExpr(BinOp::SUB, new NumberExpr(0), rhs);
+        return at(arena->make<BinaryExpr>(BinOp::SUB, at(arena->make<NumberExpr>(0), tok), rhs), tok);
     }
     return parseCall();
 }
 
 Expression* Parser::parseCall() {
+    Token first = peek();
     if (peek().type == TokType::IDENTIFIER && peek(1).type == TokType::LPAREN) {
-        std::string id = expect(TokType::IDENTIFIER).value;
+        std::string_view id = arena->intern(expect(TokType::IDENTIFIER).value);
 
         expect(TokType::LPAREN);
-        std::vector<Expression*> args;
+        ArenaVector<Expression*> args(*arena);
         if (!accept(TokType::RPAREN)) {
             args.push_back(parseExpression());
             while (accept(TokType::COMMA)) {
@@ -245,22 +353,22 @@ Expression* Parser::parseCall() {
             if (args.size() != 2) {
                 throw std::runtime_error("Max operation expects 2 arguments but got: " + std::to_string(args.size()));
             }
-            return new BinaryExpr(BinOp::MAX, args[0], args[1]);
+            return at(arena->make<BinaryExpr>(BinOp::MAX, args[0], args[1]), first);
         } else if (id == "min") {
             if (args.size() != 2) {
                 throw std::runtime_error("Min operation expects 2 arguments but got: " + std::to_string(args.size()));
             }
-            return new BinaryExpr(BinOp::MIN, args[0], args[1]);
+            return at(arena->make<BinaryExpr>(BinOp::MIN, args[0], args[1]), first);
         }
 
-        return new CallExpr(id, args);
+        return at(arena->make<CallExpr>(id, std::move(args)), first);
     } else if (peek().type == TokType::IDENTIFIER && peek(1).type == TokType::DOT) {
-        std::string namesp = expect(TokType::IDENTIFIER).value;
+        std::string_view namesp = arena->intern(expect(TokType::IDENTIFIER).value);
         expect(TokType::DOT);
-        std::string id = expect(TokType::IDENTIFIER).value;
+        std::string_view id = arena->intern(expect(TokType::IDENTIFIER).value);
 
         expect(TokType::LPAREN);
-        std::vector<Expression*> args;
+        ArenaVector<Expression*> args(*arena);
         if (!accept(TokType::RPAREN)) {
             args.push_back(parseExpression());
             while (accept(TokType::COMMA)) {
@@ -269,7 +377,7 @@ Expression* Parser::parseCall() {
             expect(TokType::RPAREN);
         }
 
-        return new CallExpr(id, args, namesp);
+        return at(arena->make<CallExpr>(id, std::move(args), namesp), first);
     }
     return parsePrimary();
 }
@@ -277,15 +385,22 @@ Expression* Parser::parseCall() {
 Expression* Parser::parsePrimary() {
     Token tok = next();
     
-    if (tok.type == TokType::NUMBER) {
-        return new NumberExpr(std::stoi(tok.value));
+    if (tok.type == TokType::NUMBER && tok.value.find('.') != std::string_view::npos) {
+        return at(arena->make<NumberExpr>(parseFixed(tok), true), tok);
+    } else if (tok.type == TokType::NUMBER) {
+        int32_t val = 0;
+        auto res = std::from_chars(tok.value.data(), tok.value.data() + tok.value.size(), val);
+        if (res.ec != std::errc()) {
+            throw CompileError("Number out of range: " + tokenDescription(tok), tok.line, tok.col);
+        }
+        return at(arena->make<NumberExpr>(val), tok);
     } else if (tok.type == TokType::IDENTIFIER) {
-        return new VarExpr(tok.value);
+        return at(arena->make<VarExpr>(arena->intern(tok.value)), tok);
     } else if (tok.type == TokType::LPAREN) {
         Expression* expr = parseExpression();
         expect(TokType::RPAREN);
         return expr;
     } else {
-        throw std::runtime_error(std::string("Unexpected token: " + tokenToString(tok)));
+        throw CompileError("Unexpected token: " + tokenDescription(tok), tok.line, tok.col);
     }
 }
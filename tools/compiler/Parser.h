@@ -1,48 +1,40 @@
 #ifndef LUMA_PARSER_H
 #define LUMA_PARSER_H
 
+#include <ostream>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <memory>
 #include <vector>
 
+#include "Arena.h"
+#include "BinOp.h"
 #include "Token.h"
+#include "TokenStream.h"
 #include "visitors/Visitor.h"
 
 #define IDENT "  "
 
-enum class BinOp {
-    ADD, SUB, MUL, DIV, MOD,
-    MAX, MIN,
-    EQUALS, NEQUALS,
-    GREATER, LESS, GEQUALS, LEQUALS,
-    LOR, LAND
-};
+// of a variable, a function's result or an expression: a plain integer or a Q16.16 `fixed`
+enum class ValueType : uint8_t { INT, FIXED };
 
-static std::string binOpToString(const BinOp& op) {
-    switch (op) {
-        case BinOp::ADD: return "ADD";
-        case BinOp::SUB: return "SUB";
-        case BinOp::MUL: return "MUL";
-        case BinOp::DIV: return "DIV";
-        case BinOp::MOD: return "MOD";
-        case BinOp::MAX: return "MAX";
-        case BinOp::MIN: return "MIN";
-        case BinOp::EQUALS: return "EQUALS";
-        case BinOp::NEQUALS: return "NEQUALS";
-        case BinOp::GREATER: return "GREATER";
-        case BinOp::LESS: return "LESS";
-        case BinOp::GEQUALS: return "GEQUALS";
-        case BinOp::LEQUALS: return "LEQUALS";
-        default: return "UNKOWN";
-    }
+inline const char* valueTypeName(ValueType type) {
+    return type == ValueType::FIXED ? "fixed" : "int";
 }
 
 class ASTNode {
     public:
-        virtual std::string to_string(size_t identLevel = 0) {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("ASTNode");
-            return ret;
+        std::string to_string(size_t identLevel = 0) {
+            std::ostringstream os;
+            print(os, identLevel);
+            return os.str();
+        }
+
+        // streams the tree, so dumping a large program doesn't build it up in one string
+        virtual void print(std::ostream& os, size_t identLevel = 0) {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "ASTNode";
         }
 
         virtual inline int visit(Visitor* visitor) = 0;
@@ -50,11 +42,11 @@ class ASTNode {
 
 class Expression : public ASTNode {
     public:
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("Expression");
-            return ret;
+        size_t line = 0, col = 0;   // of its first token, 0-based like Token. Only the parser's nodes have one
+
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "Expression";
         }
 
         virtual inline int visit(Visitor* visitor) override = 0;
@@ -70,19 +62,17 @@ class BinaryExpr : public Expression {
         BinaryExpr(BinOp op, Expression* lhs, Expression* rhs)
             : op(op), lhs(lhs), rhs(rhs) {}
 
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("BinaryExpr (");
-            ret.append(binOpToString(op));
-            ret.append("): {\n");
-            ret.append(lhs->to_string(identLevel+1));
-            ret.append(",\n");
-            ret.append(rhs->to_string(identLevel+1));
-            ret.append("\n");
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("}");
-            return ret;
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "BinaryExpr (";
+            os << binOpToString(op);
+            os << "): {\n";
+            lhs->print(os, identLevel+1);
+            os << ",\n";
+            rhs->print(os, identLevel+1);
+            os << "\n";
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "}";
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -92,24 +82,23 @@ class BinaryExpr : public Expression {
 
 class Assignment : public Expression {
     public:
-        std::string id;
+        std::string_view id;
         Expression* expr;
+        VarDeclaration* decl = nullptr;     // set by VarResolver
     
     public:
-        Assignment(const std::string& id, Expression* expr)
+        Assignment(std::string_view id, Expression* expr)
             : id(id), expr(expr) {}
 
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("Assignment (");
-            ret.append(id);
-            ret.append("): {\n");
-            ret.append(expr->to_string(identLevel+1));
-            ret.append("\n");
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("}");
-            return ret;
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "Assignment (";
+            os << id;
+            os << "): {\n";
+            expr->print(os, identLevel+1);
+            os << "\n";
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "}";
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -119,33 +108,37 @@ class Assignment : public Expression {
 
 class CallExpr : public Expression {
     public:
-        std::string id, namesp;
-        std::vector<Expression*> args;
+        std::string_view id, namesp;
+        ArenaVector<Expression*> args;
+        FnDecl* fn = nullptr;       // the user function called, set by VarResolver
 
     public:
-        CallExpr(const std::string& id, std::vector<Expression*> args, std::string namesp = "")
-            : id(id), args(args), namesp(namesp) {}
+        CallExpr(std::string_view id, ArenaVector<Expression*> args, std::string_view namesp = {})
+            : id(id), args(std::move(args)), namesp(namesp) {}
+
+        // `int(x)` or `fixed(x)`, replaced by TypeChecker
+        bool isConversion() const {
+            return namesp.size() == 0 && (id == "int" || id == "fixed");
+        }
 
-        virtual std::string to_string(size_t identLevel = 0) {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("CallExpr (");
+        virtual void print(std::ostream& os, size_t identLevel = 0) {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "CallExpr (";
             if (namesp.size() > 0) {
-                ret.append(namesp);
-                ret.append(".");
+                os << namesp;
+                os << ".";
             }
-            ret.append(id);
-            ret.append(")");
+            os << id;
+            os << ")";
             if (args.size() > 0) {
-                ret.append(": {\n");
+                os << ": {\n";
                 for (const auto& arg : args) {
-                    ret.append(arg->to_string(identLevel+1));
-                    ret.append(",\n");
+                    arg->print(os, identLevel+1);
+                    os << ",\n";
                 }
-                for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-                ret.append("}");
+                for (int i = 0; i < identLevel; i++) os << IDENT;
+                os << "}";
             }
-            return ret;
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -156,17 +149,17 @@ class CallExpr : public Expression {
 class NumberExpr : public Expression {
     public:
         int32_t val;
+        bool fixed = false;     // written with a fraction like 0.25, val is the Q16.16 number
 
     public:
-        NumberExpr(int32_t val)
-            : val(val) {}
-
-        virtual std::string to_string(size_t identLevel = 0) {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("NumberExpr: ");
-            ret.append(std::to_string(val));
-            return ret;
+        NumberExpr(int32_t val, bool fixed = false)
+            : val(val), fixed(fixed) {}
+
+        virtual void print(std::ostream& os, size_t identLevel = 0) {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "NumberExpr: ";
+            os << val;
+            if (fixed) os << " (fixed)";
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -176,18 +169,17 @@ class NumberExpr : public Expression {
 
 class VarExpr : public Expression {
     public:
-        std::string id;
+        std::string_view id;
+        VarDeclaration* decl = nullptr;     // set by VarResolver
 
     public:
-        VarExpr(const std::string& id)
+        VarExpr(std::string_view id)
             : id(id) {}
 
-        virtual std::string to_string(size_t identLevel = 0) {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("VarExpr: ");
-            ret.append(id);
-            return ret;
+        virtual void print(std::ostream& os, size_t identLevel = 0) {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "VarExpr: ";
+            os << id;
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -197,11 +189,9 @@ class VarExpr : public Expression {
 
 class Statement : public ASTNode {
     public:
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("Statement");
-            return ret;
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "Statement";
         }
 
         virtual inline int visit(Visitor* visitor) override = 0;
@@ -215,12 +205,10 @@ class ExprStatement : public Statement {
         ExprStatement(Expression* expr)
             : expr(expr) {}
 
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("ExprStatement:\n");
-            ret.append(expr->to_string(identLevel+1));
-            return ret;
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "ExprStatement:\n";
+            expr->print(os, identLevel+1);
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -239,26 +227,24 @@ class IfElse : public Statement {
         IfElse(Expression* cond, Statement* ifBody, Statement* elseBody = nullptr)
             : cond(cond), ifBody(ifBody), elseBody(elseBody) {}
 
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("If: {\n");
-            for (int i = 0; i < identLevel+1; i++) ret.append(IDENT);
-            ret.append("condition:\n");
-            ret.append(cond->to_string(identLevel+2));
-            for (int i = 0; i < identLevel+1; i++) ret.append(IDENT);
-            ret.append("body:\n");
-            ret.append(ifBody->to_string(identLevel+2));
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "If: {\n";
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "condition:\n";
+            cond->print(os, identLevel+2);
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "body:\n";
+            ifBody->print(os, identLevel+2);
             if (elseBody != nullptr) {
-                ret.append("\n");
-                for (int i = 0; i < identLevel+1; i++) ret.append(IDENT);
-                ret.append("else body:\n");
-                ret.append(elseBody->to_string(identLevel+1));
+                os << "\n";
+                for (int i = 0; i < identLevel+1; i++) os << IDENT;
+                os << "else body:\n";
+                elseBody->print(os, identLevel+1);
             }
-            ret.append("\n");
-            for (int i = 0; i < identLevel+1; i++) ret.append(IDENT);
-            ret.append("}");
-            return ret;
+            os << "\n";
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "}";
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -275,12 +261,10 @@ class LoopStmt : public Statement {
         LoopStmt(Statement* body)
             : body(body) {}
 
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("Loop:\n");
-            ret.append(body->to_string(identLevel+1));
-            return ret;
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "Loop:\n";
+            body->print(os, identLevel+1);
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -291,23 +275,21 @@ class LoopStmt : public Statement {
 
 class BlockStmt : public Statement {
     public:
-        std::vector<Statement*> stmts;
+        ArenaVector<Statement*> stmts;
 
     public:
-        BlockStmt(std::vector<Statement*> stmts)
-            : stmts(stmts) {}
+        BlockStmt(ArenaVector<Statement*> stmts)
+            : stmts(std::move(stmts)) {}
 
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("Block: {\n");
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "Block: {\n";
             for (const auto& stmt : stmts) {
-                ret.append(stmt->to_string(identLevel+1));
-                ret.append(",\n");
+                stmt->print(os, identLevel+1);
+                os << ",\n";
             }
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("}");
-            return ret;
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "}";
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -318,24 +300,26 @@ class BlockStmt : public Statement {
 
 class VarDeclaration : public Statement {
     public:
-        std::string id;
+        std::string_view id;
         Expression* expr;
+        uint32_t index = 0;     // number of the declaration in program order, set by VarResolver
+        ValueType type = ValueType::INT;
+        bool typed = false;     // declared with a type, otherwise a `let` has its initializer's, see TypeChecker
 
     public:
-        VarDeclaration(const std::string& id, Expression* expr = nullptr)
+        VarDeclaration(std::string_view id, Expression* expr = nullptr)
             : id(id), expr(expr) {}
 
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("VarDeclaration (");
-            ret.append(id);
-            ret.append(")");
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "VarDeclaration (";
+            os << id;
+            if (type != ValueType::INT) os << ": " << valueTypeName(type);
+            os << ")";
             if (expr != nullptr) {
-                ret.append(":\n");
-                ret.append(expr->to_string(identLevel+1));
+                os << ":\n";
+                expr->print(os, identLevel+1);
             }
-            return ret;
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -344,41 +328,142 @@ class VarDeclaration : public Statement {
         }
 };
 
-// TODO: Function
+// `for i in from..to body`: i counts from `from` up to `to - 1`, both are evaluated once before the first round
+class ForStmt : public Statement {
+    public:
+        VarDeclaration* var;
+        VarDeclaration* count;      // rounds left, a variable of its own the source can't name
+        Expression* from;
+        Expression* to;
+        Statement* body;
 
-class Program : public ASTNode {
     public:
-        std::vector<Statement*> stmts;
-        std::vector<std::string> reqs;
+        ForStmt(VarDeclaration* var, VarDeclaration* count, Expression* from, Expression* to, Statement* body)
+            : var(var), count(count), from(from), to(to), body(body) {}
+
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "For (" << var->id << "):\n";
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "from:\n";
+            from->print(os, identLevel+2);
+            os << "\n";
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "to:\n";
+            to->print(os, identLevel+2);
+            os << "\n";
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "body:\n";
+            body->print(os, identLevel+2);
+        }
+
+        virtual inline int visit(Visitor* visitor) override {
+            visitor->visitForStmt(this);
+            return 0;
+        }
+};
+
+class ReturnStmt : public Statement {
+    public:
+        Expression* expr;           // nullptr for a bare `return;`
+        FnDecl* fn = nullptr;       // function returned from, set by VarResolver
 
     public:
-        Program(std::vector<Statement*> stmts, std::vector<std::string> reqs)
-            : stmts(stmts), reqs(reqs) {}
+        ReturnStmt(Expression* expr = nullptr)
+            : expr(expr) {}
+
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "Return";
+            if (expr != nullptr) {
+                os << ":\n";
+                expr->print(os, identLevel+1);
+            }
+        }
 
-        virtual std::string to_string(size_t identLevel = 0) override {
-            std::string ret = "";
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("Program: {\n");
-            for (int i = 0; i < identLevel+1; i++) ret.append(IDENT);
-            ret.append("Requires: [\n");
+        virtual inline int visit(Visitor* visitor) override {
+            visitor->visitReturnStmt(this);
+            return 0;
+        }
+};
+
+class FnDecl : public Statement {
+    public:
+        std::string_view id;
+        ArenaVector<VarDeclaration*> params;
+        Statement* body;
+        uint32_t index = 0;         // number of the function in program order, set by VarResolver
+        bool returnsValue = false;  // a `return` has a value, set by VarResolver
+        ValueType returns = ValueType::INT;
+
+        // `const fn`: evaluated by the compiler where its arguments are constant
+        bool isConst = false;
+        // `const fn f(x in from..to)`: every call is a lookup in a table of f(from)..f(to - 1)
+        bool tabulated = false;
+        int32_t from = 0, to = 0;
+        uint32_t tableBase = 0;     // constant pool index of f(from), set by ConstEvaluator
+
+    public:
+        FnDecl(std::string_view id, ArenaVector<VarDeclaration*> params, Statement* body)
+            : id(id), params(std::move(params)), body(body) {}
+
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "FnDecl (";
+            if (isConst) os << "const ";
+            os << id;
+            os << "(";
+            for (size_t i = 0; i < params.size(); i++) {
+                if (i > 0) os << ", ";
+                os << params[i]->id;
+                if (params[i]->type != ValueType::INT) os << ": " << valueTypeName(params[i]->type);
+            }
+            if (tabulated) os << " in " << from << ".." << to;
+            os << ")";
+            if (returns != ValueType::INT) os << ": " << valueTypeName(returns);
+            os << "):\n";
+            body->print(os, identLevel+1);
+        }
+
+        virtual inline int visit(Visitor* visitor) override {
+            visitor->visitFnDecl(this);
+            return 0;
+        }
+};
+
+// Owns the arena every node of the tree lives in, destroying it frees the whole compile
+class Program : public ASTNode {
+    public:
+        std::unique_ptr<Arena> arena;
+        ArenaVector<Statement*> stmts;
+        ArenaVector<std::string_view> reqs;
+
+    public:
+        Program(std::unique_ptr<Arena> arena, ArenaVector<Statement*> stmts, ArenaVector<std::string_view> reqs)
+            : arena(std::move(arena)), stmts(std::move(stmts)), reqs(std::move(reqs)) {}
+
+        virtual void print(std::ostream& os, size_t identLevel = 0) override {
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "Program: {\n";
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "Requires: [\n";
             for (auto req : reqs) {
-                for (int i = 0; i < identLevel+2; i++) ret.append(IDENT);
-                ret.append(req);
-                ret.append(",\n");
+                for (int i = 0; i < identLevel+2; i++) os << IDENT;
+                os << req;
+                os << ",\n";
             }
-            for (int i = 0; i < identLevel+1; i++) ret.append(IDENT);
-            ret.append("]\n");
-            for (int i = 0; i < identLevel+1; i++) ret.append(IDENT);
-            ret.append("Statements: [\n");
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "]\n";
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "Statements: [\n";
             for (auto stmt : stmts) {
-                ret.append(stmt->to_string(identLevel+2));
-                ret.append(",\n");
+                stmt->print(os, identLevel+2);
+                os << ",\n";
             }
-            for (int i = 0; i < identLevel+1; i++) ret.append(IDENT);
-            ret.append("]\n");
-            for (int i = 0; i < identLevel; i++) ret.append(IDENT);
-            ret.append("}");
-            return ret;
+            for (int i = 0; i < identLevel+1; i++) os << IDENT;
+            os << "]\n";
+            for (int i = 0; i < identLevel; i++) os << IDENT;
+            os << "}";
         }
 
         virtual inline int visit(Visitor* visitor) override {
@@ -387,30 +472,25 @@ class Program : public ASTNode {
         }
 };
 
-class Parser {
-    std::vector<Statement*> stmts;
-    std::vector<Token> toks;
-
-    size_t index = 0;
+class Parser : public TokenStream {
+    Arena* arena = nullptr;     // arena of the Program being parsed
 
     public:
-        Parser(std::vector<Token> toks);
-        Parser(const std::string& src);
+        using TokenStream::TokenStream;
 
-        Program* parse();
+        std::unique_ptr<Program> parse();
 
     private:
-        Token peek(size_t amount = 0);
-        Token next();
-        Token expect(TokType type);
-        bool accept(TokType type);
-
         Statement* parseStatement();
         Statement* parseIfElse();
         Statement* parseLoop();
+        Statement* parseFor();
         Statement* parseBlock();
         Statement* parseVarDecl();
-        // Statement* parseFnDecl();
+        Statement* parseFnDecl();
+        Statement* parseReturn();
+        int32_t parseInteger();
+        ValueType parseType();
 
         Expression* parseExpression();
         Expression* parseAssignment();
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
 
 enum class TokType {
     // Keywords
@@ -11,8 +12,11 @@ enum class TokType {
     ELSE,
     RETURN,
     LOOP,
+    FOR,
     LET,
     FN,
+    CONST,
+    IN,
 
     // Operators
     NOT,
@@ -26,7 +30,7 @@ enum class TokType {
     COMMA, SEMICOLON,
     LPAREN, RPAREN,
     LBRACE, RBRACE,
-    ASSIGN, DOT,
+    ASSIGN, DOT, DOTDOT, COLON,
 
     IDENTIFIER,
     NUMBER,
@@ -38,10 +42,10 @@ struct Token {
     size_t line;
     size_t col;
     size_t length;
-    std::string value = "";
+    std::string_view value = {};   // view into the source, only set for identifiers and numbers
 };
 
-static std::string tokTypeToString(const TokType& type) {
+inline std::string tokTypeToString(const TokType& type) {
     std::string out = "";
     switch (type) {
         case TokType::REQUIRE: {
@@ -59,12 +63,21 @@ static std::string tokTypeToString(const TokType& type) {
         case TokType::LOOP: {
             out = "LOOP";
         } break;
+        case TokType::FOR: {
+            out = "FOR";
+        } break;
         case TokType::LET: {
             out = "LET";
         } break;
         case TokType::FN: {
             out = "FN";
         } break;
+        case TokType::CONST: {
+            out = "CONST";
+        } break;
+        case TokType::IN: {
+            out = "IN";
+        } break;
         case TokType::NOT: {
             out = "NOT";
         } break;
@@ -131,6 +144,12 @@ static std::string tokTypeToString(const TokType& type) {
         case TokType::DOT: {
             out = "DOT";
         } break;
+        case TokType::DOTDOT: {
+            out = "DOTDOT";
+        } break;
+        case TokType::COLON: {
+            out = "COLON";
+        } break;
         case TokType::IDENTIFIER: {
             out = "IDENTIFIER";
         } break;
@@ -144,7 +163,7 @@ static std::string tokTypeToString(const TokType& type) {
     return out;
 }
 
-static std::string tokenToString(const Token& tok) {
+inline std::string tokenToString(const Token& tok) {
     std::string out = tokTypeToString(tok.type);
     out.append("(");
     out.append(std::to_string(tok.line));
@@ -155,11 +174,22 @@ static std::string tokenToString(const Token& tok) {
         out.append(std::to_string(tok.col + tok.length-1));
     }
     out.append(")");
-    if (tok.value != "") {
+    if (!tok.value.empty()) {
         out.append(": ");
         out.append(tok.value);
     }
     return out;
 }
 
+// for diagnostics, which carry the position themselves
+inline std::string tokenDescription(const Token& tok) {
+    std::string out = tokTypeToString(tok.type);
+    if (!tok.value.empty()) {
+        out.append(" '");
+        out.append(tok.value);
+        out.append("'");
+    }
+    return out;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "TokenStream.h"
+
+#include <stdexcept>
+
+#include "CompileError.h"
+
+TokenStream::TokenStream(std::string_view src) : tokenizer(src)
+{}
+
+TokenStream::TokenStream(std::string&& src) : ownedSrc(std::move(src)), tokenizer(ownedSrc)
+{}
+
+const Token& TokenStream::peek(size_t amount) {
+    if (amount >= LOOKAHEAD) {
+        throw std::logic_error("Parser lookahead exceeded");
+    }
+    while (count <= amount) {
+        window[(head + count) % LOOKAHEAD] = tokenizer.nextToken();
+        count++;
+    }
+    return window[(head + amount) % LOOKAHEAD];
+}
+
+Token TokenStream::next() {
+    Token tok = peek();
+    head = (head + 1) % LOOKAHEAD;
+    count--;
+    return tok;
+}
+
+Token TokenStream::expect(TokType type) {
+    Token tok = next();
+    if (tok.type != type) {
+        throw CompileError(std::string("Expected ") + tokTypeToString(type)
+            + std::string(", got ") + tokenDescription(tok), tok.line, tok.col);
+    }
+    return tok;
+}
+
+bool TokenStream::accept(TokType type) {
+    if (peek().type == type) {
+        next();
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,33 @@
+#ifndef LUMA_TOKEN_STREAM_H
+#define LUMA_TOKEN_STREAM_H
+
+#include <string>
+#include <string_view>
+
+#include "Token.h"
+#include "Tokenizer.h"
+
+// Pulls tokens from the Tokenizer on demand, keeping only the lookahead window
+class TokenStream {
+    static constexpr size_t LOOKAHEAD = 2;
+
+    std::string ownedSrc;
+    Tokenizer tokenizer;        // tokens are views into the source
+    Token window[LOOKAHEAD];    // ring buffer of upcoming tokens
+    size_t head = 0, count = 0;
+
+    public:
+        // borrows src, the caller keeps it alive until parsing is done
+        TokenStream(std::string_view src);
+        TokenStream(std::string&& src);
+        TokenStream(const TokenStream&) = delete;
+        TokenStream& operator=(const TokenStream&) = delete;
+
+    protected:
+        const Token& peek(size_t amount = 0);
+        Token next();
+        Token expect(TokType type);
+        bool accept(TokType type);
+};
+
+#endif
@@ -1,103 +1,126 @@
 #include "Tokenizer.h"
 
-#include <iostream>
+#include <cctype>
+#include <string>
 
-Tokenizer::Tokenizer(const std::string &src) : src(std::move(src))
+#include "CompileError.h"
+
+namespace {
+    struct Keyword {
+        std::string_view text;
+        TokType type;
+    };
+
+    constexpr Keyword KEYWORDS[] = {
+        {"require", TokType::REQUIRE},
+        {"if", TokType::IF},
+        {"else", TokType::ELSE},
+        {"return", TokType::RETURN},
+        {"loop", TokType::LOOP},
+        {"for", TokType::FOR},
+        {"let", TokType::LET},
+        {"fn", TokType::FN},
+        {"const", TokType::CONST},
+        {"in", TokType::IN},
+        {"and", TokType::AND},
+        {"or", TokType::OR},
+    };
+
+    // Perfect hash over (length, first char, last char), collisions are rejected at compile time
+    constexpr size_t KEYWORD_SLOTS = 32;
+
+    constexpr size_t keywordHash(std::string_view s) {
+        return (s.size() + (size_t) s.front() * 2 + (size_t) s.back()) & (KEYWORD_SLOTS - 1);
+    }
+
+    struct KeywordTable {
+        Keyword slots[KEYWORD_SLOTS] = {};
+        bool collision = false;
+
+        constexpr KeywordTable() {
+            for (const auto& kw : KEYWORDS) {
+                auto& slot = slots[keywordHash(kw.text)];
+                if (!slot.text.empty()) collision = true;
+                slot = kw;
+            }
+        }
+    };
+
+    constexpr KeywordTable KEYWORD_TABLE;
+    static_assert(!KEYWORD_TABLE.collision, "keyword hash collision, adjust keywordHash");
+
+    // returns IDENTIFIER for non-keywords
+    inline TokType lookupKeyword(std::string_view s) {
+        const Keyword& kw = KEYWORD_TABLE.slots[keywordHash(s)];
+        return kw.text == s ? kw.type : TokType::IDENTIFIER;
+    }
+
+    inline bool isIdentStart(char c) {
+        return std::isalpha((unsigned char) c) || c == '_';
+    }
+
+    inline bool isIdentChar(char c) {
+        return std::isalnum((unsigned char) c) || c == '_';
+    }
+
+    inline bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+}
+
+Tokenizer::Tokenizer(std::string_view src) : src(src)
 {
     line = 0;
     col = 0;
     index = 0;
 }
 
-std::vector<Token> Tokenizer::tokenizeAll()
-{
-    while (nextToken().type != TokType::T_EOF);
-    return tokens;
-}
-
 Token Tokenizer::nextToken()
 {
-    char cur = src[index];
+    char cur = at(index);
 
-    while (index < src.length() && (cur == ' ' || cur == '\t' || cur == '\n' || cur == '\r' || (cur == '/' && src[index+1] == '/'))) {
+    while (index < src.length() && (cur == ' ' || cur == '\t' || cur == '\n' || cur == '\r' || (cur == '/' && at(index+1) == '/'))) {
         if (cur == '\n') {
             line++;
             col = 0;
-        } else if (cur == '/' && src[index+1] == '/') {
-            while (src[++index] != '\n');
+        } else if (cur == '/' && at(index+1) == '/') {
+            while (index + 1 < src.length() && src[++index] != '\n');
             line++;
             col = 0;
         } else {
             col++;
         }
-        cur = src[++index];
-    }
-
-    while (index < src.length() && (cur == ' ' || cur == '\t' || cur == '\n' || cur == '\r')) {
-        if (cur == '\n') {
-            line++;
-            col = 0;
-        } else {
-            col++;
-        }
-        cur = src[++index];
+        cur = at(++index);
     }
 
     if (index >= src.length()) {
-        Token t = Token{TokType::T_EOF, line, col, 0};
-        tokens.push_back(t);
-        return t;
+        return Token{TokType::T_EOF, line, col, 0};
     }
 
-    if (isalpha(cur) || cur == '_') {
-        std::string buf = "";
-        buf += cur;
-        cur = src[++index];
-        while (isalnum(cur) || cur == '_') {
-            buf += cur;
-            cur = src[++index];
-        }
-
-        Token t = Token{TokType::T_EOF, 0, 0, 0};
-        if (buf == "require") {
-            t = Token{TokType::REQUIRE, line, col, buf.length()};
-        } else if (buf == "if") {
-            t = Token{TokType::IF, line, col, buf.length()};
-        } else if (buf == "else") {
-            t = Token{TokType::ELSE, line, col, buf.length()};
-        } else if (buf == "return") {
-            t = Token{TokType::RETURN, line, col, buf.length()};
-        } else if (buf == "loop") {
-            t = Token{TokType::LOOP, line, col, buf.length()};
-        } else if (buf == "let") {
-            t = Token{TokType::LET, line, col, buf.length()};
-        } else if (buf == "fn") {
-            t = Token{TokType::FN, line, col, buf.length()};
-        } else if (buf == "and") {
-            t = Token{TokType::AND, line, col, buf.length()};
-        } else if (buf == "or") {
-            t = Token{TokType::OR, line, col, buf.length()};
-        }
+    if (isIdentStart(cur)) {
+        size_t start = index++;
+        while (isIdentChar(at(index))) index++;
+        std::string_view text = src.substr(start, index - start);
 
-        if (t.type == TokType::T_EOF) {
-            t = Token{TokType::IDENTIFIER, line, col, buf.length(), buf};
-        }
-        tokens.push_back(t);
-        col += buf.length();
+        TokType type = lookupKeyword(text);
+        Token t = type == TokType::IDENTIFIER
+            ? Token{TokType::IDENTIFIER, line, col, text.length(), text}
+            : Token{type, line, col, text.length()};
+        col += text.length();
         return t;
     }
 
-    if (isdigit(cur)) {
-        std::string buf = "";
-        buf += cur;
-        cur = src[++index];
-        while (isdigit(cur)) {
-            buf += cur;
-            cur = src[++index];
+    if (isDigit(cur)) {
+        size_t start = index++;
+        while (isDigit(at(index))) index++;
+        // a fraction makes it a fixed-point number, `0..8` stays a range
+        if (at(index) == '.' && isDigit(at(index+1))) {
+            index++;
+            while (isDigit(at(index))) index++;
         }
-        Token t = Token{TokType::NUMBER, line, col, buf.length(), buf};
-        tokens.push_back(t);
-        col += buf.length();
+        std::string_view text = src.substr(start, index - start);
+        Token t = Token{TokType::NUMBER, line, col, text.length(), text};
+        col += text.length();
         return t;
     }
 
@@ -137,10 +160,19 @@ Token Tokenizer::nextToken()
             ret = Token{TokType::RBRACE, line, col, 1};
         } break;
         case '.': {
-            ret = Token{TokType::DOT, line, col, 1};
+            if (at(index+1) == '.') {
+                index++;
+                col++;
+                ret = Token{TokType::DOTDOT, line, col, 2};
+            } else {
+                ret = Token{TokType::DOT, line, col, 1};
+            }
+        } break;
+        case ':': {
+            ret = Token{TokType::COLON, line, col, 1};
         } break;
         case '!': {
-            if (src[index+1] == '=') {
+            if (at(index+1) == '=') {
                 index++;
                 col++;
                 ret = Token{TokType::NEQUALS, line, col, 2};
@@ -149,7 +181,7 @@ Token Tokenizer::nextToken()
             }
         } break;
         case '>': {
-            if (src[index+1] == '=') {
+            if (at(index+1) == '=') {
                 index++;
                 col++;
                 ret = Token{TokType::GEQUALS, line, col, 2};
@@ -158,7 +190,7 @@ Token Tokenizer::nextToken()
             }
         } break;
         case '<': {
-            if (src[index+1] == '=') {
+            if (at(index+1) == '=') {
                 index++;
                 col++;
                 ret = Token{TokType::LEQUALS, line, col, 2};
@@ -167,7 +199,7 @@ Token Tokenizer::nextToken()
             }
         } break;
         case '=': {
-            if (src[index+1] == '=') {
+            if (at(index+1) == '=') {
                 index++;
                 col++;
                 ret = Token{TokType::EQUALS, line, col, 2};
@@ -176,23 +208,11 @@ Token Tokenizer::nextToken()
             }
         } break;
         default: {
-            std::cerr << "Unknown Symbol: " << cur << " @ " << line << ":" << col << std::endl;
-            exit(1);
+            throw CompileError("Unknown Symbol: " + std::string(1, cur), line, col);
         }
     }
 
     col++;
     index++;
-    tokens.push_back(ret);
     return ret;
-}
-
-std::vector<Token> Tokenizer::getTokens()
-{
-    Token t = nextToken();
-    while (t.type != TokType::T_EOF) {
-        t = nextToken();
-    }
-
-    return tokens;
 }
\ No newline at end of file
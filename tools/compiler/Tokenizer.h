@@ -1,23 +1,25 @@
 #ifndef LUMA_TOKENIZER_H
 #define LUMA_TOKENIZER_H
 
-#include <vector>
+#include <string_view>
 
 #include "Token.h"
 
+// Tokens hold views into src, the caller keeps the source alive
 class Tokenizer {
     public:
-        Tokenizer(const std::string& src);
+        Tokenizer(std::string_view src);
 
-        std::vector<Token> tokenizeAll();
+        // returns T_EOF forever once the source is exhausted
         Token nextToken();
 
-        std::vector<Token> getTokens();
-
     private:
-        std::string src;
-        std::vector<Token> tokens;
+        char at(size_t i) const {
+            return i < src.size() ? src[i] : '\0';
+        }
+
+        std::string_view src;
         size_t index, line, col;
 };
 
-#endif
\ No newline at end of file
+#endif
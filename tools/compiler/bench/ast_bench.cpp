@@ -0,0 +1,89 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../Parser.h"
+#include "../FlatParser.h"
+#include "../Extension.h"
+#include "../visitors/CodegenVisitor.h"
+#include "../visitors/FlatCodegen.h"
+
+// Generates a show timeline with n statements. FlatParser stops at the language
+// before functions, so the input keeps to lets, ifs, blocks and calls.
+static std::string generateSource(size_t n) {
+    std::string src = "require neopixel;\nrequire microphone;\n\nlet brightness = 128;\nlet level = 0;\n";
+    for (size_t i = 0; i < n; i++) {
+        switch (i % 4) {
+            case 0:
+                src += "level = microphone.read() * brightness / 255;\n";
+                break;
+            case 1:
+                src += "if (level >= " + std::to_string(i % 256) + " and level < 200) {\n"
+                       "    let hue = level * 3 + " + std::to_string(i % 7) + ";\n"
+                       "    neopixel.fill_rgb(hue, 0, 255 - hue);\n"
+                       "} else {\n"
+                       "    level = level - 1;\n"
+                       "}\n";
+                break;
+            case 2:
+                src += "neopixel.set_rgb(" + std::to_string(i % 60) + ", max(level, 10), min(brightness, 64), 0);\n";
+                break;
+            default:
+                src += "{ let t = level % 16; brightness = brightness + t - 8; neopixel.show(); }\n";
+                break;
+        }
+    }
+    return src;
+}
+
+template<typename F>
+static double timeIt(int reps, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / reps;
+}
+
+int main() {
+    const ExtensionRegistry& registry = ExtensionRegistry::standard();
+
+    std::printf("%10s %10s %11s %11s %11s %11s %8s %5s\n", "stmts", "nodes",
+                "tree parse", "tree gen", "flat parse", "flat gen", "speedup", "same");
+    for (size_t n : {1000, 10000, 100000, 400000}) {
+        std::string src = generateSource(n);
+        int reps = n >= 100000 ? 3 : 30;
+
+        std::unique_ptr<Program> prog;
+        double treeParse = timeIt(reps, [&] {
+            Parser parser{std::string_view(src)};
+            prog = parser.parse();
+        });
+        std::vector<uint8_t> treeOut;
+        double treeGen = timeIt(reps, [&] {
+            // mem only like FlatCodegen, so both emit the same bytes
+            VarAllocator vars;
+            vars.run(prog.get(), false);
+            CodegenVisitor cgv(registry, vars);
+            cgv.visitProgram(prog.get());
+            treeOut = cgv.getLBC();
+        });
+        prog.reset();
+
+        std::unique_ptr<FlatAST> ast;
+        double flatParse = timeIt(reps, [&] {
+            FlatParser parser{std::string_view(src)};
+            ast = parser.parse();
+        });
+        std::vector<uint8_t> flatOut;
+        double flatGen = timeIt(reps, [&] {
+            FlatCodegen cg(registry);
+            cg.generate(*ast);
+            flatOut = cg.getLBC();
+        });
+
+        std::printf("%10zu %10zu %8.2f ms %8.2f ms %8.2f ms %8.2f ms %7.2fx %5s\n", n, ast->nodes.size(),
+                    treeParse * 1e3, treeGen * 1e3, flatParse * 1e3, flatGen * 1e3,
+                    (treeParse + treeGen) / (flatParse + flatGen), treeOut == flatOut ? "yes" : "NO");
+    }
+    return 0;
+}
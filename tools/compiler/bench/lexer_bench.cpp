@@ -0,0 +1,48 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "../Tokenizer.h"
+
+// Generates a show timeline with n statements
+static std::string generateSource(size_t n) {
+    std::string src = "require neopixel;\nrequire microphone;\n\nlet brightness = 128;\nlet level = 0;\n";
+    for (size_t i = 0; i < n; i++) {
+        switch (i % 4) {
+            case 0:
+                src += "level = microphone.read() * brightness / 255; // cue " + std::to_string(i) + "\n";
+                break;
+            case 1:
+                src += "if (level >= " + std::to_string(i % 256) + " and level < 200) { neopixel.fill_rgb(level, 0, 255 - level); }\n";
+                break;
+            case 2:
+                src += "neopixel.set_rgb(" + std::to_string(i % 60) + ", max(level, 10), min(brightness, 64), 0);\n";
+                break;
+            default:
+                src += "neopixel.show();\n";
+                break;
+        }
+    }
+    return src;
+}
+
+int main() {
+    std::printf("%10s %12s %12s %12s %10s\n", "stmts", "bytes", "tokens", "MB/s", "ns/token");
+    for (size_t n : {1000, 10000, 100000, 400000}) {
+        std::string src = generateSource(n);
+
+        size_t tokens = 0;
+        int reps = n >= 100000 ? 3 : 30;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < reps; r++) {
+            Tokenizer tokenizer(src);
+            tokens = 1;
+            while (tokenizer.nextToken().type != TokType::T_EOF) tokens++;
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / reps;
+
+        std::printf("%10zu %12zu %12zu %12.1f %10.2f\n", n, src.size(), tokens,
+                    src.size() / secs / 1e6, secs * 1e9 / tokens);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "Passes.h"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+namespace ir {
+
+namespace {
+    struct ValueKey {
+        Op op;
+        int32_t imm;            // the constant, or the block id for phis
+        const ExtFunction* fn;
+        std::vector<VReg> args;
+
+        bool operator<(const ValueKey& other) const {
+            return std::tie(op, imm, fn, args) < std::tie(other.op, other.imm, other.fn, other.args);
+        }
+    };
+}
+
+/*
+ * Value numbering scoped by the dominator tree: walking down the tree, a
+ * value computed in a block is visible to every block it dominates and
+ * forgotten again on the way back up. DIV, MOD and TABLE count as pure here,
+ * the dominating copy would already have trapped on the same operands. So does
+ * an extension function marked PURE, `neopixel.led_x(i)` is only called
+ * once per `i`.
+ */
+void eliminateCommonSubexpressions(Function& fn) {
+    std::vector<Block*> idom = fn.dominators();
+    std::vector<std::vector<Block*>> children(fn.blocks.size());
+    for (auto& block : fn.blocks) {
+        Block* dom = idom[block->id];
+        if (dom != nullptr && dom != block.get()) children[dom->id].push_back(block.get());
+    }
+
+    std::vector<VReg> forward(fn.vregCount, NO_VREG);
+    auto resolve = [&](VReg v) {
+        while (forward[v] != NO_VREG) v = forward[v];
+        return v;
+    };
+
+    std::map<ValueKey, VReg> available;
+    std::vector<std::map<ValueKey, VReg>::iterator> added;    // undone when leaving a subtree
+
+    auto number = [&](const Instr& instr, int32_t imm) {
+        ValueKey key{instr.op, imm, instr.fn, {}};
+        for (VReg arg : instr.args) key.args.push_back(resolve(arg));
+        if (isCommutative(instr.op)) std::sort(key.args.begin(), key.args.end());
+
+        auto [it, inserted] = available.emplace(std::move(key), instr.dst);
+        if (inserted) {
+            added.push_back(it);
+        } else {
+            forward[instr.dst] = it->second;
+        }
+    };
+
+    struct Visit { Block* block; size_t child; size_t mark; };
+    std::vector<Visit> stack;
+    stack.push_back({fn.entry(), 0, 0});
+    while (!stack.empty()) {
+        Visit& visit = stack.back();
+        Block* block = visit.block;
+        if (visit.child == 0) {
+            visit.mark = added.size();
+            for (const Instr& phi : block->phis) number(phi, (int32_t) block->id);
+            for (const Instr& instr : block->instrs) {
+                if (isPure(instr)) number(instr, instr.imm);
+            }
+        }
+        if (visit.child < children[block->id].size()) {
+            Block* next = children[block->id][visit.child++];
+            stack.push_back({next, 0, 0});
+            continue;
+        }
+        while (added.size() > visit.mark) {
+            available.erase(added.back());
+            added.pop_back();
+        }
+        stack.pop_back();
+    }
+
+    fn.rewriteUses(forward);
+}
+
+}
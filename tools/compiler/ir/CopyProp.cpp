@@ -0,0 +1,46 @@
+#include "Passes.h"
+
+namespace ir {
+
+void propagateCopies(Function& fn) {
+    std::vector<VReg> forward(fn.vregCount, NO_VREG);
+    auto resolve = [&](VReg v) {
+        while (forward[v] != NO_VREG) v = forward[v];
+        return v;
+    };
+
+    // a phi only becomes trivial once the phis feeding it are, repeat until nothing changes
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& block : fn.blocks) {
+            for (const Instr& phi : block->phis) {
+                if (forward[phi.dst] != NO_VREG) continue;
+                VReg same = NO_VREG;
+                bool trivial = true;
+                for (VReg arg : phi.args) {
+                    arg = resolve(arg);
+                    if (arg == same || arg == phi.dst) continue;
+                    if (same != NO_VREG) {
+                        trivial = false;
+                        break;
+                    }
+                    same = arg;
+                }
+                if (trivial && same != NO_VREG) {
+                    forward[phi.dst] = same;
+                    changed = true;
+                }
+            }
+            for (const Instr& instr : block->instrs) {
+                if (instr.op != Op::COPY || forward[instr.dst] != NO_VREG) continue;
+                forward[instr.dst] = resolve(instr.args[0]);
+                changed = true;
+            }
+        }
+    }
+
+    fn.rewriteUses(forward);
+}
+
+}
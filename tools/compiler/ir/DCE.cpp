@@ -0,0 +1,165 @@
+#include "Passes.h"
+
+#include <algorithm>
+
+namespace ir {
+
+namespace {
+    // definition of every vreg, nullptr for the ones no instruction defines
+    std::vector<const Instr*> definitions(const Function& fn) {
+        std::vector<const Instr*> defs(fn.vregCount, nullptr);
+        for (const auto& block : fn.blocks) {
+            for (const Instr& phi : block->phis) defs[phi.dst] = &phi;
+            for (const Instr& instr : block->instrs) {
+                if (instr.dst != NO_VREG) defs[instr.dst] = &instr;
+            }
+        }
+        return defs;
+    }
+
+    bool isConst(const std::vector<const Instr*>& defs, VReg v) {
+        return defs[v] != nullptr && defs[v]->op == Op::CONST;
+    }
+
+    // division by zero halts the VM, so it has to happen even if the quotient is never used
+    bool mayTrap(const std::vector<const Instr*>& defs, const Instr& instr) {
+        if (instr.op == Op::TABLE) {
+            VReg index = instr.args[0];
+            return !isConst(defs, index) || defs[index]->imm < 0 || (uint32_t) defs[index]->imm >= instr.callee;
+        }
+        if (instr.op != Op::DIV && instr.op != Op::DIVQ && instr.op != Op::MOD) return false;
+        VReg divisor = instr.args[1];
+        return !isConst(defs, divisor) || defs[divisor]->imm == 0;
+    }
+
+    // turns branches with a known condition into jumps, the untaken successor may become unreachable
+    bool foldBranches(Function& fn) {
+        std::vector<const Instr*> defs = definitions(fn);
+        bool changed = false;
+        for (auto& block : fn.blocks) {
+            if (block->term != Term::BRANCH) continue;
+            Block* untaken;
+            if (block->succs[0] == block->succs[1]) {
+                untaken = block->succs[1];
+            } else if (isConst(defs, block->cond)) {
+                untaken = block->succs[defs[block->cond]->imm != 0 ? 1 : 0];
+            } else {
+                continue;
+            }
+            fn.removeEdge(block.get(), untaken);
+            block->term = Term::JUMP;
+            block->cond = NO_VREG;
+            changed = true;
+        }
+        return changed;
+    }
+
+    // appends a block to its only predecessor when that one has no other successor
+    bool mergeBlocks(Function& fn) {
+        std::vector<VReg> forward(fn.vregCount, NO_VREG);
+        bool changed = false;
+        for (auto& owner : fn.blocks) {
+            Block* block = owner.get();
+            if (block != fn.entry() && block->preds.empty()) continue;     // merged away already
+            while (block->term == Term::JUMP) {
+                Block* next = block->succs[0];
+                if (next == block || next == fn.entry() || next->preds.size() != 1) break;
+
+                for (const Instr& phi : next->phis) forward[phi.dst] = phi.args[0];
+                next->phis.clear();
+                block->instrs.insert(block->instrs.end(), next->instrs.begin(), next->instrs.end());
+                next->instrs.clear();
+
+                block->term = next->term;
+                block->cond = next->cond;
+                block->site = next->site;
+                block->succs = std::move(next->succs);
+                next->succs.clear();
+                next->preds.clear();
+                for (Block* succ : block->succs) {
+                    std::replace(succ->preds.begin(), succ->preds.end(), next, block);
+                }
+                changed = true;
+            }
+        }
+        if (changed) {
+            fn.rewriteUses(forward);
+            fn.compact();
+        }
+        return changed;
+    }
+
+    // mark and sweep from the instructions that have an effect
+    void removeDeadValues(Function& fn) {
+        std::vector<const Instr*> defs = definitions(fn);
+        std::vector<bool> live(fn.vregCount, false);
+        std::vector<VReg> work;
+        auto use = [&](VReg v) {
+            if (!live[v]) {
+                live[v] = true;
+                work.push_back(v);
+            }
+        };
+
+        for (const auto& block : fn.blocks) {
+            for (const Instr& instr : block->instrs) {
+                if (hasSideEffects(instr)) {
+                    for (VReg arg : instr.args) use(arg);
+                } else if (mayTrap(defs, instr)) {
+                    use(instr.dst);
+                }
+            }
+            if (block->cond != NO_VREG) use(block->cond);     // branch or return
+        }
+        while (!work.empty()) {
+            VReg v = work.back();
+            work.pop_back();
+            if (defs[v] == nullptr) continue;
+            for (VReg arg : defs[v]->args) use(arg);
+        }
+
+        for (auto& block : fn.blocks) {
+            block->phis.erase(std::remove_if(block->phis.begin(), block->phis.end(), [&](const Instr& phi) {
+                return !live[phi.dst];
+            }), block->phis.end());
+
+            block->instrs.erase(std::remove_if(block->instrs.begin(), block->instrs.end(), [&](const Instr& instr) {
+                return instr.dst != NO_VREG && !live[instr.dst] && !hasSideEffects(instr);
+            }), block->instrs.end());
+
+            // a function is still called when its result isn't used
+            for (Instr& instr : block->instrs) {
+                bool call = instr.op == Op::EXT || instr.op == Op::CALL;
+                if (call && instr.dst != NO_VREG && !live[instr.dst]) instr.dst = NO_VREG;
+            }
+        }
+    }
+}
+
+void eliminateDeadCode(Function& fn) {
+    foldBranches(fn);
+    fn.compact();
+    mergeBlocks(fn);
+    removeDeadValues(fn);
+}
+
+void optimize(Function& fn) {
+    auto size = [&]() {
+        size_t n = fn.blocks.size();
+        for (const auto& block : fn.blocks) n += block->phis.size() + block->instrs.size();
+        return n;
+    };
+
+    propagateCopies(fn);
+    reduceStrength(fn);
+    size_t before;
+    do {
+        before = size();
+        eliminateCommonSubexpressions(fn);
+        hoistLoopInvariants(fn);
+        eliminateDeadCode(fn);
+        propagateCopies(fn);
+    } while (size() < before);
+}
+
+}
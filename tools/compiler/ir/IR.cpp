@@ -0,0 +1,282 @@
+#include "IR.h"
+#include "../Extension.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+namespace ir {
+
+Block* Function::newBlock(uint32_t loopDepth) {
+    blocks.push_back(std::make_unique<Block>());
+    Block* block = blocks.back().get();
+    block->id = (uint32_t) blocks.size() - 1;
+    block->loopDepth = loopDepth;
+    return block;
+}
+
+void Function::jump(Block* from, Block* to) {
+    from->term = Term::JUMP;
+    from->succs = {to};
+    to->preds.push_back(from);
+}
+
+void Function::branch(Block* from, VReg cond, Block* ifTrue, Block* ifFalse) {
+    from->term = Term::BRANCH;
+    from->cond = cond;
+    from->succs = {ifTrue, ifFalse};
+    ifTrue->preds.push_back(from);
+    ifFalse->preds.push_back(from);
+}
+
+void Function::removeEdge(Block* from, Block* to) {
+    auto succ = std::find(from->succs.begin(), from->succs.end(), to);
+    if (succ != from->succs.end()) from->succs.erase(succ);
+
+    auto pred = std::find(to->preds.begin(), to->preds.end(), from);
+    if (pred == to->preds.end()) return;
+    size_t index = pred - to->preds.begin();
+    to->preds.erase(pred);
+    for (Instr& phi : to->phis) {
+        phi.args.erase(phi.args.begin() + index);
+    }
+}
+
+std::vector<Block*> Function::reversePostorder() const {
+    std::vector<Block*> order;
+    std::vector<bool> visited(blocks.size(), false);
+    // explicit stack of (block, next successor), deep if/else chains would overflow recursion
+    std::vector<std::pair<Block*, size_t>> stack;
+    stack.emplace_back(entry(), 0);
+    visited[entry()->id] = true;
+    while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        if (next < block->succs.size()) {
+            Block* succ = block->succs[next++];
+            if (!visited[succ->id]) {
+                visited[succ->id] = true;
+                stack.emplace_back(succ, 0);
+            }
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+void Function::compact() {
+    std::vector<Block*> order = reversePostorder();
+    const size_t UNREACHABLE = SIZE_MAX;
+    std::vector<size_t> position(blocks.size(), UNREACHABLE);
+    for (size_t i = 0; i < order.size(); i++) position[order[i]->id] = i;
+
+    for (auto& block : blocks) {
+        if (position[block->id] != UNREACHABLE) continue;
+        while (!block->succs.empty()) removeEdge(block.get(), block->succs.front());
+    }
+
+    std::vector<std::unique_ptr<Block>> kept(order.size());
+    for (auto& block : blocks) {
+        size_t index = position[block->id];
+        if (index != UNREACHABLE) kept[index] = std::move(block);
+    }
+    blocks = std::move(kept);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i]->id = (uint32_t) i;
+    }
+}
+
+void Function::rewriteUses(std::vector<VReg>& forward) {
+    auto resolve = [&](VReg v) {
+        VReg root = v;
+        while (root < forward.size() && forward[root] != NO_VREG) root = forward[root];
+        // path compression, later lookups along the chain are direct
+        while (v < forward.size() && forward[v] != NO_VREG) {
+            VReg next = forward[v];
+            forward[v] = root;
+            v = next;
+        }
+        return root;
+    };
+
+    for (auto& block : blocks) {
+        for (Instr& phi : block->phis) {
+            for (VReg& arg : phi.args) arg = resolve(arg);
+        }
+        for (Instr& instr : block->instrs) {
+            for (VReg& arg : instr.args) arg = resolve(arg);
+        }
+        if (block->cond != NO_VREG) block->cond = resolve(block->cond);
+    }
+
+    auto replaced = [&](const Instr& instr) {
+        return instr.dst != NO_VREG && instr.dst < forward.size() && forward[instr.dst] != NO_VREG;
+    };
+    for (auto& block : blocks) {
+        block->phis.erase(std::remove_if(block->phis.begin(), block->phis.end(), replaced), block->phis.end());
+        block->instrs.erase(std::remove_if(block->instrs.begin(), block->instrs.end(), replaced), block->instrs.end());
+    }
+}
+
+std::vector<Block*> Function::dominators() const {
+    std::vector<Block*> order = reversePostorder();
+    std::vector<size_t> position(blocks.size(), SIZE_MAX);
+    for (size_t i = 0; i < order.size(); i++) position[order[i]->id] = i;
+
+    std::vector<Block*> idom(blocks.size(), nullptr);
+    idom[entry()->id] = entry();
+
+    auto intersect = [&](Block* a, Block* b) {
+        while (a != b) {
+            while (position[a->id] > position[b->id]) a = idom[a->id];
+            while (position[b->id] > position[a->id]) b = idom[b->id];
+        }
+        return a;
+    };
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++) {
+            Block* block = order[i];
+            Block* dom = nullptr;
+            for (Block* pred : block->preds) {
+                if (idom[pred->id] == nullptr) continue;    // not processed yet or unreachable
+                dom = dom == nullptr ? pred : intersect(pred, dom);
+            }
+            if (idom[block->id] != dom) {
+                idom[block->id] = dom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+const char* opName(Op op) {
+    switch (op) {
+        case Op::CONST: return "const";
+        case Op::COPY: return "copy";
+        case Op::PHI: return "phi";
+        case Op::ADD: return "add";
+        case Op::SUB: return "sub";
+        case Op::MUL: return "mul";
+        case Op::DIV: return "div";
+        case Op::MOD: return "mod";
+        case Op::MAX: return "max";
+        case Op::MIN: return "min";
+        case Op::MULQ: return "mulq";
+        case Op::DIVQ: return "divq";
+        case Op::AND: return "and";
+        case Op::OR: return "or";
+        case Op::XOR: return "xor";
+        case Op::SHL: return "shl";
+        case Op::SHR: return "shr";
+        case Op::SAR: return "sar";
+        case Op::EQ: return "eq";
+        case Op::NEQ: return "neq";
+        case Op::GEQ: return "geq";
+        case Op::LEQ: return "leq";
+        case Op::GT: return "gt";
+        case Op::LT: return "lt";
+        case Op::NOT: return "not";
+        case Op::EXT: return "ext";
+        case Op::DELAY: return "delay";
+        case Op::ARG: return "arg";
+        case Op::CALL: return "call";
+        case Op::TABLE: return "table";
+    }
+    return "?";
+}
+
+bool isCommutative(Op op) {
+    switch (op) {
+        case Op::ADD: case Op::MUL: case Op::MAX: case Op::MIN: case Op::MULQ:
+        case Op::AND: case Op::OR: case Op::XOR:
+        case Op::EQ: case Op::NEQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// a call is assumed to do whatever its callee's extension calls may, calls that are left after inlining are rare
+bool hasSideEffects(const Instr& instr) {
+    if (instr.op == Op::EXT) return instr.fn->effect == EXT_EFFECT_WRITES_FRAMEBUFFER;
+    return instr.op == Op::DELAY || instr.op == Op::CALL;
+}
+
+// a sensor read has no side effect, but reading again may give another value
+bool isPure(const Instr& instr) {
+    if (instr.op == Op::EXT) return instr.fn->isPure();
+    return instr.op != Op::DELAY && instr.op != Op::PHI && instr.op != Op::COPY
+        && instr.op != Op::ARG && instr.op != Op::CALL;
+}
+
+void Function::print(std::ostream& os, const Module* module) const {
+    for (const auto& block : blocks) {
+        os << "b" << block->id << ":";
+        if (!block->preds.empty()) {
+            os << "  ; preds";
+            for (Block* pred : block->preds) os << " b" << pred->id;
+        }
+        if (block->loopDepth > 0) os << "  ; loop depth " << block->loopDepth;
+        os << "\n";
+
+        auto printInstr = [&](const Instr& instr) {
+            os << "    ";
+            if (instr.dst != NO_VREG) os << "v" << instr.dst << " = ";
+            os << opName(instr.op);
+            if (instr.op == Op::CONST || instr.op == Op::ARG) os << " " << instr.imm;
+            if (instr.op == Op::EXT) os << " " << instr.fn->ext << "." << instr.fn->name;
+            if (instr.op == Op::CALL) os << " f" << instr.callee;
+            if (instr.op == Op::TABLE) os << " " << instr.imm << "[" << instr.callee << "]";
+            for (size_t i = 0; i < instr.args.size(); i++) {
+                os << (i == 0 ? " " : ", ") << "v" << instr.args[i];
+                if (instr.op == Op::PHI) os << " b" << block->preds[i]->id;
+            }
+            const SiteCount* count = module != nullptr ? module->count(instr.site) : nullptr;
+            if (count != nullptr) os << "  ; " << count->calls << " calls";
+            os << "\n";
+        };
+        for (const Instr& phi : block->phis) printInstr(phi);
+        for (const Instr& instr : block->instrs) printInstr(instr);
+
+        switch (block->term) {
+            case Term::JUMP:
+                os << "    jump b" << block->succs[0]->id << "\n";
+                break;
+            case Term::BRANCH:
+                os << "    branch v" << block->cond << ", b" << block->succs[0]->id
+                   << ", b" << block->succs[1]->id;
+                if (const SiteCount* count = module != nullptr ? module->count(block->site) : nullptr) {
+                    os << "  ; " << count->toTrue << " / " << count->toFalse;
+                }
+                os << "\n";
+                break;
+            case Term::EXIT:
+                os << "    exit\n";
+                break;
+            case Term::RETURN:
+                os << "    return";
+                if (block->cond != NO_VREG) os << " v" << block->cond;
+                os << "\n";
+                break;
+        }
+    }
+}
+
+Function* Module::newFunction() {
+    functions.push_back(std::make_unique<Function>());
+    return functions.back().get();
+}
+
+void Module::print(std::ostream& os) const {
+    for (size_t i = 0; i < functions.size(); i++) {
+        if (i > 0) os << "\nf" << i << ": fn " << functions[i]->name << "\n";
+        functions[i]->print(os, this);
+    }
+}
+
+}
@@ -0,0 +1,140 @@
+#ifndef LUMA_IR_H
+#define LUMA_IR_H
+
+#include <stdint.h>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct ExtFunction;
+
+/*
+ * Mid-level SSA form between the AST and LBC. A Function is a graph of basic
+ * blocks, every virtual register is assigned exactly once and values that
+ * flow together after an `if` or around a `loop` meet in phis. Variables
+ * don't exist anymore at this level, a `let` is just a name for a vreg.
+ */
+namespace ir {
+
+struct Module;
+
+using VReg = uint32_t;
+constexpr VReg NO_VREG = 0;
+
+enum class Op : uint8_t {
+    CONST,      // dst = imm
+    COPY,       // dst = args[0]
+    PHI,        // dst = args[i] when control came from preds[i]
+    ADD, SUB, MUL, DIV, MOD, MAX, MIN,
+    MULQ, DIVQ,         // Q16.16, with a 64-bit intermediate
+    AND, OR, XOR,
+    SHL, SHR, SAR,      // shift args[0] by args[1], SHR fills with zeros, SAR with the sign
+    EQ, NEQ, GEQ, LEQ, GT, LT,
+    NOT,        // dst = ~args[0]
+    EXT,        // [dst =] fn(args...)
+    DELAY,      // delay(args[0])
+    ARG,        // dst = parameter imm of the function, only at the start of the entry block
+    CALL,       // [dst =] functions[callee](args...)
+    TABLE,      // dst = constant pool entry imm + args[0], halts unless 0 <= args[0] < callee
+};
+
+struct Instr {
+    Op op;
+    VReg dst = NO_VREG;
+    std::vector<VReg> args;
+    int32_t imm = 0;
+    const ExtFunction* fn = nullptr;    // EXT only
+    uint32_t callee = 0;                // CALL: index in Module::functions, TABLE: length of the table
+    uint32_t site = 0;                  // CALL: where it is in the source, see Module::profile
+};
+
+enum class Term : uint8_t {
+    JUMP,       // to succs[0]
+    BRANCH,     // to succs[0] if cond != 0, else to succs[1]
+    EXIT,       // end of the program
+    RETURN,     // back to the caller with cond as the result, NO_VREG for none
+};
+
+struct Block {
+    uint32_t id;
+    uint32_t loopDepth;         // number of `loop`s around the block
+    std::vector<Instr> phis;
+    std::vector<Instr> instrs;
+    Term term = Term::EXIT;
+    VReg cond = NO_VREG;
+    uint32_t site = 0;          // BRANCH: where it is in the source, see Module::profile
+    std::vector<Block*> succs;
+    std::vector<Block*> preds;  // phi arguments are in this order
+};
+
+class Function {
+    public:
+        std::vector<std::unique_ptr<Block>> blocks;     // blocks[0] is the entry
+        VReg vregCount = 1;                             // vreg 0 is NO_VREG
+        std::string name;
+        uint32_t params = 0;
+        bool returnsValue = false;
+
+        Block* newBlock(uint32_t loopDepth = 0);
+        VReg newVReg() { return vregCount++; }
+        Block* entry() const { return blocks.front().get(); }
+
+        // set the terminator of a block that has none yet, preds of the targets are kept in sync
+        void jump(Block* from, Block* to);
+        void branch(Block* from, VReg cond, Block* ifTrue, Block* ifFalse);
+        // drops the edge and the phi arguments that came along it
+        void removeEdge(Block* from, Block* to);
+
+        // blocks reachable from the entry, a block comes before its successors except along back edges
+        std::vector<Block*> reversePostorder() const;
+        // drops the unreachable blocks and renumbers the rest in reverse postorder
+        void compact();
+
+        // immediate dominator of every block by id, the entry is its own (Cooper, Harvey & Kennedy)
+        std::vector<Block*> dominators() const;
+
+        // args and conds read through forward, where forward[v] != NO_VREG replaces v, the
+        // definitions of replaced vregs are dropped
+        void rewriteUses(std::vector<VReg>& forward);
+
+        // with the counts of the module's profile, if any
+        void print(std::ostream& os, const Module* module = nullptr) const;
+};
+
+// how often a branch went either way and a call was made, while the program was profiled
+struct SiteCount {
+    uint64_t toTrue = 0, toFalse = 0;
+    uint64_t calls = 0;
+};
+
+/*
+ * The program and its `fn`s, functions[0] is the program itself and ends in
+ * EXIT, the others RETURN. IRBuilder numbers every branch and call in the
+ * order they appear in the source, copies made by the passes keep the
+ * number. With a profile those numbers index its counts.
+ */
+struct Module {
+    std::vector<std::unique_ptr<Function>> functions;
+    uint32_t sites = 1;                 // site 0 is none
+    std::vector<SiteCount> profile;     // by site, empty without a profile
+
+    Function* newFunction();
+    uint32_t newSite() { return sites++; }
+    // nullptr without a profile
+    const SiteCount* count(uint32_t site) const {
+        return site != 0 && site < profile.size() ? &profile[site] : nullptr;
+    }
+    void print(std::ostream& os) const;
+};
+
+const char* opName(Op op);
+bool isCommutative(Op op);
+// instructions that must stay even when their result is unused
+bool hasSideEffects(const Instr& instr);
+// instructions whose value only depends on their operands, they may be merged and moved
+bool isPure(const Instr& instr);
+
+}
+
+#endif
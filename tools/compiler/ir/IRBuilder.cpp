@@ -0,0 +1,592 @@
+#include "IRBuilder.h"
+#include "../Parser.h"
+#include "../Extension.h"
+#include "../visitors/VarResolver.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace ir;
+
+namespace {
+    // evaluating it or not makes no difference: no calls, assignments or divisions that may trap
+    bool harmless(Expression* expr) {
+        if (auto* bin = dynamic_cast<BinaryExpr*>(expr)) {
+            bool divides = bin->op == BinOp::DIV || bin->op == BinOp::DIVQ || bin->op == BinOp::MOD;
+            return !divides && harmless(bin->lhs) && harmless(bin->rhs);
+        }
+        return dynamic_cast<NumberExpr*>(expr) != nullptr || dynamic_cast<VarExpr*>(expr) != nullptr;
+    }
+
+    // instructions the copies of an unrolled `for` may add up to, all rounds or one round of several copies
+    const size_t FULL_UNROLL = 32;
+    const size_t UNROLLED_ROUND = 48;
+
+    // rough number of instructions a statement becomes, a loop inside is never unrolled around
+    class CodeSize : public Visitor {
+        public:
+            size_t size = 0;
+            bool loops = false;
+            bool calls = false;     // other than a table lookup, they overwrite R0..R3
+
+            virtual int visitBinaryExpr(BinaryExpr* expr) override {
+                size++;
+                expr->lhs->visit(this);
+                expr->rhs->visit(this);
+                return 0;
+            }
+            virtual int visitAssignment(Assignment* expr) override { return expr->expr->visit(this); }
+            virtual int visitCallExpr(CallExpr* expr) override {
+                size += 1 + expr->args.size();
+                if (expr->fn == nullptr || !expr->fn->tabulated) calls = true;
+                for (auto* arg : expr->args) arg->visit(this);
+                return 0;
+            }
+            virtual int visitNumberExpr(NumberExpr* expr) override { size++; return 0; }
+            virtual int visitVarExpr(VarExpr* expr) override { return 0; }
+
+            virtual void visitExprStatement(ExprStatement* stmt) override { stmt->expr->visit(this); }
+            virtual void visitIfElse(IfElse* stmt) override {
+                size += stmt->elseBody != nullptr ? 2 : 1;
+                stmt->cond->visit(this);
+                stmt->ifBody->visit(this);
+                if (stmt->elseBody != nullptr) stmt->elseBody->visit(this);
+            }
+            virtual void visitLoopStmt(LoopStmt* stmt) override { loops = true; }
+            virtual void visitForStmt(ForStmt* stmt) override { loops = true; }
+            virtual void visitBlockStmt(BlockStmt* stmt) override {
+                for (auto* s : stmt->stmts) s->visit(this);
+            }
+            virtual void visitVarDeclaration(VarDeclaration* stmt) override {
+                if (stmt->expr != nullptr) stmt->expr->visit(this);
+            }
+            virtual void visitFnDecl(FnDecl* stmt) override {}
+            virtual void visitReturnStmt(ReturnStmt* stmt) override {
+                size++;
+                if (stmt->expr != nullptr) stmt->expr->visit(this);
+            }
+            virtual void visitProgram(Program* program) override {}
+    };
+
+    // of one round, stepping the variable included. SIZE_MAX with a loop inside
+    size_t roundSize(Statement* body, bool& calls) {
+        CodeSize size;
+        body->visit(&size);
+        calls = size.calls;
+        return size.loops ? SIZE_MAX : size.size + 1;
+    }
+}
+
+IRBuilder::IRBuilder(const ExtensionRegistry& registry, Module& module)
+    : registry(registry), module(module) {}
+
+void IRBuilder::build(Program* program) {
+    VarResolver resolver;
+    program->visit(&resolver);
+
+    Function* main = module.newFunction();
+    main->name = "main";
+    for (FnDecl* decl : resolver.fns) {
+        Function* function = module.newFunction();
+        function->name = std::string(decl->id);
+        function->params = (uint32_t) decl->params.size();
+        function->returnsValue = decl->returnsValue;
+    }
+
+    begin(main);
+    program->visit(this);
+    finish();
+
+    for (FnDecl* decl : resolver.fns) {
+        begin(module.functions[decl->index + 1].get());
+        for (size_t i = 0; i < decl->params.size(); i++) {
+            writeVariable(decl->params[i]->index, cur, emit(Op::ARG, {}, (int32_t) i));
+        }
+        decl->body->visit(this);
+        // falling off the end returns 0 from a function with a value
+        ReturnStmt end;
+        end.fn = decl;
+        visitReturnStmt(&end);
+        finish();
+    }
+}
+
+void IRBuilder::begin(Function* function) {
+    fn = function;
+    loopDepth = 0;
+    defs.clear();
+    incompletePhis.clear();
+    sealed.clear();
+    forward.clear();
+    cur = newBlock(true);
+}
+
+void IRBuilder::finish() {
+    fn->rewriteUses(forward);
+}
+
+Block* IRBuilder::newBlock(bool isSealed) {
+    Block* block = fn->newBlock(loopDepth);
+    defs.emplace_back();
+    incompletePhis.emplace_back();
+    sealed.push_back(isSealed);
+    return block;
+}
+
+void IRBuilder::seal(Block* block) {
+    for (auto [var, phi] : incompletePhis[block->id]) {
+        addPhiOperands(var, block, phi);
+    }
+    incompletePhis[block->id].clear();
+    sealed[block->id] = true;
+}
+
+VReg IRBuilder::resolve(VReg v) {
+    while (v < forward.size() && forward[v] != NO_VREG) v = forward[v];
+    return v;
+}
+
+VReg IRBuilder::emit(Op op, std::vector<VReg> args, int32_t imm) {
+    Instr instr{op};
+    instr.dst = fn->newVReg();
+    instr.args = std::move(args);
+    instr.imm = imm;
+    cur->instrs.push_back(std::move(instr));
+    return cur->instrs.back().dst;
+}
+
+VReg IRBuilder::evaluate(Expression* expr) {
+    VReg v = (VReg) expr->visit(this);
+    if (v == NO_VREG) {
+        throw std::runtime_error("Using the result of a function without return value");
+    }
+    return v;
+}
+
+void IRBuilder::writeVariable(uint32_t var, Block* block, VReg value) {
+    defs[block->id][var] = value;
+}
+
+VReg IRBuilder::readVariable(uint32_t var, Block* block) {
+    auto def = defs[block->id].find(var);
+    if (def != defs[block->id].end()) {
+        return resolve(def->second);
+    }
+    return readVariableRecursive(var, block);
+}
+
+VReg IRBuilder::readVariableRecursive(uint32_t var, Block* block) {
+    VReg val;
+    if (!sealed[block->id]) {
+        // not all predecessors are known yet, the phi is completed when the block is sealed
+        val = fn->newVReg();
+        block->phis.push_back(Instr{Op::PHI, val});
+        incompletePhis[block->id].emplace_back(var, val);
+    } else if (block->preds.size() == 1) {
+        val = readVariable(var, block->preds[0]);
+    } else if (block->preds.empty()) {
+        val = undefined(block);
+    } else {
+        val = fn->newVReg();
+        block->phis.push_back(Instr{Op::PHI, val});
+        // break cycles through loops before looking at the predecessors
+        writeVariable(var, block, val);
+        val = addPhiOperands(var, block, val);
+    }
+    writeVariable(var, block, val);
+    return val;
+}
+
+VReg IRBuilder::addPhiOperands(uint32_t var, Block* block, VReg phi) {
+    std::vector<VReg> args;
+    for (Block* pred : block->preds) {
+        args.push_back(readVariable(var, pred));
+    }
+    // reading the predecessors may have added phis to this block, look it up again
+    auto instr = std::find_if(block->phis.begin(), block->phis.end(), [phi](const Instr& i) { return i.dst == phi; });
+    instr->args = std::move(args);
+    return tryRemoveTrivialPhi(block, phi);
+}
+
+VReg IRBuilder::tryRemoveTrivialPhi(Block* block, VReg phi) {
+    auto instr = std::find_if(block->phis.begin(), block->phis.end(), [phi](const Instr& i) { return i.dst == phi; });
+    VReg same = NO_VREG;
+    for (VReg arg : instr->args) {
+        arg = resolve(arg);
+        if (arg == same || arg == phi) continue;
+        if (same != NO_VREG) return phi;    // merges at least two values
+        same = arg;
+    }
+    block->phis.erase(instr);
+    if (same == NO_VREG) {
+        same = undefined(block);
+    }
+    if (forward.size() <= phi) forward.resize(fn->vregCount, NO_VREG);
+    forward[phi] = same;
+    return same;
+}
+
+// read of a variable no definition reaches, only happens in unreachable code
+VReg IRBuilder::undefined(Block* block) {
+    Instr instr{Op::CONST, fn->newVReg()};
+    block->instrs.insert(block->instrs.begin(), instr);
+    return instr.dst;
+}
+
+int IRBuilder::visitBinaryExpr(BinaryExpr* expr) {
+    bool logic = expr->op == BinOp::LAND || expr->op == BinOp::LOR;
+    if (logic && !harmless(expr->rhs)) {
+        // the right side must not run when the left decides, 1 and 0 meet in a phi
+        Block* isTrue = newBlock(false);
+        Block* isFalse = newBlock(false);
+        Block* join = newBlock(false);
+        branch(expr, isTrue, isFalse);
+        seal(isTrue);
+        seal(isFalse);
+
+        cur = isTrue;
+        VReg one = emit(Op::CONST, {}, 1);
+        fn->jump(cur, join);
+        cur = isFalse;
+        VReg zero = emit(Op::CONST, {}, 0);
+        fn->jump(cur, join);
+
+        seal(join);
+        cur = join;
+        Instr phi{Op::PHI, fn->newVReg(), {one, zero}};
+        join->phis.push_back(phi);
+        return phi.dst;
+    }
+
+    VReg lhs = evaluate(expr->lhs);
+    VReg rhs = evaluate(expr->rhs);
+
+    switch (expr->op) {
+        case BinOp::ADD: return emit(Op::ADD, {lhs, rhs});
+        case BinOp::SUB: return emit(Op::SUB, {lhs, rhs});
+        case BinOp::MUL: return emit(Op::MUL, {lhs, rhs});
+        case BinOp::DIV: return emit(Op::DIV, {lhs, rhs});
+        case BinOp::MOD: return emit(Op::MOD, {lhs, rhs});
+        case BinOp::MULQ: return emit(Op::MULQ, {lhs, rhs});
+        case BinOp::DIVQ: return emit(Op::DIVQ, {lhs, rhs});
+        case BinOp::MAX: return emit(Op::MAX, {lhs, rhs});
+        case BinOp::MIN: return emit(Op::MIN, {lhs, rhs});
+        case BinOp::EQUALS: return emit(Op::EQ, {lhs, rhs});
+        case BinOp::NEQUALS: return emit(Op::NEQ, {lhs, rhs});
+        case BinOp::GREATER: return emit(Op::GT, {lhs, rhs});
+        case BinOp::LESS: return emit(Op::LT, {lhs, rhs});
+        case BinOp::GEQUALS: return emit(Op::GEQ, {lhs, rhs});
+        case BinOp::LEQUALS: return emit(Op::LEQ, {lhs, rhs});
+        case BinOp::LAND: {
+            VReg zero = emit(Op::CONST, {}, 0);
+            VReg a = emit(Op::NEQ, {lhs, zero});
+            VReg b = emit(Op::NEQ, {rhs, zero});
+            return emit(Op::AND, {a, b});
+        }
+        case BinOp::LOR: {
+            VReg zero = emit(Op::CONST, {}, 0);
+            VReg either = emit(Op::OR, {lhs, rhs});
+            return emit(Op::NEQ, {either, zero});
+        }
+    }
+    throw std::runtime_error("Unknown binary operator " + binOpToString(expr->op));
+}
+
+/*
+ * Control goes to ifTrue when cond holds and to ifFalse otherwise. `and`
+ * and `or` branch on the left side first and only evaluate the right side
+ * in a block of its own when it still matters.
+ */
+void IRBuilder::branch(Expression* cond, Block* ifTrue, Block* ifFalse) {
+    auto* bin = dynamic_cast<BinaryExpr*>(cond);
+    if (bin != nullptr && (bin->op == BinOp::LAND || bin->op == BinOp::LOR)) {
+        Block* rhs = newBlock(false);
+        if (bin->op == BinOp::LAND) {
+            branch(bin->lhs, rhs, ifFalse);
+        } else {
+            branch(bin->lhs, ifTrue, rhs);
+        }
+        seal(rhs);
+        cur = rhs;
+        branch(bin->rhs, ifTrue, ifFalse);
+        return;
+    }
+    VReg value = evaluate(cond);
+    cur->site = module.newSite();
+    fn->branch(cur, value, ifTrue, ifFalse);
+}
+
+int IRBuilder::visitAssignment(Assignment* expr) {
+    VReg value = evaluate(expr->expr);
+    if (expr->decl == nullptr) {
+        throw std::runtime_error("Tried assigning to undeclared var: " + std::string(expr->id));
+    }
+    writeVariable(expr->decl->index, cur, value);
+    return value;
+}
+
+int IRBuilder::visitCallExpr(CallExpr* expr) {
+    size_t argc = expr->args.size();
+
+    if (expr->namesp.size() == 0 && expr->id == "delay") {
+        if (argc != 1) {
+            throw std::runtime_error("delay expects 1 argument");
+        }
+        Instr instr{Op::DELAY};
+        instr.args = {evaluate(expr->args[0])};
+        cur->instrs.push_back(std::move(instr));
+        return NO_VREG;
+    }
+
+    if (expr->namesp.size() == 0) {
+        if (expr->fn == nullptr) {
+            throw std::runtime_error("Unknown function: " + std::string(expr->id));
+        }
+        if (argc != expr->fn->params.size()) {
+            throw std::runtime_error(std::string(expr->id) + " expects " + std::to_string(expr->fn->params.size()) + " arguments");
+        }
+        if (expr->fn->tabulated) {
+            // f(x) is entry x - from of the table
+            VReg index = evaluate(expr->args[0]);
+            if (expr->fn->from != 0) index = emit(Op::SUB, {index, emit(Op::CONST, {}, expr->fn->from)});
+            Instr instr{Op::TABLE, fn->newVReg(), {index}, (int32_t) expr->fn->tableBase};
+            instr.callee = (uint32_t) (expr->fn->to - expr->fn->from);
+            cur->instrs.push_back(std::move(instr));
+            return cur->instrs.back().dst;
+        }
+        Instr instr{Op::CALL};
+        instr.callee = expr->fn->index + 1;
+        instr.site = module.newSite();
+        for (auto* arg : expr->args) {
+            instr.args.push_back(evaluate(arg));
+        }
+        if (expr->fn->returnsValue) {
+            instr.dst = fn->newVReg();
+        }
+        cur->instrs.push_back(std::move(instr));
+        return cur->instrs.back().dst;
+    }
+
+    auto ext = registry.get(expr->namesp);
+    if (ext == nullptr) {
+        throw std::runtime_error("Unknown extension: " + std::string(expr->namesp));
+    }
+    const ExtFunction* extFn = ext->getFunction(expr->id);
+    if (extFn == nullptr) {
+        throw std::runtime_error("Unknown extension function: " + std::string(expr->namesp) + "." + std::string(expr->id));
+    }
+    if (argc != extFn->argCount) {
+        throw std::runtime_error(std::string(expr->namesp) + "." + std::string(expr->id) + " expects "
+                                 + std::to_string(extFn->argCount) + " arguments");
+    }
+
+    Instr instr{Op::EXT};
+    instr.fn = extFn;
+    for (auto* arg : expr->args) {
+        instr.args.push_back(evaluate(arg));
+    }
+    if (extFn->hasReturnValue) {
+        instr.dst = fn->newVReg();
+    }
+    cur->instrs.push_back(std::move(instr));
+    return cur->instrs.back().dst;
+}
+
+int IRBuilder::visitNumberExpr(NumberExpr* expr) {
+    return emit(Op::CONST, {}, expr->val);
+}
+
+int IRBuilder::visitVarExpr(VarExpr* expr) {
+    if (expr->decl == nullptr) {
+        throw std::runtime_error("Tried accesing undeclared var: " + std::string(expr->id));
+    }
+    return readVariable(expr->decl->index, cur);
+}
+
+void IRBuilder::visitExprStatement(ExprStatement* stmt) {
+    stmt->expr->visit(this);
+}
+
+void IRBuilder::visitIfElse(IfElse* stmt) {
+    Block* thenBlock = newBlock(false);
+    Block* elseBlock = stmt->elseBody != nullptr ? newBlock(false) : nullptr;
+    Block* join = newBlock(false);
+
+    branch(stmt->cond, thenBlock, elseBlock != nullptr ? elseBlock : join);
+    seal(thenBlock);
+
+    cur = thenBlock;
+    stmt->ifBody->visit(this);
+    fn->jump(cur, join);
+
+    if (elseBlock != nullptr) {
+        seal(elseBlock);
+        cur = elseBlock;
+        stmt->elseBody->visit(this);
+        fn->jump(cur, join);
+    }
+
+    seal(join);
+    cur = join;
+}
+
+void IRBuilder::visitLoopStmt(LoopStmt* stmt) {
+    loopDepth++;
+    Block* header = newBlock(false);
+    fn->jump(cur, header);
+
+    cur = header;
+    stmt->body->visit(this);
+    fn->jump(cur, header);
+    seal(header);
+    loopDepth--;
+
+    // loops never end, whatever follows is unreachable
+    cur = newBlock(true);
+}
+
+void IRBuilder::visitForStmt(ForStmt* stmt) {
+    uint32_t guardSite = module.newSite();
+    uint32_t latchSite = module.newSite();
+    uint32_t sites = module.sites;      // the body's own
+    uint32_t var = stmt->var->index;
+    uint32_t count = stmt->count->index;
+
+    auto* from = dynamic_cast<NumberExpr*>(stmt->from);
+    auto* to = dynamic_cast<NumberExpr*>(stmt->to);
+    if (from == nullptr || to == nullptr) {
+        VReg first = evaluate(stmt->from);
+        VReg end = evaluate(stmt->to);
+        writeVariable(var, cur, first);
+        writeVariable(count, cur, emit(Op::SUB, {end, first}));
+        Block* preheader = newBlock(false);
+        Block* exit = newBlock(false);
+        VReg enter = emit(Op::LT, {first, end});
+        cur->site = guardSite;
+        fn->branch(cur, enter, preheader, exit);
+        seal(preheader);
+        cur = preheader;
+        countedLoop(stmt, 1, sites, latchSite, exit);
+        return;
+    }
+
+    int64_t rounds = (int64_t) to->val - from->val;
+    if (rounds <= 0) {
+        // never runs, the body is only checked
+        Block* after = cur;
+        cur = newBlock(true);
+        stmt->body->visit(this);
+        cur = after;
+        return;
+    }
+
+    const SiteCount* counted = module.count(latchSite);
+    bool cold = counted != nullptr && counted->toTrue + counted->toFalse == 0;
+    bool calls = false;
+    size_t size = roundSize(stmt->body, calls);
+    int64_t copies = 1;
+    if (unrolling && !cold && size != SIZE_MAX) {
+        if ((uint64_t) rounds <= FULL_UNROLL / size) {
+            copies = rounds;
+        } else if (!calls) {
+            // a call puts i + k into a register of its own in every copy, which costs what stepping i saves
+            for (int64_t k : {8, 4, 2}) {
+                if (rounds >= 2 * k && k * size <= UNROLLED_ROUND) {
+                    copies = k;
+                    break;
+                }
+            }
+        }
+    }
+
+    // a copy of the body with the variable constant
+    auto copy = [&](int64_t i) {
+        writeVariable(var, cur, emit(Op::CONST, {}, (int32_t) i));
+        module.sites = sites;
+        stmt->body->visit(this);
+    };
+    if (copies == rounds) {
+        for (int64_t i = from->val; i < to->val; i++) copy(i);
+        return;
+    }
+    int64_t peeled = rounds % copies;
+    for (int64_t i = 0; i < peeled; i++) copy(from->val + i);
+    writeVariable(var, cur, emit(Op::CONST, {}, (int32_t) (from->val + peeled)));
+    writeVariable(count, cur, emit(Op::CONST, {}, (int32_t) (uint32_t) (rounds / copies)));
+    countedLoop(stmt, (uint32_t) copies, sites, latchSite, newBlock(false));
+}
+
+/*
+ * The loop of a `for` whose variable and counter are written, cur only runs
+ * when it runs at least once. A round is copies copies of the body with
+ * the variable one further each, the counter is decremented last so the
+ * branch back tests the result of the instruction right before it.
+ */
+void IRBuilder::countedLoop(ForStmt* stmt, uint32_t copies, uint32_t sites, uint32_t latchSite, Block* exit) {
+    uint32_t count = stmt->count->index;
+    loopDepth++;
+    Block* header = newBlock(false);
+    fn->jump(cur, header);
+
+    // copy k sees i + k, dead by the next copy where i stepped k times would keep two values alive across it
+    cur = header;
+    uint32_t var = stmt->var->index;
+    VReg first = readVariable(var, cur);
+    for (uint32_t k = 0; k < copies; k++) {
+        if (k > 0) writeVariable(var, cur, emit(Op::ADD, {first, emit(Op::CONST, {}, (int32_t) k)}));
+        module.sites = sites;
+        stmt->body->visit(this);
+    }
+    writeVariable(var, cur, emit(Op::ADD, {first, emit(Op::CONST, {}, (int32_t) copies)}));
+    VReg one = emit(Op::CONST, {}, 1);
+    VReg left = emit(Op::SUB, {readVariable(count, cur), one});
+    writeVariable(count, cur, left);
+    cur->site = latchSite;
+    fn->branch(cur, left, header, exit);
+    seal(header);
+    loopDepth--;
+
+    seal(exit);
+    cur = exit;
+}
+
+void IRBuilder::visitBlockStmt(BlockStmt* stmt) {
+    for (auto* s : stmt->stmts) {
+        s->visit(this);
+    }
+}
+
+void IRBuilder::visitVarDeclaration(VarDeclaration* stmt) {
+    VReg value = stmt->expr != nullptr ? evaluate(stmt->expr) : emit(Op::CONST, {}, 0);
+    writeVariable(stmt->index, cur, value);
+}
+
+// built after the program, see build
+void IRBuilder::visitFnDecl(FnDecl* stmt) {}
+
+void IRBuilder::visitReturnStmt(ReturnStmt* stmt) {
+    VReg value = NO_VREG;
+    if (stmt->expr != nullptr) {
+        value = evaluate(stmt->expr);
+    } else if (stmt->fn->returnsValue) {
+        value = emit(Op::CONST, {}, 0);
+    }
+    cur->term = Term::RETURN;
+    cur->cond = value;
+    // whatever follows in the block is unreachable
+    cur = newBlock(true);
+}
+
+void IRBuilder::visitProgram(Program* program) {
+    for (auto req : program->reqs) {
+        auto ext = registry.get(req);
+        if (ext == nullptr) {
+            throw std::runtime_error("Unknown extension: " + std::string(req));
+        }
+        reqIDs.push_back(ext->getID());
+    }
+
+    for (auto* s : program->stmts) {
+        s->visit(this);
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef LUMA_IR_BUILDER_H
+#define LUMA_IR_BUILDER_H
+
+#include "IR.h"
+#include "../visitors/Visitor.h"
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+class ExtensionRegistry;
+class Expression;
+class Statement;
+
+/*
+ * Builds SSA straight from the AST (Braun et al., "Simple and Efficient
+ * Construction of Static Single Assignment Form"). Each block remembers the
+ * vreg every variable had when the block was left. Reading a variable the
+ * block didn't write looks it up in the predecessors and places a phi
+ * where they meet. A loop header isn't sealed until the back edge exists,
+ * its phis are completed then. Statements after a `loop` land in
+ * unreachable blocks, they are still checked but DCE drops them. `and` and
+ * `or` short-circuit: conditions branch on each side, a value is computed
+ * without branches only when running the right side anyway can't be told
+ * apart.
+ *
+ * Every `fn` becomes a Function of its own, its parameters are ARGs at the
+ * start of the entry block and a `return` ends the block it's in.
+ *
+ * A `for` counts its rounds down in a variable of its own, the branch at
+ * the end of every round tests `count - 1` so Lowering can make it a DJNZ.
+ * The loop is entered through a block that only runs when it runs at least
+ * once. With a constant trip count a small body is copied that many times
+ * instead, a larger one without calls 2, 4 or 8 times per round with the
+ * rounds that don't fill one copied in front. Every copy keeps the sites of
+ * the body as written, a loop a profile never saw running isn't unrolled.
+ */
+class IRBuilder : public Visitor {
+    const ExtensionRegistry& registry;
+    ir::Module& module;
+    ir::Function* fn = nullptr;
+    ir::Block* cur = nullptr;
+    uint32_t loopDepth = 0;
+
+    // by block id
+    std::vector<std::unordered_map<uint32_t, ir::VReg>> defs;       // variable index -> vreg
+    std::vector<std::vector<std::pair<uint32_t, ir::VReg>>> incompletePhis;
+    std::vector<bool> sealed;
+    std::vector<ir::VReg> forward;      // trivial phis, replaced by their only value
+
+    public:
+        std::vector<uint8_t> reqIDs;
+        // copy the body of `for`s with a constant trip count, not for the build a profile is taken of
+        bool unrolling = true;
+
+        IRBuilder(const ExtensionRegistry& registry, ir::Module& module);
+
+        void build(Program* program);
+
+        virtual int visitBinaryExpr(BinaryExpr* expr) override;
+        virtual int visitAssignment(Assignment* expr) override;
+        virtual int visitCallExpr(CallExpr* expr) override;
+        virtual int visitNumberExpr(NumberExpr* expr) override;
+        virtual int visitVarExpr(VarExpr* expr) override;
+        virtual void visitExprStatement(ExprStatement* stmt) override;
+        virtual void visitIfElse(IfElse* stmt) override;
+        virtual void visitLoopStmt(LoopStmt* stmt) override;
+        virtual void visitForStmt(ForStmt* stmt) override;
+        virtual void visitBlockStmt(BlockStmt* stmt) override;
+        virtual void visitVarDeclaration(VarDeclaration* stmt) override;
+        virtual void visitFnDecl(FnDecl* stmt) override;
+        virtual void visitReturnStmt(ReturnStmt* stmt) override;
+        virtual void visitProgram(Program* program) override;
+
+    private:
+        // starts building into a new function, the state of the previous one is dropped
+        void begin(ir::Function* function);
+        void finish();
+        ir::Block* newBlock(bool isSealed);
+        void seal(ir::Block* block);
+        ir::VReg emit(ir::Op op, std::vector<ir::VReg> args, int32_t imm = 0);
+        ir::VReg evaluate(Expression* expr);
+        void branch(Expression* cond, ir::Block* ifTrue, ir::Block* ifFalse);
+        void countedLoop(ForStmt* stmt, uint32_t copies, uint32_t sites, uint32_t latchSite, ir::Block* exit);
+        ir::VReg resolve(ir::VReg v);
+
+        void writeVariable(uint32_t var, ir::Block* block, ir::VReg value);
+        ir::VReg readVariable(uint32_t var, ir::Block* block);
+        ir::VReg readVariableRecursive(uint32_t var, ir::Block* block);
+        ir::VReg addPhiOperands(uint32_t var, ir::Block* block, ir::VReg phi);
+        ir::VReg tryRemoveTrivialPhi(ir::Block* block, ir::VReg phi);
+        ir::VReg undefined(ir::Block* block);
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "Passes.h"
+
+#include <algorithm>
+
+namespace ir {
+
+namespace {
+    // a callee this small is inlined everywhere, about what the call itself costs
+    const size_t SMALL = 6;
+    // inside a loop the call is paid every iteration, somewhat larger callees are worth it there
+    const size_t IN_LOOP = 24;
+    // with a profile, a call made at least 1/HOT as often as the most frequent one counts as in a loop
+    const uint64_t HOT = 8;
+
+    // dispatches a call costs next to the callee's body: moving the arguments, CALLA, RET and the result
+    size_t callOverhead(const Instr& call) {
+        return call.args.size() + 2 + (call.dst != NO_VREG ? 1 : 0);
+    }
+
+    // instructions the body adds where it's inlined, the jumps between its blocks included
+    size_t size(const Function& fn) {
+        size_t n = fn.blocks.size() - 1;
+        for (const auto& block : fn.blocks) {
+            n += block->phis.size();
+            for (const Instr& instr : block->instrs) {
+                if (instr.op != Op::ARG) n++;
+            }
+        }
+        return n;
+    }
+
+    /*
+     * Replaces the call at block->instrs[at] by a copy of the callee's
+     * blocks. The instructions after the call move to a block of their own
+     * that every RETURN of the copy jumps to, the result comes in as a phi
+     * there, parameters become copies of the arguments.
+     */
+    void inlineCall(Function& caller, Block* block, size_t at, const Function& callee) {
+        Instr call = block->instrs[at];
+        Block* cont = caller.newBlock(block->loopDepth);
+        cont->instrs.assign(block->instrs.begin() + at + 1, block->instrs.end());
+        block->instrs.resize(at);
+        cont->term = block->term;
+        cont->cond = block->cond;
+        cont->site = block->site;
+        cont->succs = std::move(block->succs);
+        block->succs.clear();
+        block->cond = NO_VREG;
+        block->site = 0;
+        for (Block* succ : cont->succs) {
+            std::replace(succ->preds.begin(), succ->preds.end(), block, cont);
+        }
+
+        std::vector<VReg> vregs(callee.vregCount, NO_VREG);
+        for (VReg v = 1; v < callee.vregCount; v++) vregs[v] = caller.newVReg();
+        std::vector<Block*> blocks(callee.blocks.size());
+        for (const auto& from : callee.blocks) {
+            blocks[from->id] = caller.newBlock(from->loopDepth + block->loopDepth);
+        }
+
+        auto copy = [&](const Instr& instr) {
+            if (instr.op == Op::ARG) return Instr{Op::COPY, vregs[instr.dst], {call.args[instr.imm]}};
+            Instr out = instr;
+            out.dst = vregs[instr.dst];
+            for (VReg& arg : out.args) arg = vregs[arg];
+            return out;
+        };
+        std::vector<VReg> results;
+        for (const auto& from : callee.blocks) {
+            Block* to = blocks[from->id];
+            for (const Instr& phi : from->phis) to->phis.push_back(copy(phi));
+            for (const Instr& instr : from->instrs) to->instrs.push_back(copy(instr));
+            for (Block* pred : from->preds) to->preds.push_back(blocks[pred->id]);
+            if (from->term == Term::RETURN) {
+                to->term = Term::JUMP;
+                to->succs = {cont};
+                cont->preds.push_back(to);
+                results.push_back(vregs[from->cond]);
+                continue;
+            }
+            to->term = from->term;
+            to->cond = vregs[from->cond];
+            to->site = from->site;
+            for (Block* succ : from->succs) to->succs.push_back(blocks[succ->id]);
+        }
+        caller.jump(block, blocks[callee.entry()->id]);
+
+        if (call.dst != NO_VREG) {
+            cont->phis.push_back(Instr{Op::PHI, call.dst, std::move(results)});
+        }
+    }
+
+    void inlineCalls(Module& module, Function& fn, const std::vector<size_t>& sites, uint64_t hottest) {
+        bool changed = false;
+        // blocks added on the way are looked at too, a call that was kept in the callee may pay off here
+        for (size_t b = 0; b < fn.blocks.size(); b++) {
+            Block* block = fn.blocks[b].get();
+            for (size_t i = 0; i < block->instrs.size(); i++) {
+                const Instr& instr = block->instrs[i];
+                if (instr.op != Op::CALL) continue;
+                const Function& callee = *module.functions[instr.callee];
+                size_t budget = callOverhead(instr) + SMALL;
+                if (block->loopDepth > 0) budget = std::max(budget, IN_LOOP);
+                // the profile knows better than the loop depth: a call that never ran isn't worth
+                // any growth, a hot one gets the budget of a loop wherever it is
+                if (const SiteCount* count = module.count(instr.site)) {
+                    if (count->calls == 0) {
+                        budget = callOverhead(instr);
+                    } else if (count->calls * HOT >= hottest) {
+                        budget = std::max(budget, IN_LOOP);
+                    }
+                }
+                if (size(callee) > budget && sites[instr.callee] != 1) continue;
+                inlineCall(fn, block, i, callee);
+                changed = true;
+                break;      // the rest of the block moved on
+            }
+        }
+        if (changed) fn.compact();
+    }
+
+    // callees before their callers, there is no recursion to make that impossible
+    void postorder(const Module& module, uint32_t fn, std::vector<bool>& visited, std::vector<uint32_t>& order) {
+        visited[fn] = true;
+        for (const auto& block : module.functions[fn]->blocks) {
+            for (const Instr& instr : block->instrs) {
+                if (instr.op == Op::CALL && !visited[instr.callee]) postorder(module, instr.callee, visited, order);
+            }
+        }
+        order.push_back(fn);
+    }
+}
+
+/*
+ * Inlines cheap callees, a function is optimized before it's inlined
+ * anywhere so its size is known. A callee with a single call site is always
+ * inlined, the copy replaces it. Functions that are never called anymore
+ * are dropped, the CALLs are renumbered.
+ */
+void optimize(Module& module, bool inlining) {
+    size_t count = module.functions.size();
+    uint64_t hottest = 0;
+    for (const SiteCount& site : module.profile) hottest = std::max(hottest, site.calls);
+    std::vector<size_t> sites(count, 0);
+    for (const auto& fn : module.functions) {
+        for (const auto& block : fn->blocks) {
+            for (const Instr& instr : block->instrs) {
+                if (instr.op == Op::CALL) sites[instr.callee]++;
+            }
+        }
+    }
+
+    std::vector<bool> visited(count, false);
+    std::vector<uint32_t> order;
+    postorder(module, 0, visited, order);
+    for (uint32_t fn : order) {
+        if (inlining) inlineCalls(module, *module.functions[fn], sites, hottest);
+        optimize(*module.functions[fn]);
+    }
+
+    std::fill(visited.begin(), visited.end(), false);
+    order.clear();
+    postorder(module, 0, visited, order);
+    std::vector<uint32_t> index(count, 0);
+    std::vector<std::unique_ptr<Function>> kept;
+    for (uint32_t fn = 0; fn < count; fn++) {
+        if (!visited[fn]) continue;
+        index[fn] = (uint32_t) kept.size();
+        kept.push_back(std::move(module.functions[fn]));
+    }
+    module.functions = std::move(kept);
+    for (auto& fn : module.functions) {
+        for (auto& block : fn->blocks) {
+            for (Instr& instr : block->instrs) {
+                if (instr.op == Op::CALL) instr.callee = index[instr.callee];
+            }
+        }
+    }
+}
+
+}
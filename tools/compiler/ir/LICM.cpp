@@ -0,0 +1,170 @@
+#include "Passes.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+namespace ir {
+
+namespace {
+    struct Loop {
+        Block* header;
+        std::vector<Block*> latches;    // sources of the back edges
+        std::vector<bool> body;         // by block id, the header included
+        size_t size = 0;
+    };
+
+    // false for unreachable blocks, they have no dominator
+    bool dominates(const std::vector<Block*>& idom, const Block* a, Block* b) {
+        while (b != a) {
+            Block* up = idom[b->id];
+            if (up == nullptr || up == b) return false;     // unreachable, or reached the entry
+            b = up;
+        }
+        return true;
+    }
+
+    // natural loops, one per header, the blocks that reach a back edge without passing the header
+    std::vector<Loop> findLoops(const Function& fn, const std::vector<Block*>& idom) {
+        std::vector<Loop> loops;
+        for (const auto& owner : fn.blocks) {
+            Block* header = owner.get();
+            if (idom[header->id] == nullptr) continue;
+            Loop loop{header, {}, std::vector<bool>(fn.blocks.size(), false)};
+            for (Block* pred : header->preds) {
+                if (dominates(idom, header, pred)) loop.latches.push_back(pred);
+            }
+            if (loop.latches.empty()) continue;
+
+            loop.body[header->id] = true;
+            loop.size = 1;
+            std::vector<Block*> work(loop.latches);
+            while (!work.empty()) {
+                Block* block = work.back();
+                work.pop_back();
+                if (loop.body[block->id] || idom[block->id] == nullptr) continue;
+                loop.body[block->id] = true;
+                loop.size++;
+                for (Block* pred : block->preds) work.push_back(pred);
+            }
+            loops.push_back(std::move(loop));
+        }
+        // a loop nested in another is smaller, inner loops go first and their
+        // invariants can move on out of the enclosing loop afterwards
+        std::stable_sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) {
+            return a.size < b.size;
+        });
+        return loops;
+    }
+}
+
+/*
+ * An instruction is invariant when it's pure and its operands are defined
+ * outside the loop, or are invariant themselves. A `loop` has no exit and
+ * a `for` has a preheader of its own that only runs when the body runs at
+ * least once, so a value computed there is the one every iteration would
+ * compute. Arithmetic is moved even out of an `if`
+ * inside the loop, that costs one extra evaluation at worst. A division is
+ * only moved with a nonzero constant divisor, it must not trap earlier than
+ * it would have, and an extension call only when it happens on every
+ * iteration anyway.
+ *
+ * Constants stay where they are: a MOVI in the loop is as cheap as keeping
+ * the value in a register the whole time, and that register is better spent
+ * on something else. A hoisted instruction gets a copy of the constants it
+ * reads in the preheader, CSE merges the copies again.
+ */
+void hoistLoopInvariants(Function& fn) {
+    std::vector<Block*> idom = fn.dominators();
+    std::vector<Block*> order = fn.reversePostorder();
+
+    // by vreg, instructions move around so values are kept instead of their definitions
+    std::vector<bool> isConst(fn.vregCount, false);
+    std::vector<int32_t> value(fn.vregCount, 0);
+    for (const auto& block : fn.blocks) {
+        for (const Instr& instr : block->instrs) {
+            if (instr.op != Op::CONST) continue;
+            isConst[instr.dst] = true;
+            value[instr.dst] = instr.imm;
+        }
+    }
+
+    for (const Loop& loop : findLoops(fn, idom)) {
+        Block* preheader = nullptr;
+        size_t outside = 0;
+        for (Block* pred : loop.header->preds) {
+            if (loop.body[pred->id] || idom[pred->id] == nullptr) continue;
+            preheader = pred;
+            outside++;
+        }
+        if (outside != 1 || preheader->term != Term::JUMP) continue;
+
+        std::vector<bool> variant(fn.vregCount, false), inside(fn.vregCount, false);
+        for (Block* block : order) {
+            if (!loop.body[block->id]) continue;
+            for (const Instr& phi : block->phis) variant[phi.dst] = true;
+            for (const Instr& instr : block->instrs) {
+                if (instr.dst == NO_VREG) continue;
+                inside[instr.dst] = true;
+                variant[instr.dst] = instr.op != Op::CONST;
+            }
+        }
+
+        std::vector<Instr> hoisted;
+        std::vector<VReg> copies(fn.vregCount, NO_VREG);    // by vreg, the preheader's copy of a constant
+        auto copyConstant = [&](VReg v) {
+            if (copies[v] == NO_VREG) {
+                Instr copy{Op::CONST, fn.newVReg()};
+                copy.imm = value[v];
+                copies[v] = copy.dst;
+                isConst.push_back(true);
+                value.push_back(copy.imm);
+                hoisted.push_back(std::move(copy));
+            }
+            return copies[v];
+        };
+
+        // in reverse postorder an operand is seen hoisted before its use
+        for (Block* block : order) {
+            if (!loop.body[block->id]) continue;
+            bool everyIteration = std::all_of(loop.latches.begin(), loop.latches.end(), [&](Block* latch) {
+                return dominates(idom, block, latch);
+            });
+
+            auto invariant = [&](const Instr& instr) -> bool {
+                if (!isPure(instr) || instr.op == Op::CONST || instr.dst == NO_VREG) return false;
+                for (VReg arg : instr.args) {
+                    if (variant[arg]) return false;
+                }
+                if (instr.op == Op::DIV || instr.op == Op::DIVQ || instr.op == Op::MOD) {
+                    return isConst[instr.args[1]] && value[instr.args[1]] != 0;
+                }
+                // a lookup outside the table halts, hoisted it would halt before the first iteration got there
+                if (instr.op == Op::TABLE) {
+                    VReg index = instr.args[0];
+                    return isConst[index] && value[index] >= 0 && (uint32_t) value[index] < instr.callee;
+                }
+                if (instr.op == Op::EXT) return everyIteration;
+                return true;
+            };
+
+            std::vector<Instr> kept;
+            for (Instr& instr : block->instrs) {
+                if (!invariant(instr)) {
+                    kept.push_back(std::move(instr));
+                    continue;
+                }
+                for (VReg& arg : instr.args) {
+                    if (inside[arg] && isConst[arg]) arg = copyConstant(arg);
+                }
+                inside[instr.dst] = false;
+                variant[instr.dst] = false;
+                hoisted.push_back(std::move(instr));
+            }
+            block->instrs = std::move(kept);
+        }
+
+        preheader->instrs.insert(preheader->instrs.end(), hoisted.begin(), hoisted.end());
+    }
+}
+
+}
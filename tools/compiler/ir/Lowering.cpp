@@ -0,0 +1,803 @@
+#include "Lowering.h"
+#include "../Extension.h"
+#include <opcode.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+using namespace ir;
+
+namespace {
+    const int REGISTERS = 8;        // R0..R7 of the VM
+    const int MEM_SLOTS = 256;
+    const int REMAT = -2;           // location of a constant that is loaded where it's used
+
+    // lowered as `MOV dst, a` followed by `OP dst, b`
+    bool isBinary(Op op) {
+        return op >= Op::ADD && op <= Op::LT;
+    }
+
+    uint8_t opcodeOf(Op op) {
+        switch (op) {
+            case Op::ADD: return OP_ADD;
+            case Op::SUB: return OP_SUB;
+            case Op::MUL: return OP_MUL;
+            case Op::DIV: return OP_DIV;
+            case Op::MOD: return OP_MOD;
+            case Op::MAX: return OP_MAX;
+            case Op::MIN: return OP_MIN;
+            case Op::MULQ: return OP_MULQ;
+            case Op::DIVQ: return OP_DIVQ;
+            case Op::AND: return OP_AND;
+            case Op::OR: return OP_OR;
+            case Op::XOR: return OP_XOR;
+            case Op::SHL: return OP_SHL;
+            case Op::SHR: return OP_SHR;
+            case Op::SAR: return OP_SAR;
+            case Op::EQ: return OP_EQ;
+            case Op::NEQ: return OP_NEQ;
+            case Op::GEQ: return OP_GEQ;
+            case Op::LEQ: return OP_LEQ;
+            case Op::GT: return OP_GT;
+            case Op::LT: return OP_LT;
+            case Op::NOT: return OP_NOT;
+            default:
+                throw std::logic_error(std::string("No opcode for ") + opName(op));
+        }
+    }
+
+    bool isComparison(Op op) {
+        return op >= Op::EQ && op <= Op::LT;
+    }
+
+    // the phi copies of an edge go at the end of its source, which must not have another successor
+    void splitCriticalEdges(Function& fn) {
+        size_t count = fn.blocks.size();
+        for (size_t i = 0; i < count; i++) {
+            Block* from = fn.blocks[i].get();
+            if (from->succs.size() < 2) continue;
+            for (Block*& to : from->succs) {
+                if (to->phis.empty()) continue;
+                Block* mid = fn.newBlock(from->loopDepth);
+                *std::find(to->preds.begin(), to->preds.end(), from) = mid;
+                mid->preds = {from};
+                mid->succs = {to};
+                mid->term = Term::JUMP;
+                to = mid;
+            }
+        }
+    }
+
+    // index of from in the preds of to, the phi arguments for that edge are there
+    size_t predIndex(const Block* to, const Block* from) {
+        return std::find(to->preds.begin(), to->preds.end(), from) - to->preds.begin();
+    }
+
+    /*
+     * Block order from a profile, Pettis & Hansen's bottom-up positioning:
+     * the edges control takes most often become fall-throughs where their
+     * blocks can still be chained. A JUMP that falls through saves its JMPA.
+     * A branch needs a JMPA only when neither side follows, on the side
+     * taken less often, so both its edges save that much and the more
+     * frequent one wins a tie. Chains keep the order of their first blocks,
+     * the entry's is first. Without counted branches it's just the reverse
+     * postorder the blocks are in.
+     */
+    std::vector<Block*> profileLayout(const Function& fn, const Module& module, uint64_t calls) {
+        size_t count = fn.blocks.size();
+        std::vector<Block*> order;
+        bool counted = std::any_of(fn.blocks.begin(), fn.blocks.end(), [&](const auto& block) {
+            return block->term == Term::BRANCH && module.count(block->site) != nullptr;
+        });
+        if (!counted) {
+            for (const auto& block : fn.blocks) order.push_back(block.get());
+            return order;
+        }
+
+        // blocks are in reverse postorder, a pass sees the counts of everything but back edges
+        std::vector<double> freq(count, 0);
+        auto edge = [&](const Block* from, size_t i) {
+            const SiteCount* c = from->term == Term::BRANCH ? module.count(from->site) : nullptr;
+            if (c != nullptr) return (double) (i == 0 ? c->toTrue : c->toFalse);
+            return from->term == Term::BRANCH ? freq[from->id] / 2 : freq[from->id];
+        };
+        for (int pass = 0; pass < 4; pass++) {
+            for (const auto& block : fn.blocks) {
+                double f = block.get() == fn.entry() ? (double) calls : 0;
+                for (size_t p = 0; p < block->preds.size(); p++) {
+                    const Block* pred = block->preds[p];
+                    if (std::find(block->preds.begin(), block->preds.begin() + p, pred) != block->preds.begin() + p) continue;
+                    for (size_t i = 0; i < pred->succs.size(); i++) {
+                        if (pred->succs[i] == block.get()) f += edge(pred, i);
+                    }
+                }
+                freq[block->id] = f;
+            }
+        }
+
+        struct Edge {
+            Block* from;
+            Block* to;
+            double saves, taken;
+        };
+        std::vector<Edge> edges;
+        for (const auto& block : fn.blocks) {
+            if (block->term == Term::JUMP) {
+                edges.push_back({block.get(), block->succs[0], freq[block->id], freq[block->id]});
+            } else if (block->term == Term::BRANCH) {
+                double t = edge(block.get(), 0), f = edge(block.get(), 1);
+                edges.push_back({block.get(), block->succs[0], std::min(t, f), t});
+                edges.push_back({block.get(), block->succs[1], std::min(t, f), f});
+            }
+        }
+        std::stable_sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) {
+            return a.saves != b.saves ? a.saves > b.saves : a.taken > b.taken;
+        });
+
+        std::vector<std::vector<Block*>> chains(count);
+        std::vector<uint32_t> chainOf(count);
+        for (const auto& block : fn.blocks) {
+            chains[block->id] = {block.get()};
+            chainOf[block->id] = block->id;
+        }
+        for (const Edge& e : edges) {
+            uint32_t a = chainOf[e.from->id], b = chainOf[e.to->id];
+            if (a == b || e.to == fn.entry() || chains[a].back() != e.from || chains[b].front() != e.to) continue;
+            for (Block* block : chains[b]) chainOf[block->id] = a;
+            chains[a].insert(chains[a].end(), chains[b].begin(), chains[b].end());
+            chains[b].clear();
+        }
+
+        for (const auto& block : fn.blocks) {
+            const std::vector<Block*>& chain = chains[block->id];
+            order.insert(order.end(), chain.begin(), chain.end());
+        }
+        return order;
+    }
+
+    // follows blocks that do nothing but jump on
+    const Block* jumpTarget(const Block* to, size_t limit) {
+        while (limit-- > 0 && to->instrs.empty() && to->term == Term::JUMP
+               && to->succs[0] != to && to->succs[0]->phis.empty()) {
+            to = to->succs[0];
+        }
+        return to;
+    }
+}
+
+Lowering::Lowering(std::vector<uint8_t> reqIDs) {
+    this->reqIDs = std::move(reqIDs);
+}
+
+/*
+ * Every block takes the positions [start, end], each instruction two of
+ * them: operands are read at the first, the result is written at the
+ * second. A result can reuse the register of an operand that dies with the
+ * instruction. The second operand of `a op b` is kept until the result is
+ * written, `MOV dst, a` would overwrite it otherwise. Live ranges are the
+ * hull of all positions a value is live at, holes aren't used.
+ */
+void Lowering::computeIntervals(const Function& fn) {
+    size_t count = fn.blocks.size();
+    blockStart.assign(count, 0);
+    blockEnd.assign(count, 0);
+    uint32_t pos = 0;
+    for (const auto& block : fn.blocks) {
+        blockStart[block->id] = pos;
+        pos += 2 + 2 * (uint32_t) block->instrs.size();
+        blockEnd[block->id] = pos;
+        pos += 2;
+    }
+
+    constants.assign(fn.vregCount, nullptr);
+    std::vector<uint32_t> defBlock(fn.vregCount, UINT32_MAX);
+    std::vector<std::vector<VReg>> gen(count), liveIn(count), liveOut(count);
+    for (const auto& block : fn.blocks) {
+        for (const Instr& phi : block->phis) defBlock[phi.dst] = block->id;
+        for (const Instr& instr : block->instrs) {
+            if (instr.dst != NO_VREG) defBlock[instr.dst] = block->id;
+            if (instr.op == Op::CONST) constants[instr.dst] = &instr;
+        }
+    }
+    findFusedCompares(fn);
+    for (const auto& block : fn.blocks) {
+        std::vector<VReg>& uses = gen[block->id];
+        for (const Instr& instr : block->instrs) {
+            for (VReg arg : instr.args) {
+                if (defBlock[arg] != block->id) uses.push_back(arg);
+            }
+        }
+        if (block->cond != NO_VREG && defBlock[block->cond] != block->id) uses.push_back(block->cond);
+        std::sort(uses.begin(), uses.end());
+        uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+    }
+
+    // backwards dataflow, the sets only grow so comparing sizes tells if anything changed
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = count; b-- > 0;) {
+            const Block* block = fn.blocks[b].get();
+            std::vector<VReg> out;
+            for (const Block* succ : block->succs) {
+                out.insert(out.end(), liveIn[succ->id].begin(), liveIn[succ->id].end());
+                size_t edge = predIndex(succ, block);
+                for (const Instr& phi : succ->phis) out.push_back(phi.args[edge]);
+            }
+            std::sort(out.begin(), out.end());
+            out.erase(std::unique(out.begin(), out.end()), out.end());
+
+            std::vector<VReg> in = gen[b];
+            for (VReg v : out) {
+                if (defBlock[v] != b) in.push_back(v);
+            }
+            std::sort(in.begin(), in.end());
+            in.erase(std::unique(in.begin(), in.end()), in.end());
+
+            if (in.size() != liveIn[b].size() || out.size() != liveOut[b].size()) changed = true;
+            liveIn[b] = std::move(in);
+            liveOut[b] = std::move(out);
+        }
+    }
+
+    intervals.assign(fn.vregCount, LiveInterval{UINT32_MAX, 0});
+    auto live = [&](VReg v, uint32_t at, double weight) {
+        LiveInterval& iv = intervals[v];
+        iv.start = std::min(iv.start, at);
+        iv.end = std::max(iv.end, at);
+        iv.weight += weight;
+    };
+
+    // positions of the calls that overwrite at least R0..R(k-1), by k
+    std::vector<uint32_t> calls[5];
+    for (const auto& block : fn.blocks) {
+        uint32_t id = block->id;
+        double weight = useWeight(block->loopDepth);
+        for (VReg v : liveIn[id]) live(v, blockStart[id], 0);
+        for (VReg v : liveOut[id]) live(v, blockEnd[id], 0);
+        for (const Instr& phi : block->phis) live(phi.dst, blockStart[id], weight);
+
+        uint32_t at = blockStart[id] + 2;
+        for (const Instr& instr : block->instrs) {
+            // a compare fused into the branch reads its operands at the jump and has no result
+            if (&instr == fused[id]) {
+                for (VReg arg : fusedOperands(instr)) live(arg, blockEnd[id], weight);
+                break;
+            }
+            for (size_t i = 0; i < instr.args.size(); i++) {
+                live(instr.args[i], isBinary(instr.op) && i > 0 ? at + 1 : at, weight);
+            }
+            // loading a constant again costs nothing extra, only its uses count
+            if (instr.dst != NO_VREG) live(instr.dst, at + 1, instr.op == Op::CONST ? 0 : weight);
+            if (instr.op == Op::EXT) {
+                size_t clobbered = std::max<size_t>(std::min<size_t>(instr.args.size(), 4), instr.fn->hasReturnValue);
+                for (size_t k = 1; k <= clobbered; k++) calls[k].push_back(at);
+            }
+            if (instr.op == Op::CALL) {
+                for (size_t k = 1; k <= 4; k++) calls[k].push_back(at);
+            }
+            // the parameters are all moved where they belong on entry
+            if (instr.op == Op::ARG) live(instr.dst, blockStart[id], 0);
+            at += 2;
+        }
+        if (block->cond != NO_VREG && fused[id] == nullptr) live(block->cond, blockEnd[id], weight);
+        for (const Block* succ : block->succs) {
+            size_t edge = predIndex(succ, block.get());
+            for (const Instr& phi : succ->phis) live(phi.args[edge], blockEnd[id], weight);
+        }
+    }
+
+    coalesce(fn);
+
+    // values live across a call stay out of the registers it overwrites. Spilling a long range frees
+    // a register for longer, so the weight is spread over the length
+    for (VReg v = 0; v < fn.vregCount; v++) {
+        if (shares[v] != v) continue;
+        LiveInterval& iv = intervals[v];
+        iv.weight /= std::sqrt(iv.end - iv.start + 1.0);
+        for (size_t k = 4; k > 0; k--) {
+            auto call = std::lower_bound(calls[k].begin(), calls[k].end(), iv.start);
+            if (call != calls[k].end() && *call < iv.end) {
+                iv.avoid = (1u << k) - 1;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * A branch on a comparison nothing else reads becomes a compare-and-branch,
+ * the comparison has to be the last instruction of the block so its
+ * operands are still where they were when the jump reads them. Comparing
+ * for (in)equality with 0 is a JZA or JNZA of the other operand. A branch
+ * on `c - 1` as the last instruction may become a DJNZ, see findDecrements.
+ */
+void Lowering::findFusedCompares(const Function& fn) {
+    std::vector<uint32_t> uses(fn.vregCount, 0);
+    for (const auto& block : fn.blocks) {
+        for (const Instr& phi : block->phis) {
+            for (VReg arg : phi.args) uses[arg]++;
+        }
+        for (const Instr& instr : block->instrs) {
+            for (VReg arg : instr.args) uses[arg]++;
+        }
+        if (block->cond != NO_VREG) uses[block->cond]++;
+    }
+
+    fused.assign(fn.blocks.size(), nullptr);
+    decrements.assign(fn.blocks.size(), nullptr);
+    unneeded.assign(fn.vregCount, false);
+    for (const auto& block : fn.blocks) {
+        if (block->term != Term::BRANCH || block->instrs.empty()) continue;
+        const Instr& last = block->instrs.back();
+        if (isComparison(last.op) && last.dst == block->cond && uses[last.dst] == 1) {
+            // comparing two constants would need two registers to load them into
+            if (constants[last.args[0]] == nullptr || constants[last.args[1]] == nullptr) fused[block->id] = &last;
+        }
+        const Instr* one = last.op == Op::SUB ? constants[last.args[1]] : nullptr;
+        if (one != nullptr && one->imm == 1 && last.dst == block->cond) {
+            decrements[block->id] = &last;
+            unneeded[one->dst] = uses[one->dst] == 1;
+        }
+    }
+}
+
+/*
+ * `c - 1` the branch tests is a DJNZ when c and the difference ended up in
+ * the same register, the counter of a `for` usually does. Anything else is
+ * a SUB and a JNZA. Only the operand's interval is reserved for the 1, its
+ * MOVI is left out when nothing else reads it.
+ */
+void Lowering::findDecrements() {
+    for (const Instr*& dec : decrements) {
+        if (dec == nullptr) continue;
+        int loc = location(dec->dst);
+        if (loc >= 0 && loc < REGISTERS && loc == location(dec->args[0])) continue;
+        unneeded[dec->args[1]] = false;
+        dec = nullptr;
+    }
+}
+
+bool Lowering::isZero(VReg v) const {
+    return constants[v] != nullptr && constants[v]->imm == 0;
+}
+
+// the operands a fused compare still reads, a 0 it's tested against is left out
+std::vector<VReg> Lowering::fusedOperands(const Instr& cmp) const {
+    if (cmp.op == Op::EQ || cmp.op == Op::NEQ) {
+        if (isZero(cmp.args[1])) return {cmp.args[0]};
+        if (isZero(cmp.args[0])) return {cmp.args[1]};
+    }
+    return cmp.args;
+}
+
+/*
+ * Merges the interval of a phi argument into the phi's when the two don't
+ * overlap, typically the value a loop variable had at the end of the last
+ * iteration and the phi it flows back into. The copy on that edge becomes a
+ * move to the same register. Writing the phi's location at the end of
+ * another predecessor can't hit a value merged into it: anything live
+ * there, apart from what the phis themselves read, is live into the
+ * phi's block too and so overlaps the phi.
+ */
+void Lowering::coalesce(const Function& fn) {
+    shares.resize(fn.vregCount);
+    for (VReg v = 0; v < fn.vregCount; v++) shares[v] = v;
+    auto find = [&](VReg v) {
+        while (shares[v] != v) v = shares[v] = shares[shares[v]];
+        return v;
+    };
+
+    for (const auto& block : fn.blocks) {
+        for (const Instr& phi : block->phis) {
+            for (VReg arg : phi.args) {
+                VReg into = find(phi.dst), from = find(arg);
+                if (into == from || constants[arg] != nullptr) continue;
+                LiveInterval& a = intervals[into];
+                LiveInterval& b = intervals[from];
+                if (a.start <= b.end && b.start <= a.end) continue;
+                a.start = std::min(a.start, b.start);
+                a.end = std::max(a.end, b.end);
+                a.weight += b.weight;
+                shares[from] = into;
+            }
+        }
+    }
+    for (VReg v = 0; v < fn.vregCount; v++) shares[v] = find(v);
+}
+
+/*
+ * All registers if that's enough. Otherwise one is set aside to load the
+ * constants that didn't fit into, an instruction reads at most one of them
+ * that way. Only when values have to go to memory as well a second one is.
+ */
+void Lowering::allocate() {
+    std::vector<LiveInterval*> used;
+    for (VReg v = 0; v < intervals.size(); v++) {
+        if (shares[v] == v && intervals[v].start != UINT32_MAX) used.push_back(&intervals[v]);
+    }
+
+    std::vector<int> registers;
+    for (int r = 0; r < REGISTERS; r++) registers.push_back(r);
+    if (linearScan(used, registers).empty()) return;
+
+    auto isConstant = [&](const LiveInterval* iv) { return constants[iv - intervals.data()] != nullptr; };
+    scratch = scratch2 = REGISTERS - 1;
+    registers.resize(REGISTERS - 1);
+    for (LiveInterval* iv : used) iv->loc = -1;
+    std::vector<LiveInterval*> left = linearScan(used, registers);
+    if (std::all_of(left.begin(), left.end(), isConstant)) {
+        for (LiveInterval* iv : left) iv->loc = REMAT;
+        return;
+    }
+
+    scratch2 = REGISTERS - 2;
+    registers.resize(REGISTERS - 2);
+    for (LiveInterval* iv : used) iv->loc = -1;
+    std::vector<LiveInterval*> spilled;
+    for (LiveInterval* iv : linearScan(used, registers)) {
+        if (isConstant(iv)) {
+            iv->loc = REMAT;
+        } else {
+            iv->avoid = 0;
+            spilled.push_back(iv);
+        }
+    }
+
+    std::vector<int> slots;
+    for (int s = memBase; s < MEM_SLOTS; s++) slots.push_back(MEM + s);
+    if (!linearScan(spilled, slots).empty()) {
+        throw std::runtime_error("Too many values live at once, mem has " + std::to_string(MEM_SLOTS) + " slots");
+    }
+}
+
+// register the result of an instruction is computed in
+int Lowering::target(VReg dst) const {
+    return location(dst) >= 0 && location(dst) < MEM ? location(dst) : scratch;
+}
+
+// register holding v, loaded into reg if v isn't in one
+int Lowering::operand(VReg v, int reg) {
+    if (location(v) >= 0 && location(v) < MEM) return location(v);
+    load(reg, v);
+    return reg;
+}
+
+void Lowering::load(int reg, VReg v) {
+    int loc = location(v);
+    if (loc == REMAT) {
+        emitu8(OP_MOVI);
+        emitu8((uint8_t) reg);
+        emiti32(constants[v]->imm);
+    } else if (loc >= MEM) {
+        emitu8(OP_LOAD);
+        emitu8((uint8_t) reg);
+        emitu8((uint8_t) (loc - MEM));
+    } else if (loc != reg) {
+        emitMov(reg, loc);
+    }
+}
+
+void Lowering::finish(VReg dst, int reg) {
+    if (location(dst) < MEM) return;
+    emitu8(OP_STORE);
+    emitu8((uint8_t) (location(dst) - MEM));
+    emitu8((uint8_t) reg);
+}
+
+// (location, value) pairs, performed as if all at once
+void Lowering::emitMoves(const std::vector<std::pair<int, VReg>>& moves) {
+    std::vector<std::pair<int, int>> copies;
+    for (auto [dst, v] : moves) {
+        if (location(v) != REMAT) copies.emplace_back(dst, location(v));
+    }
+    emitParallelMove(copies, scratch);
+
+    // constants don't read any location, they can come last
+    for (auto [dst, v] : moves) {
+        if (location(v) != REMAT) continue;
+        int reg = dst < MEM ? dst : scratch;
+        load(reg, v);
+        if (dst >= MEM) {
+            emitu8(OP_STORE);
+            emitu8((uint8_t) (dst - MEM));
+            emitu8((uint8_t) reg);
+        }
+    }
+}
+
+void Lowering::emitInstr(const Instr& instr) {
+    switch (instr.op) {
+        case Op::CONST: {
+            if (location(instr.dst) == REMAT || unneeded[instr.dst]) break;
+            int reg = target(instr.dst);
+            emitu8(OP_MOVI);
+            emitu8((uint8_t) reg);
+            emiti32(instr.imm);
+            finish(instr.dst, reg);
+            break;
+        }
+        case Op::COPY:
+            emitMoves({{location(instr.dst), instr.args[0]}});
+            break;
+        case Op::PHI:
+            throw std::logic_error("Phi among the instructions of a block");
+        case Op::NOT: {
+            int reg = target(instr.dst);
+            load(reg, instr.args[0]);
+            emitu8(OP_NOT);
+            emitu8((uint8_t) reg);
+            finish(instr.dst, reg);
+            break;
+        }
+        case Op::EXT: {
+            const ExtFunction* fn = instr.fn;
+            // arguments past R3 are popped by the VM, the fifth has to be on top
+            for (size_t i = instr.args.size(); i-- > 4;) {
+                int reg = operand(instr.args[i], scratch);
+                emitu8(OP_PUSH);
+                emitu8((uint8_t) reg);
+            }
+            std::vector<std::pair<int, VReg>> moves;
+            for (size_t i = 0; i < instr.args.size() && i < 4; i++) {
+                moves.emplace_back((int) i, instr.args[i]);
+            }
+            emitMoves(moves);
+
+            emitu8(OP_EXT);
+            emitu8(fn->extID);
+            emitu8(fn->subOp);
+            if (instr.dst != NO_VREG) {
+                emitParallelMove({{location(instr.dst), 0}});
+            }
+            break;
+        }
+        case Op::DELAY: {
+            int reg = operand(instr.args[0], scratch);
+            emitu8(OP_DELAY);
+            emitu8((uint8_t) reg);
+            break;
+        }
+        case Op::ARG:
+            break;      // moved on entry
+        case Op::TABLE: {
+            int reg = target(instr.dst);
+            int index = operand(instr.args[0], reg);
+            emitTableLoad((uint8_t) reg, (uint8_t) index, (uint16_t) instr.imm, (uint16_t) instr.callee);
+            finish(instr.dst, reg);
+            break;
+        }
+        case Op::CALL: {
+            for (size_t i = instr.args.size(); i-- > 4;) {
+                int reg = operand(instr.args[i], scratch);
+                emitu8(OP_PUSH);
+                emitu8((uint8_t) reg);
+            }
+            std::vector<std::pair<int, VReg>> moves;
+            for (size_t i = 0; i < instr.args.size() && i < 4; i++) {
+                moves.emplace_back((int) i, instr.args[i]);
+            }
+            emitMoves(moves);
+
+            if (instr.site != 0) siteAddrs.push_back({code.size(), instr.site, true});
+            emitu8(OP_CALLA);
+            callFixups.emplace_back(code.size(), instr.callee);
+            emitu16(0);
+            if (instr.dst != NO_VREG) {
+                emitParallelMove({{location(instr.dst), 0}});
+            }
+            break;
+        }
+        default: {
+            int reg = target(instr.dst);
+            // a first operand that isn't in a register is loaded straight into the result register
+            load(reg, instr.args[0]);
+            int rhs = operand(instr.args[1], scratch2);
+            emitu8(opcodeOf(instr.op));
+            emitDestSrc((uint8_t) reg, (uint8_t) rhs);
+            finish(instr.dst, reg);
+            break;
+        }
+    }
+}
+
+void Lowering::run(Module& module) {
+    this->module = &module;
+    // how often the profile saw each function called, the program runs once
+    std::vector<uint64_t> calls(module.functions.size(), 0);
+    calls[0] = 1;
+    for (const auto& fn : module.functions) {
+        for (const auto& block : fn->blocks) {
+            for (const Instr& instr : block->instrs) {
+                if (const SiteCount* count = instr.op == Op::CALL ? module.count(instr.site) : nullptr) {
+                    calls[instr.callee] += count->calls;
+                }
+            }
+        }
+    }
+
+    functionAddrs.assign(module.functions.size(), 0);
+    for (size_t i = 0; i < module.functions.size(); i++) {
+        functionAddrs[i] = code.size();
+        lowerFunction(*module.functions[i], i == 0, calls[i]);
+    }
+
+    if (code.size() > UINT16_MAX) {
+        throw std::runtime_error("Program too large, jump targets are 16 bit");
+    }
+    for (auto [at, callee] : callFixups) {
+        patchJump(at, functionAddrs[callee]);
+    }
+}
+
+void Lowering::relocate(const std::vector<size_t>& moved) {
+    std::vector<SiteAddress> kept;
+    for (SiteAddress addr : siteAddrs) {
+        if (moved[addr.at] == SIZE_MAX) continue;
+        addr.at = moved[addr.at];
+        kept.push_back(addr);
+    }
+    siteAddrs = std::move(kept);
+}
+
+/*
+ * Takes the parameters off the stack, saves the registers of the caller the
+ * function uses and moves every parameter to its location at once.
+ */
+void Lowering::emitEntry(const Function& fn) {
+    std::vector<const Instr*> args;
+    for (const Instr& instr : fn.entry()->instrs) {
+        if (instr.op == Op::ARG) args.push_back(&instr);
+    }
+
+    // the frame's spilled values come first, then the stack arguments and the two words to pop them
+    int frameEnd = memBase;
+    for (VReg v = 0; v < intervals.size(); v++) {
+        if (shares[v] == v && intervals[v].loc >= MEM) frameEnd = std::max(frameEnd, intervals[v].loc - MEM + 1);
+    }
+    int stackArgs = fn.params > 4 ? (int) fn.params - 4 : 0;
+    memBase = frameEnd + (stackArgs > 0 ? stackArgs + 2 : 0);
+    if (memBase > MEM_SLOTS) {
+        throw std::runtime_error("Too many values live at once, mem has " + std::to_string(MEM_SLOTS) + " slots");
+    }
+    if (stackArgs > 0) {
+        std::vector<uint8_t> homes;
+        for (int i = 0; i < stackArgs; i++) homes.push_back((uint8_t) (frameEnd + i));
+        emitTakeStackArgs((uint8_t) (frameEnd + stackArgs), homes);
+    }
+
+    saved = scratch >= 0 ? (uint8_t) ((1u << scratch) | (1u << scratch2)) : 0;
+    for (VReg v = 0; v < intervals.size(); v++) {
+        int loc = intervals[v].loc;
+        if (shares[v] == v && intervals[v].start != UINT32_MAX && loc >= 4 && loc < REGISTERS) saved |= (uint8_t) (1u << loc);
+    }
+    saved &= 0xF0;
+    emitSave(saved);
+
+    std::vector<std::pair<int, int>> moves;
+    for (const Instr* arg : args) {
+        int from = arg->imm < 4 ? arg->imm : MEM + frameEnd + arg->imm - 4;
+        moves.emplace_back(location(arg->dst), from);
+    }
+    emitParallelMove(moves, scratch);
+}
+
+void Lowering::lowerFunction(Function& fn, bool isMain, uint64_t calls) {
+    splitCriticalEdges(fn);
+    fn.compact();
+    scratch = scratch2 = -1;
+    computeIntervals(fn);
+    allocate();
+    findDecrements();
+    if (!isMain) emitEntry(fn);
+
+    size_t count = fn.blocks.size();
+    std::vector<uint32_t> labels(count);
+    std::vector<std::pair<size_t, const Block*>> fixups;
+    auto jump = [&](uint8_t op, int cond, const Block* to) {
+        emitu8(op);
+        if (cond >= 0) emitu8((uint8_t) cond);
+        fixups.emplace_back(code.size(), jumpTarget(to, count));
+        emitu16(0);
+    };
+
+    // registers were allocated along the reverse postorder, that holds however the code is laid out
+    std::vector<Block*> order = profileLayout(fn, *module, calls);
+    for (size_t i = 0; i < count; i++) {
+        const Block* block = order[i];
+        const Block* next = i + 1 < count ? order[i + 1] : nullptr;
+        labels[block->id] = (uint32_t) code.size();
+
+        const Instr* dec = decrements[block->id];
+        for (const Instr& instr : block->instrs) {
+            if (&instr != fused[block->id] && &instr != dec) emitInstr(instr);
+        }
+
+        switch (block->term) {
+            case Term::JUMP: {
+                const Block* succ = block->succs[0];
+                std::vector<std::pair<int, VReg>> moves;
+                size_t edge = predIndex(succ, block);
+                for (const Instr& phi : succ->phis) {
+                    moves.emplace_back(location(phi.dst), phi.args[edge]);
+                }
+                emitMoves(moves);
+                if (succ != next) jump(OP_JMPA, -1, succ);
+                break;
+            }
+            case Term::BRANCH: {
+                const Block* ifTrue = block->succs[0];
+                const Block* ifFalse = block->succs[1];
+                // jumps to `to` if the condition is jumpIf
+                auto branch = [&](bool jumpIf, const Block* to) {
+                    // the jump is emitted after its operands are loaded, that's the offset a profile counts it at
+                    auto mark = [&]() {
+                        if (block->site != 0) siteAddrs.push_back({code.size(), block->site, jumpIf});
+                    };
+                    if (dec != nullptr) {
+                        mark();
+                        jump(OP_DJNZ, location(dec->dst), to);
+                        return;
+                    }
+                    const Instr* cmp = fused[block->id];
+                    if (cmp == nullptr) {
+                        int reg = operand(block->cond, scratch);
+                        mark();
+                        jump(jumpIf ? OP_JNZA : OP_JZA, reg, to);
+                        return;
+                    }
+                    std::vector<VReg> args = fusedOperands(*cmp);
+                    if (args.size() == 1) {
+                        int reg = operand(args[0], scratch);
+                        mark();
+                        jump(jumpIf == (cmp->op == Op::NEQ) ? OP_JNZA : OP_JZA, reg, to);
+                        return;
+                    }
+                    int a = operand(args[0], scratch);
+                    int b = operand(args[1], scratch2);
+                    mark();
+                    fixups.emplace_back(emitCompareJump(opcodeOf(cmp->op), jumpIf, a, b), jumpTarget(to, count));
+                };
+                // neither side follows: the conditional jump goes where the profile says control goes more often
+                const SiteCount* counted = module->count(block->site);
+                bool falseIsHot = counted != nullptr && counted->toFalse > counted->toTrue;
+                if (dec != nullptr) {
+                    // DJNZ only jumps while the counter isn't 0
+                    branch(true, ifTrue);
+                    if (ifFalse != next) jump(OP_JMPA, -1, ifFalse);
+                } else if (ifFalse == next) {
+                    branch(true, ifTrue);
+                } else if (ifTrue == next) {
+                    branch(false, ifFalse);
+                } else if (falseIsHot) {
+                    branch(false, ifFalse);
+                    jump(OP_JMPA, -1, ifTrue);
+                } else {
+                    branch(true, ifTrue);
+                    jump(OP_JMPA, -1, ifFalse);
+                }
+                break;
+            }
+            case Term::EXIT:
+                emitu8(OP_HALT);
+                break;
+            case Term::RETURN:
+                if (block->cond != NO_VREG) emitMoves({{0, block->cond}});
+                emitRestore(saved);
+                emitu8(OP_RET);
+                break;
+        }
+    }
+
+    for (auto [at, to] : fixups) {
+        patchJump(at, labels[to->id]);
+    }
+    if (isMain) {
+        // the program's own spilled values, the functions' frames follow
+        for (VReg v = 0; v < intervals.size(); v++) {
+            if (shares[v] == v && intervals[v].loc >= MEM) memBase = std::max(memBase, intervals[v].loc - MEM + 1);
+        }
+    }
+}
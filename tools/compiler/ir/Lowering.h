@@ -0,0 +1,90 @@
+#ifndef LUMA_IR_LOWERING_H
+#define LUMA_IR_LOWERING_H
+
+#include "IR.h"
+#include "../visitors/CodeBuffer.h"
+#include "../visitors/LinearScan.h"
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Emits LBC for an SSA module, the program first and its functions after the
+ * HALT. Blocks are laid out in reverse postorder,
+ * every vreg gets a register or, when more values are live than registers
+ * exist, a memory word, by linear scan over the live ranges of the whole
+ * function. Constants that don't get a register are loaded again with MOVI
+ * wherever they are used instead of taking up memory. Phis become parallel
+ * moves at the end of the predecessors, so edges into a block with phis
+ * that leave a branch get a block of their own first. A phi and an argument
+ * whose ranges don't overlap share one, that copy disappears. A branch on a
+ * comparison becomes a single compare-and-branch, one on `c - 1` a DJNZ
+ * when c and the difference share a register. With a profile the code
+ * of the blocks is laid out so the jumps taken most often fall through
+ * instead, registers are still allocated along the reverse postorder. A
+ * branch followed by neither side jumps conditionally to the side it takes
+ * more often.
+ *
+ * Calls follow the convention of extension calls: the first four arguments
+ * in R0..R3, the rest pushed with the fifth on top, the result in R0. R0..R3
+ * are overwritten, a function saves the ones of R4..R7 it uses on the
+ * stack, a leaf that gets by with R0..R3 saves nothing. Functions can't
+ * recurse, so each has memory words of its own for spilled values.
+ */
+// the conditional jump of a branch or the CALLA of a call, see ir::Module::profile
+struct SiteAddress {
+    size_t at;              // code offset
+    uint32_t site;
+    bool jumpsIfTrue;       // a branch's jump is taken when the condition is true
+};
+
+class Lowering : public CodeBuffer {
+    std::vector<LiveInterval> intervals;    // by vreg
+    std::vector<ir::VReg> shares;           // by vreg, the vreg whose interval it was merged into
+    std::vector<const ir::Instr*> constants;    // by vreg, the CONST defining it
+    std::vector<const ir::Instr*> fused;        // by block id, the comparison its branch performs
+    std::vector<const ir::Instr*> decrements;   // by block id, the `c - 1` its DJNZ performs
+    std::vector<bool> unneeded;                 // by vreg, a 1 nothing but a DJNZ reads
+    std::vector<uint32_t> blockStart, blockEnd;
+    // registers kept free for loading memory words, only once something had to be spilled
+    int scratch = -1, scratch2 = -1;
+    int memBase = 0;                        // first memory word the function being lowered may use
+    uint8_t saved = 0;                      // R4..R7 it pushes on entry, bit n for Rn
+    std::vector<size_t> functionAddrs;      // by index in the module
+    std::vector<std::pair<size_t, uint32_t>> callFixups;
+    const ir::Module* module = nullptr;
+    std::vector<SiteAddress> siteAddrs;
+
+    public:
+        explicit Lowering(std::vector<uint8_t> reqIDs);
+
+        // splits critical edges on the way
+        void run(ir::Module& module);
+
+        // where every branch and call ended up, the peephole pass is accounted for
+        const std::vector<SiteAddress>& sites() const { return siteAddrs; }
+
+    protected:
+        void relocate(const std::vector<size_t>& moved) override;
+
+    private:
+        void lowerFunction(ir::Function& fn, bool isMain, uint64_t calls);
+        void emitEntry(const ir::Function& fn);
+        void computeIntervals(const ir::Function& fn);
+        void allocate();
+
+        void findFusedCompares(const ir::Function& fn);
+        void findDecrements();
+        bool isZero(ir::VReg v) const;
+        std::vector<ir::VReg> fusedOperands(const ir::Instr& cmp) const;
+        void coalesce(const ir::Function& fn);
+        int location(ir::VReg v) const { return intervals[shares[v]].loc; }
+        int target(ir::VReg dst) const;
+        int operand(ir::VReg v, int reg);
+        void load(int reg, ir::VReg v);
+        void finish(ir::VReg dst, int reg);
+        void emitMoves(const std::vector<std::pair<int, ir::VReg>>& moves);
+        void emitInstr(const ir::Instr& instr);
+};
+
+#endif
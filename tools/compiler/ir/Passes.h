@@ -0,0 +1,37 @@
+#ifndef LUMA_IR_PASSES_H
+#define LUMA_IR_PASSES_H
+
+#include "IR.h"
+
+namespace ir {
+
+// replaces copies and phis that merge a single value by that value
+void propagateCopies(Function& fn);
+
+// reuses the result of an identical pure instruction that dominates the recomputation
+void eliminateCommonSubexpressions(Function& fn);
+
+// turns multiplication, division and modulo by constants into shifts where that's cheaper
+void reduceStrength(Function& fn);
+
+// moves pure instructions whose operands don't change inside a `loop` in front of it
+void hoistLoopInvariants(Function& fn);
+
+/*
+ * Folds branches on constants, drops unreachable blocks (everything after a
+ * `loop`), merges straight-line chains of blocks and removes instructions
+ * whose value is never used. A `let` that is written but not read is just
+ * such a value, so dead stores go with it.
+ */
+void eliminateDeadCode(Function& fn);
+
+// runs the passes above until they stop finding anything
+void optimize(Function& fn);
+
+// inlines cheap calls and optimizes every function, functions nobody calls anymore are dropped.
+// Without inlining every call stays where it's written, which is what a profile is taken of
+void optimize(Module& module, bool inlining = true);
+
+}
+
+#endif
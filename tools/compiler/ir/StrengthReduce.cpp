@@ -0,0 +1,182 @@
+#include "Passes.h"
+
+#include <stdint.h>
+
+namespace ir {
+
+namespace {
+    // log2 of a power of two, -1 for anything else
+    int exponent(int32_t c) {
+        uint32_t u = (uint32_t) c;
+        if (u == 0 || (u & (u - 1)) != 0) return -1;
+        int k = 0;
+        while (u > 1) {
+            u >>= 1;
+            k++;
+        }
+        return k;
+    }
+
+    /*
+     * Values that are never negative, a shift right is then the same as a
+     * division. Optimistic: every value starts out non-negative and is
+     * demoted until nothing changes, so a loop counter that only grows from 0
+     * keeps its sign (as long as it's not added to, an addition may wrap).
+     */
+    std::vector<bool> nonNegativeValues(const Function& fn, const std::vector<bool>& isConst,
+                                        const std::vector<int32_t>& value) {
+        std::vector<bool> nonNeg(fn.vregCount, true);
+        auto known = [&](VReg v) -> bool { return nonNeg[v]; };
+        auto constant = [&](VReg v, int32_t& c) {
+            c = value[v];
+            return isConst[v];
+        };
+
+        auto evaluate = [&](const Instr& instr) -> bool {
+            int32_t c;
+            switch (instr.op) {
+                case Op::CONST: return instr.imm >= 0;
+                case Op::COPY: case Op::SAR: case Op::MOD: return known(instr.args[0]);
+                case Op::PHI: case Op::OR: case Op::XOR: case Op::MIN: case Op::DIV: {
+                    for (VReg arg : instr.args) {
+                        if (!known(arg)) return false;
+                    }
+                    return true;
+                }
+                case Op::AND: case Op::MAX: return known(instr.args[0]) || known(instr.args[1]);
+                case Op::SHR: return known(instr.args[0]) || (constant(instr.args[1], c) && (c & 31) != 0);
+                case Op::EQ: case Op::NEQ: case Op::GEQ: case Op::LEQ: case Op::GT: case Op::LT: return true;
+                default: return false;      // ADD, SUB, MUL and SHL may wrap, ABS(INT32_MIN) stays negative
+            }
+        };
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (const auto& block : fn.blocks) {
+                for (const Instr& phi : block->phis) {
+                    if (nonNeg[phi.dst] && !evaluate(phi)) {
+                        nonNeg[phi.dst] = false;
+                        changed = true;
+                    }
+                }
+                for (const Instr& instr : block->instrs) {
+                    if (instr.dst != NO_VREG && nonNeg[instr.dst] && !evaluate(instr)) {
+                        nonNeg[instr.dst] = false;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return nonNeg;
+    }
+}
+
+/*
+ * Rewrites multiplication, division and modulo by constants. Only rewrites
+ * that don't add instructions are done for MUL: x * 2^k becomes a shift,
+ * x * 2 an addition, a multiplier like 3 or 7 stays, SHL plus ADD is two
+ * dispatches where MUL is one. DIV and MOD by 2^k round toward zero, SAR
+ * toward minus infinity, so for a dividend that may be negative the bias
+ * 2^k - 1 is added first (taken from the sign bits):
+ *
+ *   x / 2^k   =  (x + (x >> 31 >>> 32-k)) >> k
+ *   x % 2^k   =  ((x + bias) & 2^k-1) - bias
+ *
+ * which is still cheaper than a division on a core without a divider. With a
+ * non-negative dividend it's a single SHR or AND.
+ */
+void reduceStrength(Function& fn) {
+    std::vector<bool> isConst(fn.vregCount, false);
+    std::vector<int32_t> value(fn.vregCount, 0);
+    for (const auto& block : fn.blocks) {
+        for (const Instr& instr : block->instrs) {
+            if (instr.op != Op::CONST) continue;
+            isConst[instr.dst] = true;
+            value[instr.dst] = instr.imm;
+        }
+    }
+    std::vector<bool> nonNeg = nonNegativeValues(fn, isConst, value);
+
+    for (auto& block : fn.blocks) {
+        std::vector<Instr> out;
+        out.reserve(block->instrs.size());
+        auto emit = [&](Op op, std::vector<VReg> args, int32_t imm = 0) {
+            Instr instr{op, fn.newVReg(), std::move(args), imm};
+            out.push_back(std::move(instr));
+            return out.back().dst;
+        };
+        auto constant = [&](int32_t c) { return emit(Op::CONST, {}, c); };
+        // the sign bits of x shifted down to 2^k - 1 for a negative x, 0 otherwise
+        auto bias = [&](VReg x, int k) {
+            if (k == 1) return emit(Op::SHR, {x, constant(31)});
+            VReg sign = emit(Op::SAR, {x, constant(31)});
+            return emit(Op::SHR, {sign, constant(32 - k)});
+        };
+
+        for (Instr& instr : block->instrs) {
+            bool binary = instr.op == Op::MUL || instr.op == Op::DIV || instr.op == Op::MOD;
+            if (!binary) {
+                out.push_back(std::move(instr));
+                continue;
+            }
+            VReg x = instr.args[0], c = instr.args[1];
+            if (instr.op == Op::MUL && isConst[x] && !isConst[c]) std::swap(x, c);
+            if (!isConst[c] || isConst[x]) {
+                out.push_back(std::move(instr));
+                continue;
+            }
+
+            int32_t n = value[c];
+            int k = exponent(n);
+            int kNeg = n != INT32_MIN ? exponent(-n) : -1;
+            VReg dst = instr.dst;
+            Instr result{Op::COPY, dst};
+            if (instr.op == Op::MUL) {
+                if (n == 0) {
+                    result.args = {c};
+                } else if (n == 1) {
+                    result.args = {x};
+                } else if (n == -1) {
+                    result = Instr{Op::SUB, dst, {constant(0), x}};
+                } else if (n == 2) {
+                    result = Instr{Op::ADD, dst, {x, x}};
+                } else if (k > 0) {
+                    result = Instr{Op::SHL, dst, {x, constant(k)}};
+                } else {
+                    result = std::move(instr);
+                }
+            } else if (instr.op == Op::DIV) {
+                if (n == 1) {
+                    result.args = {x};
+                } else if (n == -1) {
+                    result = Instr{Op::SUB, dst, {constant(0), x}};
+                } else if (k > 0 && k < 31) {
+                    VReg dividend = nonNeg[x] ? x : emit(Op::ADD, {x, bias(x, k)});
+                    result = Instr{nonNeg[x] ? Op::SHR : Op::SAR, dst, {dividend, constant(k)}};
+                } else {
+                    result = std::move(instr);
+                }
+            } else {
+                // the sign of a remainder is the dividend's, x % -2^k == x % 2^k
+                int m = k > 0 ? k : kNeg;
+                if (n == 1 || n == -1) {
+                    result.args = {constant(0)};
+                } else if (m > 0 && m < 31 && nonNeg[x]) {
+                    result = Instr{Op::AND, dst, {x, constant((int32_t) ((1u << m) - 1))}};
+                } else if (m > 0 && m < 31) {
+                    VReg b = bias(x, m);
+                    VReg sum = emit(Op::ADD, {x, b});
+                    VReg low = emit(Op::AND, {sum, constant((int32_t) ((1u << m) - 1))});
+                    result = Instr{Op::SUB, dst, {low, b}};
+                } else {
+                    result = std::move(instr);
+                }
+            }
+            out.push_back(std::move(result));
+        }
+        block->instrs = std::move(out);
+    }
+}
+
+}
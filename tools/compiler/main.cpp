@@ -1,41 +1,166 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
 
-#include "Parser.h"
-#include "visitors/CodegenVisitor.h"
+#include "Compiler.h"
 #include "Extension.h"
+#include "Batch.h"
+#include "CompileCache.h"
+
+static void usage() {
+    std::cerr << "Usage: LumaC <input_file> <output_file> [-O0|-O1|-O2] [--dump-ast] [--dump-ir] [--dump-hex]\n"
+              << "             [--peephole-window <n>] [--peephole-stats] [--profile-generate | --profile-use <file>]\n"
+              << "       LumaC --batch [-j <threads>] [--manifest <file>] [--cache-dir <dir>] [--cache-size <MiB>]\n"
+              << "             [--cache-stats] [input_files...]\n"
+              << "The cache directory can also be set with LUMA_CACHE_DIR.\n"
+              << "Profile-guided -O2: compile with --profile-generate, run it with LumaRun --profile <file>,\n"
+              << "compile again with --profile-use <file> and otherwise the same options." << std::endl;
+}
+
+static int runBatch(int argc, char** argv) {
+    unsigned threads = std::thread::hardware_concurrency();
+    std::vector<BatchJob> jobs;
+    const char* envCache = std::getenv("LUMA_CACHE_DIR");
+    std::string cacheDir = envCache ? envCache : "";
+    uint64_t cacheSize = CompileCache::DEFAULT_MAX_BYTES;
+    bool cacheStats = false;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = (unsigned) std::stoul(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+            threads = (unsigned) std::stoul(argv[i] + 2);
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            cacheSize = std::stoull(argv[++i]) << 20;
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            cacheStats = true;
+        } else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            auto listed = readManifest(argv[++i]);
+            jobs.insert(jobs.end(), listed.begin(), listed.end());
+        } else {
+            BatchJob job;
+            job.input = argv[i];
+            job.output = defaultOutput(job.input);
+            jobs.push_back(std::move(job));
+        }
+    }
+    if (threads == 0) threads = 1;
+
+    const ExtensionRegistry& registry = ExtensionRegistry::standard();
+    std::unique_ptr<CompileCache> cache;
+    if (!cacheDir.empty()) {
+        cache = std::make_unique<CompileCache>(cacheDir, registry, cacheSize);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    compileBatch(jobs, registry, threads, cache.get());
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (cache) {
+        cache->trim();
+    }
+
+    size_t failed = 0;
+    for (const auto& job : jobs) {
+        for (const auto& diag : job.diagnostics) {
+            std::cerr << luma_format_diagnostic(diag, job.input) << std::endl;
+        }
+        if (!job.ok) {
+            failed++;
+        }
+    }
+    std::cout << (jobs.size() - failed) << " compiled, " << failed << " failed in "
+              << (int) (secs * 1000) << " ms" << std::endl;
+    if (cache && cacheStats) {
+        CacheStats st = cache->stats();
+        std::cout << "cache: " << st.hits << " hits, " << st.misses << " misses, "
+                  << st.stores << " stored, " << st.evictions << " evicted, "
+                  << st.bytesSaved << " source bytes not recompiled" << std::endl;
+    }
+    return failed > 0 ? 1 : 0;
+}
 
 int main(int argc, char** argv) {
     // Simple blinking program
     // std::string program = "require neopixel;\nloop {\n\tneopixel.fill_rgb(255, 0, 0);\n\tneopixel.show();\n\tdelay(500);\n\tneopixel.fill_rgb(0, 255, 0);\n\tneopixel.show();\n\tdelay(500);\n}";
-    
+
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        try {
+            return runBatch(argc, argv);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
     if (argc < 3) {
-        std::cerr << "Usage: LumaC <input_file> <output_file>" << std::endl;
+        usage();
         return 1;
     }
 
-    std::ifstream inFile(argv[1]);
+    LumaCompileOptions options;
+    LumaProfile profile;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--dump-ast") == 0) {
+            options.astDump = &std::cout;
+        } else if (strcmp(argv[i], "--dump-hex") == 0) {
+            options.hexDump = &std::cout;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            options.irDump = &std::cout;
+        } else if (strcmp(argv[i], "--peephole-window") == 0 && i + 1 < argc) {
+            options.peepholeWindow = (unsigned) std::stoul(argv[++i]);
+        } else if (strcmp(argv[i], "--peephole-stats") == 0) {
+            options.peepholeStats = &std::cout;
+        } else if (strcmp(argv[i], "--profile-generate") == 0) {
+            options.profileGenerate = true;
+        } else if (strcmp(argv[i], "--profile-use") == 0 && i + 1 < argc) {
+            const char* path = argv[++i];
+            std::ifstream profFile(path);
+            std::stringstream text;
+            text << profFile.rdbuf();
+            if (!profFile) {
+                std::cerr << path << ": error: Can't open profile" << std::endl;
+                return 1;
+            }
+            if (!luma_parse_profile(text.str(), profile)) {
+                std::cerr << path << ": error: Not a profile written by LumaRun --profile" << std::endl;
+                return 1;
+            }
+            options.profile = &profile;
+        } else if (strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '2' && argv[i][3] == '\0') {
+            options.optimize = (unsigned) (argv[i][2] - '0');
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    std::ifstream inFile(argv[1], std::ios::binary);
+    if (!inFile) {
+        std::cerr << argv[1] << ": error: Can't open input file" << std::endl;
+        return 1;
+    }
     std::stringstream buf;
     buf << inFile.rdbuf();
-    
-    Parser parser(buf.str());
-    Program* prog = parser.parse();
-
-    ExtensionRegistry::instance().registerExt("neopixel", std::make_unique<Neopixel>());
-    ExtensionRegistry::instance().registerExt("microphone", std::make_unique<Microphone>());
 
-    CodegenVisitor cgv;
-    cgv.visitProgram(prog);
-    auto code = cgv.getLBC();
-
-    FILE* outFile = fopen(argv[2], "wb");
-    fwrite(code.data(), sizeof(code[0]), code.size(), outFile);
-
-    std::cout << prog->to_string() << std::endl;
-    for (size_t i = 0; i < code.size(); i++) {
-        printf("%02X ", code[i]);
+    LumaCompileResult result = luma_compile(buf.str(), options);
+    for (const auto& diag : result.diagnostics) {
+        std::cerr << luma_format_diagnostic(diag, argv[1]) << std::endl;
+    }
+    if (!result.ok) {
+        return 1;
     }
 
+    std::ofstream outFile(argv[2], std::ios::binary | std::ios::trunc);
+    if (!outFile.write(reinterpret_cast<const char*>(result.bytes.data()), result.bytes.size())) {
+        std::cerr << argv[2] << ": error: Can't write output file" << std::endl;
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,247 @@
+#include "CodeBuffer.h"
+#include <opcode.h>
+#include <Peephole.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+void CodeBuffer::runPeephole(Peephole& pass) {
+    std::vector<size_t> moved;
+    if (pass.run(code, &moved)) relocate(moved);
+}
+
+void CodeBuffer::emitu8(uint8_t val) {
+    code.push_back(val);
+}
+
+void CodeBuffer::emitu16(uint16_t val) {
+    code.push_back((uint8_t) (val & 0xFF));
+    code.push_back((uint8_t) ((val >> 8) & 0xFF));
+}
+
+void CodeBuffer::emiti32(int32_t val) {
+    code.push_back((uint8_t) (val & 0xFF));
+    code.push_back((uint8_t) ((val >> 8) & 0xFF));
+    code.push_back((uint8_t) ((val >> 16) & 0xFF));
+    code.push_back((uint8_t) ((val >> 24) & 0xFF));
+}
+
+void CodeBuffer::emitDestSrc(uint8_t dest, uint8_t src) {
+    uint8_t dstsrc = (dest << 4) | src;
+    emitu8(dstsrc);
+}
+
+void CodeBuffer::emitTableLoad(uint8_t dst, uint8_t index, uint16_t base, uint16_t len) {
+    emitu8(OP_LDCX);
+    emitDestSrc(dst, index);
+    emitu16(base);
+    emitu16(len);
+}
+
+size_t CodeBuffer::emitCompareJump(uint8_t cmp, bool jumpIf, int a, int b) {
+    uint8_t op;
+    switch (cmp) {
+        case OP_EQ: op = jumpIf ? OP_JEQA : OP_JNEA; break;
+        case OP_NEQ: op = jumpIf ? OP_JNEA : OP_JEQA; break;
+        case OP_LT: op = jumpIf ? OP_JLTA : OP_JGEA; break;
+        case OP_GEQ: op = jumpIf ? OP_JGEA : OP_JLTA; break;
+        // a > b is b < a, a <= b is b >= a
+        case OP_GT: op = jumpIf ? OP_JLTA : OP_JGEA; std::swap(a, b); break;
+        case OP_LEQ: op = jumpIf ? OP_JGEA : OP_JLTA; std::swap(a, b); break;
+        default: throw std::logic_error("Not a comparison");
+    }
+    emitu8(op);
+    emitDestSrc((uint8_t) a, (uint8_t) b);
+    size_t at = code.size();
+    emitu16(0);
+    return at;
+}
+
+size_t CodeBuffer::emitCondJump(bool jumpIf, int reg) {
+    emitu8(jumpIf ? OP_JNZA : OP_JZA);
+    emitu8((uint8_t) reg);
+    size_t at = code.size();
+    emitu16(0);
+    return at;
+}
+
+void CodeBuffer::patchJumps(const std::vector<size_t>& positions) {
+    uint16_t addr = (uint16_t) code.size();
+    for (size_t at : positions) {
+        code[at] = (uint8_t) (addr & 0xFF);
+        code[at + 1] = (uint8_t) ((addr >> 8) & 0xFF);
+    }
+}
+
+void CodeBuffer::patchJump(size_t at, size_t addr) {
+    code[at] = (uint8_t) (addr & 0xFF);
+    code[at + 1] = (uint8_t) ((addr >> 8) & 0xFF);
+}
+
+void CodeBuffer::emitTakeStackArgs(uint8_t parked, const std::vector<uint8_t>& homes) {
+    auto store = [&](uint8_t addr) {
+        emitu8(OP_STORE);
+        emitu8(addr);
+        emitu8(0);
+    };
+    auto load = [&](uint8_t addr) {
+        emitu8(OP_LOAD);
+        emitu8(0);
+        emitu8(addr);
+    };
+    store(parked);
+    emitu8(OP_POP);
+    emitu8(0);
+    store(parked + 1);
+    for (uint8_t home : homes) {
+        emitu8(OP_POP);
+        emitu8(0);
+        store(home);
+    }
+    load(parked + 1);
+    emitu8(OP_PUSH);
+    emitu8(0);
+    load(parked);
+}
+
+void CodeBuffer::emitSave(uint8_t mask) {
+    for (int r = 0; r < 8; r++) {
+        if (mask & (1u << r)) {
+            emitu8(OP_PUSH);
+            emitu8((uint8_t) r);
+        }
+    }
+}
+
+void CodeBuffer::emitRestore(uint8_t mask) {
+    for (int r = 8; r-- > 0;) {
+        if (mask & (1u << r)) {
+            emitu8(OP_POP);
+            emitu8((uint8_t) r);
+        }
+    }
+}
+
+void CodeBuffer::emitMov(int dst, int src) {
+    emitu8(OP_MOV);
+    emitDestSrc((uint8_t) dst, (uint8_t) src);
+}
+
+void CodeBuffer::emitParallelMove(std::vector<std::pair<int, int>> moves, int scratch) {
+    const int STACK = -1;
+    moves.erase(std::remove_if(moves.begin(), moves.end(), [](const auto& m) { return m.first == m.second; }),
+                moves.end());
+
+    auto isRead = [&](int loc) {
+        return std::any_of(moves.begin(), moves.end(), [loc](const auto& m) { return m.second == loc; });
+    };
+    // a register holding the value of src, memory is loaded into scratch
+    auto fetch = [&](int src) {
+        if (src == STACK) {
+            emitu8(OP_POP);
+            emitu8((uint8_t) scratch);
+            return scratch;
+        }
+        if (src < MEM) return src;
+        if (scratch < 0) throw std::logic_error("Moving between memory words needs a scratch register");
+        emitu8(OP_LOAD);
+        emitu8((uint8_t) scratch);
+        emitu8((uint8_t) (src - MEM));
+        return scratch;
+    };
+
+    while (!moves.empty()) {
+        auto ready = std::find_if(moves.begin(), moves.end(), [&](const auto& m) { return !isRead(m.first); });
+        if (ready != moves.end()) {
+            auto [dst, src] = *ready;
+            if (dst >= MEM) {
+                int reg = fetch(src);
+                emitu8(OP_STORE);
+                emitu8((uint8_t) (dst - MEM));
+                emitu8((uint8_t) reg);
+            } else if (src == STACK) {
+                emitu8(OP_POP);
+                emitu8((uint8_t) dst);
+            } else if (src >= MEM) {
+                emitu8(OP_LOAD);
+                emitu8((uint8_t) dst);
+                emitu8((uint8_t) (src - MEM));
+            } else {
+                emitMov(dst, src);
+            }
+            moves.erase(ready);
+            continue;
+        }
+
+        // only cycles are left, park one value on the stack to open one up
+        int parked = moves.front().first;
+        int reg = fetch(parked);
+        emitu8(OP_PUSH);
+        emitu8((uint8_t) reg);
+        for (auto& m : moves) {
+            if (m.second == parked) m.second = STACK;
+        }
+    }
+}
+
+std::vector<uint8_t> CodeBuffer::getLBC()
+{
+    /*
+     * Header
+     */
+    std::vector<uint8_t> out;
+    // Magic Number
+    out.push_back('L');
+    out.push_back('V');
+    out.push_back('M');
+    out.push_back('1');
+    // Bytecode version
+    out.push_back(1);
+    // Flags, bit 0: the pool is too large for ConstCount and comes with a count of its own
+    bool wide = consts.size() > 0xFF;
+    out.push_back(wide ? 0x01 : 0);
+    // Extension count
+    out.push_back(reqIDs.size());
+    // Constants count
+    out.push_back(wide ? 0 : consts.size());
+    // Code Offset
+    uint16_t offset = 16 + reqIDs.size() * 3 + (wide ? 2 : 0) + consts.size() * 4;
+    out.push_back(offset & 0xFF);
+    out.push_back((offset >> 8) & 0xFF);
+    // Entry Point
+    out.push_back(0);
+    out.push_back(0);
+    // length of code
+    out.push_back(code.size() & 0xFF);
+    out.push_back((code.size() >> 8) & 0xFF);
+    out.push_back((code.size() >> 16) & 0xFF);
+    out.push_back((code.size() >> 24) & 0xFF);
+
+    /*
+     * Extensions
+     */
+    for (auto req : reqIDs) {
+        out.push_back(req);
+        out.push_back(0);
+        out.push_back(0);
+    }
+
+    /*
+     * Constant pool
+     */
+    if (wide) {
+        out.push_back(consts.size() & 0xFF);
+        out.push_back((consts.size() >> 8) & 0xFF);
+    }
+    for (int32_t val : consts) {
+        for (int i = 0; i < 4; i++) {
+            out.push_back(((uint32_t) val >> (i * 8)) & 0xFF);
+        }
+    }
+
+    /*
+     * Code
+     */
+    out.insert(out.end(), code.begin(), code.end());
+    return out;
+}
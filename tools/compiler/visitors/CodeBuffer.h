@@ -0,0 +1,70 @@
+#ifndef LUMA_CODE_BUFFER_H
+#define LUMA_CODE_BUFFER_H
+
+#include <utility>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+class Peephole;
+
+// Bytecode being emitted plus the extensions it requires, shared by the code generators
+class CodeBuffer {
+    protected:
+        std::vector<uint8_t> code;
+        std::vector<uint8_t> reqIDs;
+        std::vector<int32_t> consts;
+
+    public:
+        std::vector<uint8_t> getCode() { return code; }
+        std::vector<uint8_t> getLBC();
+
+        // constant pool written along with the code, the tables of const fns
+        void setConstants(std::vector<int32_t> pool) { consts = std::move(pool); }
+
+        // rewrites the code emitted so far, jump targets included
+        void runPeephole(Peephole& pass);
+
+    protected:
+        // the peephole pass rewrote the code, moved[old address] is the new one or SIZE_MAX if the
+        // instruction is gone. Positions a code generator kept track of are updated here
+        virtual void relocate(const std::vector<size_t>& moved) {}
+
+        void emitu8(uint8_t val);
+        void emitu16(uint16_t val);
+        void emiti32(int32_t val);
+
+        void emitDestSrc(uint8_t dest, uint8_t src);
+        // dst = consts[base + Rindex], halts unless 0 <= Rindex < len
+        void emitTableLoad(uint8_t dst, uint8_t index, uint16_t base, uint16_t len);
+
+        // jumps if (a cmp b) == jumpIf, cmp is one of OP_EQ..OP_LT. Returns where the target
+        // goes, it's left 0 until patched
+        size_t emitCompareJump(uint8_t cmp, bool jumpIf, int a, int b);
+        // JNZA if jumpIf, else JZA
+        size_t emitCondJump(bool jumpIf, int reg);
+        // points the jumps whose targets are at positions to the code emitted next
+        void patchJumps(const std::vector<size_t>& positions);
+        void patchJump(size_t at, size_t addr);
+
+        /*
+         * Entry of a function with more than 4 parameters: the caller pushed
+         * the fifth and later ones, the return address of CALLA is on top of
+         * them. It's parked in memory word parked + 1 while they are popped
+         * into homes, R0 waits in parked.
+         */
+        void emitTakeStackArgs(uint8_t parked, const std::vector<uint8_t>& homes);
+        // PUSH of the registers in mask (bit n for Rn) in ascending order, emitRestore pops them again
+        void emitSave(uint8_t mask);
+        void emitRestore(uint8_t mask);
+
+        // locations of a parallel move, registers are 0..REG_COUNT-1 and memory word n is MEM + n
+        static constexpr int MEM = 16;
+
+        void emitMov(int dst, int src);
+        // moves are (dst, src) pairs, performed as if all at once. Cycles are broken on the
+        // stack, scratch is a free register needed only to move between memory words
+        void emitParallelMove(std::vector<std::pair<int, int>> moves, int scratch = -1);
+};
+
+#endif
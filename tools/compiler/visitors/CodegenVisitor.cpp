@@ -3,155 +3,347 @@
 #include <opcode.h>
 #include "../Extension.h"
 
-CodegenVisitor::CodegenVisitor() 
-    : allocator() {}
+#include <algorithm>
+
+namespace {
+    // Registers an expression needs to be evaluated without spilling (Sethi-Ullman)
+    class RegisterNeed : public Visitor {
+        public:
+            bool assigns = false;   // the expression writes a variable
+
+            virtual int visitBinaryExpr(BinaryExpr* expr) override {
+                int lhs = expr->lhs->visit(this);
+                int rhs = expr->rhs->visit(this);
+                // `and` and `or` hold their result while the operands are tested one after the other
+                if (expr->op == BinOp::LAND || expr->op == BinOp::LOR) return 1 + std::max(lhs, rhs);
+                return std::max(lhs, rhs + 1);
+            }
+
+            virtual int visitAssignment(Assignment* expr) override {
+                assigns = true;
+                return expr->expr->visit(this);
+            }
+
+            // arguments are held until all are evaluated, the ones past R3 are pushed right away
+            virtual int visitCallExpr(CallExpr* expr) override {
+                // a table lookup needs a register for `from` next to the index
+                int need = expr->fn != nullptr && expr->fn->tabulated ? 2 : 1;
+                for (size_t i = 0; i < expr->args.size(); i++) {
+                    int arg = expr->args[i]->visit(this);
+                    need = std::max(need, i < 4 ? (int) i + arg : arg);
+                }
+                return need;
+            }
+
+            virtual int visitNumberExpr(NumberExpr* expr) override { return 1; }
+            virtual int visitVarExpr(VarExpr* expr) override { return 1; }
+
+            virtual void visitExprStatement(ExprStatement* stmt) override {}
+            virtual void visitIfElse(IfElse* stmt) override {}
+            virtual void visitLoopStmt(LoopStmt* stmt) override {}
+            virtual void visitForStmt(ForStmt* stmt) override {}
+            virtual void visitBlockStmt(BlockStmt* stmt) override {}
+            virtual void visitVarDeclaration(VarDeclaration* stmt) override {}
+            virtual void visitFnDecl(FnDecl* stmt) override {}
+            virtual void visitReturnStmt(ReturnStmt* stmt) override {}
+            virtual void visitProgram(Program* program) override {}
+    };
+
+    int needed(Expression* expr) {
+        RegisterNeed need;
+        return expr->visit(&need);
+    }
 
-void CodegenVisitor::emitu8(uint8_t val) {
-    code.push_back(val);
+    bool assigns(Expression* expr) {
+        RegisterNeed need;
+        expr->visit(&need);
+        return need.assigns;
+    }
 }
 
-void CodegenVisitor::emitu16(uint16_t val) {
-    code.push_back((uint8_t) (val & 0xFF));
-    code.push_back((uint8_t) ((val >> 8) & 0xFF));
+CodegenVisitor::CodegenVisitor(const ExtensionRegistry& registry, const VarAllocator& vars)
+    : registry(registry), vars(vars), allocator() {}
+
+const VarLocation& CodegenVisitor::locate(const VarDeclaration* decl, std::string_view id, const char* error) {
+    if (decl == nullptr) {
+        throw std::runtime_error(error + std::string(id));
+    }
+    return vars.locations[decl->index];
 }
 
-void CodegenVisitor::emiti32(int32_t val) {
-    code.push_back((uint8_t) (val & 0xFF));
-    code.push_back((uint8_t) ((val >> 8) & 0xFF));
-    code.push_back((uint8_t) ((val >> 16) & 0xFF));
-    code.push_back((uint8_t) ((val >> 24) & 0xFF));
+int CodegenVisitor::evaluate(Expression* expr) {
+    int reg = expr->visit(this);
+    if (reg < 0) {
+        throw std::runtime_error("Using the result of a function without return value");
+    }
+    return reg;
 }
 
-void CodegenVisitor::emitDestSrc(uint8_t dest, uint8_t src) {
-    uint8_t dstsrc = (dest << 4) | src;
+// a register the caller may overwrite, variables are copied out first
+int CodegenVisitor::writable(int reg) {
+    if (!allocator.is_pinned(reg)) return reg;
+    int tmp = allocator.alloc();
+    emitMov(tmp, reg);
+    return tmp;
 }
 
-std::vector<uint8_t> CodegenVisitor::getLBC()
-{
-    /*
-     * Header
-     */
-    std::vector<uint8_t> out;
-    // Magic Number
-    out.push_back('L');
-    out.push_back('V');
-    out.push_back('M');
-    out.push_back('1');
-    // Bytecode version
-    out.push_back(1);
-    // Flags
-    out.push_back(0);
-    // Extension count
-    out.push_back(reqIDs.size());
-    // Constants count
-    out.push_back(0);
-    // Code Offset
-    uint16_t offset = 16 + reqIDs.size() * 3;
-    out.push_back(offset & 0xFF);
-    out.push_back((offset >> 8) & 0xFF);
-    // Entry Point
-    out.push_back(0);
-    out.push_back(0);
-    // length of code
-    out.push_back(code.size() & 0xFF);
-    out.push_back((code.size() >> 8) & 0xFF);
-    out.push_back((code.size() >> 16) & 0xFF);
-    out.push_back((code.size() >> 24) & 0xFF);
-
-    /*
-     * Extensions
-     */
-    for (auto req : reqIDs) {
-        out.push_back(req);
-        out.push_back(0);
-        out.push_back(0);
-    }
-
-    /*
-     * Code
-     */
-    out.insert(out.end(), code.begin(), code.end());
-    return out;
+// lhs in rLhs and rhs in rRhs, lhs waits on the stack when rhs needs more registers than are free
+void CodegenVisitor::evaluateOperands(BinaryExpr* expr, bool overwrite, int& rLhs, int& rRhs) {
+    rLhs = evaluate(expr->lhs);
+    // rhs may assign the variable lhs was read from
+    if (overwrite || assigns(expr->rhs)) rLhs = writable(rLhs);
+    bool spill = allocator.free_count() < needed(expr->rhs);
+    if (spill) {
+        emitu8(OP_PUSH);
+        emitu8(rLhs);
+        allocator.free(rLhs);
+    }
+    rRhs = evaluate(expr->rhs);
+    if (spill) {
+        rLhs = allocator.alloc();
+        emitu8(OP_POP);
+        emitu8(rLhs);
+    }
 }
 
 int CodegenVisitor::visitBinaryExpr(BinaryExpr *expr)
 {
-    int rLhs = expr->lhs->visit(this);
-    int rRhs = expr->rhs->visit(this);
-    emitu8(OP_MOV);
+    if (expr->op == BinOp::LAND || expr->op == BinOp::LOR) {
+        int reg = allocator.alloc();
+        emitu8(OP_MOVI);
+        emitu8(reg);
+        emiti32(0);
+        std::vector<size_t> toFalse;
+        condJump(expr, false, toFalse);
+        emitu8(OP_MOVI);
+        emitu8(reg);
+        emiti32(1);
+        patchJumps(toFalse);
+        return reg;
+    }
+
+    int rLhs, rRhs;
+    evaluateOperands(expr, true, rLhs, rRhs);
+    emitu8(binOpOpcode(expr->op));
     emitDestSrc(rLhs, rRhs);
     allocator.free(rRhs);
     return rLhs;
 }
 
+/*
+ * Jumps when cond is jumpIf and falls through otherwise, the positions of
+ * the jump targets are added to jumps. A comparison is a single
+ * compare-and-branch, comparing to 0 a JZA or JNZA. `and` and `or` stop as
+ * soon as the left side decides, the right side isn't evaluated then.
+ */
+void CodegenVisitor::condJump(Expression* cond, bool jumpIf, std::vector<size_t>& jumps) {
+    auto* bin = dynamic_cast<BinaryExpr*>(cond);
+    if (bin != nullptr && (bin->op == BinOp::LAND || bin->op == BinOp::LOR)) {
+        // false decides `and`, true decides `or`
+        bool decides = bin->op == BinOp::LOR;
+        if (jumpIf == decides) {
+            condJump(bin->lhs, jumpIf, jumps);
+            condJump(bin->rhs, jumpIf, jumps);
+        } else {
+            std::vector<size_t> decided;
+            condJump(bin->lhs, decides, decided);
+            condJump(bin->rhs, jumpIf, jumps);
+            patchJumps(decided);
+        }
+        return;
+    }
+
+    if (bin != nullptr && isComparison(bin->op)) {
+        auto* num = dynamic_cast<NumberExpr*>(bin->rhs);
+        bool equality = bin->op == BinOp::EQUALS || bin->op == BinOp::NEQUALS;
+        if (equality && num != nullptr && num->val == 0) {
+            int reg = evaluate(bin->lhs);
+            jumps.push_back(emitCondJump(jumpIf == (bin->op == BinOp::NEQUALS), reg));
+            allocator.free(reg);
+            return;
+        }
+        int rLhs, rRhs;
+        evaluateOperands(bin, false, rLhs, rRhs);
+        jumps.push_back(emitCompareJump(binOpOpcode(bin->op), jumpIf, rLhs, rRhs));
+        allocator.free(rLhs);
+        allocator.free(rRhs);
+        return;
+    }
+
+    int reg = evaluate(cond);
+    jumps.push_back(emitCondJump(jumpIf, reg));
+    allocator.free(reg);
+}
+
 int CodegenVisitor::visitAssignment(Assignment *expr) {
-    int reg = expr->expr->visit(this);
-    auto var = varMap.find(expr->id);
-    if (var == varMap.end()) {
-        throw std::runtime_error("Tried assigning to undeclared var: " + expr->id);
+    const VarLocation& loc = locate(expr->decl, expr->id, "Tried assigning to undeclared var: ");
+    auto* num = dynamic_cast<NumberExpr*>(expr->expr);
+    if (loc.reg >= 0 && num != nullptr) {
+        emitu8(OP_MOVI);
+        emitu8(loc.reg);
+        emiti32(num->val);
+        return loc.reg;
+    }
+
+    int reg = evaluate(expr->expr);
+    if (loc.reg >= 0) {
+        if (reg != loc.reg) {
+            emitMov(loc.reg, reg);
+            allocator.free(reg);
+        }
+        return loc.reg;
     }
     emitu8(OP_STORE);
-    emitu8(var->second);
+    emitu8(loc.slot);
     emitu8(reg);
     return reg;
 }
 
 int CodegenVisitor::visitCallExpr(CallExpr *expr) {
-    if (expr->args.size() > 0) {
-        std::vector<int> argRegs;
-        for (size_t i = 0; i < expr->args.size(); i++) {
-            int reg = expr->args[i]->visit(this);
-            argRegs.push_back(reg);
-        }
+    size_t argc = expr->args.size();
 
-        for (auto& reg : argRegs) {
-            allocator.free(reg);
+    if (expr->namesp.size() == 0 && expr->id == "delay") {
+        if (argc != 1) {
+            throw std::runtime_error("delay expects 1 argument");
         }
+        int reg = evaluate(expr->args[0]);
+        emitu8(OP_DELAY);
+        emitu8(reg);
+        allocator.free(reg);
+        return -1;
+    }
 
-        for (size_t i = 0; i < argRegs.size() && i < 4; i++) {
-            if (argRegs[i] != i) {
-                emitu8(OP_MOV);
-                emitDestSrc((uint8_t) i, argRegs[i]);
-            }
+    const Extension* ext = nullptr;
+    const ExtFunction* fn = nullptr;
+    size_t params;
+    bool returnsValue;
+    if (expr->namesp.size() == 0) {
+        if (expr->fn == nullptr) {
+            throw std::runtime_error("Unknown function: " + std::string(expr->id));
+        }
+        params = expr->fn->params.size();
+        returnsValue = expr->fn->returnsValue;
+        if (expr->fn->tabulated && argc == params) return emitTableLookup(expr->fn, expr->args[0]);
+    } else {
+        ext = registry.get(expr->namesp);
+        if (ext == nullptr) {
+            throw std::runtime_error("Unknown extension: " + std::string(expr->namesp));
+        }
+        fn = ext->getFunction(expr->id);
+        if (fn == nullptr) {
+            throw std::runtime_error("Unknown extension function: " + std::string(expr->namesp) + "." + std::string(expr->id));
         }
+        params = fn->argCount;
+        returnsValue = fn->hasReturnValue;
+    }
+    if (argc != params) {
+        std::string name = expr->namesp.size() > 0 ? std::string(expr->namesp) + "." : "";
+        throw std::runtime_error(name + std::string(expr->id) + " expects " + std::to_string(params) + " arguments");
+    }
 
-        for (size_t i = argRegs.size()-1; i >= 4; i--) {
+    // the call overwrites R0..R3, temporaries living there wait on the stack
+    std::vector<int> saved;
+    for (int r = 0; r < 4; r++) {
+        if (allocator.is_used(r)) {
             emitu8(OP_PUSH);
-            emitu8(argRegs[i]);
+            emitu8(r);
+            allocator.free(r);
+            saved.push_back(r);
         }
     }
 
-    if (expr->namesp.size() > 0) {
-        auto ext = ExtensionRegistry::instance().get(expr->namesp);
+    // arguments past R3 go on the stack with the fifth on top, so they're evaluated last to first
+    for (size_t i = argc; i-- > 4;) {
+        int reg = evaluate(expr->args[i]);
+        emitu8(OP_PUSH);
+        emitu8(reg);
+        allocator.free(reg);
+    }
 
-        ExtFunction* fn = ext->getFunction(expr->id);
-        if (fn == nullptr) {
-            throw std::runtime_error("Unknown extension function: " + expr->namesp + "." + expr->id);
+    size_t regArgs = std::min<size_t>(argc, 4);
+    int need = 0;
+    for (size_t i = 0; i < regArgs; i++) {
+        need = std::max(need, (int) i + needed(expr->args[i]));
+    }
+
+    if (need <= allocator.free_count()) {
+        std::vector<int> argRegs;
+        for (size_t i = 0; i < regArgs; i++) {
+            int reg = evaluate(expr->args[i]);
+            // a later argument may assign the variable before the call reads it
+            bool later = false;
+            for (size_t j = i + 1; j < regArgs; j++) later = later || assigns(expr->args[j]);
+            argRegs.push_back(later ? writable(reg) : reg);
         }
 
-        if (fn->hasReturnValue) {
-            if (allocator.is_used(0)) {
-                emitu8(OP_PUSH);
-                emitu8(0);
-            } else {
-                allocator.alloc(0);
-            }
+        std::vector<std::pair<int, int>> moves;
+        for (size_t i = 0; i < regArgs; i++) {
+            moves.emplace_back((int) i, argRegs[i]);
+        }
+        emitParallelMove(moves);
+        for (int reg : argRegs) {
+            allocator.free(reg);
+        }
+    } else {
+        // not enough registers to hold them all, go through the stack
+        for (size_t i = 0; i < regArgs; i++) {
+            int reg = evaluate(expr->args[i]);
+            emitu8(OP_PUSH);
+            emitu8(reg);
+            allocator.free(reg);
         }
+        for (size_t i = regArgs; i-- > 0;) {
+            emitu8(OP_POP);
+            emitu8((uint8_t) i);
+        }
+    }
 
+    if (ext != nullptr) {
         emitu8(OP_EXT);
         emitu8(ext->getID());
         emitu8(fn->subOp);
-        
-        return 0;
+    } else {
+        emitu8(OP_CALLA);
+        callFixups.emplace_back(code.size(), expr->fn);
+        emitu16(0);
     }
 
-    if (expr->id == "delay") {
-        emitu8(OP_DELAY);
-        emitu8(0);
-        return 0;
+    for (int r : saved) {
+        allocator.alloc(r);
+    }
+    int result = -1;
+    if (returnsValue) {
+        if (allocator.is_used(0)) {
+            result = allocator.alloc();
+            emitMov(result, 0);
+        } else {
+            result = allocator.alloc(0);
+        }
+    }
+    for (size_t i = saved.size(); i-- > 0;) {
+        emitu8(OP_POP);
+        emitu8(saved[i]);
     }
+    return result;
+}
 
-    throw std::runtime_error("User functions not implemented yet!");
+// f(x) is entry x - from of f's table
+int CodegenVisitor::emitTableLookup(FnDecl* fn, Expression* arg) {
+    int index = evaluate(arg);
+    if (fn->from != 0) {
+        index = writable(index);
+        int from = allocator.alloc();
+        emitu8(OP_MOVI);
+        emitu8(from);
+        emiti32(fn->from);
+        emitu8(OP_SUB);
+        emitDestSrc(index, from);
+        allocator.free(from);
+    }
+    int dst = allocator.is_pinned(index) ? allocator.alloc() : index;
+    emitTableLoad(dst, index, (uint16_t) fn->tableBase, (uint16_t) (fn->to - fn->from));
+    if (dst != index) allocator.free(index);
+    return dst;
 }
 
 int CodegenVisitor::visitNumberExpr(NumberExpr *expr)
@@ -164,14 +356,14 @@ int CodegenVisitor::visitNumberExpr(NumberExpr *expr)
 }
 
 int CodegenVisitor::visitVarExpr(VarExpr *expr) {
-    auto var = varMap.find(expr->id);
-    if (var == varMap.end()) {
-        throw std::runtime_error("Tried accesing undeclared var: " + expr->id);
+    const VarLocation& loc = locate(expr->decl, expr->id, "Tried accesing undeclared var: ");
+    if (loc.reg >= 0) {
+        return loc.reg;
     }
     int reg = allocator.alloc();
     emitu8(OP_LOAD);
     emitu8(reg);
-    emitu8(var->second);
+    emitu8(loc.slot);
     return reg;
 }
 
@@ -181,71 +373,239 @@ void CodegenVisitor::visitExprStatement(ExprStatement *stmt) {
 }
 
 void CodegenVisitor::visitIfElse(IfElse *stmt) {
-    int reg = stmt->cond->visit(this);
-    emitu8(OP_JZA);
-    uint16_t jmpPos = (uint16_t) code.size();
-    emitu16(0);
-    stmt->ifBody->visit(this);
+    std::vector<size_t> toElse;
+    condJump(stmt->cond, false, toElse);
+    emitStatement(stmt->ifBody);
     if (stmt->elseBody != nullptr) {
         emitu8(OP_JMPA);
-        uint16_t jEndPos = (uint16_t) code.size();
+        std::vector<size_t> toEnd = {code.size()};
         emitu16(0);
-
-        uint16_t addr = (uint16_t) code.size();
-        code[jmpPos] = (uint8_t) (addr & 0xFF);
-        code[jmpPos+1] = (uint8_t) ((addr >> 8) & 0xFF);
-
-        stmt->elseBody->visit(this);
-        addr = (uint16_t) code.size();
-        code[jEndPos] = (uint8_t) (addr & 0xFF);
-        code[jEndPos+1] = (uint8_t) ((addr >> 8) & 0xFF);
+        patchJumps(toElse);
+        emitStatement(stmt->elseBody);
+        patchJumps(toEnd);
     } else {
-        uint16_t addr = (uint16_t) code.size();
-        code[jmpPos] = (uint8_t) (addr & 0xFF);
-        code[jmpPos+1] = (uint8_t) ((addr >> 8) & 0xFF);
+        patchJumps(toElse);
     }
 }
 
 void CodegenVisitor::visitLoopStmt(LoopStmt *stmt) {
     uint16_t loopStart = (uint16_t) code.size();
-    stmt->body->visit(this);
+    emitStatement(stmt->body);
     emitu8(OP_JMPA);
     emitu16(loopStart);
 }
 
+/*
+ * i = from and the counter = to - from, skipped unless from < to. Every round
+ * ends with i += 1 and a DJNZ on the counter, a counter in mem is loaded,
+ * decremented and stored for a JNZA instead.
+ */
+void CodegenVisitor::visitForStmt(ForStmt *stmt) {
+    const VarLocation& var = vars.locations[stmt->var->index];
+    const VarLocation& count = vars.locations[stmt->count->index];
+    auto location = [](const VarLocation& loc) { return loc.reg >= 0 ? loc.reg : MEM + loc.slot; };
+
+    BinaryExpr range(BinOp::LESS, stmt->from, stmt->to);
+    int rFrom, rTo;
+    evaluateOperands(&range, true, rFrom, rTo);
+    std::vector<size_t> toEnd = {emitCompareJump(OP_LT, false, rFrom, rTo)};
+    rTo = writable(rTo);
+    emitu8(OP_SUB);
+    emitDestSrc(rTo, rFrom);
+    // the temporaries may be the registers of i and the counter, which aren't taken yet
+    emitParallelMove({{location(var), rFrom}, {location(count), rTo}}, -1);
+    allocator.free(rFrom);
+    allocator.free(rTo);
+    if (var.reg >= 0) allocator.pin(var.reg);
+    if (count.reg >= 0) allocator.pin(count.reg);
+
+    uint16_t loopStart = (uint16_t) code.size();
+    emitStatement(stmt->body);
+
+    int one = allocator.alloc();
+    emitu8(OP_MOVI);
+    emitu8(one);
+    emiti32(1);
+    auto step = [&](const VarLocation& loc, uint8_t op) {
+        int reg = loc.reg;
+        if (reg < 0) {
+            reg = allocator.alloc();
+            emitu8(OP_LOAD);
+            emitu8(reg);
+            emitu8(loc.slot);
+        }
+        emitu8(op);
+        emitDestSrc(reg, one);
+        if (loc.reg < 0) {
+            emitu8(OP_STORE);
+            emitu8(loc.slot);
+            emitu8(reg);
+        }
+        return reg;
+    };
+    allocator.free(step(var, OP_ADD));
+    if (count.reg >= 0) {
+        allocator.free(one);
+        emitu8(OP_DJNZ);
+        emitu8(count.reg);
+    } else {
+        int reg = step(count, OP_SUB);
+        allocator.free(one);
+        allocator.free(reg);
+        emitu8(OP_JNZA);
+        emitu8(reg);
+    }
+    emitu16(loopStart);
+    patchJumps(toEnd);
+}
+
 void CodegenVisitor::visitBlockStmt(BlockStmt *stmt) {
-    varLocStack.push_back(nextVarLoc);
     for (auto* s : stmt->stmts) {
-        s->visit(this);
+        emitStatement(s);
     }
-    nextVarLoc = varLocStack.back();
-    varLocStack.pop_back();
 }
 
 void CodegenVisitor::visitVarDeclaration(VarDeclaration *stmt) {
-    auto it = varMap.insert({stmt->id, nextVarLoc++});
+    const VarLocation& loc = vars.locations[stmt->index];
+    auto* num = dynamic_cast<NumberExpr*>(stmt->expr);
+    if (loc.reg >= 0 && (stmt->expr == nullptr || num != nullptr)) {
+        allocator.pin(loc.reg);
+        emitu8(OP_MOVI);
+        emitu8(loc.reg);
+        emiti32(num != nullptr ? num->val : 0);
+        return;
+    }
+
     int reg;
     if (stmt->expr != nullptr) {
-        reg = stmt->expr->visit(this);
+        reg = evaluate(stmt->expr);
     } else {
         reg = allocator.alloc();
+        emitu8(OP_MOVI);
+        emitu8(reg);
+        emiti32(0);
     }
 
+    if (loc.reg >= 0) {
+        if (reg != loc.reg) {
+            emitMov(loc.reg, reg);
+            allocator.free(reg);
+        }
+        allocator.pin(loc.reg);
+        return;
+    }
     emitu8(OP_STORE);
-    emitu8(it.second);
+    emitu8(loc.slot);
     emitu8(reg);
+    allocator.free(reg);
+}
+
+// frees the registers of variables that die with the statement
+void CodegenVisitor::emitStatement(Statement* stmt) {
+    stmt->visit(this);
+    auto released = vars.releases.find(stmt);
+    if (released != vars.releases.end()) {
+        for (int r : released->second) {
+            allocator.unpin(r);
+        }
+    }
+}
+
+// functions are generated after the program, see emitFunction
+void CodegenVisitor::visitFnDecl(FnDecl *stmt) {}
+
+void CodegenVisitor::visitReturnStmt(ReturnStmt *stmt) {
+    if (stmt->expr != nullptr) {
+        int reg = evaluate(stmt->expr);
+        if (reg != 0) emitMov(0, reg);
+        allocator.free(reg);
+    } else if (stmt->fn->returnsValue) {
+        emitu8(OP_MOVI);
+        emitu8(0);
+        emiti32(0);
+    }
+    emitEpilogue();
+}
+
+void CodegenVisitor::emitFunction(FnDecl* fn) {
+    size_t start = code.size();
+    size_t fixups = callFixups.size();
+    calleeSaved = 0;
+    while (true) {
+        allocator = RegAllocater();
+        functionAddrs[fn->index] = start;
+        emitEntry(fn);
+        emitStatement(fn->body);
+        // falling off the end returns 0 from a function with a value
+        ReturnStmt end;
+        end.fn = fn;
+        visitReturnStmt(&end);
+
+        uint8_t taken = allocator.ever_taken() & 0xF0;
+        if ((taken & ~calleeSaved) == 0) break;
+        calleeSaved = taken;
+        code.resize(start);
+        callFixups.resize(fixups);
+    }
+}
+
+// moves the arguments where the parameters live and saves the registers the function takes
+void CodegenVisitor::emitEntry(FnDecl* fn) {
+    size_t params = fn->params.size();
+    if (params > 4) {
+        std::vector<uint8_t> homes;
+        for (size_t i = 4; i < params; i++) homes.push_back(vars.locations[fn->params[i]->index].slot);
+        emitTakeStackArgs(vars.entrySlots[fn->index], homes);
+    }
+    emitSave(calleeSaved);
+
+    std::vector<std::pair<int, int>> moves;
+    for (size_t i = 0; i < params && i < 4; i++) {
+        const VarLocation& loc = vars.locations[fn->params[i]->index];
+        moves.emplace_back(loc.reg >= 0 ? loc.reg : MEM + loc.slot, (int) i);
+    }
+    emitParallelMove(moves);
+
+    for (auto* param : fn->params) {
+        const VarLocation& loc = vars.locations[param->index];
+        if (loc.reg >= 0) allocator.pin(loc.reg);
+    }
+    // parameters that are never read
+    for (auto* param : fn->params) {
+        auto released = vars.releases.find(param);
+        if (released == vars.releases.end()) continue;
+        for (int r : released->second) allocator.unpin(r);
+    }
+}
+
+void CodegenVisitor::emitEpilogue() {
+    emitRestore(calleeSaved);
+    emitu8(OP_RET);
 }
 
 void CodegenVisitor::visitProgram(Program *program) {
     for (auto req : program->reqs) {
-        auto ext = ExtensionRegistry::instance().get(req);
+        auto ext = registry.get(req);
         if (ext == nullptr) {
-            throw std::runtime_error("Unknown extension: " + req);
+            throw std::runtime_error("Unknown extension: " + std::string(req));
         }
         reqIDs.push_back(ext->getID());
     }
 
+    std::vector<FnDecl*> fns;
     for (auto s : program->stmts) {
-        s->visit(this);
+        if (auto* fn = dynamic_cast<FnDecl*>(s)) fns.push_back(fn);
+        emitStatement(s);
+    }
+    emitu8(OP_HALT);
+    if (fns.empty()) return;
+
+    functionAddrs.assign(fns.size(), 0);
+    for (FnDecl* fn : fns) {
+        // only ever looked up in its table
+        if (!fn->tabulated) emitFunction(fn);
+    }
+    for (auto [at, fn] : callFixups) {
+        patchJump(at, functionAddrs[fn->index]);
     }
 }
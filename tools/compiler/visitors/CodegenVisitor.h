@@ -2,56 +2,45 @@
 #define LUMA_CODEGEN_VISITOR_H
 
 #include "Visitor.h"
+#include "CodeBuffer.h"
+#include "RegAllocater.h"
+#include "VarAllocator.h"
 
+#include <string_view>
+#include <utility>
 #include <vector>
 #include <stdint.h>
-#include <unordered_map>
 #include <stdexcept>
 
-class RegAllocater {
-    bool used[8] = { false };
+class ExtensionRegistry;
+class Expression;
+class Statement;
 
-    public:
-        int alloc() {
-            for (int i = 0; i < 8; i++) {
-                if (!used[i]) {
-                    used[i] = true;
-                    return i;
-                }
-            }
-            throw std::runtime_error("Out of registers");
-        }
-
-        int alloc(int r) {
-            if (used[r]) throw std::runtime_error("Reallocating register that is already used!");
-            used[r] = true;
-            return r;
-        }
-
-        bool is_used(int r) {
-            return used[r];
-        }
-
-        void free(int r) {
-            used[r] = false;
-        }
-};
-
-class CodegenVisitor : public Visitor {
-    std::vector<uint8_t> code;
-    std::vector<uint8_t> reqIDs;
-    // std::unordered_map<std::string, FunctionDecl*> funcs;
-    std::unordered_map<std::string, uint8_t> varMap;
+/*
+ * Emits bytecode for a Program. Variables live where the VarAllocator put
+ * them, reading one that lives in a register hands out that register
+ * without copying, freeing it is a no-op. Expression temporaries come from
+ * the registers left over, when a subexpression needs more than are free
+ * the value waiting for it is pushed on the stack instead of failing.
+ *
+ * Functions follow the program's HALT. A call passes arguments like an
+ * extension call and overwrites R0..R3, the result comes back in R0. The
+ * callee saves the ones of R4..R7 it takes, which is known only once its
+ * body is generated: a function that needs to save registers is generated
+ * a second time with the pushes in front. Leaf functions rarely get that
+ * far, their temporaries fit in R0..R3.
+ */
+class CodegenVisitor : public Visitor, public CodeBuffer {
+    const ExtensionRegistry& registry;
+    const VarAllocator& vars;
     RegAllocater allocator;
 
-    uint8_t nextVarLoc = 0;
-    std::vector<uint8_t> varLocStack;
+    uint8_t calleeSaved = 0;                // R4..R7 the function being generated saves, bit n for Rn
+    std::vector<size_t> functionAddrs;      // by FnDecl::index
+    std::vector<std::pair<size_t, const FnDecl*>> callFixups;  // CALLA targets to fill in
 
     public:
-        CodegenVisitor();
-        
-        std::vector<uint8_t> getCode() { return code; }
-        std::vector<uint8_t> getLBC();
+        CodegenVisitor(const ExtensionRegistry& registry, const VarAllocator& vars);
 
         virtual int visitBinaryExpr(BinaryExpr* expr) override;
         virtual int visitAssignment(Assignment* expr) override;
@@ -61,16 +50,24 @@ class CodegenVisitor : public Visitor {
         virtual void visitExprStatement(ExprStatement* stmt) override;
         virtual void visitIfElse(IfElse* stmt) override;
         virtual void visitLoopStmt(LoopStmt* stmt) override;
+        virtual void visitForStmt(ForStmt* stmt) override;
         virtual void visitBlockStmt(BlockStmt* stmt) override;
         virtual void visitVarDeclaration(VarDeclaration* stmt) override;
+        virtual void visitFnDecl(FnDecl* stmt) override;
+        virtual void visitReturnStmt(ReturnStmt* stmt) override;
         virtual void visitProgram(Program* program) override;
-    
-    private:
-        void emitu8(uint8_t val);
-        void emitu16(uint16_t val);
-        void emiti32(int32_t val);
 
-        void emitDestSrc(uint8_t dest, uint8_t src);
+    private:
+        void emitStatement(Statement* stmt);
+        void emitFunction(FnDecl* fn);
+        void emitEntry(FnDecl* fn);
+        void emitEpilogue();
+        int emitTableLookup(FnDecl* fn, Expression* arg);
+        int evaluate(Expression* expr);
+        void evaluateOperands(BinaryExpr* expr, bool overwrite, int& rLhs, int& rRhs);
+        void condJump(Expression* cond, bool jumpIf, std::vector<size_t>& jumps);
+        int writable(int reg);
+        const VarLocation& locate(const VarDeclaration* decl, std::string_view id, const char* error);
 };
 
-#endif
\ No newline at end of file
+#endif
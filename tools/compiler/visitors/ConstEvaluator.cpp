@@ -0,0 +1,179 @@
+#include "ConstEvaluator.h"
+#include "VarResolver.h"
+#include "../Parser.h"
+#include <arith.h>
+
+#include <stdexcept>
+#include <string>
+
+bool ConstEvaluator::evaluate(BinOp op, int32_t a, int32_t b, int32_t& out) {
+    switch (op) {
+        case BinOp::ADD: out = arith_add(a, b); return true;
+        case BinOp::SUB: out = arith_sub(a, b); return true;
+        case BinOp::MUL: out = arith_mul(a, b); return true;
+        case BinOp::DIV: out = arith_div(a, b); return true;
+        case BinOp::MOD: out = arith_mod(a, b); return true;
+        case BinOp::MULQ: out = arith_mulq(a, b); return true;
+        case BinOp::DIVQ: out = arith_divq(a, b); return true;
+        case BinOp::MAX: out = a > b ? a : b; return true;
+        case BinOp::MIN: out = a < b ? a : b; return true;
+        case BinOp::EQUALS: out = a == b; return true;
+        case BinOp::NEQUALS: out = a != b; return true;
+        case BinOp::GREATER: out = a > b; return true;
+        case BinOp::LESS: out = a < b; return true;
+        case BinOp::GEQUALS: out = a >= b; return true;
+        case BinOp::LEQUALS: out = a <= b; return true;
+        case BinOp::LAND: out = a != 0 && b != 0; return true;
+        case BinOp::LOR: out = a != 0 || b != 0; return true;
+    }
+    return false;
+}
+
+void ConstEvaluator::run(Program* program) {
+    VarResolver resolver;
+    program->visit(&resolver);
+    values.assign(resolver.decls.size(), 0);
+
+    for (FnDecl* f : resolver.fns) {
+        if (!f->tabulated) continue;
+        size_t len = (size_t) ((int64_t) f->to - f->from);
+        if (pool.size() + len > POOL_LIMIT) {
+            throw std::runtime_error("Tables of const fns are too large, the constant pool holds "
+                                     + std::to_string(POOL_LIMIT) + " entries");
+        }
+        f->tableBase = (uint32_t) pool.size();
+        for (int64_t x = f->from; x < f->to; x++) {
+            pool.push_back(call(f, {(int32_t) x}));
+        }
+    }
+}
+
+int32_t ConstEvaluator::call(FnDecl* callee, const std::vector<int32_t>& args) {
+    if (callee->tabulated && (args[0] < callee->from || args[0] >= callee->to)) {
+        throw std::runtime_error(std::string(callee->id) + "(" + std::to_string(args[0]) + ") is outside of its table "
+                                 + std::to_string(callee->from) + ".." + std::to_string(callee->to));
+    }
+    if (depth == 0) steps = 0;
+
+    // no recursion, the callee's variables aren't in use by any call in progress
+    FnDecl* caller = fn;
+    fn = callee;
+    depth++;
+    for (size_t i = 0; i < args.size(); i++) {
+        values[callee->params[i]->index] = args[i];
+    }
+    callee->body->visit(this);
+    // like at runtime, reaching the end of the body gives 0
+    int32_t result = returning ? returned : 0;
+    returning = false;
+    depth--;
+    fn = caller;
+    return result;
+}
+
+void ConstEvaluator::step() {
+    if (++steps > STEP_LIMIT) {
+        throw std::runtime_error("const fn " + std::string(fn->id) + " didn't return within "
+                                 + std::to_string(STEP_LIMIT) + " steps");
+    }
+}
+
+int ConstEvaluator::visitBinaryExpr(BinaryExpr* expr) {
+    int32_t lhs = expr->lhs->visit(this);
+    // `and` and `or` don't evaluate the right side once the left one decides
+    if (expr->op == BinOp::LAND && lhs == 0) return 0;
+    if (expr->op == BinOp::LOR && lhs != 0) return 1;
+
+    int32_t rhs = expr->rhs->visit(this);
+    if (rhs == 0 && (expr->op == BinOp::DIV || expr->op == BinOp::DIVQ || expr->op == BinOp::MOD)) {
+        throw std::runtime_error((expr->op != BinOp::MOD ? "Division by zero in const fn " : "Modulo by zero in const fn ")
+                                 + std::string(fn->id));
+    }
+    int32_t val = 0;
+    evaluate(expr->op, lhs, rhs, val);
+    return val;
+}
+
+int ConstEvaluator::visitAssignment(Assignment* expr) {
+    int32_t val = expr->expr->visit(this);
+    if (expr->decl == nullptr) {
+        throw std::runtime_error("Tried assigning to undeclared var: " + std::string(expr->id));
+    }
+    values[expr->decl->index] = val;
+    return val;
+}
+
+int ConstEvaluator::visitCallExpr(CallExpr* expr) {
+    if (expr->args.size() != expr->fn->params.size()) {
+        throw std::runtime_error(std::string(expr->id) + " expects " + std::to_string(expr->fn->params.size()) + " arguments");
+    }
+    std::vector<int32_t> args;
+    for (auto* arg : expr->args) args.push_back(arg->visit(this));
+    return call(expr->fn, args);
+}
+
+int ConstEvaluator::visitNumberExpr(NumberExpr* expr) {
+    return expr->val;
+}
+
+int ConstEvaluator::visitVarExpr(VarExpr* expr) {
+    if (expr->decl == nullptr) {
+        throw std::runtime_error("Tried accesing undeclared var: " + std::string(expr->id));
+    }
+    return values[expr->decl->index];
+}
+
+void ConstEvaluator::visitExprStatement(ExprStatement* stmt) {
+    step();
+    stmt->expr->visit(this);
+}
+
+void ConstEvaluator::visitIfElse(IfElse* stmt) {
+    step();
+    if (stmt->cond->visit(this) != 0) {
+        stmt->ifBody->visit(this);
+    } else if (stmt->elseBody != nullptr) {
+        stmt->elseBody->visit(this);
+    }
+}
+
+// there is no `break`, only a `return` leaves the loop
+void ConstEvaluator::visitLoopStmt(LoopStmt* stmt) {
+    while (!returning) {
+        step();
+        stmt->body->visit(this);
+    }
+}
+
+void ConstEvaluator::visitForStmt(ForStmt* stmt) {
+    step();
+    int32_t from = stmt->from->visit(this);
+    int32_t to = stmt->to->visit(this);
+    for (int64_t i = from; i < to && !returning; i++) {
+        step();
+        values[stmt->var->index] = (int32_t) i;
+        stmt->body->visit(this);
+    }
+}
+
+void ConstEvaluator::visitBlockStmt(BlockStmt* stmt) {
+    for (auto* s : stmt->stmts) {
+        if (returning) break;
+        s->visit(this);
+    }
+}
+
+void ConstEvaluator::visitVarDeclaration(VarDeclaration* stmt) {
+    step();
+    values[stmt->index] = stmt->expr != nullptr ? stmt->expr->visit(this) : 0;
+}
+
+void ConstEvaluator::visitFnDecl(FnDecl* stmt) {}
+
+void ConstEvaluator::visitReturnStmt(ReturnStmt* stmt) {
+    step();
+    returned = stmt->expr != nullptr ? stmt->expr->visit(this) : 0;
+    returning = true;
+}
+
+void ConstEvaluator::visitProgram(Program* program) {}
@@ -0,0 +1,59 @@
+#ifndef LUMA_CONST_EVALUATOR_H
+#define LUMA_CONST_EVALUATOR_H
+
+#include "Visitor.h"
+#include "../BinOp.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Runs `const fn`s in the compiler with the VM's integer semantics from
+ * common/arith.h. VarResolver makes sure they only call other const fns, so
+ * a call depends on nothing but its arguments. Division by zero, an argument
+ * outside a table's range and a call that doesn't return within STEP_LIMIT
+ * statements are compile errors. run() fills the constant pool with the
+ * tables of the tabulated ones, `f(x in 0..256)` is f(0)..f(255).
+ */
+class ConstEvaluator : public Visitor {
+    std::vector<int32_t> values;    // by VarDeclaration::index
+    FnDecl* fn = nullptr;           // function being evaluated
+    size_t depth = 0;               // calls in progress
+    uint64_t steps = 0;             // statements run since the outermost call
+    bool returning = false;         // a `return` was reached, statements are skipped until the call ends
+    int32_t returned = 0;
+
+    public:
+        static constexpr uint64_t STEP_LIMIT = 1000000;
+        // entries of all tables together, 16 KB of LBC
+        static constexpr size_t POOL_LIMIT = 4096;
+
+        std::vector<int32_t> pool;
+
+        void run(Program* program);
+        int32_t call(FnDecl* callee, const std::vector<int32_t>& args);
+
+        // a op b, false for operators without a value of their own. Division by zero is the caller's to check
+        static bool evaluate(BinOp op, int32_t a, int32_t b, int32_t& out);
+
+        virtual int visitBinaryExpr(BinaryExpr* expr) override;
+        virtual int visitAssignment(Assignment* expr) override;
+        virtual int visitCallExpr(CallExpr* expr) override;
+        virtual int visitNumberExpr(NumberExpr* expr) override;
+        virtual int visitVarExpr(VarExpr* expr) override;
+        virtual void visitExprStatement(ExprStatement* stmt) override;
+        virtual void visitIfElse(IfElse* stmt) override;
+        virtual void visitLoopStmt(LoopStmt* stmt) override;
+        virtual void visitForStmt(ForStmt* stmt) override;
+        virtual void visitBlockStmt(BlockStmt* stmt) override;
+        virtual void visitVarDeclaration(VarDeclaration* stmt) override;
+        virtual void visitFnDecl(FnDecl* stmt) override;
+        virtual void visitReturnStmt(ReturnStmt* stmt) override;
+        virtual void visitProgram(Program* program) override;
+
+    private:
+        void step();
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "ConstantFolder.h"
+#include "ConstEvaluator.h"
+#include "VarResolver.h"
+#include "../Parser.h"
+
+#include <stdexcept>
+
+ConstantFolder::ConstantFolder(ConstEvaluator& consts) : consts(consts) {}
+
+void ConstantFolder::run(Program* program) {
+    VarResolver resolver;
+    program->visit(&resolver);
+    vars.assign(resolver.decls.size(), VarInfo{});
+    for (size_t i = 0; i < vars.size(); i++) {
+        vars[i].assignments = resolver.assignments[i];
+    }
+    program->visit(this);
+}
+
+Expression* ConstantFolder::fold(Expression* expr) {
+    result = expr;
+    expr->visit(this);
+    return result;
+}
+
+int ConstantFolder::visitBinaryExpr(BinaryExpr* expr) {
+    expr->lhs = fold(expr->lhs);
+    auto* lhs = dynamic_cast<NumberExpr*>(expr->lhs);
+    // the right side of `0 and b` and `1 or b` is never evaluated
+    bool decided = expr->op == BinOp::LAND ? lhs != nullptr && lhs->val == 0
+                 : expr->op == BinOp::LOR && lhs != nullptr && lhs->val != 0;
+    if (decided) {
+        result = arena->make<NumberExpr>(expr->op == BinOp::LOR ? 1 : 0);
+        folded++;
+        return 0;
+    }
+
+    expr->rhs = fold(expr->rhs);
+    result = expr;
+
+    auto* rhs = dynamic_cast<NumberExpr*>(expr->rhs);
+    bool divides = expr->op == BinOp::DIV || expr->op == BinOp::DIVQ || expr->op == BinOp::MOD;
+    if (rhs != nullptr && rhs->val == 0 && divides) {
+        throw std::runtime_error(expr->op != BinOp::MOD ? "Division by zero" : "Modulo by zero");
+    }
+
+    int32_t val;
+    if (lhs != nullptr && rhs != nullptr && ConstEvaluator::evaluate(expr->op, lhs->val, rhs->val, val)) {
+        result = arena->make<NumberExpr>(val);
+        folded++;
+    }
+    return 0;
+}
+
+int ConstantFolder::visitAssignment(Assignment* expr) {
+    expr->expr = fold(expr->expr);
+    result = expr;
+    return 0;
+}
+
+int ConstantFolder::visitCallExpr(CallExpr* expr) {
+    bool constant = true;
+    for (auto& arg : expr->args) {
+        arg = fold(arg);
+        constant = constant && dynamic_cast<NumberExpr*>(arg) != nullptr;
+    }
+    result = expr;
+
+    // a const fn called with constants is replaced by its result
+    if (constant && expr->fn != nullptr && expr->fn->isConst && expr->args.size() == expr->fn->params.size()) {
+        std::vector<int32_t> args;
+        for (auto* arg : expr->args) args.push_back(static_cast<NumberExpr*>(arg)->val);
+        result = arena->make<NumberExpr>(consts.call(expr->fn, args));
+        evaluated++;
+    }
+    return 0;
+}
+
+int ConstantFolder::visitNumberExpr(NumberExpr* expr) {
+    result = expr;
+    return 0;
+}
+
+int ConstantFolder::visitVarExpr(VarExpr* expr) {
+    result = expr;
+    if (expr->decl == nullptr) return 0;
+
+    const VarInfo& info = vars[expr->decl->index];
+    if (info.constant) {
+        result = arena->make<NumberExpr>(info.value);
+        propagated++;
+    }
+    return 0;
+}
+
+void ConstantFolder::visitExprStatement(ExprStatement* stmt) {
+    stmt->expr = fold(stmt->expr);
+}
+
+void ConstantFolder::visitIfElse(IfElse* stmt) {
+    stmt->cond = fold(stmt->cond);
+    stmt->ifBody->visit(this);
+    if (stmt->elseBody != nullptr) {
+        stmt->elseBody->visit(this);
+    }
+}
+
+void ConstantFolder::visitLoopStmt(LoopStmt* stmt) {
+    stmt->body->visit(this);
+}
+
+void ConstantFolder::visitForStmt(ForStmt* stmt) {
+    stmt->from = fold(stmt->from);
+    stmt->to = fold(stmt->to);
+    stmt->body->visit(this);
+}
+
+void ConstantFolder::visitBlockStmt(BlockStmt* stmt) {
+    for (auto* s : stmt->stmts) {
+        s->visit(this);
+    }
+}
+
+void ConstantFolder::visitVarDeclaration(VarDeclaration* stmt) {
+    if (stmt->expr == nullptr) return;
+    stmt->expr = fold(stmt->expr);
+
+    VarInfo& info = vars[stmt->index];
+    if (auto* num = dynamic_cast<NumberExpr*>(stmt->expr); num != nullptr && info.assignments == 0) {
+        info.constant = true;
+        info.value = num->val;
+    }
+}
+
+void ConstantFolder::visitFnDecl(FnDecl* stmt) {
+    stmt->body->visit(this);
+}
+
+void ConstantFolder::visitReturnStmt(ReturnStmt* stmt) {
+    if (stmt->expr != nullptr) {
+        stmt->expr = fold(stmt->expr);
+    }
+}
+
+void ConstantFolder::visitProgram(Program* program) {
+    arena = program->arena.get();
+    for (auto* s : program->stmts) {
+        s->visit(this);
+    }
+    arena = nullptr;
+}
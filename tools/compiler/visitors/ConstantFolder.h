@@ -0,0 +1,62 @@
+#ifndef LUMA_CONSTANT_FOLDER_H
+#define LUMA_CONSTANT_FOLDER_H
+
+#include "Visitor.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class Arena;
+class ConstEvaluator;
+class Expression;
+
+/*
+ * Folds BinaryExprs with constant operands (max/min included) and replaces
+ * reads of never reassigned, constant initialized lets by their value. Uses
+ * the VM's integer semantics from common/arith.h, a division or modulo by a
+ * constant zero is a compile error. Calls of const fns with constant
+ * arguments are evaluated by consts.
+ */
+class ConstantFolder : public Visitor {
+    struct VarInfo {
+        uint32_t assignments = 0;
+        bool constant = false;
+        int32_t value = 0;
+    };
+
+    ConstEvaluator& consts;
+    Arena* arena = nullptr;
+    Expression* result = nullptr;   // replacement for the expression just visited
+
+    std::vector<VarInfo> vars;      // by VarDeclaration::index
+
+    public:
+        explicit ConstantFolder(ConstEvaluator& consts);
+
+        void run(Program* program);
+
+        size_t folded = 0;          // BinaryExprs folded
+        size_t propagated = 0;      // variable reads replaced by constants
+        size_t evaluated = 0;       // const fn calls replaced by their result
+
+        virtual int visitBinaryExpr(BinaryExpr* expr) override;
+        virtual int visitAssignment(Assignment* expr) override;
+        virtual int visitCallExpr(CallExpr* expr) override;
+        virtual int visitNumberExpr(NumberExpr* expr) override;
+        virtual int visitVarExpr(VarExpr* expr) override;
+        virtual void visitExprStatement(ExprStatement* stmt) override;
+        virtual void visitIfElse(IfElse* stmt) override;
+        virtual void visitLoopStmt(LoopStmt* stmt) override;
+        virtual void visitForStmt(ForStmt* stmt) override;
+        virtual void visitBlockStmt(BlockStmt* stmt) override;
+        virtual void visitVarDeclaration(VarDeclaration* stmt) override;
+        virtual void visitFnDecl(FnDecl* stmt) override;
+        virtual void visitReturnStmt(ReturnStmt* stmt) override;
+        virtual void visitProgram(Program* program) override;
+
+    private:
+        Expression* fold(Expression* expr);
+};
+
+#endif
@@ -0,0 +1,242 @@
+#include "FlatCodegen.h"
+#include <opcode.h>
+#include <stdexcept>
+#include <string>
+#include "../Extension.h"
+
+FlatCodegen::FlatCodegen(const ExtensionRegistry& registry)
+    : registry(registry) {}
+
+void FlatCodegen::generate(const FlatAST& flat) {
+    ast = &flat;
+    varLoc.assign(flat.names.size(), -1);
+
+    for (NameRef req : flat.reqs) {
+        auto ext = registry.get(flat.names[req]);
+        if (ext == nullptr) {
+            throw std::runtime_error("Unknown extension: " + std::string(flat.names[req]));
+        }
+        reqIDs.push_back(ext->getID());
+    }
+
+    for (NodeRef stmt : flat.stmts) {
+        genStmt(stmt);
+    }
+    emitu8(OP_HALT);
+    ast = nullptr;
+}
+
+int FlatCodegen::genExpr(NodeRef ref) {
+    const FlatNode& n = (*ast)[ref];
+    switch (n.kind) {
+        case NodeKind::NUMBER: {
+            int reg = allocator.alloc();
+            emitu8(OP_MOVI);
+            emitu8(reg);
+            emiti32((int32_t) n.a);
+            return reg;
+        }
+        case NodeKind::VAR: {
+            if (varLoc[n.a] < 0) {
+                throw std::runtime_error("Tried accesing undeclared var: " + std::string(ast->names[n.a]));
+            }
+            int reg = allocator.alloc();
+            emitu8(OP_LOAD);
+            emitu8(reg);
+            emitu8((uint8_t) varLoc[n.a]);
+            return reg;
+        }
+        case NodeKind::BINARY: {
+            if (n.op == BinOp::LAND || n.op == BinOp::LOR) {
+                int reg = allocator.alloc();
+                emitu8(OP_MOVI);
+                emitu8(reg);
+                emiti32(0);
+                std::vector<size_t> toFalse;
+                genCondJump(ref, false, toFalse);
+                emitu8(OP_MOVI);
+                emitu8(reg);
+                emiti32(1);
+                patchJumps(toFalse);
+                return reg;
+            }
+            int rLhs = genExpr(n.a);
+            int rRhs = genExpr(n.b);
+            emitu8(binOpOpcode(n.op));
+            emitDestSrc(rLhs, rRhs);
+            allocator.free(rRhs);
+            return rLhs;
+        }
+        case NodeKind::ASSIGN: {
+            int reg = genExpr(n.b);
+            if (varLoc[n.a] < 0) {
+                throw std::runtime_error("Tried assigning to undeclared var: " + std::string(ast->names[n.a]));
+            }
+            emitu8(OP_STORE);
+            emitu8((uint8_t) varLoc[n.a]);
+            emitu8(reg);
+            return reg;
+        }
+        case NodeKind::CALL:
+            return genCall(n);
+        default:
+            throw std::logic_error("Statement node in expression position");
+    }
+}
+
+int FlatCodegen::genCall(const FlatNode& n) {
+    if (n.count > 0) {
+        size_t mark = argRegs.size();
+        for (const NodeRef* it = ast->begin(n); it != ast->end(n); it++) {
+            int reg = genExpr(*it);
+            argRegs.push_back(reg);
+        }
+        const int* regs = argRegs.data() + mark;
+        size_t argc = n.count;
+
+        for (size_t i = 0; i < argc; i++) {
+            allocator.free(regs[i]);
+        }
+
+        for (size_t i = 0; i < argc && i < 4; i++) {
+            if (regs[i] != i) {
+                emitu8(OP_MOV);
+                emitDestSrc((uint8_t) i, regs[i]);
+            }
+        }
+
+        for (size_t i = argc-1; i >= 4; i--) {
+            emitu8(OP_PUSH);
+            emitu8(regs[i]);
+        }
+        argRegs.resize(mark);
+    }
+
+    if (n.b != NO_NODE) {
+        auto ext = registry.get(ast->names[n.b]);
+        if (ext == nullptr) {
+            throw std::runtime_error("Unknown extension: " + std::string(ast->names[n.b]));
+        }
+
+        const ExtFunction* fn = ext->getFunction(ast->names[n.a]);
+        if (fn == nullptr) {
+            throw std::runtime_error("Unknown extension function: " + std::string(ast->names[n.b]) + "." + std::string(ast->names[n.a]));
+        }
+
+        if (fn->hasReturnValue) {
+            if (allocator.is_used(0)) {
+                emitu8(OP_PUSH);
+                emitu8(0);
+            } else {
+                allocator.alloc(0);
+            }
+        }
+
+        emitu8(OP_EXT);
+        emitu8(ext->getID());
+        emitu8(fn->subOp);
+
+        return 0;
+    }
+
+    if (ast->names[n.a] == "delay") {
+        emitu8(OP_DELAY);
+        emitu8(0);
+        return 0;
+    }
+
+    throw std::runtime_error("User functions not implemented yet!");
+}
+
+// same jumps as CodegenVisitor::condJump
+void FlatCodegen::genCondJump(NodeRef ref, bool jumpIf, std::vector<size_t>& jumps) {
+    const FlatNode& n = (*ast)[ref];
+    bool binary = n.kind == NodeKind::BINARY;
+    if (binary && (n.op == BinOp::LAND || n.op == BinOp::LOR)) {
+        bool decides = n.op == BinOp::LOR;
+        if (jumpIf == decides) {
+            genCondJump(n.a, jumpIf, jumps);
+            genCondJump(n.b, jumpIf, jumps);
+        } else {
+            std::vector<size_t> decided;
+            genCondJump(n.a, decides, decided);
+            genCondJump(n.b, jumpIf, jumps);
+            patchJumps(decided);
+        }
+        return;
+    }
+
+    if (binary && isComparison(n.op)) {
+        const FlatNode& rhs = (*ast)[n.b];
+        bool equality = n.op == BinOp::EQUALS || n.op == BinOp::NEQUALS;
+        if (equality && rhs.kind == NodeKind::NUMBER && (int32_t) rhs.a == 0) {
+            int reg = genExpr(n.a);
+            jumps.push_back(emitCondJump(jumpIf == (n.op == BinOp::NEQUALS), reg));
+            allocator.free(reg);
+            return;
+        }
+        int rLhs = genExpr(n.a);
+        int rRhs = genExpr(n.b);
+        jumps.push_back(emitCompareJump(binOpOpcode(n.op), jumpIf, rLhs, rRhs));
+        allocator.free(rLhs);
+        allocator.free(rRhs);
+        return;
+    }
+
+    int reg = genExpr(ref);
+    jumps.push_back(emitCondJump(jumpIf, reg));
+    allocator.free(reg);
+}
+
+void FlatCodegen::genStmt(NodeRef ref) {
+    const FlatNode& n = (*ast)[ref];
+    switch (n.kind) {
+        case NodeKind::EXPR_STMT:
+            allocator.free(genExpr(n.a));
+            break;
+        case NodeKind::IF_ELSE: {
+            std::vector<size_t> toElse;
+            genCondJump(n.a, false, toElse);
+            genStmt(n.b);
+            if (n.c != NO_NODE) {
+                emitu8(OP_JMPA);
+                std::vector<size_t> toEnd = {code.size()};
+                emitu16(0);
+                patchJumps(toElse);
+                genStmt(n.c);
+                patchJumps(toEnd);
+            } else {
+                patchJumps(toElse);
+            }
+            break;
+        }
+        case NodeKind::LOOP: {
+            uint16_t loopStart = (uint16_t) code.size();
+            genStmt(n.a);
+            emitu8(OP_JMPA);
+            emitu16(loopStart);
+            break;
+        }
+        case NodeKind::BLOCK: {
+            uint8_t savedLoc = nextVarLoc;
+            for (const NodeRef* it = ast->begin(n); it != ast->end(n); it++) {
+                genStmt(*it);
+            }
+            nextVarLoc = savedLoc;
+            break;
+        }
+        case NodeKind::VAR_DECL: {
+            uint8_t loc = nextVarLoc++;
+            varLoc[n.a] = loc;
+            int reg = n.b != NO_NODE ? genExpr(n.b) : allocator.alloc();
+            emitu8(OP_STORE);
+            emitu8(loc);
+            emitu8(reg);
+            allocator.free(reg);
+            break;
+        }
+        default:
+            allocator.free(genExpr(ref));
+            break;
+    }
+}
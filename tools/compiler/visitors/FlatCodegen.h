@@ -0,0 +1,35 @@
+#ifndef LUMA_FLAT_CODEGEN_H
+#define LUMA_FLAT_CODEGEN_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "CodeBuffer.h"
+#include "RegAllocater.h"
+#include "../FlatAST.h"
+
+// Emits the same bytecode as CodegenVisitor from a FlatAST, dispatching on node kind
+class ExtensionRegistry;
+
+class FlatCodegen : public CodeBuffer {
+    const ExtensionRegistry& registry;
+    const FlatAST* ast = nullptr;
+    RegAllocater allocator;
+    std::vector<int> argRegs;   // registers of the arguments of the calls being generated
+
+    std::vector<int> varLoc;    // per NameRef, -1 while undeclared
+    uint8_t nextVarLoc = 0;
+
+    public:
+        FlatCodegen(const ExtensionRegistry& registry);
+
+        void generate(const FlatAST& ast);
+
+    private:
+        int genExpr(NodeRef ref);
+        int genCall(const FlatNode& node);
+        void genCondJump(NodeRef ref, bool jumpIf, std::vector<size_t>& jumps);
+        void genStmt(NodeRef ref);
+};
+
+#endif
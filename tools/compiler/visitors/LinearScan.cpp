@@ -0,0 +1,69 @@
+#include "LinearScan.h"
+
+#include <algorithm>
+
+double useWeight(size_t loopDepth) {
+    static const double WEIGHTS[] = {1, 10, 100, 1000, 10000};
+    return WEIGHTS[std::min<size_t>(loopDepth, 4)];
+}
+
+std::vector<LiveInterval*> linearScan(std::vector<LiveInterval*> intervals, const std::vector<int>& locations) {
+    std::stable_sort(intervals.begin(), intervals.end(), [](const LiveInterval* a, const LiveInterval* b) {
+        return a->start < b->start;
+    });
+
+    std::vector<int> available(locations.rbegin(), locations.rend());   // back() is handed out first
+    std::vector<LiveInterval*> active;                                  // sorted by end
+    std::vector<LiveInterval*> spilled;
+
+    auto activate = [&](LiveInterval* iv) {
+        auto pos = std::upper_bound(active.begin(), active.end(), iv, [](const LiveInterval* a, const LiveInterval* b) {
+            return a->end < b->end;
+        });
+        active.insert(pos, iv);
+    };
+
+    for (LiveInterval* iv : intervals) {
+        // expire everything that ended before this one starts
+        size_t expired = 0;
+        while (expired < active.size() && active[expired]->end < iv->start) {
+            available.push_back(active[expired]->loc);
+            expired++;
+        }
+        active.erase(active.begin(), active.begin() + expired);
+
+        auto allowed = [&](int loc) {
+            if (iv->avoid == 0) return true;
+            size_t n = std::find(locations.begin(), locations.end(), loc) - locations.begin();
+            return n >= 32 || (iv->avoid & (1u << n)) == 0;
+        };
+
+        auto free = std::find_if(available.rbegin(), available.rend(), allowed);
+        if (free != available.rend()) {
+            iv->loc = *free;
+            available.erase(std::next(free).base());
+            activate(iv);
+            continue;
+        }
+
+        auto cheapest = active.end();
+        for (auto it = active.begin(); it != active.end(); ++it) {
+            if (allowed((*it)->loc) && (cheapest == active.end() || (*it)->weight < (*cheapest)->weight)) {
+                cheapest = it;
+            }
+        }
+        if (cheapest == active.end() || (*cheapest)->weight >= iv->weight) {
+            iv->loc = -1;
+            spilled.push_back(iv);
+            continue;
+        }
+
+        LiveInterval* victim = *cheapest;
+        active.erase(cheapest);
+        iv->loc = victim->loc;
+        victim->loc = -1;
+        spilled.push_back(victim);
+        activate(iv);
+    }
+    return spilled;
+}
@@ -0,0 +1,29 @@
+#ifndef LUMA_LINEAR_SCAN_H
+#define LUMA_LINEAR_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct LiveInterval {
+    uint32_t start, end;    // first and last position the value is live at, inclusive
+    double weight = 0;      // cost of keeping it out of a register
+    int loc = -1;           // assigned location, -1 if spilled
+    uint32_t avoid = 0;     // bit n set: must not get locations[n]
+};
+
+// a use inside n nested loops counts 10^n, deeper nesting isn't told apart
+double useWeight(size_t loopDepth);
+
+/*
+ * Linear scan allocation (Poletto & Sarkar) of a fixed set of locations.
+ * Intervals are visited by start, when all locations are taken the interval
+ * with the lowest weight is spilled instead of the one ending last, so
+ * values used in loops win over long lived but rarely touched ones. An
+ * interval that must stay out of some locations (say the registers a call
+ * overwrites) only takes or steals one it is allowed to have.
+ * Returns the intervals that didn't get a location.
+ */
+std::vector<LiveInterval*> linearScan(std::vector<LiveInterval*> intervals, const std::vector<int>& locations);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef LUMA_REG_ALLOCATER_H
+#define LUMA_REG_ALLOCATER_H
+
+#include <stdint.h>
+#include <stdexcept>
+
+// Temporaries of the expression being generated, registers holding a variable are pinned
+class RegAllocater {
+    bool used[8] = { false };
+    bool pinned[8] = { false };
+    uint8_t taken = 0;      // bit n set once Rn was handed out
+
+    public:
+        int alloc() {
+            for (int i = 0; i < 8; i++) {
+                if (!used[i]) {
+                    used[i] = true;
+                    taken |= 1u << i;
+                    return i;
+                }
+            }
+            throw std::runtime_error("Out of registers");
+        }
+
+        int alloc(int r) {
+            if (used[r]) throw std::runtime_error("Reallocating register that is already used!");
+            used[r] = true;
+            taken |= 1u << r;
+            return r;
+        }
+
+        // registers that were allocated or pinned at some point, a function has to save them
+        uint8_t ever_taken() {
+            return taken;
+        }
+
+        bool is_used(int r) {
+            return used[r];
+        }
+
+        // freeing a variable's register or no register (-1) does nothing
+        void free(int r) {
+            if (r < 0 || pinned[r]) return;
+            used[r] = false;
+        }
+
+        int free_count() {
+            int n = 0;
+            for (int i = 0; i < 8; i++) {
+                if (!used[i]) n++;
+            }
+            return n;
+        }
+
+        // r holds a variable until unpin, r may be the temporary that computed its value
+        void pin(int r) {
+            used[r] = true;
+            pinned[r] = true;
+            taken |= 1u << r;
+        }
+
+        void unpin(int r) {
+            used[r] = false;
+            pinned[r] = false;
+        }
+
+        bool is_pinned(int r) {
+            return r >= 0 && pinned[r];
+        }
+};
+
+#endif
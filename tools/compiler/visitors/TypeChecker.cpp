@@ -0,0 +1,175 @@
+#include "TypeChecker.h"
+#include "VarResolver.h"
+#include "../Parser.h"
+#include "../CompileError.h"
+#include <arith.h>
+
+void TypeChecker::run(Program* program) {
+    VarResolver resolver;
+    program->visit(&resolver);
+    program->visit(this);
+}
+
+// a conversion node reports where the expression it replaces was
+template<typename T>
+static T* at(T* node, const Expression* replaced) {
+    node->line = replaced->line;
+    node->col = replaced->col;
+    return node;
+}
+
+ValueType TypeChecker::check(Expression*& expr) {
+    result = expr;
+    auto type = (ValueType) expr->visit(this);
+    expr = result;
+    return type;
+}
+
+Expression* TypeChecker::convert(Expression* expr, ValueType from, ValueType to, const std::string& what) {
+    if (from == to) return expr;
+    if (to == ValueType::INT) {
+        throw CompileError(what + " is fixed where an int is expected, convert it with int()", expr->line, expr->col);
+    }
+    if (auto* num = dynamic_cast<NumberExpr*>(expr)) {
+        return at(arena->make<NumberExpr>(arith_mul(num->val, ARITH_Q_ONE), true), expr);
+    }
+    return at(arena->make<BinaryExpr>(BinOp::MUL, expr, at(arena->make<NumberExpr>(ARITH_Q_ONE), expr)), expr);
+}
+
+int TypeChecker::visitBinaryExpr(BinaryExpr* expr) {
+    ValueType lhs = check(expr->lhs);
+    ValueType rhs = check(expr->rhs);
+    result = expr;
+    bool lhsFixed = lhs == ValueType::FIXED, rhsFixed = rhs == ValueType::FIXED;
+
+    switch (expr->op) {
+        // only compared with 0
+        case BinOp::LAND: case BinOp::LOR:
+            return (int) ValueType::INT;
+        // the int operand scales the fixed one as it is
+        case BinOp::MUL:
+            if (lhsFixed && rhsFixed) expr->op = BinOp::MULQ;
+            return (int) (lhsFixed || rhsFixed ? ValueType::FIXED : ValueType::INT);
+        case BinOp::DIV:
+            if (rhsFixed) {
+                expr->lhs = convert(expr->lhs, lhs, ValueType::FIXED, "");
+                expr->op = BinOp::DIVQ;
+            }
+            return (int) (lhsFixed || rhsFixed ? ValueType::FIXED : ValueType::INT);
+        default:
+            break;
+    }
+
+    // both on the same scale
+    if (lhsFixed != rhsFixed) {
+        expr->lhs = convert(expr->lhs, lhs, ValueType::FIXED, "");
+        expr->rhs = convert(expr->rhs, rhs, ValueType::FIXED, "");
+    }
+    bool fixed = (lhsFixed || rhsFixed) && !isComparison(expr->op);
+    return (int) (fixed ? ValueType::FIXED : ValueType::INT);
+}
+
+int TypeChecker::visitAssignment(Assignment* expr) {
+    ValueType type = check(expr->expr);
+    result = expr;
+    if (expr->decl == nullptr) return (int) type;
+    expr->expr = convert(expr->expr, type, expr->decl->type, "The value assigned to " + std::string(expr->id));
+    return (int) expr->decl->type;
+}
+
+int TypeChecker::visitCallExpr(CallExpr* expr) {
+    std::string name = expr->namesp.size() > 0 ? std::string(expr->namesp) + "." + std::string(expr->id)
+                                               : std::string(expr->id);
+    if (expr->isConversion()) {
+        if (expr->args.size() != 1) {
+            throw CompileError(name + " expects 1 argument but got: " + std::to_string(expr->args.size()), expr->line, expr->col);
+        }
+        ValueType type = check(expr->args[0]);
+        Expression* arg = expr->args[0];
+        if (expr->id == "fixed") {
+            result = convert(arg, type, ValueType::FIXED, "");
+            return (int) ValueType::FIXED;
+        }
+        result = type == ValueType::FIXED ? at(arena->make<BinaryExpr>(BinOp::DIV, arg, at(arena->make<NumberExpr>(ARITH_Q_ONE), expr)), expr)
+                                          : arg;
+        return (int) ValueType::INT;
+    }
+
+    // a user function takes what its parameters are declared as, everything else ints
+    FnDecl* callee = expr->namesp.size() == 0 ? expr->fn : nullptr;
+    for (size_t i = 0; i < expr->args.size(); i++) {
+        ValueType type = check(expr->args[i]);
+        ValueType param = callee != nullptr && i < callee->params.size() ? callee->params[i]->type : ValueType::INT;
+        expr->args[i] = convert(expr->args[i], type, param, "Argument " + std::to_string(i + 1) + " of " + name);
+    }
+    result = expr;
+    return (int) (callee != nullptr ? callee->returns : ValueType::INT);
+}
+
+int TypeChecker::visitNumberExpr(NumberExpr* expr) {
+    result = expr;
+    return (int) (expr->fixed ? ValueType::FIXED : ValueType::INT);
+}
+
+int TypeChecker::visitVarExpr(VarExpr* expr) {
+    result = expr;
+    return (int) (expr->decl != nullptr ? expr->decl->type : ValueType::INT);
+}
+
+void TypeChecker::visitExprStatement(ExprStatement* stmt) {
+    check(stmt->expr);
+}
+
+void TypeChecker::visitIfElse(IfElse* stmt) {
+    check(stmt->cond);
+    stmt->ifBody->visit(this);
+    if (stmt->elseBody != nullptr) {
+        stmt->elseBody->visit(this);
+    }
+}
+
+void TypeChecker::visitLoopStmt(LoopStmt* stmt) {
+    stmt->body->visit(this);
+}
+
+void TypeChecker::visitForStmt(ForStmt* stmt) {
+    std::string what = "A bound of the for over " + std::string(stmt->var->id);
+    ValueType from = check(stmt->from);
+    ValueType to = check(stmt->to);
+    stmt->from = convert(stmt->from, from, ValueType::INT, what);
+    stmt->to = convert(stmt->to, to, ValueType::INT, what);
+    stmt->body->visit(this);
+}
+
+void TypeChecker::visitBlockStmt(BlockStmt* stmt) {
+    for (auto* s : stmt->stmts) {
+        s->visit(this);
+    }
+}
+
+void TypeChecker::visitVarDeclaration(VarDeclaration* stmt) {
+    if (stmt->expr == nullptr) return;
+    ValueType type = check(stmt->expr);
+    if (!stmt->typed) stmt->type = type;
+    stmt->expr = convert(stmt->expr, type, stmt->type, "The initial value of " + std::string(stmt->id));
+}
+
+void TypeChecker::visitFnDecl(FnDecl* stmt) {
+    fn = stmt;
+    stmt->body->visit(this);
+    fn = nullptr;
+}
+
+void TypeChecker::visitReturnStmt(ReturnStmt* stmt) {
+    if (stmt->expr == nullptr) return;
+    ValueType type = check(stmt->expr);
+    stmt->expr = convert(stmt->expr, type, fn->returns, "The result of " + std::string(fn->id));
+}
+
+void TypeChecker::visitProgram(Program* program) {
+    arena = program->arena.get();
+    for (auto* s : program->stmts) {
+        s->visit(this);
+    }
+    arena = nullptr;
+}
@@ -0,0 +1,50 @@
+#ifndef LUMA_TYPE_CHECKER_H
+#define LUMA_TYPE_CHECKER_H
+
+#include "Visitor.h"
+
+#include <stdint.h>
+#include <string>
+
+class Arena;
+class Expression;
+enum class ValueType : uint8_t;
+
+/*
+ * Types every expression as int or Q16.16 `fixed` and rewrites the tree so
+ * the passes after it only see word operations. A `let` without a type has
+ * its initializer's, parameters and results are int unless declared fixed.
+ * An int where a fixed is expected is multiplied by 65536, the other way
+ * round is an error unless written as `int(x)`, which divides (toward 0).
+ * Two fixed operands make `*` a MULQ and `/` a DIVQ, a fixed times or
+ * divided by an int stays a MUL or DIV. Runs once, right after parsing.
+ */
+class TypeChecker : public Visitor {
+    Arena* arena = nullptr;
+    Expression* result = nullptr;   // replacement for the expression just visited
+    FnDecl* fn = nullptr;           // function whose body is being checked
+
+    public:
+        void run(Program* program);
+
+        virtual int visitBinaryExpr(BinaryExpr* expr) override;
+        virtual int visitAssignment(Assignment* expr) override;
+        virtual int visitCallExpr(CallExpr* expr) override;
+        virtual int visitNumberExpr(NumberExpr* expr) override;
+        virtual int visitVarExpr(VarExpr* expr) override;
+        virtual void visitExprStatement(ExprStatement* stmt) override;
+        virtual void visitIfElse(IfElse* stmt) override;
+        virtual void visitLoopStmt(LoopStmt* stmt) override;
+        virtual void visitForStmt(ForStmt* stmt) override;
+        virtual void visitBlockStmt(BlockStmt* stmt) override;
+        virtual void visitVarDeclaration(VarDeclaration* stmt) override;
+        virtual void visitFnDecl(FnDecl* stmt) override;
+        virtual void visitReturnStmt(ReturnStmt* stmt) override;
+        virtual void visitProgram(Program* program) override;
+
+    private:
+        ValueType check(Expression*& expr);
+        Expression* convert(Expression* expr, ValueType from, ValueType to, const std::string& what);
+};
+
+#endif
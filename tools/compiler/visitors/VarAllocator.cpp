@@ -0,0 +1,222 @@
+#include "VarAllocator.h"
+#include "VarResolver.h"
+#include "../Parser.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void VarAllocator::run(Program* program, bool useRegisters) {
+    VarResolver resolver;
+    program->visit(&resolver);
+    infos.resize(resolver.decls.size());
+    locations.resize(resolver.decls.size());
+    for (size_t i = 0; i < infos.size(); i++) {
+        infos[i].owner = resolver.owners[i] != nullptr ? resolver.owners[i]->index + 1 : 0;
+    }
+    calls.assign(resolver.fns.size() + 1, false);
+    calls[0] = true;
+    program->visit(this);
+
+    // the program and functions that call something in R4..R7, leaf functions in R0..R3
+    std::vector<LiveInterval*> intervals, leaves;
+    for (VarInfo& info : infos) {
+        info.interval.end = ends[info.lastUse.pos];
+        (calls[info.owner] ? intervals : leaves).push_back(&info.interval);
+    }
+
+    if (useRegisters) {
+        std::vector<int> regs, leafRegs;
+        for (int r = FIRST_VAR_REG; r < FIRST_VAR_REG + VAR_REG_COUNT; r++) regs.push_back(r);
+        for (int r = 0; r < VAR_REG_COUNT; r++) leafRegs.push_back(r);
+        linearScan(intervals, regs);
+        linearScan(leaves, leafRegs);
+    }
+
+    for (size_t i = 0; i < infos.size(); i++) {
+        const VarInfo& info = infos[i];
+        if (info.interval.loc >= 0 && useRegisters) {
+            locations[i].reg = info.interval.loc;
+            releases[info.lastUse.stmt].push_back(info.interval.loc);
+            inRegisters++;
+        }
+    }
+
+    // one frame after the other, the program's own variables first
+    size_t functions = resolver.fns.size();
+    entrySlots.assign(functions, 0);
+    int base = 0;
+    for (uint32_t owner = 0; owner <= functions; owner++) {
+        std::vector<LiveInterval*> frame;
+        for (size_t i = 0; i < infos.size(); i++) {
+            if (infos[i].owner != owner || locations[i].reg >= 0) continue;
+            infos[i].interval.avoid = 0;
+            frame.push_back(&infos[i].interval);
+        }
+        std::vector<int> slots;
+        for (int s = base; s < MEM_SLOTS; s++) slots.push_back(s);
+        if (!linearScan(frame, slots).empty()) {
+            throw std::runtime_error("Too many variables live at once, mem has " + std::to_string(MEM_SLOTS) + " slots");
+        }
+        for (LiveInterval* iv : frame) base = std::max(base, iv->loc + 1);
+        if (owner > 0 && resolver.fns[owner - 1]->params.size() > 4) {
+            if (base + 2 > MEM_SLOTS) {
+                throw std::runtime_error("Too many variables live at once, mem has " + std::to_string(MEM_SLOTS) + " slots");
+            }
+            entrySlots[owner - 1] = (uint8_t) base;
+            base += 2;
+        }
+    }
+    for (size_t i = 0; i < infos.size(); i++) {
+        if (locations[i].reg < 0) {
+            locations[i].slot = (uint8_t) infos[i].interval.loc;
+            inMemory++;
+        }
+    }
+}
+
+uint32_t VarAllocator::enter(const Statement* stmt) {
+    uint32_t pos = (uint32_t) ends.size();
+    ends.push_back(pos);
+    open.push_back({stmt, pos});
+    return pos;
+}
+
+void VarAllocator::leave() {
+    ends[open.back().pos] = (uint32_t) ends.size() - 1;
+    open.pop_back();
+}
+
+void VarAllocator::use(const VarDeclaration* decl) {
+    if (decl == nullptr) return;
+    VarInfo& info = infos[decl->index];
+    info.interval.weight += useWeight(loops.size());
+
+    // the outermost loop entered after the declaration keeps the variable live to its end
+    OpenStmt until = open.back();
+    for (uint32_t loop : loops) {
+        if (loop > info.interval.start) {
+            until = *std::find_if(open.begin(), open.end(), [loop](const OpenStmt& s) { return s.pos == loop; });
+            break;
+        }
+    }
+
+    // a statement still open contains this use and ends after it
+    bool isOpen = std::any_of(open.begin(), open.end(), [&](const OpenStmt& s) { return s.pos == info.lastUse.pos; });
+    if (!isOpen) {
+        info.lastUse = until;
+    }
+}
+
+int VarAllocator::visitBinaryExpr(BinaryExpr* expr) {
+    expr->lhs->visit(this);
+    expr->rhs->visit(this);
+    return 0;
+}
+
+int VarAllocator::visitAssignment(Assignment* expr) {
+    expr->expr->visit(this);
+    use(expr->decl);
+    return 0;
+}
+
+int VarAllocator::visitCallExpr(CallExpr* expr) {
+    for (auto* arg : expr->args) arg->visit(this);
+    bool lookup = expr->fn != nullptr && expr->fn->tabulated;
+    if (expr->namesp.size() > 0 || (expr->id != "delay" && !lookup)) calls[owner] = true;
+    return 0;
+}
+
+int VarAllocator::visitNumberExpr(NumberExpr* expr) {
+    return 0;
+}
+
+int VarAllocator::visitVarExpr(VarExpr* expr) {
+    use(expr->decl);
+    return 0;
+}
+
+void VarAllocator::visitExprStatement(ExprStatement* stmt) {
+    enter(stmt);
+    stmt->expr->visit(this);
+    leave();
+}
+
+void VarAllocator::visitIfElse(IfElse* stmt) {
+    enter(stmt);
+    stmt->cond->visit(this);
+    stmt->ifBody->visit(this);
+    if (stmt->elseBody != nullptr) stmt->elseBody->visit(this);
+    leave();
+}
+
+void VarAllocator::visitLoopStmt(LoopStmt* stmt) {
+    loops.push_back(enter(stmt));
+    stmt->body->visit(this);
+    loops.pop_back();
+    leave();
+}
+
+void VarAllocator::visitForStmt(ForStmt* stmt) {
+    uint32_t pos = enter(stmt);
+    stmt->from->visit(this);
+    stmt->to->visit(this);
+    visitVarDeclaration(stmt->var);
+    visitVarDeclaration(stmt->count);
+    loops.push_back(pos);
+    stmt->body->visit(this);
+    // stepped at the end of every round, both stay live to the end of the for
+    use(stmt->var);
+    use(stmt->count);
+    loops.pop_back();
+    leave();
+}
+
+void VarAllocator::visitBlockStmt(BlockStmt* stmt) {
+    enter(stmt);
+    for (auto* s : stmt->stmts) s->visit(this);
+    leave();
+}
+
+void VarAllocator::visitVarDeclaration(VarDeclaration* stmt) {
+    uint32_t pos = enter(stmt);
+    if (stmt->expr != nullptr) stmt->expr->visit(this);
+
+    VarInfo& info = infos[stmt->index];
+    info.interval.start = pos;
+    info.interval.weight = useWeight(loops.size());
+    info.lastUse = open.back();
+    leave();
+}
+
+void VarAllocator::visitFnDecl(FnDecl* stmt) {
+    owner = stmt->index + 1;
+    enter(stmt);
+    for (size_t i = 0; i < stmt->params.size(); i++) {
+        visitVarDeclaration(stmt->params[i]);
+        // popped off the stack into mem before anything else happens
+        if (i >= 4) infos[stmt->params[i]->index].interval.avoid = (1u << VAR_REG_COUNT) - 1;
+    }
+    // the entry stores all arguments at once, no parameter's location is free before the last one is in place
+    if (!stmt->params.empty()) {
+        OpenStmt entry = {stmt->params.back(), infos[stmt->params.back()->index].interval.start};
+        uint32_t first = infos[stmt->params.front()->index].interval.start;
+        for (auto* param : stmt->params) {
+            VarInfo& info = infos[param->index];
+            info.interval.start = first;
+            if (info.lastUse.pos < entry.pos) info.lastUse = entry;
+        }
+    }
+    stmt->body->visit(this);
+    leave();
+    owner = 0;
+}
+
+void VarAllocator::visitReturnStmt(ReturnStmt* stmt) {
+    enter(stmt);
+    if (stmt->expr != nullptr) stmt->expr->visit(this);
+    leave();
+}
+
+void VarAllocator::visitProgram(Program* program) {
+    for (auto* s : program->stmts) s->visit(this);
+}
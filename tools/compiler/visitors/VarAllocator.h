@@ -0,0 +1,94 @@
+#ifndef LUMA_VAR_ALLOCATOR_H
+#define LUMA_VAR_ALLOCATOR_H
+
+#include "Visitor.h"
+#include "LinearScan.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+class Statement;
+
+struct VarLocation {
+    int reg = -1;           // register for the whole live range, -1 if the variable lives in mem
+    uint8_t slot = 0;       // mem address otherwise
+};
+
+/*
+ * Decides where every `let` lives. Statements are numbered in program order
+ * and each variable is live from its declaration up to the statement with
+ * its last use. A variable declared outside a loop and used inside it stays
+ * live until the loop ends, its value has to survive the back edge.
+ * Intervals are weighted by their uses, ten times per loop level, and
+ * linear scan hands R4..R7 to the heaviest ones. The rest are packed into
+ * mem slots the same way. R0..R3 are never given to variables, extension
+ * calls pass their arguments there and return in R0.
+ *
+ * Functions can't recurse, so each one has a static frame: its variables
+ * get mem slots no other function uses, a callee never overwrites its
+ * caller's. Registers are shared, a function saves the ones it takes.
+ * Parameters are all live from the function's entry, where the arguments
+ * are stored, and those past the fourth arrive on the stack and live in mem.
+ * A leaf function, one without calls, gets R0..R3 instead of R4..R7: its
+ * parameters stay where they arrived and there is nothing to save.
+ */
+class VarAllocator : public Visitor {
+    struct OpenStmt {
+        const Statement* stmt;
+        uint32_t pos;
+    };
+
+    struct VarInfo {
+        LiveInterval interval;
+        OpenStmt lastUse;           // statement after which the variable is dead
+        uint32_t owner = 0;         // FnDecl::index + 1 of its function, 0 outside functions
+    };
+
+    std::vector<VarInfo> infos;                 // by VarDeclaration::index
+    std::vector<uint32_t> ends;                 // last position inside the statement at each position
+    std::vector<OpenStmt> open;                 // statements being visited, innermost last
+    std::vector<uint32_t> loops;                // positions of the enclosing loops, innermost last
+    uint32_t owner = 0;                         // of the statements being visited
+    std::vector<bool> calls;                    // by owner, something in it overwrites R0..R3
+
+    public:
+        static constexpr int FIRST_VAR_REG = 4;
+        static constexpr int VAR_REG_COUNT = 4;
+        static constexpr int MEM_SLOTS = 256;
+
+        // with useRegisters false every variable gets a mem slot, as with -O0
+        void run(Program* program, bool useRegisters = true);
+
+        std::vector<VarLocation> locations;     // by VarDeclaration::index
+        // by FnDecl::index, two mem words a function with parameters on the stack moves them with
+        std::vector<uint8_t> entrySlots;
+        // variable registers that are free again once the statement is done
+        std::unordered_map<const Statement*, std::vector<int>> releases;
+
+        size_t inRegisters = 0;
+        size_t inMemory = 0;
+
+        virtual int visitBinaryExpr(BinaryExpr* expr) override;
+        virtual int visitAssignment(Assignment* expr) override;
+        virtual int visitCallExpr(CallExpr* expr) override;
+        virtual int visitNumberExpr(NumberExpr* expr) override;
+        virtual int visitVarExpr(VarExpr* expr) override;
+        virtual void visitExprStatement(ExprStatement* stmt) override;
+        virtual void visitIfElse(IfElse* stmt) override;
+        virtual void visitLoopStmt(LoopStmt* stmt) override;
+        virtual void visitForStmt(ForStmt* stmt) override;
+        virtual void visitBlockStmt(BlockStmt* stmt) override;
+        virtual void visitVarDeclaration(VarDeclaration* stmt) override;
+        virtual void visitFnDecl(FnDecl* stmt) override;
+        virtual void visitReturnStmt(ReturnStmt* stmt) override;
+        virtual void visitProgram(Program* program) override;
+
+    private:
+        uint32_t enter(const Statement* stmt);
+        void leave();
+        void use(const VarDeclaration* decl);
+};
+
+#endif
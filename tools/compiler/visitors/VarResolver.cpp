@@ -0,0 +1,174 @@
+#include "VarResolver.h"
+#include "../Parser.h"
+
+#include <stdexcept>
+#include <string>
+
+VarDeclaration* VarResolver::lookup(std::string_view id) {
+    for (auto it = scopes.rbegin(); it != scopes.rend(); it++) {
+        auto var = it->find(id);
+        if (var != it->end()) return var->second;
+    }
+    return nullptr;
+}
+
+int VarResolver::visitBinaryExpr(BinaryExpr* expr) {
+    expr->lhs->visit(this);
+    expr->rhs->visit(this);
+    return 0;
+}
+
+int VarResolver::visitAssignment(Assignment* expr) {
+    expr->expr->visit(this);
+    expr->decl = lookup(expr->id);
+    if (forVars.count(expr->decl) > 0) {
+        throw std::runtime_error("Can't assign to the variable of a for: " + std::string(expr->id));
+    }
+    if (expr->decl != nullptr) assignments[expr->decl->index]++;
+    return 0;
+}
+
+int VarResolver::visitCallExpr(CallExpr* expr) {
+    for (auto* arg : expr->args) arg->visit(this);
+    if (expr->namesp.size() == 0) {
+        auto fn = functions.find(expr->id);
+        expr->fn = fn != functions.end() ? fn->second : nullptr;
+        if (expr->fn != nullptr && current != nullptr) callees[current->index].push_back(expr->fn);
+    }
+    // the compiler runs const fns, there are no LEDs, sensors or clock there
+    bool constCallee = expr->isConversion() || (expr->namesp.size() == 0 && expr->fn != nullptr && expr->fn->isConst);
+    if (current != nullptr && current->isConst && !constCallee) {
+        std::string name = expr->namesp.size() > 0 ? std::string(expr->namesp) + "." : "";
+        throw std::runtime_error("const fn " + std::string(current->id) + " can only call other const fns, not "
+                                 + name + std::string(expr->id));
+    }
+    return 0;
+}
+
+int VarResolver::visitNumberExpr(NumberExpr* expr) {
+    return 0;
+}
+
+int VarResolver::visitVarExpr(VarExpr* expr) {
+    expr->decl = lookup(expr->id);
+    return 0;
+}
+
+void VarResolver::visitExprStatement(ExprStatement* stmt) {
+    stmt->expr->visit(this);
+}
+
+// a body is a scope of its own even without braces, `if (c) let x = 1;` doesn't leak x
+void VarResolver::visitBody(Statement* body) {
+    scopes.emplace_back();
+    body->visit(this);
+    scopes.pop_back();
+}
+
+void VarResolver::visitIfElse(IfElse* stmt) {
+    stmt->cond->visit(this);
+    visitBody(stmt->ifBody);
+    if (stmt->elseBody != nullptr) visitBody(stmt->elseBody);
+}
+
+void VarResolver::visitLoopStmt(LoopStmt* stmt) {
+    visitBody(stmt->body);
+}
+
+// from and to are outside of the loop, the variable and the counter belong to the body
+void VarResolver::visitForStmt(ForStmt* stmt) {
+    stmt->from->visit(this);
+    stmt->to->visit(this);
+    scopes.emplace_back();
+    stmt->var->visit(this);
+    stmt->count->visit(this);
+    forVars.insert(stmt->var);
+    visitBody(stmt->body);
+    scopes.pop_back();
+}
+
+void VarResolver::visitBlockStmt(BlockStmt* stmt) {
+    scopes.emplace_back();
+    for (auto* s : stmt->stmts) s->visit(this);
+    scopes.pop_back();
+}
+
+void VarResolver::visitVarDeclaration(VarDeclaration* stmt) {
+    if (stmt->expr != nullptr) stmt->expr->visit(this);
+    stmt->index = (uint32_t) decls.size();
+    decls.push_back(stmt);
+    assignments.push_back(0);
+    owners.push_back(current);
+    scopes.back()[stmt->id] = stmt;
+}
+
+void VarResolver::visitFnDecl(FnDecl* stmt) {
+    if (current != nullptr || scopes.size() != 1) {
+        throw std::runtime_error("Functions can only be declared at the top level: " + std::string(stmt->id));
+    }
+    auto outer = std::move(scopes);
+    scopes.assign(1, {});
+    if (stmt->tabulated && stmt->to <= stmt->from) {
+        throw std::runtime_error("Empty table range of " + std::string(stmt->id) + ": "
+                                 + std::to_string(stmt->from) + ".." + std::to_string(stmt->to));
+    }
+    current = stmt;
+    for (auto* param : stmt->params) param->visit(this);
+    visitBody(stmt->body);
+    if (stmt->isConst && !stmt->returnsValue) {
+        throw std::runtime_error("const fn " + std::string(stmt->id) + " has to return a value");
+    }
+    current = nullptr;
+    scopes = std::move(outer);
+}
+
+void VarResolver::visitReturnStmt(ReturnStmt* stmt) {
+    if (current == nullptr) {
+        throw std::runtime_error("return outside of a function");
+    }
+    stmt->fn = current;
+    if (stmt->expr != nullptr) {
+        stmt->expr->visit(this);
+        current->returnsValue = true;
+    }
+}
+
+void VarResolver::checkRecursion() {
+    // 0 unvisited, 1 on the path being followed, 2 done
+    std::vector<uint8_t> state(fns.size(), 0);
+    auto visit = [&](auto& self, FnDecl* fn) -> void {
+        state[fn->index] = 1;
+        for (FnDecl* callee : callees[fn->index]) {
+            if (state[callee->index] == 1) {
+                throw std::runtime_error("Recursive call of " + std::string(callee->id) + ", functions can't call themselves");
+            }
+            if (state[callee->index] == 0) self(self, callee);
+        }
+        state[fn->index] = 2;
+    };
+    for (FnDecl* fn : fns) {
+        if (state[fn->index] == 0) visit(visit, fn);
+    }
+}
+
+void VarResolver::visitProgram(Program* program) {
+    // functions can be called before they are declared
+    for (auto* s : program->stmts) {
+        auto* fn = dynamic_cast<FnDecl*>(s);
+        if (fn == nullptr) continue;
+        if (fn->id == "delay" || fn->id == "int" || fn->id == "fixed") {
+            throw std::runtime_error(std::string(fn->id) + " is built in and can't be declared");
+        }
+        if (!functions.emplace(fn->id, fn).second) {
+            throw std::runtime_error("Function declared twice: " + std::string(fn->id));
+        }
+        fn->index = (uint32_t) fns.size();
+        fns.push_back(fn);
+        callees.emplace_back();
+    }
+
+    scopes.emplace_back();
+    for (auto* s : program->stmts) s->visit(this);
+    scopes.pop_back();
+    checkRecursion();
+}
@@ -0,0 +1,58 @@
+#ifndef LUMA_VAR_RESOLVER_H
+#define LUMA_VAR_RESOLVER_H
+
+#include "Visitor.h"
+
+#include <stdint.h>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Statement;
+
+/*
+ * Binds every VarExpr and Assignment to its declaration by lexical scope
+ * (their decl stays null for undeclared variables), numbers the
+ * declarations and counts the assignments to each. Calls are bound to the
+ * function they name, functions are declared at the top level and can be
+ * called before their declaration. A function body only sees its parameters
+ * and its own variables. Recursion is an error, every function has a single
+ * static frame. A const fn has to return a value and may only call other
+ * const fns. The variable of a `for` can't be assigned to.
+ */
+class VarResolver : public Visitor {
+    std::vector<std::unordered_map<std::string_view, VarDeclaration*>> scopes;
+    std::unordered_map<std::string_view, FnDecl*> functions;
+    FnDecl* current = nullptr;              // function whose body is being resolved
+    std::unordered_set<const VarDeclaration*> forVars;
+
+    public:
+        std::vector<VarDeclaration*> decls;     // by VarDeclaration::index
+        std::vector<uint32_t> assignments;      // by VarDeclaration::index
+        std::vector<FnDecl*> owners;            // by VarDeclaration::index, nullptr outside functions
+        std::vector<FnDecl*> fns;               // by FnDecl::index
+        std::vector<std::vector<FnDecl*>> callees;  // by FnDecl::index, once per call
+
+        virtual int visitBinaryExpr(BinaryExpr* expr) override;
+        virtual int visitAssignment(Assignment* expr) override;
+        virtual int visitCallExpr(CallExpr* expr) override;
+        virtual int visitNumberExpr(NumberExpr* expr) override;
+        virtual int visitVarExpr(VarExpr* expr) override;
+        virtual void visitExprStatement(ExprStatement* stmt) override;
+        virtual void visitIfElse(IfElse* stmt) override;
+        virtual void visitLoopStmt(LoopStmt* stmt) override;
+        virtual void visitForStmt(ForStmt* stmt) override;
+        virtual void visitBlockStmt(BlockStmt* stmt) override;
+        virtual void visitVarDeclaration(VarDeclaration* stmt) override;
+        virtual void visitFnDecl(FnDecl* stmt) override;
+        virtual void visitReturnStmt(ReturnStmt* stmt) override;
+        virtual void visitProgram(Program* program) override;
+
+    private:
+        VarDeclaration* lookup(std::string_view id);
+        void visitBody(Statement* body);
+        void checkRecursion();
+};
+
+#endif
@@ -9,8 +9,11 @@ class VarExpr;
 class ExprStatement;
 class IfElse;
 class LoopStmt;
+class ForStmt;
 class BlockStmt;
 class VarDeclaration;
+class FnDecl;
+class ReturnStmt;
 class Program;
 
 class Visitor {
@@ -23,8 +26,11 @@ class Visitor {
         virtual void visitExprStatement(ExprStatement* exprStmt) = 0;
         virtual void visitIfElse(IfElse* ifElse) = 0;
         virtual void visitLoopStmt(LoopStmt* loopStmt) = 0;
+        virtual void visitForStmt(ForStmt* forStmt) = 0;
         virtual void visitBlockStmt(BlockStmt* blockStmt) = 0;
         virtual void visitVarDeclaration(VarDeclaration* varDeclaration) = 0;
+        virtual void visitFnDecl(FnDecl* fnDecl) = 0;
+        virtual void visitReturnStmt(ReturnStmt* returnStmt) = 0;
         virtual void visitProgram(Program* program) = 0;
 };
 
@@ -0,0 +1,398 @@
+#include "Peephole.h"
+
+#include <opcode.h>
+#include <extension.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <initializer_list>
+
+namespace {
+    constexpr uint8_t ALL_REGS = 0xFF;
+
+    enum : uint8_t {
+        BRANCH = 1 << 0,    // ends in an absolute 16 bit target
+        STOP = 1 << 1,      // never falls through to the next instruction
+        BARRIER = 1 << 2,   // control may leave, scans end here
+        MEMORY = 1 << 3,    // may read or write any memory word
+    };
+
+    struct Insn {
+        uint8_t bytes[6];
+        uint8_t len;
+        uint8_t reads = 0, writes = 0;  // registers, a bit per register
+        uint8_t flags = 0;
+        size_t target = 0;              // BRANCH only, index of the instruction it lands on
+        bool isTarget = false;
+        bool removed = false;
+
+        uint8_t op() const { return bytes[0]; }
+    };
+
+    uint8_t reg(uint8_t r) { return (uint8_t) (1u << (r & 7)); }
+
+    uint8_t argRegs(uint8_t argc) { return (uint8_t) ((1u << (argc < 4 ? argc : 4)) - 1); }
+
+    const ExtFuncDesc* findFunction(uint8_t id, uint8_t subop) {
+        const ExtDesc* desc = ext_desc_find(id);
+        for (uint8_t i = 0; desc != nullptr && i < desc->func_count; i++) {
+            if (desc->funcs[i].subop == subop) return &desc->funcs[i];
+        }
+        return nullptr;
+    }
+
+    const ExtFuncDesc* findShortcut(uint8_t opcode) {
+        switch (opcode) {
+#define EXT_SHORTCUT(name, fn, opcode, MNEMONIC) case OP_D_##MNEMONIC: return &EXT_FUNCS[EXT_IDX_##name##_##fn];
+#include <extensions.def>
+            default: return nullptr;
+        }
+    }
+
+    // length and effects of the instruction at code[pc], false if it isn't one
+    bool decode(const std::vector<uint8_t>& code, size_t pc, Insn& insn) {
+        uint8_t op = code[pc];
+        size_t avail = code.size() - pc;
+        auto operand = [&](size_t i) { return i < avail ? code[pc + i] : 0; };
+        uint8_t dst = operand(1) >> 4, src = operand(1) & 0xF;
+
+        switch (op) {
+            case OP_NOOP:
+                insn.len = 1;
+                break;
+            case OP_MOVI:
+                insn.len = 6;
+                insn.writes = reg(operand(1));
+                break;
+            case OP_MOV:
+                insn.len = 2;
+                insn.reads = reg(src);
+                insn.writes = reg(dst);
+                break;
+            case OP_LOAD:
+            case OP_LDC:
+                insn.len = 3;
+                insn.writes = reg(operand(1));
+                break;
+            case OP_LDCX:
+                insn.len = 6;
+                insn.reads = reg(src);
+                insn.writes = reg(dst);
+                break;
+            case OP_STORE:
+                insn.len = 3;
+                insn.reads = reg(operand(2));
+                break;
+            case OP_PUSH:
+            case OP_DELAY:
+                insn.len = 2;
+                insn.reads = reg(operand(1));
+                break;
+            case OP_POP:
+                insn.len = 2;
+                insn.writes = reg(operand(1));
+                break;
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD: case OP_MAX: case OP_MIN:
+            case OP_AND: case OP_OR: case OP_XOR: case OP_SHL: case OP_SHR: case OP_SAR:
+            case OP_MULQ: case OP_DIVQ:
+            case OP_EQ: case OP_NEQ: case OP_GEQ: case OP_LEQ: case OP_GT: case OP_LT:
+                insn.len = 2;
+                insn.reads = reg(dst) | reg(src);
+                insn.writes = reg(dst);
+                break;
+            case OP_ABS:
+            case OP_NOT:
+                insn.len = 2;
+                insn.reads = insn.writes = reg(operand(1));
+                break;
+            case OP_JMPA:
+                insn.len = 3;
+                insn.flags = BRANCH | STOP | BARRIER;
+                break;
+            case OP_JZA:
+            case OP_JNZA:
+                insn.len = 4;
+                insn.reads = reg(operand(1));
+                insn.flags = BRANCH | BARRIER;
+                break;
+            case OP_JEQA: case OP_JNEA: case OP_JLTA: case OP_JGEA:
+                insn.len = 4;
+                insn.reads = reg(dst) | reg(src);
+                insn.flags = BRANCH | BARRIER;
+                break;
+            case OP_DJNZ:
+                insn.len = 4;
+                insn.reads = insn.writes = reg(operand(1));
+                insn.flags = BRANCH | BARRIER;
+                break;
+            case OP_CALLA:
+                insn.len = 3;
+                insn.reads = insn.writes = ALL_REGS;
+                insn.flags = BRANCH | BARRIER | MEMORY;
+                break;
+            case OP_RET:
+            case OP_HALT:
+                insn.len = 1;
+                insn.reads = ALL_REGS;
+                insn.flags = STOP | BARRIER | MEMORY;
+                break;
+            case OP_EXT: {
+                insn.len = 3;
+                insn.flags = MEMORY;
+                const ExtFuncDesc* fn = findFunction(operand(1), operand(2));
+                if (fn == nullptr) {
+                    // an extension of a custom registry, anything may happen
+                    insn.reads = insn.writes = ALL_REGS;
+                    insn.flags |= BARRIER;
+                } else {
+                    insn.reads = argRegs(fn->arg_count);
+                    insn.writes = fn->has_ret ? reg(0) : 0;
+                }
+                break;
+            }
+            default: {
+                const ExtFuncDesc* fn = findShortcut(op);
+                if (fn == nullptr) return false;    // unknown, or a relative jump
+                insn.len = fn->has_ret ? 2 : 1;
+                insn.reads = argRegs(fn->arg_count);
+                insn.writes = fn->has_ret ? reg(operand(1)) : 0;
+                insn.flags = MEMORY;
+                break;
+            }
+        }
+        if (insn.len > avail) return false;
+        std::copy(code.begin() + pc, code.begin() + pc + insn.len, insn.bytes);
+        return true;
+    }
+
+    class Program {
+        public:
+            std::vector<Insn> insns;
+            unsigned window;
+            size_t removedInsns = 0, removedBytes = 0;
+
+            // the first instruction at or after i that is still there, insns.size() if none is
+            size_t live(size_t i) const {
+                while (i < insns.size() && insns[i].removed) i++;
+                return i;
+            }
+
+            size_t next(size_t i) const { return live(i + 1); }
+
+            size_t target(const Insn& insn) const { return live(insn.target); }
+
+            // jumps to a removed instruction land on the next one, which needs to exist
+            bool removable(size_t i) const {
+                return !insns[i].isTarget || next(i) < insns.size();
+            }
+
+            void remove(size_t i) {
+                Insn& insn = insns[i];
+                insn.removed = true;
+                if (insn.isTarget) insns[next(i)].isTarget = true;
+                removedInsns++;
+                removedBytes += insn.len;
+            }
+
+            void rewrite(size_t i, std::initializer_list<uint8_t> bytes, uint8_t reads, uint8_t writes) {
+                Insn& insn = insns[i];
+                removedBytes += insn.len - bytes.size();
+                insn.len = (uint8_t) bytes.size();
+                std::copy(bytes.begin(), bytes.end(), insn.bytes);
+                insn.reads = reads;
+                insn.writes = writes;
+                insn.flags = 0;
+            }
+
+            // calls visit(j) for the instructions of the straight-line window after i, until it returns true
+            template<typename Visit>
+            void scan(size_t i, Visit visit) const {
+                size_t j = next(i);
+                for (unsigned n = 0; n < window && j < insns.size() && !insns[j].isTarget; n++) {
+                    if (visit(j) || (insns[j].flags & BARRIER)) return;
+                    j = next(j);
+                }
+            }
+    };
+
+    bool movSelf(Program& p, size_t i) {
+        const Insn& insn = p.insns[i];
+        if (insn.op() != OP_MOV || (insn.bytes[1] >> 4) != (insn.bytes[1] & 0xF) || !p.removable(i)) return false;
+        p.remove(i);
+        return true;
+    }
+
+    bool storeLoad(Program& p, size_t i) {
+        const Insn& store = p.insns[i];
+        if (store.op() != OP_STORE) return false;
+        uint8_t addr = store.bytes[1], r = store.bytes[2];
+        bool changed = false;
+        p.scan(i, [&](size_t j) {
+            Insn& insn = p.insns[j];
+            if (insn.op() == OP_LOAD && insn.bytes[2] == addr) {
+                uint8_t dst = insn.bytes[1];
+                if (dst == r) {
+                    p.remove(j);
+                } else {
+                    p.rewrite(j, {OP_MOV, (uint8_t) ((dst << 4) | r)}, reg(r), reg(dst));
+                }
+                changed = true;
+                return true;
+            }
+            return (insn.writes & reg(r)) || (insn.op() == OP_STORE && insn.bytes[1] == addr) || (insn.flags & MEMORY);
+        });
+        return changed;
+    }
+
+    bool deadMovi(Program& p, size_t i) {
+        const Insn& movi = p.insns[i];
+        if (movi.op() != OP_MOVI || !p.removable(i)) return false;
+        uint8_t r = reg(movi.bytes[1]);
+        bool dead = false;
+        p.scan(i, [&](size_t j) {
+            const Insn& insn = p.insns[j];
+            if (insn.reads & r) return true;
+            dead = (insn.writes & r) != 0;
+            return dead;
+        });
+        if (dead) p.remove(i);
+        return dead;
+    }
+
+    bool jumpThread(Program& p, size_t i) {
+        Insn& insn = p.insns[i];
+        if (!(insn.flags & BRANCH)) return false;
+        size_t to = p.target(insn);
+        // a loop of jumps that never gets anywhere stays as it is
+        for (size_t hops = 0; hops < p.insns.size() && to < p.insns.size() && p.insns[to].op() == OP_JMPA; hops++) {
+            size_t further = p.target(p.insns[to]);
+            if (further == to) break;
+            to = further;
+        }
+        if (to == p.target(insn)) return false;
+        insn.target = to;
+        p.insns[to].isTarget = true;
+        return true;
+    }
+
+    bool jumpNext(Program& p, size_t i) {
+        const Insn& insn = p.insns[i];
+        // calls and DJNZ do more than jump
+        if (!(insn.flags & BRANCH) || insn.writes != 0) return false;
+        if (p.target(insn) != p.next(i) || !p.removable(i)) return false;
+        p.remove(i);
+        return true;
+    }
+
+    bool unreachable(Program& p, size_t i) {
+        if (!(p.insns[i].flags & STOP)) return false;
+        bool changed = false;
+        for (size_t j = p.next(i); j < p.insns.size() && !p.insns[j].isTarget; j = p.next(j)) {
+            p.remove(j);
+            changed = true;
+        }
+        return changed;
+    }
+
+    struct Rule {
+        const char* name;
+        bool (*apply)(Program& p, size_t i);
+    };
+
+    const Rule RULES[] = {
+        {"mov-self", movSelf},
+        {"store-load", storeLoad},
+        {"dead-movi", deadMovi},
+        {"jump-thread", jumpThread},
+        {"jump-next", jumpNext},
+        {"unreachable", unreachable},
+    };
+    constexpr size_t RULE_COUNT = sizeof(RULES) / sizeof(RULES[0]);
+}
+
+Peephole::Peephole(unsigned window) : window(window) {
+    for (const Rule& rule : RULES) ruleStats.push_back({rule.name});
+}
+
+bool Peephole::run(std::vector<uint8_t>& code, std::vector<size_t>* moved) {
+    Program p;
+    p.window = window;
+
+    std::vector<size_t> index(code.size() + 1, SIZE_MAX);     // by address, the instruction starting there
+    for (size_t pc = 0; pc < code.size();) {
+        Insn insn;
+        if (!decode(code, pc, insn)) return false;
+        index[pc] = p.insns.size();
+        p.insns.push_back(insn);
+        pc += insn.len;
+    }
+    if (p.insns.empty()) return true;
+    for (Insn& insn : p.insns) {
+        if (!(insn.flags & BRANCH)) continue;
+        uint16_t addr = (uint16_t) (insn.bytes[insn.len - 2] | (insn.bytes[insn.len - 1] << 8));
+        if (addr >= code.size() || index[addr] == SIZE_MAX) return false;
+        insn.target = index[addr];
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        // where jumps land is worked out again every round, threading leaves old targets behind
+        for (Insn& insn : p.insns) insn.isTarget = false;
+        p.insns[p.live(0)].isTarget = true;     // the entry
+        for (const Insn& insn : p.insns) {
+            if (!insn.removed && (insn.flags & BRANCH)) p.insns[p.target(insn)].isTarget = true;
+        }
+
+        for (size_t i = p.live(0); i < p.insns.size(); i = p.next(i)) {
+            for (size_t r = 0; r < RULE_COUNT && !p.insns[i].removed; r++) {
+                size_t insnsBefore = p.removedInsns, bytesBefore = p.removedBytes;
+                if (!RULES[r].apply(p, i)) continue;
+                PeepholeRuleStats& stats = ruleStats[r];
+                stats.applied++;
+                stats.instructions += p.removedInsns - insnsBefore;
+                stats.bytes += p.removedBytes - bytesBefore;
+                changed = true;
+            }
+        }
+    }
+
+    std::vector<uint16_t> addrs(p.insns.size() + 1);
+    uint16_t pc = 0;
+    for (size_t i = 0; i < p.insns.size(); i++) {
+        addrs[i] = pc;
+        if (!p.insns[i].removed) pc += p.insns[i].len;
+    }
+    addrs[p.insns.size()] = pc;
+    if (moved != nullptr) {
+        moved->assign(code.size(), SIZE_MAX);
+        for (size_t at = 0; at < code.size(); at++) {
+            if (index[at] != SIZE_MAX && !p.insns[index[at]].removed) (*moved)[at] = addrs[index[at]];
+        }
+    }
+
+    bytesBefore += code.size();
+    code.clear();
+    for (Insn& insn : p.insns) {
+        if (insn.removed) continue;
+        if (insn.flags & BRANCH) {
+            uint16_t addr = addrs[p.target(insn)];
+            insn.bytes[insn.len - 2] = (uint8_t) (addr & 0xFF);
+            insn.bytes[insn.len - 1] = (uint8_t) (addr >> 8);
+        }
+        code.insert(code.end(), insn.bytes, insn.bytes + insn.len);
+    }
+    bytesAfter += code.size();
+    return true;
+}
+
+void Peephole::printStats(std::ostream& os) const {
+    char line[96];
+    std::snprintf(line, sizeof(line), "peephole: %zu -> %zu bytes (window %u)\n", bytesBefore, bytesAfter, window);
+    os << line;
+    for (const PeepholeRuleStats& stats : ruleStats) {
+        std::snprintf(line, sizeof(line), "  %-12s %6zu applied %6zu instructions %6zu bytes removed\n",
+                      stats.name, stats.applied, stats.instructions, stats.bytes);
+        os << line;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef LUMA_PEEPHOLE_H
+#define LUMA_PEEPHOLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+struct PeepholeRuleStats {
+    const char* name;
+    size_t applied = 0;
+    size_t instructions = 0;    // removed
+    size_t bytes = 0;           // removed
+};
+
+/*
+ * Peephole pass over LBC as it is written to the file, shared by LumaC and
+ * LumASM. The code is decoded into instructions, every jump remembers the
+ * instruction it lands on instead of an address, the rules of a table are
+ * tried at every instruction until none applies anymore and the survivors
+ * are encoded again with their jumps pointing at the new addresses.
+ *
+ * Rules only look at straight-line code: a scan stops at the next jump
+ * target or control transfer and after `window` instructions.
+ *
+ *   mov-self      MOV r, r
+ *   store-load    STORE a, r ... LOAD r', a     the load becomes MOV r', r or goes away
+ *   dead-movi     MOVI r, n ... r written before it is read
+ *   jump-thread   a jump or call to JMP x goes to x directly
+ *   jump-next     a jump to the instruction right after it
+ *   unreachable   code after JMP, RET or HALT that nothing jumps to
+ *
+ * Code that can't be decoded (unknown opcodes, relative jumps, a target in
+ * the middle of an instruction) is left as it is.
+ */
+class Peephole {
+    unsigned window;
+    std::vector<PeepholeRuleStats> ruleStats;
+    size_t bytesBefore = 0, bytesAfter = 0;
+
+    public:
+        static constexpr unsigned DEFAULT_WINDOW = 4;
+
+        explicit Peephole(unsigned window = DEFAULT_WINDOW);
+
+        // false if the code couldn't be decoded and wasn't touched. moved, when given, is filled
+        // with the new address of every instruction by its old one, SIZE_MAX for removed ones
+        bool run(std::vector<uint8_t>& code, std::vector<size_t>* moved = nullptr);
+
+        // summed over every run
+        const std::vector<PeepholeRuleStats>& stats() const { return ruleStats; }
+        void printStats(std::ostream& os) const;
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cinttypes>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+
+#include "vm.h"
+#include "profile.h"
+#include "microphone.h"
+#include "neopixel.h"
+#include "output_stage.h"
+#include "ws281x.h"
+
+// Loaded .lbc image (see docs/LBC_FileFormat_Specs.md)
+struct ExtRecord {
+    uint8_t id;
+    size_t configPos;
+    uint8_t configLen;
+};
+
+struct Image {
+    std::vector<uint8_t> file;
+    std::vector<ExtRecord> extensions;
+    std::vector<uint32_t> consts;
+    uint16_t codeOffset = 0;
+    uint16_t entry = 0;
+    uint32_t codeSize = 0;
+};
+
+static uint16_t le16(const uint8_t* p) { return (uint16_t) (p[0] | (p[1] << 8)); }
+static uint32_t le32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24); }
+
+static bool loadImage(const std::string& path, Image& img) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Failed to open " + path);
+    img.file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    const auto& f = img.file;
+    if (f.size() < 16 || std::memcmp(f.data(), "LVM1", 4) != 0) {
+        throw std::runtime_error("Not an LBC file: " + path);
+    }
+    bool wideConsts = (f[5] & 0x01) != 0;
+    uint8_t extCount = f[6];
+    uint16_t constCount = f[7];
+    img.codeOffset = le16(&f[8]);
+    img.entry = le16(&f[10]);
+    img.codeSize = le32(&f[12]);
+
+    size_t pos = 16;
+    for (uint8_t i = 0; i < extCount; i++) {
+        if (pos + 3 > f.size() || pos + 3 + f[pos + 2] > f.size()) {
+            throw std::runtime_error("Truncated extension table");
+        }
+        img.extensions.push_back(ExtRecord{f[pos], pos + 3, f[pos + 2]});
+        pos += 3 + f[pos + 2];
+    }
+    if (wideConsts) {
+        // more than 255 constants, the count is in front of the pool
+        if (pos + 2 > f.size()) throw std::runtime_error("Truncated constant pool");
+        constCount = le16(&f[pos]);
+        pos += 2;
+    }
+    for (uint16_t i = 0; i < constCount; i++) {
+        if (pos + 4 > f.size()) throw std::runtime_error("Truncated constant pool");
+        img.consts.push_back(le32(&f[pos]));
+        pos += 4;
+    }
+    if ((size_t) img.codeOffset + img.codeSize > f.size() || img.codeSize > 0xFFFF) {
+        throw std::runtime_error("Code section out of bounds");
+    }
+    return true;
+}
+
+// Output sink writing raw RGB frames, stand-in for the LED driver / socket
+static void fileSink(const uint8_t* data, uint16_t len, void* user) {
+    FILE* f = static_cast<FILE*>(user);
+    fwrite(data, 1, len, f);
+    fflush(f);
+}
+
+// Output sink encoding frames into a WS281x SPI bitstream (e.g. /dev/spidev0.0)
+struct SpiOutput {
+    WsEncoder enc;
+    FILE* file;
+};
+
+static void spiSink(const uint8_t* data, uint16_t len, void* user) {
+    auto* spi = static_cast<SpiOutput*>(user);
+    size_t n = ws_encode(&spi->enc, data, (uint16_t) (len / 3));
+    fwrite(spi->enc.buf, 1, n, spi->file);
+    fflush(spi->file);
+}
+
+// Stops the capture and output threads and closes what they write to, on
+// every way out of main. The output thread goes first, its sink uses the rest.
+struct Teardown {
+    FILE*& outFile;
+    SpiOutput& spi;
+    bool encoder = false;   // spi.enc is allocated
+
+    void run() {
+        mic_close();
+        out_stop();
+        if (encoder) ws_free(&spi.enc);
+        encoder = false;
+        if (spi.file) fclose(spi.file);
+        spi.file = nullptr;
+        if (outFile && outFile != stdout) fclose(outFile);
+        outFile = nullptr;
+    }
+    ~Teardown() { run(); }
+};
+
+static OutPolicy parsePolicy(const std::string& name) {
+    if (name == "drop") return OUT_DROP_OLDEST;
+    if (name == "block") return OUT_BLOCK;
+    if (name == "coalesce") return OUT_COALESCE;
+    throw std::runtime_error("Unknown output policy: " + name);
+}
+
+// Ctrl-C ends a profiling run, the profile is still written
+static volatile std::sig_atomic_t interrupted = 0;
+static void onInterrupt(int) { interrupted = 1; }
+
+static void writeProfile(const std::string& path, const Image& img, const VmProfile& prof) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) throw std::runtime_error("Failed to open profile: " + path);
+    fprintf(f, "%s %d %016" PRIx64 "\n", LUMA_PROFILE_MAGIC, LUMA_PROFILE_VERSION,
+            luma_program_hash(img.file.data(), img.file.size()));
+    for (uint32_t at = 0; at < img.codeSize; at++) {
+        if (prof.taken[at] == 0 && prof.not_taken[at] == 0) continue;
+        fprintf(f, "%" PRIu32 " %" PRIu32 " %" PRIu32 "\n", at, prof.taken[at], prof.not_taken[at]);
+    }
+    fclose(f);
+}
+
+static void printStats() {
+    OutStats st;
+    out_get_stats(&st);
+    std::cerr << "output: published=" << st.published << " sent=" << st.sent
+              << " dropped=" << st.dropped << " coalesced=" << st.coalesced
+              << " depth=" << st.depth << " max_depth=" << st.max_depth
+              << " latency_avg=" << st.latency_avg_ns / 1000 << "us"
+              << " latency_max=" << st.latency_max_ns / 1000 << "us\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: LumaRun <program.lbc> [--mic <file.wav>] [--mic-pipe <path|-> <rate>] [--steps <n>]\n"
+                     "               [--leds <n>] [--out <path|->] [--spi <path>] [--policy drop|block|coalesce] [--stats]\n"
+                     "               [--profile <path>]\n"
+                     "--profile counts the conditional jumps and calls for LumaC --profile-use, best on a\n"
+                     "program compiled with --profile-generate. Ctrl-C ends the run and writes it.\n";
+        return 1;
+    }
+
+    uint64_t maxSteps = 0;
+    int leds = -1;
+    FILE* outFile = nullptr;
+    SpiOutput spi = {};
+    OutPolicy policy = OUT_DROP_OLDEST;
+    bool stats = false;
+    std::string profilePath;
+    Teardown teardown{outFile, spi};
+    try {
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--mic" && i + 1 < argc) {
+                if (!mic_open_wav(argv[++i])) throw std::runtime_error(std::string("Failed to open WAV: ") + argv[i]);
+            } else if (arg == "--mic-pipe" && i + 2 < argc) {
+                const char* path = argv[++i];
+                if (!mic_open_pipe(path, (uint32_t) std::stoul(argv[++i]))) {
+                    throw std::runtime_error(std::string("Failed to open pipe: ") + path);
+                }
+            } else if (arg == "--steps" && i + 1 < argc) {
+                maxSteps = std::stoull(argv[++i]);
+            } else if (arg == "--leds" && i + 1 < argc) {
+                leds = std::stoi(argv[++i]);
+            } else if (arg == "--out" && i + 1 < argc) {
+                std::string path = argv[++i];
+                outFile = path == "-" ? stdout : fopen(path.c_str(), "wb");
+                if (!outFile) throw std::runtime_error("Failed to open output: " + path);
+            } else if (arg == "--spi" && i + 1 < argc) {
+                std::string path = argv[++i];
+                spi.file = fopen(path.c_str(), "wb");
+                if (!spi.file) throw std::runtime_error("Failed to open SPI device: " + path);
+            } else if (arg == "--policy" && i + 1 < argc) {
+                policy = parsePolicy(argv[++i]);
+            } else if (arg == "--stats") {
+                stats = true;
+            } else if (arg == "--profile" && i + 1 < argc) {
+                profilePath = argv[++i];
+            } else {
+                throw std::runtime_error("Unknown argument: " + arg);
+            }
+        }
+
+        Image img;
+        loadImage(argv[1], img);
+        mic_register();
+        neo_register();
+        for (const auto& ext : img.extensions) {
+            if (!vm_configure_ext(ext.id, img.file.data() + ext.configPos, ext.configLen)) {
+                throw std::runtime_error("Invalid config for extension " + std::to_string(ext.id));
+            }
+        }
+        if (leds >= 0) neo_configure((uint16_t) leds);
+        if (spi.file) {
+            if (!ws_init(&spi.enc, WS_ORDER_GRB, WS_SYMBOL_3BIT, 2400000, 300, NEO_MAX_LEDS)) {
+                throw std::runtime_error("Failed to allocate the WS281x encoder");
+            }
+            teardown.encoder = true;
+        }
+        bool started = spi.file ? out_start(policy, spiSink, &spi)
+                                : out_start(policy, outFile ? fileSink : nullptr, outFile);
+        if (!started) throw std::runtime_error("Failed to start the output thread");
+
+        static VM vm;
+        vm_load_program(&vm, img.file.data() + img.codeOffset, (uint16_t) img.codeSize,
+                        img.consts.data(), (uint16_t) img.consts.size());
+        vm.pc = img.entry;
+
+        std::vector<uint32_t> taken, notTaken;
+        VmProfile prof = {};
+        if (!profilePath.empty()) {
+            taken.assign(img.codeSize, 0);
+            notTaken.assign(img.codeSize, 0);
+            prof.taken = taken.data();
+            prof.not_taken = notTaken.data();
+            vm.profile = &prof;
+            std::signal(SIGINT, onInterrupt);
+        }
+
+        for (uint64_t steps = 0; !vm.halted && !interrupted && (maxSteps == 0 || steps < maxSteps); steps++) {
+            vm_step(&vm);
+        }
+        if (!profilePath.empty()) writeProfile(profilePath, img, prof);
+        teardown.run();
+        if (stats) printStats();
+
+        if (vm.err != ERR_OK) {
+            std::cerr << "VM error " << vm.err << " at pc " << vm.pc << "\n";
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}